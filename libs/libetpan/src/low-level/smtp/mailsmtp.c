@@ -378,17 +378,8 @@ int mailsmtp_rcpt(mailsmtp * session, const char * to)
   return mailesmtp_rcpt(session, to, 0, NULL);
 }
 
-int mailsmtp_data(mailsmtp * session)
+static int data_response_to_error(int r)
 {
-  int r;
-  char command[SMTP_STRING_SIZE];
-
-  snprintf(command, SMTP_STRING_SIZE, "DATA\r\n");
-  r = send_command(session, command);
-  if (r == -1)
-    return MAILSMTP_ERROR_STREAM;
-  r = read_response(session);
-
   switch (r) {
   case 354:
     return MAILSMTP_NO_ERROR;
@@ -410,6 +401,20 @@ int mailsmtp_data(mailsmtp * session)
   }
 }
 
+int mailsmtp_data(mailsmtp * session)
+{
+  int r;
+  char command[SMTP_STRING_SIZE];
+
+  snprintf(command, SMTP_STRING_SIZE, "DATA\r\n");
+  r = send_command(session, command);
+  if (r == -1)
+    return MAILSMTP_ERROR_STREAM;
+  r = read_response(session);
+
+  return data_response_to_error(r);
+}
+
 static int send_data(mailsmtp * session, const char * message, size_t size);
 
 int mailsmtp_data_message(mailsmtp * session,
@@ -686,13 +691,9 @@ int mailesmtp_mail(mailsmtp * session,
 	return mailesmtp_mail_size(session, from, return_full, envid, 0);
 }
 
-int mailesmtp_mail_size(mailsmtp * session,
-		    const char * from,
-		    int return_full,
-		    const char * envid, size_t size)
+static void esmtp_mail_command(mailsmtp * session, char * command,
+    const char * from, int return_full, const char * envid, size_t size)
 {
-  int r;
-  char command[SMTP_STRING_SIZE];
   char ret_param[SMTP_STRING_SIZE];
   char envid_param[SMTP_STRING_SIZE];
   char size_param[SMTP_STRING_SIZE];
@@ -711,12 +712,10 @@ int mailesmtp_mail_size(mailsmtp * session,
   }
   snprintf(command, SMTP_STRING_SIZE, "MAIL FROM:<%s>%s%s%s\r\n",
     from, ret_param, envid_param, size_param);
+}
 
-  r = send_command(session, command);
-  if (r == -1)
-    return MAILSMTP_ERROR_STREAM;
-  r = read_response(session);
-
+static int mail_response_to_error(int r)
+{
   switch (r) {
   case 250:
     return MAILSMTP_NO_ERROR;
@@ -747,13 +746,27 @@ int mailesmtp_mail_size(mailsmtp * session,
   }
 }
 
-int mailesmtp_rcpt(mailsmtp * session,
-		    const char * to,
-		    int notify,
-		    const char * orcpt)
+int mailesmtp_mail_size(mailsmtp * session,
+		    const char * from,
+		    int return_full,
+		    const char * envid, size_t size)
 {
   int r;
   char command[SMTP_STRING_SIZE];
+
+  esmtp_mail_command(session, command, from, return_full, envid, size);
+
+  r = send_command(session, command);
+  if (r == -1)
+    return MAILSMTP_ERROR_STREAM;
+  r = read_response(session);
+
+  return mail_response_to_error(r);
+}
+
+static void esmtp_rcpt_command(mailsmtp * session, char * command,
+    const char * to, int notify, const char * orcpt)
+{
   char notify_str[30] = "";
   char notify_info_str[30] = "";
 
@@ -779,12 +792,10 @@ int mailesmtp_rcpt(mailsmtp * session,
 	     to, notify_str, orcpt);
   else
     snprintf(command, SMTP_STRING_SIZE, "RCPT TO:<%s>%s\r\n", to, notify_str);
+}
 
-  r = send_command(session, command);
-  if (r == -1)
-    return MAILSMTP_ERROR_STREAM;
-  r = read_response(session);
-
+static int rcpt_response_to_error(int r)
+{
   switch (r) {
   case 250:
     return MAILSMTP_NO_ERROR;
@@ -822,6 +833,92 @@ int mailesmtp_rcpt(mailsmtp * session,
   }
 }
 
+int mailesmtp_rcpt(mailsmtp * session,
+		    const char * to,
+		    int notify,
+		    const char * orcpt)
+{
+  int r;
+  char command[SMTP_STRING_SIZE];
+
+  esmtp_rcpt_command(session, command, to, notify, orcpt);
+
+  r = send_command(session, command);
+  if (r == -1)
+    return MAILSMTP_ERROR_STREAM;
+  r = read_response(session);
+
+  return rcpt_response_to_error(r);
+}
+
+static int write_command(mailsmtp * f, char * command)
+{
+  mailstream_set_privacy(f->stream, 1);
+  if (mailstream_write(f->stream, command, strlen(command)) == -1)
+    return -1;
+
+  return 0;
+}
+
+int mailesmtp_mail_rcpt_data_pipelined(mailsmtp * session,
+    const char * from,
+    int return_full,
+    const char * envid, size_t size,
+    clist * addresses,
+    int * rcpt_errors)
+{
+  int r;
+  int mail_error;
+  int data_error;
+  int i;
+  clistiter * l;
+  char command[SMTP_STRING_SIZE];
+
+  /* RFC 2920: MAIL FROM, all RCPT TO and DATA are written at once,
+     the replies are read afterwards in the same order */
+  esmtp_mail_command(session, command, from, return_full, envid, size);
+  if (write_command(session, command) == -1)
+    return MAILSMTP_ERROR_STREAM;
+
+  for(l = clist_begin(addresses) ; l != NULL; l = clist_next(l)) {
+    struct esmtp_address * addr;
+
+    addr = clist_content(l);
+
+    esmtp_rcpt_command(session, command, addr->address, addr->notify, addr->orcpt);
+    if (write_command(session, command) == -1)
+      return MAILSMTP_ERROR_STREAM;
+  }
+
+  snprintf(command, SMTP_STRING_SIZE, "DATA\r\n");
+  if (write_command(session, command) == -1)
+    return MAILSMTP_ERROR_STREAM;
+
+  if (mailstream_flush(session->stream) == -1)
+    return MAILSMTP_ERROR_STREAM;
+
+  r = read_response(session);
+  mail_error = mail_response_to_error(r);
+  if (mail_error == MAILSMTP_ERROR_STREAM)
+    return MAILSMTP_ERROR_STREAM;
+
+  for(l = clist_begin(addresses), i = 0 ; l != NULL; l = clist_next(l), i ++) {
+    r = read_response(session);
+    rcpt_errors[i] = rcpt_response_to_error(r);
+    if (rcpt_errors[i] == MAILSMTP_ERROR_STREAM)
+      return MAILSMTP_ERROR_STREAM;
+  }
+
+  /* the server rejects DATA if no recipient was accepted */
+  r = read_response(session);
+  data_error = data_response_to_error(r);
+
+  if (mail_error != MAILSMTP_NO_ERROR && data_error != MAILSMTP_ERROR_STREAM)
+    return mail_error;
+
+  return data_error;
+}
+
 int auth_map_errors(int err)
 {
   switch (err) {
@@ -139,6 +139,27 @@ int mailesmtp_rcpt(mailsmtp * session,
 		    int notify,
 		    const char * orcpt);
 
+/*
+   mailesmtp_mail_rcpt_data_pipelined()
+
+   sends MAIL FROM, RCPT TO for all addresses (a list of struct esmtp_address)
+   and DATA in one write and reads the replies afterwards, see RFC 2920;
+   the server must announce PIPELINING (MAILSMTP_ESMTP_PIPELINING).
+
+   rcpt_errors must have room for one MAILSMTP_ERROR_XXX code per address.
+
+   @return MAILSMTP_NO_ERROR if DATA is accepted, the message is then sent
+     using mailsmtp_data_message(); otherwise the error of MAIL FROM or DATA
+*/
+
+LIBETPAN_EXPORT
+int mailesmtp_mail_rcpt_data_pipelined(mailsmtp * session,
+    const char * from,
+    int return_full,
+    const char * envid, size_t size,
+    clist * addresses,
+    int * rcpt_errors);
+
 LIBETPAN_EXPORT
 int mailesmtp_starttls(mailsmtp * session);
 
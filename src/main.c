@@ -139,6 +139,23 @@ int main(int argc, char ** argv)
 		{
 			break;
 		}
+		else if( strncmp(cmd, "benchmark", 9)==0 && (cmd[9]==0 || cmd[9]==' ') )
+		{
+			/* benchmark [<msg-cnt>] [<result-file>] - runs on a temporary mailbox, the opened one is not touched */
+			char* arg1 = cmd[9]? (char*)&cmd[10] : NULL;
+			char* arg2 = arg1? strchr(arg1, ' ') : NULL;
+			if( arg2 ) { *arg2 = 0; arg2++; }
+			char* bench_result = stress_benchmark(arg1? atoi(arg1) : 0, arg2);
+			if( bench_result ) {
+				printf("%s", bench_result);
+				free(bench_result);
+			}
+		}
+		else if( strcmp(cmd, "queryplans")==0 )
+		{
+			stress_query_plans(); /* runs on a temporary mailbox, the opened one is not touched */
+			printf("Query plans okay.\n");
+		}
 		else if( cmd[0] == 0 )
 		{
 			; /* nothing typed */
@@ -51,7 +51,7 @@ int mrmailbox_get_fresh_msg_count__(mrmailbox_t* mailbox, uint32_t chat_id)
 	sqlite3_stmt* stmt = NULL;
 
 	stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_COUNT_FROM_msgs_WHERE_state_AND_chat_id,
-		"SELECT COUNT(*) FROM msgs WHERE state=" MR_STRINGIFY(MR_IN_FRESH) " AND chat_id=?;"); /* we have an index over the state-column, this should be sufficient as there are typically only few fresh messages */
+		"SELECT COUNT(*) FROM msgs WHERE state=" MR_STRINGIFY(MR_IN_FRESH) " AND chat_id=?;"); /* answered by the partial index msgs_index6 over the fresh messages */
 	sqlite3_bind_int(stmt, 1, chat_id);
 
 	if( sqlite3_step(stmt) != SQLITE_ROW ) {
@@ -214,7 +214,7 @@ int mrchat_update_param__(mrchat_t* ths)
 {
 	int success = 0;
 	sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(ths->m_mailbox->m_sql, "UPDATE chats SET param=? WHERE id=?");
-	sqlite3_bind_text(stmt, 1, ths->m_param->m_packed, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 1, mrparam_get_packed(ths->m_param), -1, SQLITE_STATIC);
 	sqlite3_bind_int (stmt, 2, ths->m_id);
 	success = sqlite3_step(stmt)==SQLITE_DONE? 1 : 0;
 	sqlite3_finalize(stmt);
@@ -298,7 +298,7 @@ mrchatlist_t* mrmailbox_get_chatlist(mrmailbox_t* ths, const char* query)
 	int db_locked = 0;
 	mrchatlist_t* obj = mrchatlist_new(ths);
 
-	mrsqlite3_lock(ths->m_sql);
+	mrsqlite3_lock_read(ths->m_sql);
 	db_locked = 1;
 
 	if( !mrchatlist_load_from_db__(obj, query) ) {
@@ -312,7 +312,7 @@ mrchatlist_t* mrmailbox_get_chatlist(mrmailbox_t* ths, const char* query)
 	/* cleanup */
 cleanup:
 	if( db_locked ) {
-		mrsqlite3_unlock(ths->m_sql);
+		mrsqlite3_unlock_read(ths->m_sql);
 	}
 
 	if( success ) {
@@ -331,7 +331,7 @@ mrchat_t* mrmailbox_get_chat(mrmailbox_t* ths, uint32_t id)
 	int db_locked = 0;
 	mrchat_t* obj = mrchat_new(ths);
 
-	mrsqlite3_lock(ths->m_sql);
+	mrsqlite3_lock_read(ths->m_sql);
 	db_locked = 1;
 
 	if( !mrchat_load_from_db__(obj, id) ) {
@@ -344,7 +344,7 @@ mrchat_t* mrmailbox_get_chat(mrmailbox_t* ths, uint32_t id)
 	/* cleanup */
 cleanup:
 	if( db_locked ) {
-		mrsqlite3_unlock(ths->m_sql);
+		mrsqlite3_unlock_read(ths->m_sql);
 	}
 
 	if( success ) {
@@ -628,7 +628,7 @@ carray* mrmailbox_get_fresh_msgs(mrmailbox_t* mailbox)
 		goto cleanup;
 	}
 
-	mrsqlite3_lock(mailbox->m_sql);
+	mrsqlite3_lock_read(mailbox->m_sql);
 	locked = 1;
 
 		show_deaddrop = mrsqlite3_get_config_int__(mailbox->m_sql, "show_deaddrop", 0);
@@ -645,14 +645,14 @@ carray* mrmailbox_get_fresh_msgs(mrmailbox_t* mailbox)
 			carray_add(ret, (void*)(uintptr_t)sqlite3_column_int(stmt, 0), NULL);
 		}
 
-	mrsqlite3_unlock(mailbox->m_sql);
+	mrsqlite3_unlock_read(mailbox->m_sql);
 	locked = 0;
 
 	success = 1;
 
 cleanup:
 	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
+		mrsqlite3_unlock_read(mailbox->m_sql);
 	}
 
 	if( success ) {
@@ -683,7 +683,7 @@ carray* mrmailbox_get_chat_msgs(mrmailbox_t* mailbox, uint32_t chat_id, uint32_t
 		goto cleanup;
 	}
 
-	mrsqlite3_lock(mailbox->m_sql);
+	mrsqlite3_lock_read(mailbox->m_sql);
 	locked = 1;
 
 		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c,
@@ -716,14 +716,14 @@ carray* mrmailbox_get_chat_msgs(mrmailbox_t* mailbox, uint32_t chat_id, uint32_t
 			carray_add(ret, (void*)(uintptr_t)curr_id, NULL);
 		}
 
-	mrsqlite3_unlock(mailbox->m_sql);
+	mrsqlite3_unlock_read(mailbox->m_sql);
 	locked = 0;
 
 	success = 1;
 
 cleanup:
 	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
+		mrsqlite3_unlock_read(mailbox->m_sql);
 	}
 
 	if( success ) {
@@ -738,11 +738,162 @@ cleanup:
 }
 
 
-carray* mrmailbox_search_msgs(mrmailbox_t* mailbox, uint32_t chat_id, const char* query__)
+carray* mrmailbox_get_chat_msgs_page(mrmailbox_t* mailbox, uint32_t chat_id, uint32_t flags, uint32_t marker1before,
+                                     time_t anchor_timestamp, uint32_t anchor_id, int direction, int page_size)
 {
 	int           success = 0, locked = 0;
+	carray*       ret = carray_new(page_size>0? page_size+page_size/4 : 16);
+	sqlite3_stmt* stmt = NULL;
+	uint32_t*     ids = NULL;
+	time_t*       timestamps = NULL;
+	int           i, cnt = 0, first = 0;
+
+	uint32_t      curr_id;
+	int           curr_day, last_day = 0;
+	long          cnv_to_local = mr_gm2local_offset();
+
+	if( mailbox==NULL || ret == NULL || page_size <= 0 ) {
+		goto cleanup;
+	}
+
+	/* one more row than requested is read in the direction of older messages: it is not returned but tells us whether the first message of the window starts a new day */
+	if( (ids=malloc((page_size+1)*sizeof(uint32_t)))==NULL || (timestamps=malloc((page_size+1)*sizeof(time_t)))==NULL ) {
+		exit(61); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	mrsqlite3_lock_read(mailbox->m_sql);
+	locked = 1;
+
+		/* both queries are answered by the index over (chat_id, timestamp, id) without sorting, see mrsqlite3_open__() */
+		if( direction == MR_PAGE_NEWER )
+		{
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_AND_newer,
+				"SELECT m.id, m.timestamp"
+					" FROM msgs m"
+					" LEFT JOIN contacts ct ON m.from_id=ct.id"
+					" WHERE m.chat_id=? AND ct.blocked=0 AND m.timestamp>=? AND (m.timestamp>? OR m.id>?)"
+					" ORDER BY m.timestamp,m.id LIMIT ?;");
+			sqlite3_bind_int  (stmt, 1, chat_id);
+			sqlite3_bind_int64(stmt, 2, anchor_id? anchor_timestamp : 0);
+			sqlite3_bind_int64(stmt, 3, anchor_id? anchor_timestamp : 0);
+			sqlite3_bind_int64(stmt, 4, anchor_id);
+			sqlite3_bind_int  (stmt, 5, page_size);
+
+			while( sqlite3_step(stmt) == SQLITE_ROW ) {
+				ids[cnt]        =         sqlite3_column_int  (stmt, 0);
+				timestamps[cnt] = (time_t)sqlite3_column_int64(stmt, 1);
+				cnt++;
+			}
+
+			if( anchor_id ) {
+				last_day = (anchor_timestamp+cnv_to_local)/SECONDS_PER_DAY;
+			}
+		}
+		else
+		{
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_AND_older,
+				"SELECT m.id, m.timestamp"
+					" FROM msgs m"
+					" LEFT JOIN contacts ct ON m.from_id=ct.id"
+					" WHERE m.chat_id=? AND ct.blocked=0 AND m.timestamp<=? AND (m.timestamp<? OR m.id<?)"
+					" ORDER BY m.timestamp DESC,m.id DESC LIMIT ?;");
+			sqlite3_bind_int  (stmt, 1, chat_id);
+			sqlite3_bind_int64(stmt, 2, anchor_id? (sqlite3_int64)anchor_timestamp : INT64_MAX);
+			sqlite3_bind_int64(stmt, 3, anchor_id? (sqlite3_int64)anchor_timestamp : INT64_MAX);
+			sqlite3_bind_int64(stmt, 4, anchor_id? anchor_id : UINT32_MAX);
+			sqlite3_bind_int  (stmt, 5, page_size+1);
+
+			/* the rows come newest first, store them oldest first */
+			while( sqlite3_step(stmt) == SQLITE_ROW ) {
+				cnt++;
+				ids[page_size+1-cnt]        =         sqlite3_column_int  (stmt, 0);
+				timestamps[page_size+1-cnt] = (time_t)sqlite3_column_int64(stmt, 1);
+			}
+			first = page_size+1-cnt;
+
+			if( cnt == page_size+1 ) {
+				last_day = (timestamps[first]+cnv_to_local)/SECONDS_PER_DAY;
+				first++;
+				cnt--;
+			}
+		}
+
+	mrsqlite3_unlock_read(mailbox->m_sql);
+	locked = 0;
+
+	/* same markers as in mrmailbox_get_chat_msgs() */
+	for( i = first; i < first+cnt; i++ )
+	{
+		curr_id = ids[i];
+
+		if( curr_id == marker1before ) {
+			carray_add(ret, (void*)MR_MSG_ID_MARKER1, NULL);
+		}
+
+		if( flags&MR_GCM_ADDDAYMARKER ) {
+			curr_day = (timestamps[i]+cnv_to_local)/SECONDS_PER_DAY;
+			if( curr_day != last_day ) {
+				carray_add(ret, (void*)MR_MSG_ID_DAYMARKER, NULL);
+				last_day = curr_day;
+			}
+		}
+
+		carray_add(ret, (void*)(uintptr_t)curr_id, NULL);
+	}
+
+	success = 1;
+
+cleanup:
+	if( locked ) {
+		mrsqlite3_unlock_read(mailbox->m_sql);
+	}
+
+	free(ids);
+	free(timestamps);
+
+	if( success ) {
+		return ret;
+	}
+	else {
+		if( ret ) {
+			carray_free(ret);
+		}
+		return NULL;
+	}
+}
+
+
+static char* get_fts_query(const char* query)
+{
+	/* convert the user input to a FTS5 query matching all words as prefixes, eg. `foo bar` -> `"foo"* "bar"*`;
+	quoting makes sure, the input is not interpreted as FTS5 operators */
+	mrstrbuilder_t ret;
+	char*          words = safe_strdup(query), *word, *saveptr = NULL;
+
+	mrstrbuilder_init(&ret);
+
+	for( word = strtok_r(words, " \t\r\n", &saveptr); word; word = strtok_r(NULL, " \t\r\n", &saveptr) ) {
+		char* quoted = safe_strdup(word);
+		mr_str_replace(&quoted, "\"", "\"\"");
+		if( ret.m_buf[0] ) {
+			mrstrbuilder_cat(&ret, " ");
+		}
+		mrstrbuilder_cat(&ret, "\"");
+		mrstrbuilder_cat(&ret, quoted);
+		mrstrbuilder_cat(&ret, "\"*");
+		free(quoted);
+	}
+
+	free(words);
+	return ret.m_buf;
+}
+
+
+carray* mrmailbox_search_msgs__(mrmailbox_t* mailbox, uint32_t chat_id, const char* query__, int flags)
+{
+	int           success = 0, use_fts;
 	carray*       ret = carray_new(100);
-	char*         strLikeInText = NULL, *strLikeBeg=NULL, *query = NULL;
+	char*         strLikeInText = NULL, *strLikeBeg=NULL, *query = NULL, *strFts = NULL;
 	sqlite3_stmt* stmt = NULL;
 
 	if( mailbox==NULL || ret == NULL || query__ == NULL ) {
@@ -759,52 +910,62 @@ carray* mrmailbox_search_msgs(mrmailbox_t* mailbox, uint32_t chat_id, const char
 	strLikeInText = mr_mprintf("%%%s%%", query);
 	strLikeBeg = mr_mprintf("%s%%", query); /*for the name search, we use "Name%" which is fast as it can use the index ("%Name%" could not). */
 
-	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
+	use_fts = mailbox->m_sql->m_has_fts && !(flags&MR_SEARCH_NO_FTS);
 
-		/* Incremental search with "LIKE %query%" cannot take advantages from any index
-		("query%" could for COLLATE NOCASE indexes, see http://www.sqlite.org/optoverview.html#like_opt )
-		An alternative may be the FULLTEXT sqlite stuff, however, this does not really help with incremental search.
-		An extra table with all words and a COLLATE NOCASE indexes may help, however,
-		this must be updated all the time and probably consumes more time than we can save in tenthousands of searches.
-		For now, we just expect the following query to be fast enough :-) */
-		#define QUR1  "SELECT m.id, m.timestamp" \
-		                  " FROM msgs m" \
-		                  " LEFT JOIN contacts ct ON m.from_id=ct.id" \
-		                  " WHERE"
-		#define QUR2      " AND ct.blocked=0 AND (txt LIKE ? OR ct.name LIKE ?)"
-		if( chat_id ) {
+	/* Incremental search with "LIKE %query%" cannot take advantages from any index
+	("query%" could for COLLATE NOCASE indexes, see http://www.sqlite.org/optoverview.html#like_opt ).
+	So, if the SQLite library supports FTS5, the words of the query are searched as prefixes in the full text index msgs_fts;
+	this is no substring search any longer, however, for an incremental search, prefixes are what the user expects.
+	msgs_fts is kept up to date by triggers on the msgs table, see mrsqlite3_open__(). */
+	#define QUR1  "SELECT m.id, m.timestamp" \
+	                  " FROM msgs m" \
+	                  " LEFT JOIN contacts ct ON m.from_id=ct.id" \
+	                  " WHERE"
+	#define QUR2      " AND ct.blocked=0 AND (txt LIKE ? OR ct.name LIKE ?)"
+	#define QUR2_FTS  " AND ct.blocked=0 AND (m.id IN (SELECT rowid FROM msgs_fts WHERE msgs_fts MATCH ?) OR ct.name LIKE ?)"
+	if( use_fts ) {
+		strFts = get_fts_query(query);
+	}
+
+	if( chat_id ) {
+		if( use_fts ) {
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_fts_WHERE_chat_id_AND_query,
+				QUR1 " m.chat_id=? " QUR2_FTS " ORDER BY m.timestamp,m.id;");
+		}
+		else {
 			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_WHERE_chat_id_AND_query,
 				QUR1 " m.chat_id=? " QUR2 " ORDER BY m.timestamp,m.id;"); /* chats starts with the oldest message*/
-			sqlite3_bind_int (stmt, 1, chat_id);
-			sqlite3_bind_text(stmt, 2, strLikeInText, -1, SQLITE_STATIC);
-			sqlite3_bind_text(stmt, 3, strLikeBeg, -1, SQLITE_STATIC);
+		}
+		sqlite3_bind_int (stmt, 1, chat_id);
+		sqlite3_bind_text(stmt, 2, use_fts? strFts : strLikeInText, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 3, strLikeBeg, -1, SQLITE_STATIC);
+	}
+	else {
+		int show_deaddrop = mrsqlite3_get_config_int__(mailbox->m_sql, "show_deaddrop", 0);
+		if( use_fts ) {
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_fts_WHERE_query,
+				QUR1 " (m.chat_id>? OR m.chat_id=?) " QUR2_FTS " ORDER BY m.timestamp DESC,m.id DESC;");
 		}
 		else {
-			int show_deaddrop = mrsqlite3_get_config_int__(mailbox->m_sql, "show_deaddrop", 0);
 			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_WHERE_query,
 				QUR1 " (m.chat_id>? OR m.chat_id=?) " QUR2 " ORDER BY m.timestamp DESC,m.id DESC;"); /* chat overview starts with the newest message*/
-			sqlite3_bind_int (stmt, 1, MR_CHAT_ID_LAST_SPECIAL);
-			sqlite3_bind_int (stmt, 2, show_deaddrop? MR_CHAT_ID_DEADDROP : MR_CHAT_ID_LAST_SPECIAL+1 /*just any ID that is already selected*/);
-			sqlite3_bind_text(stmt, 3, strLikeInText, -1, SQLITE_STATIC);
-			sqlite3_bind_text(stmt, 4, strLikeBeg, -1, SQLITE_STATIC);
-		}
-
-		while( sqlite3_step(stmt) == SQLITE_ROW ) {
-			carray_add(ret, (void*)(uintptr_t)sqlite3_column_int(stmt, 0), NULL);
 		}
+		sqlite3_bind_int (stmt, 1, MR_CHAT_ID_LAST_SPECIAL);
+		sqlite3_bind_int (stmt, 2, show_deaddrop? MR_CHAT_ID_DEADDROP : MR_CHAT_ID_LAST_SPECIAL+1 /*just any ID that is already selected*/);
+		sqlite3_bind_text(stmt, 3, use_fts? strFts : strLikeInText, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 4, strLikeBeg, -1, SQLITE_STATIC);
+	}
 
-	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
+	while( sqlite3_step(stmt) == SQLITE_ROW ) {
+		carray_add(ret, (void*)(uintptr_t)sqlite3_column_int(stmt, 0), NULL);
+	}
 
 	success = 1;
 
 cleanup:
-	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
-	}
 	free(strLikeInText);
 	free(strLikeBeg);
+	free(strFts);
 	free(query);
 	if( success ) {
 		return ret;
@@ -818,6 +979,20 @@ cleanup:
 }
 
 
+carray* mrmailbox_search_msgs(mrmailbox_t* mailbox, uint32_t chat_id, const char* query)
+{
+	carray* ret = NULL;
+
+	if( mailbox ) {
+		mrsqlite3_lock_read(mailbox->m_sql);
+			ret = mrmailbox_search_msgs__(mailbox, chat_id, query, 0);
+		mrsqlite3_unlock_read(mailbox->m_sql);
+	}
+
+	return ret;
+}
+
+
 int mrchat_set_draft(mrchat_t* ths, const char* msg)
 {
 	sqlite3_stmt* stmt;
@@ -975,9 +1150,11 @@ We use the following approach:
 
 int mrmailbox_delete_chat_part2(mrmailbox_t* mailbox, uint32_t chat_id)
 {
-	int       success = 0, locked = 0, pending_transaction = 0;
-	mrchat_t* obj = mrchat_new(mailbox);
-	char*     q3 = NULL;
+	int           success = 0, locked = 0, pending_transaction = 0;
+	mrchat_t*     obj = mrchat_new(mailbox);
+	char*         q3 = NULL;
+	sqlite3_stmt* stmt = NULL;
+	mrparam_t*    param = mrparam_new();
 
 	mrsqlite3_lock(mailbox->m_sql);
 	locked = 1;
@@ -989,6 +1166,15 @@ int mrmailbox_delete_chat_part2(mrmailbox_t* mailbox, uint32_t chat_id)
 		mrsqlite3_begin_transaction__(mailbox->m_sql);
 		pending_transaction = 1;
 
+			stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT type, param FROM msgs WHERE chat_id=?;");
+			sqlite3_bind_int(stmt, 1, chat_id);
+			while( sqlite3_step(stmt) == SQLITE_ROW ) {
+				mrparam_set_packed(param, (const char*)sqlite3_column_text(stmt, 1));
+				mrmailbox_unref_msg_file__(mailbox, sqlite3_column_int(stmt, 0), param);
+			}
+			sqlite3_finalize(stmt);
+			stmt = NULL;
+
 			q3 = sqlite3_mprintf("DELETE FROM msgs WHERE chat_id=%i;", chat_id);
 			if( !mrsqlite3_execute__(mailbox->m_sql, q3) ) {
 				goto cleanup;
@@ -1023,6 +1209,8 @@ cleanup:
 	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
 	mrchat_unref(obj);
 	if( q3 ) { sqlite3_free(q3); }
+	if( stmt ) { sqlite3_finalize(stmt); }
+	mrparam_unref(param);
 	return success;
 }
 
@@ -1049,7 +1237,7 @@ int mrmailbox_delete_chat(mrmailbox_t* mailbox, uint32_t chat_id)
 		mrparam_set_int(chat->m_param, MRP_DEL_AFTER_SEND, link_msg_to_chat_deletion);
 		mrsqlite3_lock(mailbox->m_sql);
 			sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, "UPDATE chats SET blocked=1, param=? WHERE id=?;");
-			sqlite3_bind_text (stmt, 1, chat->m_param->m_packed, -1, SQLITE_STATIC);
+			sqlite3_bind_text (stmt, 1, mrparam_get_packed(chat->m_param), -1, SQLITE_STATIC);
 			sqlite3_bind_int  (stmt, 2, chat_id);
 			sqlite3_step(stmt);
 			mrmailbox_set_group_explicitly_left__(mailbox, chat->m_grpid);
@@ -1090,6 +1278,10 @@ void mrmailbox_send_msg_to_imap(mrmailbox_t* mailbox, mrjob_t* job)
 	mrmimefactory_t  mimefactory;
 	char*            server_folder = NULL;
 	uint32_t         server_uid = 0;
+	char*            rendered_file = mrparam_get(job->m_param, MRP_FILE, NULL);
+	void*            rendered = NULL;
+	size_t           rendered_bytes = 0;
+	int              keep_rendered_file = 0;
 
 	mrmimefactory_init(&mimefactory, mailbox);
 
@@ -1098,6 +1290,7 @@ void mrmailbox_send_msg_to_imap(mrmailbox_t* mailbox, mrjob_t* job)
 		mrmailbox_connect_to_imap(mailbox, NULL);
 		if( !mrimap_is_connected(mailbox->m_imap) ) {
 			mrjob_try_again_later(job, MR_STANDARD_DELAY);
+			keep_rendered_file = 1;
 			goto cleanup;
 		}
 	}
@@ -1108,12 +1301,21 @@ void mrmailbox_send_msg_to_imap(mrmailbox_t* mailbox, mrjob_t* job)
 		goto cleanup; /* should not happen as we've send the message to the SMTP server before */
 	}
 
-	if( !mrmimefactory_render(&mimefactory, 1/*encrypt to self*/) ) {
-		goto cleanup; /* should not happen as we've send the message to the SMTP server before */
+	/* use the message rendered for SMTP, if possible; the attachments are not read and encoded again and there is no need to encrypt again
+	(the SMTP message is always encrypted to ourself as well, see mrmailbox_e2ee_encrypt()) */
+	if( rendered_file==NULL || !mr_read_file(rendered_file, &rendered, &rendered_bytes, mailbox) ) {
+		if( !mrmimefactory_render(&mimefactory, 1/*encrypt to self*/) ) {
+			goto cleanup; /* should not happen as we've send the message to the SMTP server before */
+		}
+		free(rendered);
+		rendered = NULL;
 	}
 
-	if( !mrimap_append_msg(mailbox->m_imap, mimefactory.m_msg->m_timestamp, mimefactory.m_out->str, mimefactory.m_out->len, &server_folder, &server_uid) ) {
+	if( !mrimap_append_msg(mailbox->m_imap, mimefactory.m_msg->m_timestamp,
+	                       rendered? rendered : mimefactory.m_out->str, rendered? rendered_bytes : mimefactory.m_out->len,
+	                       &server_folder, &server_uid) ) {
 		mrjob_try_again_later(job, MR_STANDARD_DELAY);
+		keep_rendered_file = 1;
 		goto cleanup;
 	}
 	else {
@@ -1129,8 +1331,13 @@ void mrmailbox_send_msg_to_imap(mrmailbox_t* mailbox, mrjob_t* job)
 	}
 
 cleanup:
+	if( rendered_file && !keep_rendered_file ) {
+		mr_delete_file(rendered_file, mailbox);
+	}
 	mrmimefactory_empty(&mimefactory);
 	free(server_folder);
+	free(rendered_file);
+	free(rendered);
 }
 
 
@@ -1147,24 +1354,34 @@ static void mark_as_error(mrmailbox_t* mailbox, mrmsg_t* msg)
 }
 
 
-void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
+static int connect_to_smtp(mrmailbox_t* mailbox)
 {
-	mrmimefactory_t mimefactory;
-
-	mrmimefactory_init(&mimefactory, mailbox);
-
 	/* connect to SMTP server, if not yet done */
-	if( !mrsmtp_is_connected(mailbox->m_smtp) ) {
+	int connected = 1;
+	if( !mrsmtp_check_connection(mailbox->m_smtp) ) {
 		mrloginparam_t* loginparam = mrloginparam_new();
 			mrsqlite3_lock(mailbox->m_sql);
 				mrloginparam_read__(loginparam, mailbox->m_sql, "configured_");
 			mrsqlite3_unlock(mailbox->m_sql);
-			int connected = mrsmtp_connect(mailbox->m_smtp, loginparam);
+			connected = mrsmtp_connect(mailbox->m_smtp, loginparam);
 		mrloginparam_unref(loginparam);
-		if( !connected ) {
-			mrjob_try_again_later(job, MR_STANDARD_DELAY);
-			goto cleanup;
-		}
+	}
+	return connected;
+}
+
+
+void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
+{
+	mrmimefactory_t mimefactory;
+	mrparam_t*      imap_param = mrparam_new();
+	char*           rendered_file = NULL;
+	char*           rejected = NULL;
+
+	mrmimefactory_init(&mimefactory, mailbox);
+
+	if( !connect_to_smtp(mailbox) ) {
+		mrjob_try_again_later(job, MR_STANDARD_DELAY);
+		goto cleanup;
 	}
 
 	/* load message data */
@@ -1196,13 +1413,25 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 			goto cleanup; /* unrecoverable */
 		}
 
-		if( !mrsmtp_send_msg(mailbox->m_smtp, mimefactory.m_recipients_addr, mimefactory.m_out->str, mimefactory.m_out->len) ) {
-			mrsmtp_disconnect(mailbox->m_smtp);
+		/* if the server only rejects this message (eg. it is too large), the session is kept for the other queued messages */
+		int sent = mrsmtp_send_msg(mailbox->m_smtp, mimefactory.m_recipients_addr, mimefactory.m_out->str, mimefactory.m_out->len, &rejected);
+		if( sent != MR_SMTP_SENT ) {
+			if( sent == MR_SMTP_CONNECTION_ERROR ) {
+				mrsmtp_disconnect(mailbox->m_smtp);
+			}
 			mrjob_try_again_later(job, MR_AT_ONCE); /* MR_AT_ONCE is only the _initial_ delay, if the second try failes, the delay gets larger */
 			goto cleanup;
 		}
 	}
 
+	/* keep the rendered message for the IMAP upload, see mrmailbox_send_msg_to_imap() */
+	if( (mailbox->m_imap->m_server_flags&MR_NO_EXTRA_IMAP_UPLOAD)==0 && mimefactory.m_out ) {
+		rendered_file = mr_mprintf("%s/" MR_RENDERED_PREFIX "%lu.eml", mailbox->m_blobdir, (unsigned long)mimefactory.m_msg->m_id);
+		if( mr_write_file(rendered_file, mimefactory.m_out->str, mimefactory.m_out->len, mailbox) ) {
+			mrparam_set(imap_param, MRP_FILE, rendered_file);
+		}
+	}
+
 	/* done */
 	mrsqlite3_lock(mailbox->m_sql);
 	mrsqlite3_begin_transaction__(mailbox->m_sql);
@@ -1219,13 +1448,17 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 		}
 
 		mrmailbox_update_msg_state__(mailbox, mimefactory.m_msg->m_id, MR_OUT_DELIVERED);
-		if( mimefactory.m_out_encrypted && mrparam_get_int(mimefactory.m_msg->m_param, MRP_GUARANTEE_E2EE, 0)==0 ) {
-			mrparam_set_int(mimefactory.m_msg->m_param, MRP_GUARANTEE_E2EE, 1); /* can upgrade to E2EE - fine! */
+		if( (mimefactory.m_out_encrypted && mrparam_get_int(mimefactory.m_msg->m_param, MRP_GUARANTEE_E2EE, 0)==0)
+		 || rejected ) {
+			if( mimefactory.m_out_encrypted ) {
+				mrparam_set_int(mimefactory.m_msg->m_param, MRP_GUARANTEE_E2EE, 1); /* can upgrade to E2EE - fine! */
+			}
+			mrparam_set(mimefactory.m_msg->m_param, MRP_REJECTED_RCPTS, rejected); /* delivered, but not to these recipients, see mrmailbox_get_msg_info() */
 			mrmsg_save_param_to_disk__(mimefactory.m_msg);
 		}
 
 		if( (mailbox->m_imap->m_server_flags&MR_NO_EXTRA_IMAP_UPLOAD)==0 ) {
-			mrjob_add__(mailbox, MRJ_SEND_MSG_TO_IMAP, mimefactory.m_msg->m_id, NULL); /* send message to IMAP in another job */
+			mrjob_add__(mailbox, MRJ_SEND_MSG_TO_IMAP, mimefactory.m_msg->m_id, mrparam_get_packed(imap_param)); /* send message to IMAP in another job */
 		}
 
 	mrsqlite3_commit__(mailbox->m_sql);
@@ -1235,6 +1468,30 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 
 cleanup:
 	mrmimefactory_empty(&mimefactory);
+	mrparam_unref(imap_param);
+	free(rendered_file);
+	free(rejected);
+}
+
+
+void mrmailbox_send_msgs_to_smtp(mrmailbox_t* mailbox, carray* jobs)
+{
+	/* the messages are sent one after another using the same SMTP session, see mrsmtp_check_connection();
+	if we cannot connect, the remaining jobs are not tried one by one but delayed together.
+	a message rejected by the server (eg. as it is too large) does not affect the other messages. */
+	int i, cnt = carray_count(jobs);
+
+	for( i = 0; i < cnt; i++ )
+	{
+		if( !connect_to_smtp(mailbox) ) {
+			for( ; i < cnt; i++ ) {
+				mrjob_try_again_later((mrjob_t*)carray_get(jobs, i), MR_STANDARD_DELAY);
+			}
+			break;
+		}
+
+		mrmailbox_send_msg_to_smtp(mailbox, (mrjob_t*)carray_get(jobs, i));
+	}
 }
 
 
@@ -1307,6 +1564,8 @@ uint32_t mrchat_send_msg__(mrchat_t* ths, const mrmsg_t* msg, time_t timestamp)
 	mrparam_set(msg->m_param, MRP_ERRONEOUS_E2EE, NULL); /* reset eg. on forwarding */
 
 	/* add message to the database */
+	mrmailbox_ref_msg_file__(ths->m_mailbox, msg->m_param, NULL);
+
 	stmt = mrsqlite3_predefine__(ths->m_mailbox->m_sql, INSERT_INTO_msgs_mcftttstpb,
 		"INSERT INTO msgs (rfc724_mid,chat_id,from_id,to_id, timestamp,type,state, txt,param) VALUES (?,?,?,?, ?,?,?, ?,?);");
 	sqlite3_bind_text (stmt,  1, rfc724_mid, -1, SQLITE_STATIC);
@@ -1317,7 +1576,7 @@ uint32_t mrchat_send_msg__(mrchat_t* ths, const mrmsg_t* msg, time_t timestamp)
 	sqlite3_bind_int  (stmt,  6, msg->m_type);
 	sqlite3_bind_int  (stmt,  7, MR_OUT_PENDING);
 	sqlite3_bind_text (stmt,  8, msg->m_text? msg->m_text : "",  -1, SQLITE_STATIC);
-	sqlite3_bind_text (stmt,  9, msg->m_param->m_packed, -1, SQLITE_STATIC);
+	sqlite3_bind_text (stmt,  9, mrparam_get_packed(msg->m_param), -1, SQLITE_STATIC);
 	if( sqlite3_step(stmt) != SQLITE_DONE ) {
 		goto cleanup;
 	}
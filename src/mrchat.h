@@ -85,12 +85,16 @@ uint32_t      mrmailbox_lookup_real_nchat_by_contact_id__(mrmailbox_t*, uint32_t
 int           mrmailbox_get_total_msg_count__        (mrmailbox_t*, uint32_t chat_id);
 int           mrmailbox_get_fresh_msg_count__        (mrmailbox_t*, uint32_t chat_id);
 void          mrmailbox_send_msg_to_smtp             (mrmailbox_t*, mrjob_t*);
+void          mrmailbox_send_msgs_to_smtp            (mrmailbox_t*, carray* jobs); /* jobs of the action MRJ_SEND_MSG_TO_SMTP */
 void          mrmailbox_send_msg_to_imap             (mrmailbox_t*, mrjob_t*);
+#define       MR_RENDERED_PREFIX                     ".rendered-" /* messages sent by SMTP are kept as <blobdir>/.rendered-<msg_id>.eml until they're uploaded to IMAP */
 int           mrmailbox_add_contact_to_chat__        (mrmailbox_t*, uint32_t chat_id, uint32_t contact_id);
 int           mrmailbox_is_contact_in_chat__         (mrmailbox_t*, uint32_t chat_id, uint32_t contact_id);
 int           mrmailbox_get_chat_contact_count__     (mrmailbox_t*, uint32_t chat_id);
 int           mrmailbox_group_explicitly_left__      (mrmailbox_t*, const char* grpid);
 void          mrmailbox_set_group_explicitly_left__  (mrmailbox_t*, const char* grpid);
+#define       MR_SEARCH_NO_FTS                       0x01 /* search using LIKE even if the full text index is available, used for benchmarking */
+carray*       mrmailbox_search_msgs__                (mrmailbox_t*, uint32_t chat_id, const char* query, int flags);
 
 #define APPROX_SUBJECT_CHARS 32  /* as we do not cut inside words, this results in about 32-42 characters.
 								 Do not use too long subjects - we add a tag after the subject which gets truncated by the clients otherwise.
@@ -26,6 +26,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 #include "mrmailbox.h"
 #include "mrtools.h"
 
@@ -50,12 +51,10 @@ int mrchatlist_load_from_db__(mrchatlist_t* ths, const char* query__)
 
 	show_deaddrop = mrsqlite3_get_config_int__(ths->m_mailbox->m_sql, "show_deaddrop", 0);
 
-	/* select example with left join and minimum: http://stackoverflow.com/questions/7588142/mysql-left-join-min */
-	#define QUR1 "SELECT c.id, m.id FROM chats c " \
-	                " LEFT JOIN msgs m ON (c.id=m.chat_id AND m.timestamp=(SELECT MAX(timestamp) FROM msgs WHERE chat_id=c.id)) " \
+	/* the last message of each chat is maintained by triggers on msgs, see mrsqlite3_open__() */
+	#define QUR1 "SELECT c.id, c.last_msg_id FROM chats c " \
 	                " WHERE (c.id>? OR c.id=?) AND blocked=0"
-	#define QUR2    " GROUP BY c.id " /* GROUP BY is needed as there may be several messages with the same timestamp */ \
-	                " ORDER BY MAX(c.draft_timestamp, IFNULL(m.timestamp,0)) DESC,m.id DESC;" /* the list starts with the newest chats */
+	#define QUR2    " ORDER BY MAX(c.draft_timestamp, c.last_timestamp) DESC,c.last_msg_id DESC;" /* the list starts with the newest chats; read in the order of chats_index3, the expression must match */
 
 	if( query__ )
 	{
@@ -229,3 +228,218 @@ cleanup:
 
 
 
+
+
+/*******************************************************************************
+ * Batched summaries
+ ******************************************************************************/
+
+
+#define SUMMARY_STRINGS 3 /* chat name, text1, text2 */
+
+
+static size_t summaries_add_str(mrchatsummaries_t* ths, const char* str)
+{
+	/* returns the offset+1 of the copied string in the arena or 0 for NULL; pointers are resolved after all strings are added as the arena may move */
+	size_t bytes;
+
+	if( str == NULL ) {
+		return 0;
+	}
+
+	bytes = strlen(str) + 1;
+	if( ths->_m_arena_used + bytes > ths->_m_arena_size ) {
+		size_t new_size = ths->_m_arena_size? ths->_m_arena_size*2 : 1024;
+		while( ths->_m_arena_used + bytes > new_size ) {
+			new_size *= 2;
+		}
+		if( (ths->_m_arena=realloc(ths->_m_arena, new_size))==NULL ) {
+			exit(60); /* cannot allocate little memory, unrecoverable error */
+		}
+		ths->_m_arena_size = new_size;
+	}
+
+	memcpy(ths->_m_arena+ths->_m_arena_used, str, bytes);
+	ths->_m_arena_used += bytes;
+	return ths->_m_arena_used - bytes + 1;
+}
+
+
+static size_t summaries_add_str_and_free(mrchatsummaries_t* ths, char* str)
+{
+	size_t ofs = summaries_add_str(ths, str);
+	free(str);
+	return ofs;
+}
+
+
+mrchatsummaries_t* mrchatlist_get_summaries(mrchatlist_t* chatlist, size_t first, size_t cnt)
+{
+	/* Same result as mrchatlist_get_chat_by_index() plus mrchatlist_get_summary_by_index() for each index,
+	however, chats, last messages and their senders are loaded by one joined query under one lock. */
+	mrchatsummaries_t* ret = NULL;
+	uint32_t*          chat_ids = NULL;
+	size_t*            ofs = NULL;
+	char*              idsstr = NULL, *q3 = NULL;
+	sqlite3_stmt*      stmt = NULL;
+	int                locked = 0;
+	mrparam_t*         param = mrparam_new();
+	size_t             i;
+
+	if( (ret=calloc(1, sizeof(mrchatsummaries_t)))==NULL ) {
+		exit(60); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	if( chatlist == NULL || chatlist->m_mailbox == NULL || first >= chatlist->m_cnt || cnt == 0 ) {
+		goto cleanup;
+	}
+
+	if( cnt > chatlist->m_cnt - first ) {
+		cnt = chatlist->m_cnt - first;
+	}
+
+	if( (ret->m_items=calloc(cnt, sizeof(mrchatsummary_t)))==NULL
+	 || (chat_ids=malloc(cnt*sizeof(uint32_t)))==NULL
+	 || (ofs=calloc(cnt*SUMMARY_STRINGS, sizeof(size_t)))==NULL ) {
+		exit(60); /* cannot allocate little memory, unrecoverable error */
+	}
+	ret->m_cnt = cnt;
+
+	for( i = 0; i < cnt; i++ ) {
+		chat_ids[i] = (uint32_t)(uintptr_t)carray_get(chatlist->m_chatNlastmsg_ids, (first+i)*IDS_PER_RESULT);
+		ret->m_items[i].m_chat_id = chat_ids[i];
+		ofs[i*SUMMARY_STRINGS+2] = summaries_add_str(ret, "ErrNoChat"); /* overwritten below if the chat exists */
+	}
+
+	/* the last message is the one set by the triggers on msgs, not the snapshot in m_chatNlastmsg_ids; this way, we always show the freshest state */
+	idsstr = mr_arr_to_string(chat_ids, cnt);
+	q3 = sqlite3_mprintf("SELECT c.id, c.type, c.name, c.draft_timestamp, c.draft_txt,"
+	                     " m.from_id, m.timestamp, m.type, m.state, m.txt, m.param, ct.name, ct.addr"
+	                     " FROM chats c"
+	                     " LEFT JOIN msgs m ON m.id=c.last_msg_id"
+	                     " LEFT JOIN contacts ct ON ct.id=m.from_id"
+	                     " WHERE c.id IN(%s);", idsstr);
+
+	mrsqlite3_lock_read(chatlist->m_mailbox->m_sql);
+	locked = 1;
+
+		stmt = mrsqlite3_prepare_v2_(chatlist->m_mailbox->m_sql, q3);
+		if( stmt == NULL ) {
+			goto cleanup;
+		}
+
+		while( sqlite3_step(stmt) == SQLITE_ROW )
+		{
+			uint32_t    chat_id         = (uint32_t)sqlite3_column_int(stmt, 0);
+			int         chat_type       =           sqlite3_column_int(stmt, 1);
+			const char* chat_name       = (const char*)sqlite3_column_text(stmt, 2);
+			time_t      draft_timestamp = (time_t)  sqlite3_column_int64(stmt, 3);
+			const char* draft_text      = (const char*)sqlite3_column_text(stmt, 4);
+			int         has_msg         =           sqlite3_column_type(stmt, 5) != SQLITE_NULL;
+			uint32_t    from_id         = (uint32_t)sqlite3_column_int(stmt, 5);
+			time_t      msg_timestamp   = (time_t)  sqlite3_column_int64(stmt, 6);
+			int         msg_type        =           sqlite3_column_int(stmt, 7);
+			int         msg_state       =           sqlite3_column_int(stmt, 8);
+			const char* msg_text        = (const char*)sqlite3_column_text(stmt, 9);
+			const char* contact_name    = (const char*)sqlite3_column_text(stmt, 11);
+			const char* contact_addr    = (const char*)sqlite3_column_text(stmt, 12);
+			size_t      name_ofs = 0, text1_ofs = 0, text2_ofs = 0;
+			int         text1_meaning = MR_TEXT1_NORMAL;
+			time_t      timestamp = 0;
+			int         state = 0;
+
+			if( !(draft_timestamp && draft_text && draft_text[0]) ) {
+				draft_timestamp = 0; /* same as in mrchat_set_from_stmt__() */
+			}
+
+			/* see mrchat_set_from_stmt__() */
+			name_ofs = chat_id == MR_CHAT_ID_DEADDROP? summaries_add_str_and_free(ret, mrstock_str(MR_STR_DEADDROP)) : summaries_add_str(ret, chat_name);
+
+			/* see mrchatlist_get_summary_by_index() and mrpoortext_fill() */
+			if( draft_timestamp && (!has_msg || draft_timestamp>msg_timestamp) )
+			{
+				char* temp = safe_strdup(draft_text);
+				mr_truncate_n_unwrap_str(temp, MR_SUMMARY_CHARACTERS, 1);
+				text1_ofs     = summaries_add_str_and_free(ret, mrstock_str(MR_STR_DRAFT));
+				text1_meaning = MR_TEXT1_DRAFT;
+				text2_ofs     = summaries_add_str_and_free(ret, temp);
+				timestamp     = draft_timestamp;
+			}
+			else if( !has_msg || from_id == 0 )
+			{
+				text2_ofs = summaries_add_str_and_free(ret, mrstock_str(MR_STR_NOMESSAGES));
+			}
+			else
+			{
+				if( from_id == MR_CONTACT_ID_SELF ) {
+					text1_ofs     = summaries_add_str_and_free(ret, mrstock_str(MR_STR_SELF));
+					text1_meaning = MR_TEXT1_SELF;
+				}
+				else if( chat_type == MR_CHAT_GROUP ) {
+					if( contact_name && contact_name[0] ) {
+						text1_ofs = summaries_add_str_and_free(ret, mr_get_first_name(contact_name));
+						text1_meaning = MR_TEXT1_USERNAME;
+					}
+					else if( contact_addr && contact_addr[0] ) {
+						text1_ofs = summaries_add_str(ret, contact_addr);
+						text1_meaning = MR_TEXT1_USERNAME;
+					}
+					else {
+						text1_ofs = summaries_add_str(ret, "Unnamed contact");
+						text1_meaning = MR_TEXT1_USERNAME;
+					}
+				}
+
+				mrparam_set_packed(param, (const char*)sqlite3_column_text(stmt, 10));
+				text2_ofs = summaries_add_str_and_free(ret, mrmsg_get_summarytext_by_raw(msg_type, msg_text, param, MR_SUMMARY_CHARACTERS));
+				timestamp = msg_timestamp;
+				state     = msg_state;
+			}
+
+			/* a chat may appear several times in the range if the list was modified while building it */
+			for( i = 0; i < cnt; i++ ) {
+				if( chat_ids[i] == chat_id ) {
+					mrchatsummary_t* item = &ret->m_items[i];
+					item->m_chat_type     = chat_type;
+					item->m_text1_meaning = text1_meaning;
+					item->m_timestamp     = timestamp;
+					item->m_state         = state;
+					ofs[i*SUMMARY_STRINGS+0] = name_ofs;
+					ofs[i*SUMMARY_STRINGS+1] = text1_ofs;
+					ofs[i*SUMMARY_STRINGS+2] = text2_ofs;
+				}
+			}
+		}
+
+cleanup:
+	if( stmt ) { sqlite3_finalize(stmt); }
+	if( locked ) { mrsqlite3_unlock_read(chatlist->m_mailbox->m_sql); }
+
+	/* the arena does not move any longer, resolve the offsets */
+	#define OFS_TO_STR(o) ((o)? ret->_m_arena+(o)-1 : NULL)
+	for( i = 0; ofs && i < cnt; i++ ) {
+		ret->m_items[i].m_chat_name = OFS_TO_STR(ofs[i*SUMMARY_STRINGS+0]);
+		ret->m_items[i].m_text1     = OFS_TO_STR(ofs[i*SUMMARY_STRINGS+1]);
+		ret->m_items[i].m_text2     = OFS_TO_STR(ofs[i*SUMMARY_STRINGS+2]);
+	}
+	#undef OFS_TO_STR
+
+	if( q3 ) { sqlite3_free(q3); }
+	free(idsstr);
+	free(ofs);
+	free(chat_ids);
+	mrparam_unref(param);
+	return ret;
+}
+
+
+void mrchatsummaries_unref(mrchatsummaries_t* ths)
+{
+	if( ths==NULL ) {
+		return;
+	}
+
+	free(ths->m_items);
+	free(ths->_m_arena);
+	free(ths);
+}
@@ -51,6 +51,38 @@ mrchat_t*     mrchatlist_get_chat_by_index   (mrchatlist_t*, size_t index); /* r
 mrpoortext_t* mrchatlist_get_summary_by_index(mrchatlist_t*, size_t index, mrchat_t*); /* result must be unref'd, the 3rd parameter is only to speed up things */
 
 
+/* Summaries for a range of the chatlist, loaded by a single query; meant for
+frontends rendering the visible rows of a long list.  All strings are owned by
+the mrchatsummaries_t object and live as long as it. */
+typedef struct mrchatsummary_t
+{
+	uint32_t    m_chat_id;
+	int         m_chat_type;      /* one of MR_CHAT_* */
+	const char* m_chat_name;      /* may be NULL */
+	const char* m_text1;          /* may be NULL */
+	int         m_text1_meaning;  /* one of MR_TEXT1_* */
+	const char* m_text2;          /* may be NULL */
+	time_t      m_timestamp;      /* may be 0 */
+	int         m_state;          /* may be 0 */
+} mrchatsummary_t;
+
+
+typedef struct mrchatsummaries_t
+{
+	size_t           m_cnt;
+	mrchatsummary_t* m_items;     /* m_items[0] is the summary of the chat at index `first` */
+
+	/** private */
+	char*            _m_arena;
+	size_t           _m_arena_used;
+	size_t           _m_arena_size;
+} mrchatsummaries_t;
+
+
+mrchatsummaries_t* mrchatlist_get_summaries  (mrchatlist_t*, size_t first, size_t cnt); /* result must be unref'd, cnt is truncated to the end of the list */
+void               mrchatsummaries_unref     (mrchatsummaries_t*);
+
+
 /*** library-private **********************************************************/
 
 int           mrchatlist_load_from_db__    (mrchatlist_t*, const char* query);
@@ -27,6 +27,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "mrmailbox.h"
 #include "mrcmdline.h"
 #include "mrapeerstate.h"
@@ -159,6 +160,7 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 
 			"\nChat commands:\n"
 			"listchats [<query>]\n"
+			"benchchatlist\n"
 			"chat [<chat-id>|0]\n"
 			"createchat <contact-id>\n"
 			"creategroup <name>\n"
@@ -175,6 +177,7 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 
 			"\nMessage commands:\n"
 			"listmsgs <query>\n"
+			"benchsearch <query>\n"
 			"msginfo <msg-id>\n"
 			"listfresh\n"
 			"forward <msg-id> <chat-id>\n"
@@ -190,6 +193,8 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 			"event <event-id to test>\n"
 			"fileinfo <file>\n"
 			"heartbeat\n"
+			"benchmark [<msg-cnt>] [<result-file>]\n" /* must be implemented by  the caller */
+			"queryplans\n" /* must be implemented by  the caller */
 			"clear -- clear screen\n" /* must be implemented by  the caller */
 			"exit" /* must be implemented by  the caller */
 		);
@@ -392,6 +397,57 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 			ret = COMMAND_FAILED;
 		}
 	}
+	else if( strcmp(cmd, "benchchatlist")==0 )
+	{
+		/* render the chatlist as the frontends do, one-by-one and batched, and measure the parameter lookups alone, see mrparam.c */
+		#define BENCH_ROUNDS 10
+		#define BENCH_PARAM_LOOKUPS 1000000
+		int            round, i, cnt = 0, sum = 0;
+		mrchatlist_t*  chatlist;
+		double         ms[3] = {0, 0, 0};
+		struct timeval start, end;
+		for( round = 0; round < BENCH_ROUNDS; round++ ) {
+			gettimeofday(&start, NULL);
+				chatlist = mrmailbox_get_chatlist(mailbox, NULL);
+				if( chatlist ) {
+					cnt = mrchatlist_get_cnt(chatlist);
+					for( i = 0; i < cnt; i++ ) {
+						mrchat_t*     chat = mrchatlist_get_chat_by_index(chatlist, i);
+						mrpoortext_t* poortext = mrchatlist_get_summary_by_index(chatlist, i, chat);
+						mrpoortext_unref(poortext);
+						mrchat_unref(chat);
+					}
+					mrchatlist_unref(chatlist);
+				}
+			gettimeofday(&end, NULL);
+			ms[0] += (end.tv_sec-start.tv_sec)*1000.0 + (end.tv_usec-start.tv_usec)/1000.0;
+
+			gettimeofday(&start, NULL);
+				chatlist = mrmailbox_get_chatlist(mailbox, NULL);
+				if( chatlist ) {
+					mrchatsummaries_t* summaries = mrchatlist_get_summaries(chatlist, 0, mrchatlist_get_cnt(chatlist));
+					mrchatsummaries_unref(summaries);
+					mrchatlist_unref(chatlist);
+				}
+			gettimeofday(&end, NULL);
+			ms[2] += (end.tv_sec-start.tv_sec)*1000.0 + (end.tv_usec-start.tv_usec)/1000.0;
+		}
+
+		mrparam_t* param = mrparam_new();
+		mrparam_set_packed(param, "f=/path/to/blobs/file.jpg\nm=image/jpeg\nw=1024\nh=768\nc=1");
+		gettimeofday(&start, NULL);
+			for( i = 0; i < BENCH_PARAM_LOOKUPS; i++ ) {
+				sum += mrparam_get_int(param, MRP_WIDTH, 0) + mrparam_get_int(param, MRP_GUARANTEE_E2EE, 0) + mrparam_exists(param, MRP_FILE);
+			}
+		gettimeofday(&end, NULL);
+		ms[1] = (end.tv_sec-start.tv_sec)*1000.0 + (end.tv_usec-start.tv_usec)/1000.0;
+		mrparam_unref(param);
+
+		ret = mr_mprintf("Chatlist with %i chats rendered in %.2f ms, batched in %.2f ms (average of %i rounds); %i parameter lookups in %.2f ms (checksum %i).",
+			cnt, ms[0]/BENCH_ROUNDS, ms[2]/BENCH_ROUNDS, BENCH_ROUNDS, BENCH_PARAM_LOOKUPS*3, ms[1], sum);
+		#undef BENCH_ROUNDS
+		#undef BENCH_PARAM_LOOKUPS
+	}
 	else if( strcmp(cmd, "chat")==0 )
 	{
 		if( arg1 && arg1[0] ) {
@@ -573,6 +629,35 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 			ret = safe_strdup("ERROR: Argument <query> missing.");
 		}
 	}
+	else if( strcmp(cmd, "benchsearch")==0 )
+	{
+		if( arg1 ) {
+			/* compare the full text index with the LIKE search, see mrmailbox_search_msgs() */
+			#define BENCH_ROUNDS 10
+			int            round, flags, cnt[2] = {0, 0};
+			double         ms[3] = {0, 0, 0};
+			struct timeval start, end;
+			for( flags = 0; flags <= MR_SEARCH_NO_FTS; flags += MR_SEARCH_NO_FTS ) {
+				for( round = 0; round < BENCH_ROUNDS; round++ ) {
+					gettimeofday(&start, NULL);
+						mrsqlite3_lock_read(mailbox->m_sql);
+							carray* msglist = mrmailbox_search_msgs__(mailbox, sel_chat? sel_chat->m_id : 0, arg1, flags);
+						mrsqlite3_unlock_read(mailbox->m_sql);
+					gettimeofday(&end, NULL);
+					ms[flags] += (end.tv_sec-start.tv_sec)*1000.0 + (end.tv_usec-start.tv_usec)/1000.0;
+					if( msglist ) {
+						cnt[flags] = carray_count(msglist);
+						carray_free(msglist);
+					}
+				}
+			}
+			ret = mr_mprintf("%s: %i messages in %.2f ms; LIKE: %i messages in %.2f ms (average of %i rounds).",
+				mailbox->m_sql->m_has_fts? "FTS5" : "FTS5 not available, LIKE", cnt[0], ms[0]/BENCH_ROUNDS, cnt[1], ms[1]/BENCH_ROUNDS, BENCH_ROUNDS);
+		}
+		else {
+			ret = safe_strdup("ERROR: Argument <query> missing.");
+		}
+	}
 	else if( strcmp(cmd, "draft")==0 )
 	{
 		if( sel_chat ) {
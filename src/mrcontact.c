@@ -142,16 +142,214 @@ size_t mrmailbox_get_real_contact_cnt__(mrmailbox_t* mailbox)
 }
 
 
+/* The contact cache avoids the SELECT and, if nothing has changed, the UPDATE in mrmailbox_add_or_lookup_contact__() - when receiving
+messages, this function is called for every address in From:, To: and Cc:, mostly with the same few addresses.
+Only rows found or inserted are cached, so rows added by plain SQL do not make the cache stale; rows modified or deleted by plain SQL do,
+use mrcontact_cache_empty__() in this case. */
+typedef struct mrcontactcacheentry_t
+{
+	uint32_t m_id;
+	char*    m_name;
+	char*    m_addr;
+	char*    m_authname;
+	int      m_origin;         /* may be larger than the origin in the database, see m_origin_pending */
+	int      m_origin_pending; /* set if m_origin is not yet written, this is done by mrcontact_cache_flush__() */
+	int      m_blocked;
+} mrcontactcacheentry_t;
+
+
+#define MR_CONTACT_CACHE_MAX 2000 /* when reached, the cache is emptied */
+
+
+static mrcontactcacheentry_t* cache_get_by_addr__(mrsqlite3_t* sql, const char* addr)
+{
+	mrcontactcacheentry_t* entry = NULL;
+	char*                  key;
+
+	if( sql->m_contact_cache_addr == NULL ) {
+		return NULL;
+	}
+
+	key = mr_strlower(addr); /* same as `COLLATE NOCASE` which only folds ASCII characters */
+		chashdatum k = { key, strlen(key) }, v;
+		if( chash_get(sql->m_contact_cache_addr, &k, &v) == 0 ) {
+			entry = (mrcontactcacheentry_t*)v.data;
+		}
+	free(key);
+
+	return entry;
+}
+
+
+static mrcontactcacheentry_t* cache_get_by_id__(mrsqlite3_t* sql, uint32_t contact_id)
+{
+	chashdatum k = { &contact_id, sizeof(uint32_t) }, v;
+
+	if( sql->m_contact_cache_id == NULL || chash_get(sql->m_contact_cache_id, &k, &v) != 0 ) {
+		return NULL;
+	}
+
+	return (mrcontactcacheentry_t*)v.data;
+}
+
+
+static void cache_remove__(mrsqlite3_t* sql, uint32_t contact_id)
+{
+	mrcontactcacheentry_t* entry = cache_get_by_id__(sql, contact_id);
+	char*                  key;
+
+	if( entry == NULL ) {
+		return;
+	}
+
+	key = mr_strlower(entry->m_addr);
+		chashdatum ka = { key, strlen(key) }, ki = { &contact_id, sizeof(uint32_t) };
+		chash_delete(sql->m_contact_cache_addr, &ka, NULL);
+		chash_delete(sql->m_contact_cache_id, &ki, NULL);
+	free(key);
+
+	if( entry->m_origin_pending ) {
+		sql->m_contact_cache_pending--;
+	}
+
+	free(entry->m_name);
+	free(entry->m_addr);
+	free(entry->m_authname);
+	free(entry);
+}
+
+
+static mrcontactcacheentry_t* cache_add__(mrsqlite3_t* sql, uint32_t contact_id, const char* name, const char* addr, const char* authname, int origin, int blocked)
+{
+	mrcontactcacheentry_t* entry;
+	char*                  key;
+
+	if( sql->m_contact_cache_addr && chash_count(sql->m_contact_cache_addr) >= MR_CONTACT_CACHE_MAX ) {
+		mrcontact_cache_flush__(sql);
+		mrcontact_cache_empty__(sql);
+	}
+
+	if( sql->m_contact_cache_addr == NULL ) {
+		if( (sql->m_contact_cache_addr=chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY))==NULL
+		 || (sql->m_contact_cache_id=chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY))==NULL ) {
+			exit(62); /* cannot allocate little memory, unrecoverable error */
+		}
+	}
+
+	cache_remove__(sql, contact_id); /* there may be an entry with an old address */
+
+	if( (entry=calloc(1, sizeof(mrcontactcacheentry_t)))==NULL ) {
+		exit(63); /* cannot allocate little memory, unrecoverable error */
+	}
+	entry->m_id       = contact_id;
+	entry->m_name     = safe_strdup(name);
+	entry->m_addr     = safe_strdup(addr);
+	entry->m_authname = safe_strdup(authname);
+	entry->m_origin   = origin;
+	entry->m_blocked  = blocked;
+
+	key = mr_strlower(addr);
+		chashdatum ka = { key, strlen(key) }, ki = { &entry->m_id, sizeof(uint32_t) }, v = { entry, 0 };
+		chash_set(sql->m_contact_cache_addr, &ka, &v, NULL);
+		chash_set(sql->m_contact_cache_id, &ki, &v, NULL);
+	free(key);
+
+	return entry;
+}
+
+
+static void cache_replace_str(char** str, const char* new_str)
+{
+	char* old_str = *str; /* new_str may be a pointer to the old string */
+	*str = safe_strdup(new_str);
+	free(old_str);
+}
+
+
+void mrcontact_cache_flush__(mrsqlite3_t* sql)
+{
+	chashiter*             iter;
+	chashdatum             v;
+	mrcontactcacheentry_t* entry;
+	int                    origin;
+	char*                  q3;
+	sqlite3_stmt*          stmt;
+	mrstrbuilder_t         ids;
+
+	/* typically, all pending upgrades use the same origin, so this results in a single UPDATE statement */
+	mrstrbuilder_init(&ids);
+	while( sql && sql->m_contact_cache_pending > 0 && sql->m_contact_cache_id )
+	{
+		origin = 0;
+		mrstrbuilder_empty(&ids);
+		for( iter = chash_begin(sql->m_contact_cache_id); iter != NULL; iter = chash_next(sql->m_contact_cache_id, iter) ) {
+			chash_value(iter, &v);
+			entry = (mrcontactcacheentry_t*)v.data;
+			if( entry->m_origin_pending && (origin == 0 || entry->m_origin == origin) ) {
+				char* temp = mr_mprintf("%s%lu", ids.m_buf[0]? "," : "", (unsigned long)entry->m_id);
+					mrstrbuilder_cat(&ids, temp);
+				free(temp);
+				origin = entry->m_origin;
+				entry->m_origin_pending = 0;
+				sql->m_contact_cache_pending--;
+			}
+		}
+
+		if( origin == 0 ) {
+			sql->m_contact_cache_pending = 0; /* should not happen */
+			break;
+		}
+
+		q3 = sqlite3_mprintf("UPDATE contacts SET origin=? WHERE id IN(%s) AND origin<?;", ids.m_buf);
+			stmt = mrsqlite3_prepare_v2_(sql, q3);
+			sqlite3_bind_int(stmt, 1, origin);
+			sqlite3_bind_int(stmt, 2, origin);
+			sqlite3_step(stmt);
+			sqlite3_finalize(stmt);
+		sqlite3_free(q3);
+	}
+	free(ids.m_buf);
+}
+
+
+void mrcontact_cache_empty__(mrsqlite3_t* sql)
+{
+	chashiter*             iter;
+	chashdatum             v;
+	mrcontactcacheentry_t* entry;
+
+	if( sql == NULL || sql->m_contact_cache_id == NULL ) {
+		return;
+	}
+
+	for( iter = chash_begin(sql->m_contact_cache_id); iter != NULL; iter = chash_next(sql->m_contact_cache_id, iter) ) {
+		chash_value(iter, &v);
+		entry = (mrcontactcacheentry_t*)v.data;
+		free(entry->m_name);
+		free(entry->m_addr);
+		free(entry->m_authname);
+		free(entry);
+	}
+
+	chash_free(sql->m_contact_cache_id);
+	chash_free(sql->m_contact_cache_addr);
+	sql->m_contact_cache_id      = NULL;
+	sql->m_contact_cache_addr    = NULL;
+	sql->m_contact_cache_pending = 0;
+}
+
+
 uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
                                            const char*  name /*can be NULL, the caller may use mr_normalize_name() before*/,
                                            const char*  addr__,
                                            int          origin,
                                            int*         sth_modified )
 {
-	sqlite3_stmt* stmt;
-	uint32_t      row_id = 0;
-	int           dummy;
-	char*         addr = NULL;
+	sqlite3_stmt*          stmt;
+	uint32_t               row_id = 0;
+	int                    dummy;
+	char*                  addr = NULL;
+	mrcontactcacheentry_t* entry;
 
 	if( sth_modified == NULL ) {
 		sth_modified = &dummy;
@@ -175,23 +373,38 @@ uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
 
 	/* insert email-address to database or modify the record with the given email-address.
 	we treat all email-addresses case-insensitive. */
-	stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_inao_FROM_contacts_a,
-		"SELECT id, name, addr, origin, authname FROM contacts WHERE addr=? COLLATE NOCASE;");
-	sqlite3_bind_text(stmt, 1, (const char*)addr, -1, SQLITE_STATIC);
-	if( sqlite3_step(stmt) == SQLITE_ROW )
+	if( (entry=cache_get_by_addr__(mailbox->m_sql, addr)) != NULL )
+	{
+		mailbox->m_sql->m_contact_cache_hits++;
+	}
+	else
 	{
-		const char  *row_name, *row_addr, *row_authname;
-		int         row_origin, update_addr = 0, update_name = 0, update_authname = 0;
+		mailbox->m_sql->m_contact_cache_misses++;
+		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_inaob_FROM_contacts_a,
+			"SELECT id, name, addr, origin, authname, blocked FROM contacts WHERE addr=? COLLATE NOCASE;");
+		sqlite3_bind_text(stmt, 1, (const char*)addr, -1, SQLITE_STATIC);
+		if( sqlite3_step(stmt) == SQLITE_ROW )
+		{
+			const char* row_addr = (const char*)sqlite3_column_text(stmt, 2);
+			entry = cache_add__(mailbox->m_sql,
+				sqlite3_column_int(stmt, 0),
+				(const char*)sqlite3_column_text(stmt, 1),
+				row_addr? row_addr : addr,
+				(const char*)sqlite3_column_text(stmt, 4),
+				sqlite3_column_int(stmt, 3),
+				sqlite3_column_int(stmt, 5));
+		}
+	}
+
+	if( entry )
+	{
+		int row_origin = entry->m_origin, update_addr = 0, update_name = 0, update_authname = 0;
 
-		row_id       = sqlite3_column_int(stmt, 0);
-		row_name     = (const char*)sqlite3_column_text(stmt, 1); if( row_name == NULL ) { row_name = ""; }
-		row_addr     = (const char*)sqlite3_column_text(stmt, 2); if( row_addr == NULL ) { row_addr = addr; }
-		row_origin   = sqlite3_column_int(stmt, 3);
-		row_authname = (const char*)sqlite3_column_text(stmt, 4); if( row_authname == NULL ) { row_authname = ""; }
+		row_id = entry->m_id;
 
 		if( name && name[0] ) {
-			if( row_name && row_name[0] ) {
-				if( origin>=row_origin && strcmp(name, row_name)!=0 ) {
+			if( entry->m_name[0] ) {
+				if( origin>=row_origin && strcmp(name, entry->m_name)!=0 ) {
 					update_name = 1;
 				}
 			}
@@ -199,26 +412,32 @@ uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
 				update_name = 1;
 			}
 
-			if( origin == MR_ORIGIN_INCOMING_UNKNOWN_FROM && strcmp(name, row_authname)!=0 ) {
+			if( origin == MR_ORIGIN_INCOMING_UNKNOWN_FROM && strcmp(name, entry->m_authname)!=0 ) {
 				update_authname = 1;
 			}
 		}
 
-		if( origin>=row_origin && strcmp(addr, row_addr)!=0 /*really compare case-sensitive here*/ ) {
+		if( origin>=row_origin && strcmp(addr, entry->m_addr)!=0 /*really compare case-sensitive here*/ ) {
 			update_addr = 1;
 		}
 
-		if( update_name || update_authname || update_addr || origin>row_origin )
+		if( update_name || update_authname || update_addr )
 		{
 			stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_contacts_nao_WHERE_i,
 				"UPDATE contacts SET name=?, addr=?, origin=?, authname=? WHERE id=?;");
-			sqlite3_bind_text(stmt, 1, update_name?       name   : row_name, -1, SQLITE_STATIC);
-			sqlite3_bind_text(stmt, 2, update_addr?       addr   : row_addr, -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 1, update_name?       name   : entry->m_name, -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 2, update_addr?       addr   : entry->m_addr, -1, SQLITE_STATIC);
 			sqlite3_bind_int (stmt, 3, origin>row_origin? origin : row_origin);
-			sqlite3_bind_text(stmt, 4, update_authname?   name   : row_authname, -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 4, update_authname?   name   : entry->m_authname, -1, SQLITE_STATIC);
 			sqlite3_bind_int (stmt, 5, row_id);
 			sqlite3_step     (stmt);
 
+			if( update_name )   { cache_replace_str(&entry->m_name, name); }
+			if( update_addr )   { cache_replace_str(&entry->m_addr, addr); } /* the lower-case key does not change */
+			if( update_authname ) { cache_replace_str(&entry->m_authname, name); }
+			if( origin>row_origin ) { entry->m_origin = origin; }
+			if( entry->m_origin_pending ) { entry->m_origin_pending = 0; mailbox->m_sql->m_contact_cache_pending--; } /* written above */
+
 			if( update_name )
 			{
 				/* Update the contact name also if it is used as a group name.
@@ -231,6 +450,26 @@ uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
 				sqlite3_step     (stmt);
 			}
 		}
+		else if( origin>row_origin )
+		{
+			/* only the origin is upgraded; within a transaction (eg. when receiving messages) this is deferred to the commit,
+			so that the upgrades of all addresses of all messages in a row are written by a single statement */
+			entry->m_origin = origin;
+			if( mailbox->m_sql->m_transactionCount > 0 ) {
+				if( !entry->m_origin_pending ) {
+					entry->m_origin_pending = 1;
+					mailbox->m_sql->m_contact_cache_pending++;
+				}
+			}
+			else {
+				stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_contacts_SET_origin_WHERE_id,
+					"UPDATE contacts SET origin=? WHERE id=? AND origin<?;");
+				sqlite3_bind_int(stmt, 1, origin);
+				sqlite3_bind_int(stmt, 2, row_id);
+				sqlite3_bind_int(stmt, 3, origin);
+				sqlite3_step(stmt);
+			}
+		}
 
 		*sth_modified = 1;
 	}
@@ -244,6 +483,7 @@ uint32_t mrmailbox_add_or_lookup_contact__( mrmailbox_t* mailbox,
 		if( sqlite3_step(stmt) == SQLITE_DONE )
 		{
 			row_id = sqlite3_last_insert_rowid(mailbox->m_sql->m_cobj);
+			cache_add__(mailbox->m_sql, row_id, name, addr, NULL, origin, 0);
 			*sth_modified = 1;
 		}
 		else
@@ -260,6 +500,8 @@ cleanup:
 
 void mrmailbox_scaleup_contact_origin__(mrmailbox_t* mailbox, uint32_t contact_id, int origin)
 {
+	mrcontactcacheentry_t* entry;
+
 	if( mailbox == NULL ) {
 		return;
 	}
@@ -270,14 +512,24 @@ void mrmailbox_scaleup_contact_origin__(mrmailbox_t* mailbox, uint32_t contact_i
 	sqlite3_bind_int(stmt, 2, contact_id);
 	sqlite3_bind_int(stmt, 3, origin);
 	sqlite3_step(stmt);
+
+	if( (entry=cache_get_by_id__(mailbox->m_sql, contact_id)) != NULL && origin > entry->m_origin ) {
+		entry->m_origin = origin;
+	}
 }
 
 
 int mrmailbox_is_contact_blocked__(mrmailbox_t* mailbox, uint32_t contact_id)
 {
-	int          is_blocked = 0;
-	mrcontact_t* ths = mrcontact_new();
+	int                    is_blocked = 0;
+	mrcontact_t*           ths;
+	mrcontactcacheentry_t* entry;
+
+	if( (entry=cache_get_by_id__(mailbox->m_sql, contact_id)) != NULL ) {
+		return entry->m_blocked? 1 : 0;
+	}
 
+	ths = mrcontact_new();
 	if( mrcontact_load_from_db__(ths, mailbox->m_sql, contact_id) ) { /* we could optimize this by loading only the needed fields */
 		if( ths->m_blocked ) {
 			is_blocked = 1;
@@ -291,12 +543,25 @@ int mrmailbox_is_contact_blocked__(mrmailbox_t* mailbox, uint32_t contact_id)
 
 int mrmailbox_is_known_contact__(mrmailbox_t* mailbox, uint32_t contact_id, int* ret_blocked)
 {
-	int          is_known = 0;
-	int          dummy; if( ret_blocked==NULL ) { ret_blocked = &dummy; }
-	mrcontact_t* ths = mrcontact_new();
+	int                    is_known = 0;
+	int                    dummy; if( ret_blocked==NULL ) { ret_blocked = &dummy; }
+	mrcontact_t*           ths = NULL;
+	mrcontactcacheentry_t* entry;
 
 	*ret_blocked = 0;
 
+	if( (entry=cache_get_by_id__(mailbox->m_sql, contact_id)) != NULL ) {
+		/* the cached origin also includes upgrades not yet written */
+		if( entry->m_blocked ) {
+			*ret_blocked = 1;
+		}
+		else if( entry->m_origin >= MR_ORIGIN_MIN_START_NEW_CHAT ) {
+			is_known = 1;
+		}
+		goto cleanup;
+	}
+
+	ths = mrcontact_new();
 	if( !mrcontact_load_from_db__(ths, mailbox->m_sql, contact_id) ) { /* we could optimize this by loading only the needed fields */
 		goto cleanup;
 	}
@@ -556,6 +821,7 @@ int mrmailbox_block_contact(mrmailbox_t* mailbox, uint32_t contact_id, int new_b
 	int success = 0, locked = 0, send_event = 0, transaction_pending = 0;
 	mrcontact_t*  contact = mrcontact_new();
 	sqlite3_stmt* stmt;
+	mrcontactcacheentry_t* entry;
 
 	if( mailbox == NULL ) {
 		return 0;
@@ -578,6 +844,10 @@ int mrmailbox_block_contact(mrmailbox_t* mailbox, uint32_t contact_id, int new_b
 					goto cleanup;
 				}
 
+				if( (entry=cache_get_by_id__(mailbox->m_sql, contact_id)) != NULL ) {
+					entry->m_blocked = new_blocking;
+				}
+
 				/* also (un)block all chats with _only_ this contact - we do not delete them to allow a non-destructive blocking->unblocking.
 				(Maybe, beside normal chats (type=100) we should also block group chats with only this user.
 				However, I'm not sure about this point; it may be confusing if the user wants to add other people;
@@ -767,6 +1037,8 @@ int mrmailbox_delete_contact(mrmailbox_t* mailbox, uint32_t contact_id)
 			goto cleanup;
 		}
 
+		cache_remove__(mailbox->m_sql, contact_id);
+
 	mrsqlite3_unlock(mailbox->m_sql);
 	locked = 0;
 
@@ -87,6 +87,8 @@ int          mrmailbox_is_contact_blocked__   (mrmailbox_t*, uint32_t id);
 int          mrmailbox_real_contact_exists__  (mrmailbox_t*, uint32_t id);
 int          mrmailbox_contact_addr_equals__  (mrmailbox_t*, uint32_t contact_id, const char* other_addr);
 void         mrmailbox_scaleup_contact_origin__(mrmailbox_t*, uint32_t contact_id, int origin);
+void         mrcontact_cache_flush__          (mrsqlite3_t*); /* writes deferred origin upgrades, called by mrsqlite3_commit__() */
+void         mrcontact_cache_empty__          (mrsqlite3_t*); /* must be called if the contacts table is modified without the functions above */
 void         mr_normalize_name                (char* full_name);
 char*        mr_get_first_name                (const char* full_name); /* returns part before the space or after a comma; the result must be free()'d */
 
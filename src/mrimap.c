@@ -50,6 +50,11 @@
 		pthread_mutex_unlock(&ths->m_inwait_mutex); \
 	}
 
+#define MR_JOBS_CONNECTION_UNUSED_SECONDS 120 /* close the connection for jobs if it is not used for this time, see mrimap_heartbeat() */
+
+#define MR_FETCH_BATCH_MSGS  50                /* default for the config-value "fetch_batch_msgs", max. number of messages requested by one UID FETCH */
+#define MR_FETCH_BATCH_BYTES (2*1024*1024)     /* default for the config-value "fetch_batch_bytes", max. summed up message sizes requested by one UID FETCH */
+
 static int  setup_handle_if_needed__ (mrimap_t*);
 static void unsetup_handle__         (mrimap_t*);
 
@@ -395,6 +400,29 @@ static uint32_t peek_uid(struct mailimap_msg_att* msg_att)
 }
 
 
+static uint32_t peek_size(struct mailimap_msg_att* msg_att)
+{
+	/* search the RFC822.SIZE in a list of attributes returned by a FETCH command */
+	clistiter* iter1;
+	for( iter1=clist_begin(msg_att->att_list); iter1!=NULL; iter1=clist_next(iter1) )
+	{
+		struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(iter1);
+		if( item )
+		{
+			if( item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC )
+			{
+				if( item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_RFC822_SIZE )
+				{
+					return item->att_data.att_static->att_data.att_rfc822_size;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+
 static int peek_flag_keyword(struct mailimap_msg_att* msg_att, const char* flag_keyword)
 {
 	/* search $MDNSent in a list of attributes returned by a FETCH command */
@@ -558,17 +586,355 @@ cleanup:
 }
 
 
+typedef struct mrimap_batchmsg_t
+{
+	uint32_t m_server_uid;
+	uint32_t m_flags;
+	char*    m_content; /* a copy, as libetpan frees msg_att after the handler returns */
+	size_t   m_bytes;
+} mrimap_batchmsg_t;
+
+
+typedef struct mrimap_batch_t
+{
+	mrimap_t*       m_imap;
+	const uint32_t* m_uids; /* the UIDs requested by the current UID FETCH */
+	int*            m_done; /* set to 1 for each UID that should be treated as received */
+	int             m_cnt;
+	carray*         m_msgs; /* mrimap_batchmsg_t, passed to m_receive_imf after the UID FETCH returns */
+} mrimap_batch_t;
+
+
+static void fetch_batch_msg_att_handler(struct mailimap_msg_att* msg_att, void* context)
+{
+	/* called by libetpan for each message as soon as it is read from the stream - so we do not need to hold the whole
+	FETCH response in memory; msg_att is freed by libetpan after we return.  The message is only copied here; it is not
+	received while the handle is locked, as parsing and writing the message would block all other users of the handle. */
+	mrimap_batch_t*    batch = (mrimap_batch_t*)context;
+	mrimap_batchmsg_t* msg;
+	char*              msg_content = NULL;
+	size_t             msg_bytes = 0;
+	uint32_t           flags = 0, server_uid;
+	int                deleted = 0, i;
+
+	if( batch==NULL || msg_att==NULL || (server_uid=peek_uid(msg_att))==0 ) {
+		return;
+	}
+
+	for( i = 0; i < batch->m_cnt; i++ ) {
+		if( batch->m_uids[i] == server_uid ) {
+			break;
+		}
+	}
+
+	if( i >= batch->m_cnt ) {
+		return; /* not requested by us, maybe an unsolicited FETCH response */
+	}
+
+	batch->m_done[i] = 1;
+
+	peek_body(msg_att, &msg_content, &msg_bytes, &flags, &deleted);
+	if( msg_content == NULL  || msg_bytes <= 0 || deleted ) {
+		return; /* empty or deleted, this is a quite usual situation, see fetch_single_msg() */
+	}
+
+	if( (msg=calloc(1, sizeof(mrimap_batchmsg_t)))==NULL || (msg->m_content=malloc(msg_bytes))==NULL ) {
+		exit(69); /* cannot allocate little memory, unrecoverable error */
+	}
+	memcpy(msg->m_content, msg_content, msg_bytes);
+	msg->m_bytes      = msg_bytes;
+	msg->m_server_uid = server_uid;
+	msg->m_flags      = flags;
+	carray_add(batch->m_msgs, msg, NULL);
+}
+
+
+static int fetch_msg_batch(mrimap_t* ths, const char* folder, const uint32_t* server_uids, int* done, int cnt)
+{
+	/* fetch the bodies of several messages with a single UID FETCH command; for the return values, see fetch_single_msg().
+	On errors, done[] is set for the messages read before the error, so the caller can decide which messages to fetch again. */
+	int                  r = 0, i, retry_later = 0, handle_locked = 0;
+	clist*               fetch_result = NULL;
+	struct mailimap_set* set = NULL;
+	mrimap_batch_t       batch;
+
+	memset(&batch, 0, sizeof(mrimap_batch_t));
+
+	if( ths==NULL || server_uids==NULL || done==NULL || cnt <= 0 ) {
+		goto cleanup;
+	}
+
+	batch.m_imap   = ths;
+	batch.m_uids   = server_uids;
+	batch.m_done   = done;
+	batch.m_cnt    = cnt;
+	batch.m_msgs   = carray_new(cnt);
+
+	set = mailimap_set_new_empty();
+	for( i = 0; i < cnt; i++ ) {
+		mailimap_set_add_single(set, server_uids[i]);
+	}
+
+	LOCK_HANDLE
+
+		if( ths->m_hEtpan==NULL ) {
+			retry_later = 1; /* the connection was lost while fetching the previous batch */
+			goto cleanup;
+		}
+
+		mailimap_set_msg_att_handler(ths->m_hEtpan, fetch_batch_msg_att_handler, &batch);
+			r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_body, &fetch_result);
+		mailimap_set_msg_att_handler(ths->m_hEtpan, NULL, NULL);
+
+	UNLOCK_HANDLE
+
+	/* receive the messages read, also if there was an error afterwards.  This is done in bulk mode, that is, the receiver
+	may hold the database lock over several messages; as the handle is unlocked, others can use it meanwhile and there are
+	no network reads while the database is locked */
+	if( carray_count(batch.m_msgs) > 0 ) {
+		ths->m_bulk_receive(ths, 1);
+			for( i = 0; i < (int)carray_count(batch.m_msgs); i++ ) {
+				mrimap_batchmsg_t* msg = (mrimap_batchmsg_t*)carray_get(batch.m_msgs, i);
+				ths->m_receive_imf(ths, msg->m_content, msg->m_bytes, folder, msg->m_server_uid, msg->m_flags);
+			}
+		ths->m_bulk_receive(ths, 0);
+	}
+
+	if( is_error(ths, r) || fetch_result == NULL ) {
+		mrmailbox_log_warning(ths->m_mailbox, 0, "Error #%i on fetching %i messages from folder \"%s\"; retry=%i.", (int)r, cnt, folder, (int)ths->m_should_reconnect);
+		if( ths->m_should_reconnect ) {
+			retry_later = 1; /* messages already passed to the handler are in done[], the others should be fetched again */
+			goto cleanup;
+		}
+	}
+
+	for( i = 0; i < cnt; i++ ) {
+		done[i] = 1; /* as in fetch_single_msg(), messages not returned by the server do not exist and should not be fetched again */
+	}
+
+cleanup:
+	UNLOCK_HANDLE
+
+	if( batch.m_msgs ) {
+		for( i = 0; i < (int)carray_count(batch.m_msgs); i++ ) {
+			mrimap_batchmsg_t* msg = (mrimap_batchmsg_t*)carray_get(batch.m_msgs, i);
+			free(msg->m_content);
+			free(msg);
+		}
+		carray_free(batch.m_msgs);
+	}
+
+	if( fetch_result ) {
+		mailimap_fetch_list_free(fetch_result);
+	}
+
+	if( set ) {
+		mailimap_set_free(set);
+	}
+
+	return retry_later? 0 : 1;
+}
+
+
+/*******************************************************************************
+ * Sync flags and expunges using CONDSTORE/QRESYNC, see RFC 7162
+ ******************************************************************************/
+
+
+static void report_remote_flags(mrimap_t* ths, const char* folder, clist* fetch_result, uint32_t lastuid)
+{
+	clistiter* cur;
+
+	if( fetch_result == NULL ) {
+		return;
+	}
+
+	for( cur = clist_begin(fetch_result); cur != NULL ; cur = clist_next(cur) )
+	{
+		struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur);
+		char*    msg_content = NULL; /* not requested */
+		size_t   msg_bytes = 0;
+		uint32_t flags = 0, server_uid = peek_uid(msg_att);
+		int      deleted = 0;
+
+		if( server_uid == 0 || server_uid > lastuid ) {
+			continue; /* newer messages are fetched as usual */
+		}
+
+		peek_body(msg_att, &msg_content, &msg_bytes, &flags, &deleted);
+		if( deleted ) {
+			flags |= MR_IMAP_GONE;
+		}
+
+		if( flags ) {
+			ths->m_remote_flags(ths, folder, server_uid, server_uid, flags);
+		}
+	}
+}
+
+
+static void report_vanished(mrimap_t* ths, const char* folder, struct mailimap_qresync_vanished* vanished, uint32_t lastuid)
+{
+	clistiter* cur;
+
+	if( vanished == NULL || vanished->qr_known_uids == NULL ) {
+		return;
+	}
+
+	for( cur = clist_begin(vanished->qr_known_uids->set_list); cur != NULL ; cur = clist_next(cur) )
+	{
+		struct mailimap_set_item* item = (struct mailimap_set_item*)clist_content(cur);
+		uint32_t first = item->set_first, last = item->set_last==0 /* `*` */ ? lastuid : item->set_last;
+		if( first > 0 && first <= lastuid ) {
+			ths->m_remote_flags(ths, folder, first, MR_MIN(last, lastuid), MR_IMAP_GONE);
+		}
+	}
+}
+
+
+static void report_changes(mrimap_t* ths, const char* folder, clist* changes, struct mailimap_qresync_vanished* vanished, uint32_t lastuid)
+{
+	/* pass the changes returned by sync_folder__() to the handlers; this is done without holding the IMAP handle
+	as the changes are written to the database.  The changes are written in bulk mode, see fetch_msg_batch() */
+	if( changes == NULL && vanished == NULL ) {
+		return;
+	}
+
+	ths->m_bulk_receive(ths, 1);
+		report_remote_flags(ths, folder, changes, lastuid);
+		report_vanished(ths, folder, vanished, lastuid);
+	ths->m_bulk_receive(ths, 0);
+
+	mrmailbox_log_info(ths->m_mailbox, 0, "%i flag changes synced from \"%s\".", changes? (int)clist_count(changes) : 0, folder);
+}
+
+
+static int sync_folder__(mrimap_t* ths, const char* folder, char** ret_modseq_config_key, uint64_t* ret_modseq, int* ret_unchanged,
+                         clist** ret_changes, struct mailimap_qresync_vanished** ret_vanished, uint32_t* ret_lastuid)
+{
+	/* Select the folder using CONDSTORE or QRESYNC.  If the HIGHESTMODSEQ stored in the config key "imap.modseq.<folder>" is
+	still valid, flag changes (and, with QRESYNC, expunges) since then are returned for messages up to imap.lastuid.*;
+	if the HIGHESTMODSEQ has not changed, nothing has changed and *ret_unchanged is set - this costs only a single round trip.
+	The caller should write the returned HIGHESTMODSEQ after new messages are fetched; it is 0 if the folder does not support modseqs.
+	The changes are returned in *ret_changes and *ret_vanished, the caller passes them to report_changes() after the IMAP handle
+	is unlocked and frees them. */
+	int                                success = 0, r, uses_qresync = 0;
+	char*                              modseq_str = NULL, *lastuid_config_key = NULL;
+	unsigned long                      old_uidvalidity = 0;
+	unsigned long long                 old_modseq = 0;
+	uint32_t                           lastuid = 0;
+	uint64_t                           modseq = 0;
+	clist*                             fetch_result = NULL;
+	struct mailimap_qresync_vanished*  vanished = NULL;
+	struct mailimap_set*               set = NULL;
+
+	*ret_modseq_config_key = mr_mprintf("imap.modseq.%s", folder);
+	*ret_modseq            = 0;
+	*ret_unchanged         = 0;
+	*ret_changes           = NULL;
+	*ret_vanished          = NULL;
+	*ret_lastuid           = 0;
+
+	modseq_str = ths->m_get_config(ths, *ret_modseq_config_key, NULL);
+	if( modseq_str == NULL || sscanf(modseq_str, "%lu:%llu", &old_uidvalidity, &old_modseq) != 2 ) {
+		old_uidvalidity = 0;
+		old_modseq      = 0;
+	}
+
+	if( old_uidvalidity && old_modseq ) {
+		lastuid_config_key = mr_mprintf("imap.lastuid.%lu.%s", old_uidvalidity, folder);
+		lastuid = ths->m_get_config_int(ths, lastuid_config_key, 0);
+	}
+
+	/* always select the folder again - the HIGHESTMODSEQ of a cached selection would be outdated */
+	forget_folder_selection__(ths);
+	if( ths->m_has_qresync && lastuid > 0 ) {
+		uses_qresync = 1;
+		r = mailimap_select_qresync(ths->m_hEtpan, folder, old_uidvalidity, old_modseq, NULL, NULL, NULL, &fetch_result, &vanished, &modseq);
+	}
+	else {
+		r = mailimap_select_condstore(ths->m_hEtpan, folder, &modseq);
+	}
+
+	if( is_error(ths, r) || ths->m_hEtpan->imap_selection_info == NULL ) {
+		goto cleanup;
+	}
+	free(ths->m_selected_folder);
+	ths->m_selected_folder = safe_strdup(folder);
+
+	if( lastuid == 0 || ths->m_hEtpan->imap_selection_info->sel_uidvalidity != old_uidvalidity || modseq == 0 ) {
+		/* first sync, the folder was recreated or the server has no modseqs for the folder; there is nothing to compare with */
+		success = 1;
+		goto cleanup;
+	}
+
+	if( modseq == old_modseq ) {
+		*ret_unchanged = 1;
+		success = 1;
+		goto cleanup;
+	}
+
+	if( !uses_qresync ) {
+		set = mailimap_set_new_interval(1, lastuid);
+		r = mailimap_uid_fetch_changedsince(ths->m_hEtpan, set, ths->m_fetch_type_flags, old_modseq, &fetch_result);
+		if( is_error(ths, r) ) {
+			goto cleanup;
+		}
+	}
+
+	*ret_changes  = fetch_result;
+	*ret_vanished = vanished;
+	*ret_lastuid  = lastuid;
+	fetch_result  = NULL;
+	vanished      = NULL;
+	success = 1;
+
+cleanup:
+	if( success ) {
+		*ret_modseq = modseq;
+	}
+	if( set ) {
+		mailimap_set_free(set);
+	}
+	if( fetch_result ) {
+		mailimap_fetch_list_free(fetch_result);
+	}
+	if( vanished ) {
+		mailimap_qresync_vanished_free(vanished);
+	}
+	free(lastuid_config_key);
+	free(modseq_str);
+	return success;
+}
+
+
+/*******************************************************************************
+ * Fetch new messages
+ ******************************************************************************/
+
+
 static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t uidvalidity)
 {
-	int        r, handle_locked = 0, log_summary = 1;
+	int        r, handle_locked = 0, log_summary = 1, i, first, last, uid_cnt = 0, batch_msgs, batch_bytes;
 	clist*     fetch_result = NULL;
-	uint32_t   out_largetst_uid = 0;
-	size_t     read_cnt = 0, read_errors = 0;
+	uint32_t   out_largetst_uid = 0, first_failed_uid = 0;
+	uint32_t*  uids = NULL;
+	uint32_t*  sizes = NULL;
+	int*       done = NULL;
+	size_t     read_cnt = 0, read_errors = 0, chunk_bytes;
 	clistiter* cur;
 
 	uint32_t   lastuid = 0; /* The last uid fetched, we fetch from lastuid+1. If 0, we get some of the newest ones. */
 	char*      lastuid_config_key = NULL;
 
+	char*      modseq_config_key = NULL; /* set if the folder was synced using sync_folder__() */
+	uint64_t   modseq = 0;
+	uint32_t   modseq_uidvalidity = 0;
+	int        unchanged = 0;
+	clist*     changes = NULL; /* flag changes and expunges returned by sync_folder__() */
+	struct mailimap_qresync_vanished* vanished = NULL;
+	uint32_t   changes_lastuid = 0;
+
 	if( ths==NULL ) {
 		goto cleanup;
 	}
@@ -588,7 +954,7 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t
 
 			if( lastuid > 0 ) {
 				struct mailimap_set* set = mailimap_set_new_interval(lastuid+1, 0);
-					r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_uid, &fetch_result); /* execute UID FETCH from:to command, result includes the given UIDs */
+					r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_uid_size, &fetch_result); /* execute UID FETCH from:to command, result includes the given UIDs and their sizes */
 				mailimap_set_free(set);
 			}
 			else {
@@ -603,6 +969,21 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t
 
 		if( lastuid == 0 )
 		{
+			if( ths->m_has_condstore ) {
+				if( sync_folder__(ths, folder, &modseq_config_key, &modseq, &unchanged, &changes, &vanished, &changes_lastuid) ) {
+					if( unchanged ) {
+						mrmailbox_log_info(ths->m_mailbox, 0, "Folder \"%s\" unchanged.", folder);
+						log_summary = 0;
+						goto cleanup;
+					}
+				}
+				else {
+					mrmailbox_log_info(ths->m_mailbox, 0, "Cannot sync folder \"%s\", selecting as usual.", folder);
+					free(modseq_config_key);
+					modseq_config_key = NULL;
+				}
+			}
+
 			if( select_folder__(ths, folder)==0 ) {
 				mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot select folder \"%s\".", folder);
 				log_summary = 0;
@@ -612,6 +993,7 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t
 			lastuid_config_key = mr_mprintf("imap.lastuid.%lu.%s",
 				(unsigned long)ths->m_hEtpan->imap_selection_info->sel_uidvalidity, folder); /* RFC3501: UID are unique and should grow only, for mailbox recreation etc. UIDVALIDITY changes. */
 			lastuid = ths->m_get_config_int(ths, lastuid_config_key, 0);
+			modseq_uidvalidity = ths->m_hEtpan->imap_selection_info->sel_uidvalidity;
 
 			mrmailbox_log_info(ths->m_mailbox, 0, "%s=%lu (validity read from folder)", lastuid_config_key, (unsigned long)lastuid);
 
@@ -635,7 +1017,7 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t
 				*/
 
 				struct mailimap_set* set = mailimap_set_new_interval(lastuid+1, 0);
-					r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_uid, &fetch_result); /* execute UID FETCH from:to command, result includes the given UIDs */
+					r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_uid_size, &fetch_result); /* execute UID FETCH from:to command, result includes the given UIDs and their sizes */
 				mailimap_set_free(set);
 			}
 			else
@@ -663,6 +1045,8 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t
 
 	UNLOCK_HANDLE
 
+	report_changes(ths, folder, changes, vanished, changes_lastuid);
+
 	if( is_error(ths, r) || fetch_result == NULL )
 	{
 		fetch_result = NULL;
@@ -675,27 +1059,79 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t
 		goto cleanup;
 	}
 
-	/* go through all mails in folder (this is typically _fast_ as we already have the whole list) */
+	/* go through all mails in folder and collect the UIDs to fetch (this is typically _fast_ as we already have the whole list) */
+	uids  = malloc(sizeof(uint32_t)*(clist_count(fetch_result)+1));
+	sizes = malloc(sizeof(uint32_t)*(clist_count(fetch_result)+1));
+	done  = calloc(clist_count(fetch_result)+1, sizeof(int));
+	if( uids==NULL || sizes==NULL || done==NULL ) {
+		exit(47); /* cannot allocate little memory, unrecoverable error */
+	}
+
 	for( cur = clist_begin(fetch_result); cur != NULL ; cur = clist_next(cur) )
 	{
 		struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur); /* mailimap_msg_att is a list of attributes: list is a list of message attributes */
 		uint32_t cur_uid = peek_uid(msg_att);
 		if( cur_uid && (lastuid==0 || cur_uid>lastuid) ) /* normally, the "cur_uid>lastuid" is not needed, however, some server return some smaller IDs under some curcumstances. Mailcore2 does the same check, see see "if (uid < fromUID) {..}"@IMAPSession::fetchMessageNumberUIDMapping()@MCIMAPSession.cpp */
 		{
-			read_cnt++;
-			if( fetch_single_msg(ths, folder, cur_uid, 0) == 0 ) {
-				read_errors++;
+			uids[uid_cnt]  = cur_uid;
+			sizes[uid_cnt] = peek_size(msg_att);
+			uid_cnt++;
+		}
+	}
+
+	mailimap_fetch_list_free(fetch_result);
+	fetch_result = NULL;
+
+	/* fetch the bodies in chunks; a chunk is limited by the number of messages and by the summed up RFC822.SIZE
+	(a single message larger than the byte limit gets a chunk on its own); "fetch_batch_msgs=1" fetches message by message */
+	batch_msgs  = MR_MAX(ths->m_get_config_int(ths, "fetch_batch_msgs", MR_FETCH_BATCH_MSGS), 1);
+	batch_bytes = ths->m_get_config_int(ths, "fetch_batch_bytes", MR_FETCH_BATCH_BYTES);
+
+	for( first = 0; first < uid_cnt; first = last )
+	{
+		chunk_bytes = 0;
+		for( last = first; last < uid_cnt && last-first < batch_msgs; last++ ) {
+			if( last > first && batch_bytes > 0 && chunk_bytes+sizes[last] > (size_t)batch_bytes ) {
+				break;
 			}
-			else if( cur_uid > out_largetst_uid ) {
-				out_largetst_uid = cur_uid;
+			chunk_bytes += sizes[last];
+		}
+
+		read_cnt += last-first;
+		if( fetch_msg_batch(ths, folder, &uids[first], &done[first], last-first) == 0 ) {
+			break; /* connection problem, the messages not done are fetched again on the next call */
+		}
+	}
+
+	/* the lastuid is advanced up to the first message that should be fetched again; this way, a partly failed chunk
+	does not lose messages but the messages received before the error are not downloaded again */
+	for( i = 0; i < uid_cnt; i++ ) {
+		if( !done[i] ) {
+			read_errors++;
+			if( first_failed_uid == 0 || uids[i] < first_failed_uid ) {
+				first_failed_uid = uids[i];
 			}
 		}
 	}
 
-	if( !read_errors && out_largetst_uid > 0 ) {
+	for( i = 0; i < uid_cnt; i++ ) {
+		if( done[i] && uids[i] > out_largetst_uid && (first_failed_uid == 0 || uids[i] < first_failed_uid) ) {
+			out_largetst_uid = uids[i];
+		}
+	}
+
+	if( out_largetst_uid > 0 ) {
 		ths->m_set_config_int(ths, lastuid_config_key, out_largetst_uid);
 	}
 
+	/* remember the HIGHESTMODSEQ read before fetching, only if all new messages are fetched - otherwise, the next sync_folder__()
+	would find the folder unchanged and the failed messages are not fetched again */
+	if( modseq_config_key && modseq && modseq_uidvalidity && read_errors == 0 ) {
+		char* temp = mr_mprintf("%lu:%llu", (unsigned long)modseq_uidvalidity, (unsigned long long)modseq);
+			ths->m_set_config(ths, modseq_config_key, temp);
+		free(temp);
+	}
+
 	/* done */
 cleanup:
 	UNLOCK_HANDLE
@@ -716,10 +1152,24 @@ cleanup:
 		mailimap_fetch_list_free(fetch_result);
 	}
 
+	if( changes ) {
+		mailimap_fetch_list_free(changes);
+	}
+
+	if( vanished ) {
+		mailimap_qresync_vanished_free(vanished);
+	}
+
+	free(uids);
+	free(sizes);
+	free(done);
+
 	if( lastuid_config_key ) {
 		free(lastuid_config_key);
 	}
 
+	free(modseq_config_key);
+
 	return read_cnt;
 }
 
@@ -1017,6 +1467,39 @@ static void* heartbeat_thread_entry_point(void* entry_arg)
 }
 
 
+static void close_jobs_connection(mrimap_t* ths, int unused_seconds)
+{
+	/* ths is the connection for jobs; it is opened again by the next job that needs it */
+	int handle_locked = 0;
+
+	if( ths == NULL ) {
+		return;
+	}
+
+	LOCK_HANDLE
+		if( ths->m_hEtpan && time(NULL)-ths->m_jobs_last_use >= unused_seconds ) {
+			mrmailbox_log_info(ths->m_mailbox, 0, "Closing IMAP-connection for jobs.");
+			unsetup_handle__(ths);
+		}
+	UNLOCK_HANDLE
+}
+
+
+static int setup_jobs_connection__(mrimap_t* ths)
+{
+	/* ths is the connection for jobs, connect if needed; must be called with the handle locked */
+	if( ths->m_hEtpan == NULL ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "Opening IMAP-connection for jobs...");
+	}
+	ths->m_jobs_last_use = time(NULL);
+	if( !setup_handle_if_needed__(ths) ) {
+		ths->m_should_reconnect = 1; /* the callers return "try again later" then */
+		return 0;
+	}
+	return 1;
+}
+
+
 void mrimap_heartbeat(mrimap_t* ths)
 {
 	/* the function */
@@ -1026,6 +1509,8 @@ void mrimap_heartbeat(mrimap_t* ths)
 		return;
 	}
 
+	close_jobs_connection(ths->m_jobs, MR_JOBS_CONNECTION_UNUSED_SECONDS);
+
 	LOCK_HANDLE
 
 		if( ths->m_hEtpan == NULL || ths->m_should_reconnect == 1 ) {
@@ -1067,6 +1552,136 @@ cleanup:
  ******************************************************************************/
 
 
+static int enable_qresync__(mrimap_t* ths)
+{
+	int                              r, enabled = 0;
+	clist*                           cap_list = clist_new();
+	struct mailimap_capability_data* caps = NULL, *result = NULL;
+	clistiter*                       cur;
+
+	if( cap_list == NULL ) {
+		goto cleanup;
+	}
+	clist_append(cap_list, mailimap_capability_new(MAILIMAP_CAPABILITY_NAME, NULL, strdup("QRESYNC")));
+	caps = mailimap_capability_data_new(cap_list);
+
+	r = mailimap_enable(ths->m_hEtpan, caps, &result);
+	if( is_error(ths, r) || result == NULL || result->cap_list == NULL ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "Cannot enable QRESYNC. (Error #%i)", (int)r); /* not really an error, we use CONDSTORE only then */
+		goto cleanup;
+	}
+
+	for( cur = clist_begin(result->cap_list); cur != NULL; cur = clist_next(cur) ) {
+		struct mailimap_capability* cap = (struct mailimap_capability*)clist_content(cur);
+		if( cap && cap->cap_type == MAILIMAP_CAPABILITY_NAME && cap->cap_data.cap_name && strcasecmp(cap->cap_data.cap_name, "QRESYNC")==0 ) {
+			enabled = 1;
+		}
+	}
+
+cleanup:
+	if( caps ) {
+		mailimap_capability_data_free(caps);
+	}
+	else if( cap_list ) {
+		clist_free(cap_list);
+	}
+	if( result ) {
+		mailimap_capability_data_free(result);
+	}
+	return enabled;
+}
+
+
+typedef struct mrbytecounter_t
+{
+	mailstream_low* m_low;
+	uint64_t*       m_bytes_read;
+	uint64_t*       m_bytes_written;
+} mrbytecounter_t;
+
+
+static ssize_t bytecounter_read(mailstream_low* s, void* buf, size_t count)
+{
+	mrbytecounter_t* data = (mrbytecounter_t*)s->data;
+	ssize_t r = mailstream_low_read(data->m_low, buf, count);
+	if( r > 0 ) {
+		*data->m_bytes_read += r;
+	}
+	return r;
+}
+static ssize_t bytecounter_write(mailstream_low* s, const void* buf, size_t count)
+{
+	mrbytecounter_t* data = (mrbytecounter_t*)s->data;
+	ssize_t r = mailstream_low_write(data->m_low, buf, count);
+	if( r > 0 ) {
+		*data->m_bytes_written += r;
+	}
+	return r;
+}
+static int bytecounter_close(mailstream_low* s)
+{
+	return mailstream_low_close(((mrbytecounter_t*)s->data)->m_low);
+}
+static int bytecounter_get_fd(mailstream_low* s)
+{
+	return mailstream_low_get_fd(((mrbytecounter_t*)s->data)->m_low);
+}
+static void bytecounter_free(mailstream_low* s)
+{
+	mailstream_low_free(((mrbytecounter_t*)s->data)->m_low);
+	free(s->data);
+	free(s);
+}
+static void bytecounter_cancel(mailstream_low* s)
+{
+	mailstream_low_cancel(((mrbytecounter_t*)s->data)->m_low);
+}
+static struct mailstream_cancel* bytecounter_get_cancel(mailstream_low* s)
+{
+	return mailstream_low_get_cancel(((mrbytecounter_t*)s->data)->m_low);
+}
+static carray* bytecounter_get_certificate_chain(mailstream_low* s)
+{
+	return mailstream_low_get_certificate_chain(((mrbytecounter_t*)s->data)->m_low);
+}
+static int bytecounter_setup_idle(mailstream_low* s)
+{
+	return mailstream_low_setup_idle(((mrbytecounter_t*)s->data)->m_low);
+}
+static int bytecounter_unsetup_idle(mailstream_low* s)
+{
+	return mailstream_low_unsetup_idle(((mrbytecounter_t*)s->data)->m_low);
+}
+static int bytecounter_interrupt_idle(mailstream_low* s)
+{
+	return mailstream_low_interrupt_idle(((mrbytecounter_t*)s->data)->m_low);
+}
+static mailstream_low_driver s_bytecounter_driver = {
+	bytecounter_read, bytecounter_write, bytecounter_close, bytecounter_get_fd, bytecounter_free, bytecounter_cancel,
+	bytecounter_get_cancel, bytecounter_get_certificate_chain, bytecounter_setup_idle, bytecounter_unsetup_idle, bytecounter_interrupt_idle
+};
+
+
+static void count_bytes__(mrimap_t* ths, uint64_t* bytes_read, uint64_t* bytes_written)
+{
+	/* put a layer counting the transferred bytes on top of the current stream; done once directly after connecting and, for the
+	uncompressed bytes, once after COMPRESS=DEFLATE is enabled. mailstream_wait_idle() works as before as it uses the file descriptor. */
+	mailstream_low*  low = mailstream_get_low(ths->m_hEtpan->imap_stream);
+	mailstream_low*  counter;
+	mrbytecounter_t* data;
+
+	if( (data=calloc(1, sizeof(mrbytecounter_t)))==NULL
+	 || (counter=mailstream_low_new(data, &s_bytecounter_driver))==NULL ) {
+		exit(66); /* cannot allocate little memory, unrecoverable error */
+	}
+	data->m_low           = low;
+	data->m_bytes_read    = bytes_read;
+	data->m_bytes_written = bytes_written;
+	mailstream_low_set_timeout(counter, mailstream_low_get_timeout(low));
+	mailstream_set_low(ths->m_hEtpan->imap_stream, counter);
+}
+
+
 static int setup_handle_if_needed__(mrimap_t* ths)
 {
 	int r, success = 0;
@@ -1123,6 +1738,12 @@ static int setup_handle_if_needed__(mrimap_t* ths)
 	}
 	mrmailbox_log_info(ths->m_mailbox, 0, "Connection to IMAP-server ok.");
 
+	ths->m_bytes_read                 = 0;
+	ths->m_bytes_written              = 0;
+	ths->m_bytes_read_uncompressed    = 0;
+	ths->m_bytes_written_uncompressed = 0;
+	count_bytes__(ths, &ths->m_bytes_read, &ths->m_bytes_written);
+
 	mrmailbox_log_info(ths->m_mailbox, 0, "Login to IMAP-server as \"%s\"...", ths->m_imap_user);
 
 		/* TODO: There are more authorisation types, see mailcore2/MCIMAPSession.cpp, however, I'm not sure of they are really all needed */
@@ -1150,6 +1771,30 @@ static int setup_handle_if_needed__(mrimap_t* ths)
 
 	mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-Login ok.");
 
+	/* compress everything after the login, see RFC 4978; the server may send the capabilities only after the login */
+	if( (ths->m_server_flags&MR_NO_IMAP_COMPRESS)==0 && mailimap_has_compress_deflate(ths->m_hEtpan) ) {
+		r = mailimap_compress(ths->m_hEtpan);
+		if( is_error(ths, r) ) {
+			mrmailbox_log_info(ths->m_mailbox, 0, "Cannot enable IMAP compression. (Error #%i)", (int)r);
+			if( ths->m_should_reconnect ) {
+				goto cleanup; /* the connection is broken, otherwise we just continue uncompressed */
+			}
+		}
+		else {
+			ths->m_compressed = 1;
+			ths->m_bytes_read_uncompressed    = ths->m_bytes_read; /* the login was not compressed */
+			ths->m_bytes_written_uncompressed = ths->m_bytes_written;
+			count_bytes__(ths, &ths->m_bytes_read_uncompressed, &ths->m_bytes_written_uncompressed);
+			mrmailbox_log_info(ths->m_mailbox, 0, "IMAP compression enabled.");
+		}
+	}
+
+	/* CONDSTORE is enabled implicitly by SELECT (CONDSTORE), QRESYNC must be enabled explicitly for each session, see RFC 7162 */
+	ths->m_has_condstore = mailimap_has_condstore(ths->m_hEtpan);
+	if( ths->m_has_condstore && !ths->m_is_jobs && mailimap_has_qresync(ths->m_hEtpan) && mailimap_has_enable(ths->m_hEtpan) ) {
+		ths->m_has_qresync = enable_qresync__(ths);
+	}
+
 	success = 1;
 
 cleanup:
@@ -1189,6 +1834,9 @@ static void unsetup_handle__(mrimap_t* ths)
 	}
 
 	ths->m_selected_folder[0] = 0;
+	ths->m_has_condstore = 0;
+	ths->m_has_qresync   = 0;
+	ths->m_compressed    = 0;
 
 	/* we leave m_sent_folder set; normally this does not change in a normal reconnect; we'll update this folder if we get errors */
 }
@@ -1249,6 +1897,26 @@ int mrimap_connect(mrimap_t* ths, const mrloginparam_t* lp)
 			free(capinfostr.m_buf);
 		}
 
+		if( ths->m_can_idle && (ths->m_server_flags&MR_NO_IMAP_JOBS_CONNECTION)==0 ) {
+			if( ths->m_jobs == NULL ) {
+				ths->m_jobs = mrimap_new(ths->m_get_config_int, ths->m_set_config_int, ths->m_get_config, ths->m_set_config,
+					ths->m_receive_imf, ths->m_bulk_receive, ths->m_remote_flags, ths->m_userData, ths->m_mailbox);
+				ths->m_jobs->m_is_jobs = 1;
+			}
+
+			pthread_mutex_lock(&ths->m_jobs->m_hEtpanmutex);
+				unsetup_handle__(ths->m_jobs); /* the login parameters may have changed */
+				free(ths->m_jobs->m_imap_server); ths->m_jobs->m_imap_server  = safe_strdup(ths->m_imap_server);
+				                                  ths->m_jobs->m_imap_port    = ths->m_imap_port;
+				free(ths->m_jobs->m_imap_user);   ths->m_jobs->m_imap_user    = safe_strdup(ths->m_imap_user);
+				free(ths->m_jobs->m_imap_pw);     ths->m_jobs->m_imap_pw      = safe_strdup(ths->m_imap_pw);
+				                                  ths->m_jobs->m_server_flags = ths->m_server_flags;
+				                                  ths->m_jobs->m_has_xlist    = ths->m_has_xlist; /* the jobs connection lists the folders itself, see init_chat_folders__() */
+			pthread_mutex_unlock(&ths->m_jobs->m_hEtpanmutex);
+
+			ths->m_use_jobs = 1;
+		}
+
 		mrmailbox_log_info(ths->m_mailbox, 0, "Starting IMAP-watch-thread...");
 		ths->m_watch_do_exit = 0;
 
@@ -1320,6 +1988,10 @@ void mrimap_disconnect(mrimap_t* ths)
 			mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-restore-thread stopped.");
 		}
 
+		/* the connection for jobs is kept allocated as a job may just use it */
+		ths->m_use_jobs = 0;
+		close_jobs_connection(ths->m_jobs, 0);
+
 		LOCK_HANDLE
 			unsetup_handle__(ths);
 			ths->m_can_idle  = 0;
@@ -1461,7 +2133,8 @@ cleanup:
  ******************************************************************************/
 
 
-mrimap_t* mrimap_new(mr_get_config_int_t get_config_int, mr_set_config_int_t set_config_int, mr_receive_imf_t receive_imf, void* userData, mrmailbox_t* mailbox)
+mrimap_t* mrimap_new(mr_get_config_int_t get_config_int, mr_set_config_int_t set_config_int, mr_get_config_t get_config, mr_set_config_t set_config,
+                     mr_receive_imf_t receive_imf, mr_bulk_receive_t bulk_receive, mr_remote_flags_t remote_flags, void* userData, mrmailbox_t* mailbox)
 {
 	mrimap_t* ths = NULL;
 
@@ -1474,7 +2147,11 @@ mrimap_t* mrimap_new(mr_get_config_int_t get_config_int, mr_set_config_int_t set
 	ths->m_mailbox        = mailbox;
 	ths->m_get_config_int = get_config_int;
 	ths->m_set_config_int = set_config_int;
+	ths->m_get_config     = get_config;
+	ths->m_set_config     = set_config;
 	ths->m_receive_imf    = receive_imf;
+	ths->m_bulk_receive   = bulk_receive;
+	ths->m_remote_flags   = remote_flags;
 	ths->m_userData       = userData;
 
 	pthread_mutex_init(&ths->m_hEtpanmutex, NULL);
@@ -1496,6 +2173,10 @@ mrimap_t* mrimap_new(mr_get_config_int_t get_config_int, mr_set_config_int_t set
 	ths->m_fetch_type_uid = mailimap_fetch_type_new_fetch_att_list_empty(); /* object to fetch the ID */
 	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_uid, mailimap_fetch_att_new_uid());
 
+	ths->m_fetch_type_uid_size = mailimap_fetch_type_new_fetch_att_list_empty(); /* object to fetch the ID and the size, used to build batches */
+	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_uid_size, mailimap_fetch_att_new_uid());
+	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_uid_size, mailimap_fetch_att_new_rfc822_size());
+
 	ths->m_fetch_type_body = mailimap_fetch_type_new_fetch_att_list_empty(); /* object to fetch flags+body */
 	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_body, mailimap_fetch_att_new_flags());
 	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_body, mailimap_fetch_att_new_body_peek_section(mailimap_section_new(NULL)));
@@ -1515,6 +2196,11 @@ void mrimap_unref(mrimap_t* ths)
 
 	mrimap_disconnect(ths);
 
+	if( ths->m_jobs ) {
+		close_jobs_connection(ths->m_jobs, 0);
+		mrimap_unref(ths->m_jobs);
+	}
+
 	pthread_cond_destroy(&ths->m_heartbeat_cond);
 	pthread_mutex_destroy(&ths->m_heartbeat_condmutex);
 
@@ -1532,6 +2218,7 @@ void mrimap_unref(mrimap_t* ths)
 	free(ths->m_sent_folder);
 
 	if( ths->m_fetch_type_uid )  { mailimap_fetch_type_free(ths->m_fetch_type_uid);  }
+	if( ths->m_fetch_type_uid_size ) { mailimap_fetch_type_free(ths->m_fetch_type_uid_size); }
 	if( ths->m_fetch_type_body ) { mailimap_fetch_type_free(ths->m_fetch_type_body); }
 	if( ths->m_fetch_type_flags ){ mailimap_fetch_type_free(ths->m_fetch_type_flags);}
 
@@ -1567,8 +2254,16 @@ int mrimap_append_msg(mrimap_t* ths, time_t timestamp, const char* data_not_term
 		goto cleanup;
 	}
 
+	if( ths->m_use_jobs ) {
+		return mrimap_append_msg(ths->m_jobs, timestamp, data_not_terminated, data_bytes, ret_server_folder, ret_server_uid);
+	}
+
 	LOCK_HANDLE
 
+	if( ths->m_is_jobs ) {
+		setup_jobs_connection__(ths);
+	}
+
 	if( ths->m_hEtpan==NULL ) {
 		goto cleanup;
 	}
@@ -1627,14 +2322,67 @@ cleanup:
 }
 
 
-static int add_flag__(mrimap_t* ths, const char* folder, uint32_t server_uid, struct mailimap_flag* flag)
+static struct mailimap_set* uids_to_set(const uint32_t* server_uids, const int* selected, int cnt)
+{
+	/* create a set as "100:102,107" from the given UIDs; if selected is given, only UIDs with selected[i] set are added.
+	Returns NULL if no UID is added. */
+	struct mailimap_set*      set = NULL;
+	struct mailimap_set_item* last_item = NULL;
+	int                       i;
+
+	for( i = 0; i < cnt; i++ )
+	{
+		if( server_uids[i]==0 || (selected && !selected[i]) ) {
+			continue;
+		}
+
+		if( set == NULL ) {
+			set = mailimap_set_new_empty();
+		}
+
+		if( last_item && last_item->set_last+1 == server_uids[i] ) {
+			last_item->set_last = server_uids[i];
+		}
+		else {
+			mailimap_set_add_single(set, server_uids[i]);
+			last_item = (struct mailimap_set_item*)clist_content(clist_end(set->set_list));
+		}
+	}
+
+	return set;
+}
+
+
+static uint32_t set_get_uid(struct mailimap_set* set, int index)
+{
+	/* get the UID at the given position of a set as returned eg. by COPYUID, 0 if there is no such UID */
+	clistiter* iter;
+
+	if( set == NULL ) {
+		return 0;
+	}
+
+	for( iter=clist_begin(set->set_list); iter!=NULL; iter=clist_next(iter) )
+	{
+		struct mailimap_set_item* item = (struct mailimap_set_item*)clist_content(iter);
+		int item_cnt = (item->set_last > item->set_first)? (int)(item->set_last-item->set_first)+1 : 1;
+		if( index < item_cnt ) {
+			return item->set_first + index;
+		}
+		index -= item_cnt;
+	}
+
+	return 0;
+}
+
+
+static int add_flag__(mrimap_t* ths, const char* folder, struct mailimap_set* set, struct mailimap_flag* flag)
 {
 	int                              r;
 	struct mailimap_flag_list*       flag_list = NULL;
 	struct mailimap_store_att_flags* store_att_flags = NULL;
-	struct mailimap_set*             set = mailimap_set_new_single(server_uid);
 
-	if( ths==NULL || ths->m_hEtpan==NULL ) {
+	if( ths==NULL || ths->m_hEtpan==NULL || set==NULL ) {
 		goto cleanup;
 	}
 
@@ -1656,32 +2404,79 @@ cleanup:
 	if( store_att_flags ) {
 		mailimap_store_att_flags_free(store_att_flags);
 	}
-	if( set ) {
-		mailimap_set_free(set);
-	}
 	return ths->m_should_reconnect? 0 : 1; /* all non-connection states are treated as success - the mail may already be deleted or moved away on the server */
 }
 
 
-int mrimap_markseen_msg(mrimap_t* ths, const char* folder, uint32_t server_uid, int ms_flags,
-                        char** ret_server_folder, uint32_t* ret_server_uid, int* ret_ms_flags)
+static int can_create_mdnsent_flag__(mrimap_t* ths)
+{
+	/* Check if the selected folder can handle the `$MDNSent` flag (see RFC 3503). */
+	clistiter* iter;
+
+	if( ths->m_hEtpan->imap_selection_info==NULL || ths->m_hEtpan->imap_selection_info->sel_perm_flags==NULL ) {
+		return 0;
+	}
+
+	for( iter=clist_begin(ths->m_hEtpan->imap_selection_info->sel_perm_flags); iter!=NULL; iter=clist_next(iter) )
+	{
+		struct mailimap_flag_perm* fp = (struct mailimap_flag_perm*)clist_content(iter);
+		if( fp ) {
+			if( fp->fl_type==MAILIMAP_FLAG_PERM_ALL ) {
+				return 1;
+			}
+			else if( fp->fl_type==MAILIMAP_FLAG_PERM_FLAG && fp->fl_flag ) {
+				struct mailimap_flag* fl = (struct mailimap_flag*)fp->fl_flag;
+				if( fl->fl_type==MAILIMAP_FLAG_KEYWORD && fl->fl_data.fl_keyword && strcmp(fl->fl_data.fl_keyword, "$MDNSent")==0 ) {
+					return 1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+int mrimap_markseen_msgs(mrimap_t* ths, const char* folder, int cnt, const uint32_t* server_uids, const int* ms_flags,
+                         char** ret_server_folder, uint32_t* ret_server_uids, int* ret_ms_flags)
 {
 	// when marking as seen, there is no real need to check against the rfc724_mid - in the worst case, when the UID validity or the mailbox has changed, we mark the wrong message as "seen" - as the very most messages are seen, this is no big thing.
 	// command would be "STORE 123,456,678 +FLAGS (\Seen)"
-	int                  handle_locked = 0, idle_blocked = 0, r;
+	int                  handle_locked = 0, idle_blocked = 0, r, i, k, mdn_cnt = 0, move_cnt = 0;
 	struct mailimap_set* set = NULL;
+	struct mailimap_set* mdn_set = NULL;
+	struct mailimap_set* move_set = NULL;
+	int*                 selected = NULL;
+	clist*               fetch_result = NULL;
 
-	if( ths==NULL || folder==NULL || server_uid==0 || ret_server_folder==NULL || ret_server_uid==NULL || ret_ms_flags==NULL
-	 || *ret_server_folder!=NULL || *ret_server_uid!=0 || *ret_ms_flags!=0 ) {
+	if( ths==NULL || folder==NULL || cnt<=0 || server_uids==NULL || ms_flags==NULL
+	 || ret_server_folder==NULL || ret_server_uids==NULL || ret_ms_flags==NULL || *ret_server_folder!=NULL ) {
 		return 1; /* job done */
 	}
 
-	if( (set=mailimap_set_new_single(server_uid))==NULL ) {
-		goto cleanup;
+	for( i = 0; i < cnt; i++ ) {
+		ret_server_uids[i] = 0;
+		ret_ms_flags[i] = 0;
+	}
+
+	if( ths->m_use_jobs ) {
+		return mrimap_markseen_msgs(ths->m_jobs, folder, cnt, server_uids, ms_flags, ret_server_folder, ret_server_uids, ret_ms_flags);
+	}
+
+	if( (set=uids_to_set(server_uids, NULL, cnt))==NULL ) {
+		return 1; /* job done, no valid UIDs */
+	}
+
+	if( (selected=calloc(cnt, sizeof(int)))==NULL ) {
+		exit(50); /* cannot allocate little memory, unrecoverable error */
 	}
 
 	LOCK_HANDLE
 
+	if( ths->m_is_jobs ) {
+		setup_jobs_connection__(ths);
+	}
+
 	if( ths->m_hEtpan==NULL ) {
 		goto cleanup;
 	}
@@ -1690,148 +2485,188 @@ int mrimap_markseen_msg(mrimap_t* ths, const char* folder, uint32_t server_uid,
 
 		INTERRUPT_IDLE
 
-		mrmailbox_log_info(ths->m_mailbox, 0, "Marking message %s/%i as seen...", folder, (int)server_uid);
+		mrmailbox_log_info(ths->m_mailbox, 0, "Marking %i message(s) in %s as seen...", cnt, folder);
 
-		if( add_flag__(ths, folder, server_uid, mailimap_flag_new_seen())==0 ) {
-			mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot mark message as seen.");
+		if( add_flag__(ths, folder, set, mailimap_flag_new_seen())==0 ) {
+			mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot mark messages as seen.");
 			goto cleanup;
 		}
 
-		mrmailbox_log_info(ths->m_mailbox, 0, "Message marked as seen.");
+		mrmailbox_log_info(ths->m_mailbox, 0, "Messages marked as seen.");
+
+		/* set the `$MDNSent` flag for the messages requesting this and return the messages for that it was just set.
+		If the folder cannot handle the `$MDNSent` flag, we risk duplicated MDNs; it's up to the receiving MUA to handle this then (eg. Delta Chat has no problem with this). */
+		for( i = 0; i < cnt; i++ ) {
+			selected[i] = (ms_flags[i]&MR_MS_SET_MDNSent_FLAG)? 1 : 0;
+		}
 
-		if( (ms_flags&MR_MS_SET_MDNSent_FLAG)
-		 && ths->m_hEtpan->imap_selection_info!=NULL && ths->m_hEtpan->imap_selection_info->sel_perm_flags!=NULL )
+		if( (mdn_set=uids_to_set(server_uids, selected, cnt))!=NULL && ths->m_hEtpan->imap_selection_info!=NULL )
 		{
-			/* Check if the folder can handle the `$MDNSent` flag (see RFC 3503).  If so, and not set: set the flags and return this information.
-			If the folder cannot handle the `$MDNSent` flag, we risk duplicated MDNs; it's up to the receiving MUA to handle this then (eg. Delta Chat has no problem with this). */
-			int can_create_flag = 0;
-			clistiter* iter;
-			for( iter=clist_begin(ths->m_hEtpan->imap_selection_info->sel_perm_flags); iter!=NULL; iter=clist_next(iter) )
+			if( can_create_mdnsent_flag__(ths) )
 			{
-				struct mailimap_flag_perm* fp = (struct mailimap_flag_perm*)clist_content(iter);
-				if( fp ) {
-					if( fp->fl_type==MAILIMAP_FLAG_PERM_ALL ) {
-						can_create_flag = 1;
-						break;
-					}
-					else if( fp->fl_type==MAILIMAP_FLAG_PERM_FLAG && fp->fl_flag ) {
-						struct mailimap_flag* fl = (struct mailimap_flag*)fp->fl_flag;
-						if( fl->fl_type==MAILIMAP_FLAG_KEYWORD && fl->fl_data.fl_keyword && strcmp(fl->fl_data.fl_keyword, "$MDNSent")==0 ) {
-							can_create_flag = 1;
-							break;
+				memset(selected, 0, cnt*sizeof(int));
+				r = mailimap_uid_fetch(ths->m_hEtpan, mdn_set, ths->m_fetch_type_flags, &fetch_result);
+				if( !is_error(ths, r) && fetch_result ) {
+					clistiter* cur;
+					for( cur=clist_begin(fetch_result); cur!=NULL; cur=clist_next(cur) ) {
+						struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur);
+						uint32_t server_uid = peek_uid(msg_att);
+						for( i = 0; i < cnt; i++ ) {
+							if( server_uids[i]==server_uid && (ms_flags[i]&MR_MS_SET_MDNSent_FLAG) && !peek_flag_keyword(msg_att, "$MDNSent") ) {
+								selected[i] = 1;
+								ret_ms_flags[i] |= MR_MS_MDNSent_JUST_SET;
+								mdn_cnt++;
+							}
 						}
 					}
 				}
-			}
 
-			if( can_create_flag )
-			{
-				clist* fetch_result = NULL;
-				r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_flags, &fetch_result);
-				if( !is_error(ths, r) && fetch_result ) {
-					clistiter* cur=clist_begin(fetch_result);
-					if( cur ) {
-						if( !peek_flag_keyword((struct mailimap_msg_att*)clist_content(cur), "$MDNSent") ) {
-							add_flag__(ths, folder, server_uid, mailimap_flag_new_flag_keyword(safe_strdup("$MDNSent")));
-							*ret_ms_flags |= MR_MS_MDNSent_JUST_SET;
-						}
-					}
-					mailimap_fetch_list_free(fetch_result);
+				if( mdn_cnt ) {
+					mailimap_set_free(mdn_set);
+					mdn_set = uids_to_set(server_uids, selected, cnt);
+					add_flag__(ths, folder, mdn_set, mailimap_flag_new_flag_keyword(safe_strdup("$MDNSent")));
 				}
-				mrmailbox_log_info(ths->m_mailbox, 0, ((*ret_ms_flags)&MR_MS_MDNSent_JUST_SET)? "$MDNSent just set and MDN will be send." : "$MDNSent already set and MDN already send.");
+				mrmailbox_log_info(ths->m_mailbox, 0, "$MDNSent just set for %i message(s), MDNs will be send.", mdn_cnt);
 			}
 			else
 			{
-				*ret_ms_flags |= MR_MS_MDNSent_JUST_SET;
+				for( i = 0; i < cnt; i++ ) {
+					if( ms_flags[i]&MR_MS_SET_MDNSent_FLAG ) {
+						ret_ms_flags[i] |= MR_MS_MDNSent_JUST_SET;
+					}
+				}
 				mrmailbox_log_info(ths->m_mailbox, 0, "Cannot store $MDNSent flags, risk sending duplicate MDN.");
 			}
 		}
 
-		if( (ms_flags&MR_MS_ALSO_MOVE) && (ths->m_server_flags&MR_NO_MOVE_TO_CHATS)==0 )
+		if( (ths->m_server_flags&MR_NO_MOVE_TO_CHATS)==0 )
 		{
-			init_chat_folders__(ths);
-			if( ths->m_moveto_folder && strcmp(folder, ths->m_moveto_folder)==0 )
+			for( i = 0; i < cnt; i++ ) {
+				selected[i] = (ms_flags[i]&MR_MS_ALSO_MOVE)? 1 : 0;
+				move_cnt += selected[i];
+			}
+
+			if( move_cnt ) {
+				init_chat_folders__(ths);
+			}
+
+			if( move_cnt && ths->m_moveto_folder && strcmp(folder, ths->m_moveto_folder)==0 )
 			{
-				mrmailbox_log_info(ths->m_mailbox, 0, "Message %s/%i is already in %s...", folder, (int)server_uid, ths->m_moveto_folder);
+				mrmailbox_log_info(ths->m_mailbox, 0, "%i message(s) already in %s...", move_cnt, ths->m_moveto_folder);
 				/* avoid deadlocks as moving messages in the same folder may be result in a new server_uid and the state "fresh" -
 				we will catch these messages again on the next pull, try to move them away and so on, see also (***) */
 			}
-			else if( ths->m_moveto_folder )
+			else if( move_cnt && ths->m_moveto_folder && (move_set=uids_to_set(server_uids, selected, cnt))!=NULL )
 			{
-				mrmailbox_log_info(ths->m_mailbox, 0, "Moving message %s/%i to %s...", folder, (int)server_uid, ths->m_moveto_folder);
+				mrmailbox_log_info(ths->m_mailbox, 0, "Moving %i message(s) from %s to %s...", move_cnt, folder, ths->m_moveto_folder);
 
 				/* TODO/TOCHECK: MOVE may not be supported on servers, if this is often the case, we should fallback to a COPY/DELETE implementation.
 				Same for the UIDPLUS extension (if in doubt, we can find out the resulting UID using "imap_selection_info->sel_uidnext" then). */
 				uint32_t             res_uid = 0;
 				struct mailimap_set* res_setsrc = NULL;
 				struct mailimap_set* res_setdest = NULL;
-				r = mailimap_uidplus_uid_move(ths->m_hEtpan, set, ths->m_moveto_folder, &res_uid, &res_setsrc, &res_setdest); /* the correct folder is already selected in add_flag__() above */
+				r = mailimap_uidplus_uid_move(ths->m_hEtpan, move_set, ths->m_moveto_folder, &res_uid, &res_setsrc, &res_setdest); /* the correct folder is already selected in add_flag__() above */
 				if( is_error(ths, r) ) {
-					mrmailbox_log_info(ths->m_mailbox, 0, "Cannot move message.");
+					mrmailbox_log_info(ths->m_mailbox, 0, "Cannot move messages.");
 					goto cleanup;
 				}
 
+				for( i = 0; i < cnt; i++ ) {
+					if( selected[i] ) {
+						ret_ms_flags[i] |= MR_MS_MOVED;
+					}
+				}
+
+				if( res_setsrc && res_setdest ) {
+					/* COPYUID returns the source and the destination UIDs in the same order (RFC 4315), map them back to our messages */
+					uint32_t src_uid, dest_uid;
+					for( k = 0; (src_uid=set_get_uid(res_setsrc, k))!=0 && (dest_uid=set_get_uid(res_setdest, k))!=0; k++ ) {
+						for( i = 0; i < cnt; i++ ) {
+							if( selected[i] && server_uids[i]==src_uid ) {
+								ret_server_uids[i] = dest_uid;
+							}
+						}
+					}
+					*ret_server_folder = safe_strdup(ths->m_moveto_folder);
+				}
+
 				if( res_setsrc ) {
 					mailimap_set_free(res_setsrc);
 				}
 
 				if( res_setdest ) {
-					clistiter* cur = clist_begin(res_setdest->set_list);
-					if (cur != NULL) {
-						struct mailimap_set_item* item;
-						item = clist_content(cur);
-						*ret_server_uid = item->set_first;
-						*ret_server_folder = safe_strdup(ths->m_moveto_folder);
-					}
 					mailimap_set_free(res_setdest);
 				}
 
 				// TODO: If the new UID is equal to lastuid.Chats, we should increase lastuid.Chats by one
 				// (otherwise, we'll download the mail in moment again from the chats folder ...)
 
-				mrmailbox_log_info(ths->m_mailbox, 0, "Message moved.");
+				mrmailbox_log_info(ths->m_mailbox, 0, "Messages moved.");
 			}
 		}
 
 cleanup:
 	UNBLOCK_IDLE
 	UNLOCK_HANDLE
+	if( fetch_result ) {
+		mailimap_fetch_list_free(fetch_result);
+	}
 	if( set ) {
 		mailimap_set_free(set);
 	}
+	if( mdn_set ) {
+		mailimap_set_free(mdn_set);
+	}
+	if( move_set ) {
+		mailimap_set_free(move_set);
+	}
+	free(selected);
 	return ths->m_should_reconnect? 0 : 1;
 }
 
 
-int mrimap_delete_msg(mrimap_t* ths, const char* rfc724_mid, const char* folder, uint32_t server_uid)
+int mrimap_delete_msgs(mrimap_t* ths, const char* folder, int cnt, const uint32_t* server_uids)
 {
-	// when deleting using server_uid, we have to check against rfc724_mid first - the UID validity or the mailbox may have change
-	int success = 0, handle_locked = 0, idle_blocked = 0;
+	// the caller has to check against the rfc724_mid before - the UID validity or the mailbox may have change
+	int                  success = 0, handle_locked = 0, idle_blocked = 0;
+	struct mailimap_set* set = NULL;
+
+	if( ths==NULL || folder==NULL || folder[0]==0 || cnt<=0 || server_uids==NULL ) {
+		return 1; /* job done */
+	}
+
+	if( ths->m_use_jobs ) {
+		return mrimap_delete_msgs(ths->m_jobs, folder, cnt, server_uids);
+	}
 
-	if( ths==NULL || rfc724_mid==NULL || folder==NULL || folder[0]==0 || server_uid==0 ) {
+	if( (set=uids_to_set(server_uids, NULL, cnt))==NULL ) {
 		return 1; /* job done */
 	}
 
 	LOCK_HANDLE
+
+	if( ths->m_is_jobs ) {
+		setup_jobs_connection__(ths);
+	}
+
 	BLOCK_IDLE
 
 		INTERRUPT_IDLE
 
-		mrmailbox_log_info(ths->m_mailbox, 0, "Deleting message \"%s\", server_folder=%s, server_uid=%i...", rfc724_mid, folder, (int)server_uid);
+		mrmailbox_log_info(ths->m_mailbox, 0, "Deleting %i message(s) in %s...", cnt, folder);
 
-		if( add_flag__(ths, folder, server_uid, mailimap_flag_new_deleted())==0 ) {
-			mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot delete message."); /* maybe the message is already deleted */
+		if( add_flag__(ths, folder, set, mailimap_flag_new_deleted())==0 ) {
+			mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot delete messages."); /* maybe the message is already deleted */
 			goto cleanup;
 		}
 
-		mrmailbox_log_info(ths->m_mailbox, 0, "Message deleted.");
+		mrmailbox_log_info(ths->m_mailbox, 0, "Messages deleted.");
 
 		success = 1;
 
 cleanup:
 	UNBLOCK_IDLE
 	UNLOCK_HANDLE
-
+	mailimap_set_free(set);
 	return success;
 }
-
@@ -40,10 +40,15 @@ typedef struct mrloginparam_t mrloginparam_t;
 typedef struct mrimap_t mrimap_t;
 
 #define MR_IMAP_SEEN 0x0001L
+#define MR_IMAP_GONE 0x0002L /* the message was expunged or flagged as deleted on the server, only used for mr_remote_flags_t */
 
 typedef int32_t  (*mr_get_config_int_t)(mrimap_t*, const char*, int32_t);
 typedef void     (*mr_set_config_int_t)(mrimap_t*, const char*, int32_t);
+typedef char*    (*mr_get_config_t)    (mrimap_t*, const char*, const char*); /* the result must be free()'d */
+typedef void     (*mr_set_config_t)    (mrimap_t*, const char*, const char*);
 typedef void     (*mr_receive_imf_t)   (mrimap_t*, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags);
+typedef void     (*mr_bulk_receive_t)  (mrimap_t*, int start); /* called with start=1 before and with start=0 after several messages are passed to mr_receive_imf_t in a row */
+typedef void     (*mr_remote_flags_t)  (mrimap_t*, const char* server_folder, uint32_t server_uid_first, uint32_t server_uid_last, uint32_t flags); /* flags changed by other clients, see sync_folder__() */
 
 
 typedef struct mrimap_t
@@ -63,6 +68,9 @@ typedef struct mrimap_t
 
 	int                   m_can_idle;
 	int                   m_has_xlist;
+	int                   m_has_condstore; /* set per session, if set, changes are synced using HIGHESTMODSEQ, see sync_folder__() */
+	int                   m_has_qresync;   /* set per session if QRESYNC is enabled, expunges are synced then, too */
+	int                   m_compressed;    /* set per session if COMPRESS=DEFLATE is active, see MR_NO_IMAP_COMPRESS */
 	char*                 m_moveto_folder;/* Folder, where reveived chat messages should go to.  Normally "Chats" but may be NULL to leave them in the INBOX */
 	char*                 m_sent_folder;  /* Folder, where send messages should go to.  Normally "Chats". */
 	pthread_mutex_t       m_idlemutex;    /* set, if idle is not possible; morover, the interrupted IDLE thread waits a second before IDLEing again; this allows several jobs to be executed */
@@ -85,20 +93,39 @@ typedef struct mrimap_t
 	int                   m_restore_do_exit;
 
 	struct mailimap_fetch_type* m_fetch_type_uid;
+	struct mailimap_fetch_type* m_fetch_type_uid_size;
 	struct mailimap_fetch_type* m_fetch_type_body;
 	struct mailimap_fetch_type* m_fetch_type_flags;
 
 	mr_get_config_int_t   m_get_config_int;
 	mr_set_config_int_t   m_set_config_int;
+	mr_get_config_t       m_get_config;
+	mr_set_config_t       m_set_config;
 	mr_receive_imf_t      m_receive_imf;
+	mr_bulk_receive_t     m_bulk_receive;
+	mr_remote_flags_t     m_remote_flags;
 	void*                 m_userData;
 	mrmailbox_t*          m_mailbox;
 
 	int                   m_log_connect_errors;
+
+	/* if IDLE is used, appending, marking and deleting messages is done by a second connection, so that IDLE is not interrupted for jobs.
+	The second connection is opened on demand and closed by the heartbeat if unused, see MR_NO_IMAP_JOBS_CONNECTION */
+	struct mrimap_t*      m_jobs;
+	int                   m_use_jobs;
+	int                   m_is_jobs;       /* set for the second connection itself */
+	time_t                m_jobs_last_use;
+
+	/* bytes transferred by the current connection as sent over the network and, if m_compressed is set, before compression;
+	written by the thread holding the handle, may be read by others for statistics */
+	uint64_t              m_bytes_read;
+	uint64_t              m_bytes_written;
+	uint64_t              m_bytes_read_uncompressed;
+	uint64_t              m_bytes_written_uncompressed;
 } mrimap_t;
 
 
-mrimap_t* mrimap_new               (mr_get_config_int_t, mr_set_config_int_t, mr_receive_imf_t, void* userData, mrmailbox_t*);
+mrimap_t* mrimap_new               (mr_get_config_int_t, mr_set_config_int_t, mr_get_config_t, mr_set_config_t, mr_receive_imf_t, mr_bulk_receive_t, mr_remote_flags_t, void* userData, mrmailbox_t*);
 void      mrimap_unref             (mrimap_t*);
 
 int       mrimap_connect           (mrimap_t*, const mrloginparam_t*);
@@ -112,9 +139,10 @@ int       mrimap_append_msg        (mrimap_t*, time_t timestamp, const char* dat
 #define   MR_MS_ALSO_MOVE          0x01
 #define   MR_MS_SET_MDNSent_FLAG   0x02
 #define   MR_MS_MDNSent_JUST_SET   0x10
-int       mrimap_markseen_msg      (mrimap_t*, const char* folder, uint32_t server_uid, int ms_flags, char** ret_server_folder, uint32_t* ret_server_uid, int* ret_ms_flags); /* only returns 0 on connection problems; we should try later again in this case */
+#define   MR_MS_MOVED              0x20
+int       mrimap_markseen_msgs     (mrimap_t*, const char* folder, int cnt, const uint32_t* server_uids, const int* ms_flags, char** ret_server_folder, uint32_t* ret_server_uids, int* ret_ms_flags); /* all messages must be in the same folder; moved messages get MR_MS_MOVED, ret_server_uids[i] is set for them only if the server returns the new UIDs; only returns 0 on connection problems; we should try later again in this case */
 
-int       mrimap_delete_msg        (mrimap_t*, const char* rfc724_mid, const char* folder, uint32_t server_uid); /* only returns 0 on connection problems; we should try later again in this case */
+int       mrimap_delete_msgs       (mrimap_t*, const char* folder, int cnt, const uint32_t* server_uids); /* only returns 0 on connection problems; we should try later again in this case */
 
 void      mrimap_heartbeat         (mrimap_t*);
 
@@ -34,35 +34,228 @@
 #include "mrosnative.h"
 
 
+/*******************************************************************************
+ * The job queue
+ *
+ * The pending jobs are held in two heaps: m_job_due contains the jobs that may be
+ * executed now, ordered by priority (action DESC) and id - this is the order the
+ * jobs were selected from the database before.  m_job_delayed contains the jobs
+ * to execute later, ordered by the desired timestamp; they're moved to m_job_due
+ * as the time comes.  The jobs table is only used to persist the queue.
+ ******************************************************************************/
+
+
+#define MR_JOB_SAVE_EVERY   64  /* max. number of executed jobs written to the database in one transaction ... */
+#define MR_JOB_SAVE_AT_ONCE(action) ((action)==MRJ_SEND_MSG_TO_SMTP || (action)==MRJ_SEND_MDN || (action)==MRJ_SEND_MSG_TO_IMAP) /* ... jobs that must not be repeated after a crash are written at once */
+#define MR_JOB_COALESCE_MAX 200 /* max. number of IMAP jobs executed together */
+#define MR_JOB_COALESCE_SMTP_MAX 20 /* max. number of messages sent together over one SMTP session */
+
+typedef int (*mrjob_cmp_t)(const mrjob_t*, const mrjob_t*); /* returns <0 if the first job should be executed first */
+
+
+static int cmp_due(const mrjob_t* a, const mrjob_t* b)
+{
+	if( a->m_action != b->m_action ) {
+		return b->m_action - a->m_action; /* higher actions have higher priorities */
+	}
+	return a->m_job_id < b->m_job_id? -1 : (a->m_job_id > b->m_job_id? 1 : 0);
+}
+
+
+static int cmp_delayed(const mrjob_t* a, const mrjob_t* b)
+{
+	if( a->m_start_again_at != b->m_start_again_at ) {
+		return a->m_start_again_at < b->m_start_again_at? -1 : 1;
+	}
+	return cmp_due(a, b);
+}
+
+
+static void heap_sift_down(carray* heap, unsigned int i, mrjob_cmp_t cmp)
+{
+	unsigned int cnt = carray_count(heap), child;
+	while( (child=i*2+1) < cnt ) {
+		if( child+1 < cnt && cmp(carray_get(heap, child+1), carray_get(heap, child)) < 0 ) {
+			child++;
+		}
+		if( cmp(carray_get(heap, child), carray_get(heap, i)) >= 0 ) {
+			break;
+		}
+		void* temp = carray_get(heap, i);
+		carray_set(heap, i, carray_get(heap, child));
+		carray_set(heap, child, temp);
+		i = child;
+	}
+}
+
+
+static void heap_push(carray* heap, mrjob_t* job, mrjob_cmp_t cmp)
+{
+	unsigned int i, parent;
+	carray_add(heap, job, &i);
+	while( i > 0 && cmp(carray_get(heap, (parent=(i-1)/2)), job) > 0 ) {
+		carray_set(heap, i, carray_get(heap, parent));
+		i = parent;
+	}
+	carray_set(heap, i, job);
+}
+
+
+static mrjob_t* heap_pop(carray* heap, mrjob_cmp_t cmp)
+{
+	unsigned int cnt = carray_count(heap);
+	if( cnt == 0 ) {
+		return NULL;
+	}
+
+	mrjob_t* top = carray_get(heap, 0);
+	carray_set(heap, 0, carray_get(heap, cnt-1));
+	carray_set_size(heap, cnt-1);
+	heap_sift_down(heap, 0, cmp);
+	return top;
+}
+
+
+static mrjob_t* job_new(uint32_t job_id, int action, uint32_t foreign_id, const char* param, time_t desired_timestamp)
+{
+	mrjob_t* job = calloc(1, sizeof(mrjob_t));
+	if( job == NULL ) {
+		exit(49); /* cannot allocate little memory, unrecoverable error */
+	}
+	job->m_job_id         = job_id;
+	job->m_action         = action;
+	job->m_foreign_id     = foreign_id;
+	job->m_param          = mrparam_new();
+	job->m_start_again_at = desired_timestamp;
+	mrparam_set_packed(job->m_param, param);
+	return job;
+}
+
+
+static void job_unref(mrjob_t* job)
+{
+	if( job ) {
+		mrparam_unref(job->m_param);
+		free(job);
+	}
+}
+
+
+static void queue_job__(mrmailbox_t* mailbox, mrjob_t* job) /* the caller must lock m_job_condmutex */
+{
+	if( job->m_start_again_at <= time(NULL) ) {
+		heap_push(mailbox->m_job_due, job, cmp_due);
+	}
+	else {
+		heap_push(mailbox->m_job_delayed, job, cmp_delayed);
+	}
+}
+
+
+static void empty_queue__(mrmailbox_t* mailbox) /* the caller must lock m_job_condmutex */
+{
+	mrjob_t* job;
+	while( (job=heap_pop(mailbox->m_job_due, cmp_due)) != NULL ) {
+		job_unref(job);
+	}
+	while( (job=heap_pop(mailbox->m_job_delayed, cmp_delayed)) != NULL ) {
+		job_unref(job);
+	}
+}
+
+
+static void remove_action_from_heap__(carray* heap, int action, mrjob_cmp_t cmp)
+{
+	unsigned int i, cnt = carray_count(heap), kept = 0;
+	for( i = 0; i < cnt; i++ ) {
+		mrjob_t* job = carray_get(heap, i);
+		if( job->m_action == action ) {
+			job_unref(job);
+		}
+		else {
+			carray_set(heap, kept++, job);
+		}
+	}
+	carray_set_size(heap, kept);
+
+	for( i = kept/2; i > 0; i-- ) { /* rebuild the heap */
+		heap_sift_down(heap, i-1, cmp);
+	}
+}
+
+
+static int get_wait_seconds__(mrmailbox_t* mailbox) // >0: wait seconds, =0: do not wait, <0: wait until signal; the caller must lock m_job_condmutex
+{
+	time_t   now = time(NULL);
+	mrjob_t* job;
+
+	while( (job=carray_count(mailbox->m_job_delayed)? carray_get(mailbox->m_job_delayed, 0) : NULL) != NULL
+	    && job->m_start_again_at <= now ) {
+		heap_push(mailbox->m_job_due, heap_pop(mailbox->m_job_delayed, cmp_delayed), cmp_due);
+	}
+
+	if( carray_count(mailbox->m_job_due) ) {
+		return 0;
+	}
+
+	if( job ) {
+		return (int)(job->m_start_again_at-now) + 1 /*wait a second longer, pthread_cond_timedwait() is not _that_ exact and we want to be sure to catch the jobs in the first try*/;
+	}
+
+	return -1;
+}
+
+
 /*******************************************************************************
  * The job thread
  ******************************************************************************/
 
 
-static int get_wait_seconds(mrmailbox_t* mailbox) // >0: wait seconds, =0: do not wait, <0: wait until signal
+static void save_executed_jobs(mrmailbox_t* mailbox, carray* executed)
 {
-	int           ret = -1;
+	/* write the results of the executed jobs to the database using a single transaction;
+	executed contains copies of the jobs as they may already be executed again */
 	sqlite3_stmt* stmt;
+	unsigned int  i, cnt = carray_count(executed);
+
+	if( cnt == 0 ) {
+		return;
+	}
 
 	mrsqlite3_lock(mailbox->m_sql);
-		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_MIN_d_FROM_jobs, "SELECT MIN(desired_timestamp) FROM jobs;");
-		if( stmt && sqlite3_step(stmt) == SQLITE_ROW )
+	if( !mrsqlite3_is_open(mailbox->m_sql) ) {
+		goto cleanup; /* the database was closed meanwhile, the queue is emptied by mrjob_load__() in this case */
+	}
+	mrsqlite3_begin_transaction__(mailbox->m_sql);
+
+		for( i = 0; i < cnt; i++ )
 		{
-			if( sqlite3_column_type(stmt, 0)!=SQLITE_NULL )
-			{
-				time_t min_desired_timestamp = (time_t)sqlite3_column_int64(stmt, 0);
-				time_t now = time(NULL);
-				if( min_desired_timestamp <= now ) {
-					ret = 0;
-				}
-				else {
-					ret = (int)(min_desired_timestamp-now) + 1 /*wait a second longer, pthread_cond_timedwait() is not _that_ exact and we want to be sure to catch the jobs in the first try*/;
-				}
+			mrjob_t* job = carray_get(executed, i);
+			if( job->m_start_again_at ) {
+				stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_jobs_SET_dp_WHERE_id,
+					"UPDATE jobs SET desired_timestamp=?, param=? WHERE id=?;");
+				sqlite3_bind_int64(stmt, 1, job->m_start_again_at);
+				sqlite3_bind_text (stmt, 2, mrparam_get_packed(job->m_param), -1, SQLITE_STATIC);
+				sqlite3_bind_int  (stmt, 3, job->m_job_id);
+				sqlite3_step(stmt);
+			}
+			else {
+				stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_jobs_WHERE_id,
+					"DELETE FROM jobs WHERE id=?;");
+				sqlite3_bind_int(stmt, 1, job->m_job_id);
+				sqlite3_step(stmt);
 			}
 		}
+
+	mrsqlite3_commit__(mailbox->m_sql);
+
+cleanup:
 	mrsqlite3_unlock(mailbox->m_sql);
 
-	return ret;
+	for( i = 0; i < cnt; i++ ) {
+		job_unref((mrjob_t*)carray_get(executed, i));
+	}
+	carray_set_size(executed, 0);
 }
 
 
@@ -71,12 +264,10 @@ static void* job_thread_entry_point(void* entry_arg)
 	mrmailbox_t*  mailbox = (mrmailbox_t*)entry_arg;
 	mrosnative_setup_thread(mailbox); /* must be very first */
 
-	sqlite3_stmt* stmt;
-	mrjob_t       job;
-	int           seconds_to_wait;
-
-	memset(&job, 0, sizeof(mrjob_t));
-	job.m_param = mrparam_new();
+	mrjob_t*      job;
+	carray*       jobs = carray_new(16);
+	carray*       executed = carray_new(MR_JOB_SAVE_EVERY);
+	int           seconds_to_wait, killed, i, cnt;
 
 	/* init thread */
 	mrmailbox_log_info(mailbox, 0, "Job thread entered.");
@@ -85,7 +276,7 @@ static void* job_thread_entry_point(void* entry_arg)
 	{
 		/* wait for condition */
 		pthread_mutex_lock(&mailbox->m_job_condmutex);
-			seconds_to_wait = get_wait_seconds(mailbox);
+			seconds_to_wait = get_wait_seconds__(mailbox);
 			if( seconds_to_wait > 0 ) {
 				mrmailbox_log_info(mailbox, 0, "Job thread waiting for %i seconds or signal...", seconds_to_wait);
 				if( mailbox->m_job_condflag == 0 ) {
@@ -108,72 +299,105 @@ static void* job_thread_entry_point(void* entry_arg)
 		mrmailbox_log_info(mailbox, 0, "Job thread checks for pending jobs...");
 		while( 1 )
 		{
+			/* get next waiting job; IMAP jobs of the same action are executed together, so that
+			they can be coalesced to a few commands, see mrmailbox_markseen_msgs_on_imap(); messages to send are drained
+			together over the same SMTP session, see mrmailbox_send_msgs_to_smtp() */
 			pthread_mutex_lock(&mailbox->m_job_condmutex);
 				if( mailbox->m_job_do_exit ) {
 					pthread_mutex_unlock(&mailbox->m_job_condmutex);
 					goto exit_;
 				}
-			pthread_mutex_unlock(&mailbox->m_job_condmutex);
 
-			/* get next waiting job */
-			job.m_job_id = 0;
-			mrsqlite3_lock(mailbox->m_sql);
-				stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_iafp_FROM_jobs,
-					"SELECT id, action, foreign_id, param FROM jobs WHERE desired_timestamp<=? ORDER BY action DESC, id LIMIT 1;");
-				sqlite3_bind_int64(stmt, 1, time(NULL));
-				if( sqlite3_step(stmt) == SQLITE_ROW ) {
-					job.m_job_id                         = sqlite3_column_int (stmt, 0);
-					job.m_action                         = sqlite3_column_int (stmt, 1);
-					job.m_foreign_id                     = sqlite3_column_int (stmt, 2);
-					mrparam_set_packed(job.m_param, (char*)sqlite3_column_text(stmt, 3));
+				carray_set_size(jobs, 0);
+				job = NULL;
+				if( get_wait_seconds__(mailbox) == 0 ) {
+					job = heap_pop(mailbox->m_job_due, cmp_due);
+					carray_add(jobs, job, NULL);
+					if( job->m_action==MRJ_DELETE_MSG_ON_IMAP || job->m_action==MRJ_MARKSEEN_MSG_ON_IMAP || job->m_action==MRJ_MARKSEEN_MDN_ON_IMAP ) {
+						while( carray_count(jobs) < MR_JOB_COALESCE_MAX && carray_count(mailbox->m_job_due)
+						    && ((mrjob_t*)carray_get(mailbox->m_job_due, 0))->m_action == job->m_action ) {
+							carray_add(jobs, heap_pop(mailbox->m_job_due, cmp_due), NULL);
+						}
+					}
+					else if( job->m_action==MRJ_SEND_MSG_TO_SMTP ) {
+						while( carray_count(jobs) < MR_JOB_COALESCE_SMTP_MAX && carray_count(mailbox->m_job_due)
+						    && ((mrjob_t*)carray_get(mailbox->m_job_due, 0))->m_action == job->m_action ) {
+							carray_add(jobs, heap_pop(mailbox->m_job_due, cmp_due), NULL);
+						}
+					}
 				}
-			mrsqlite3_unlock(mailbox->m_sql);
+				mailbox->m_job_running        = job;
+				mailbox->m_job_running_killed = 0;
+			pthread_mutex_unlock(&mailbox->m_job_condmutex);
 
-			if( job.m_job_id == 0 ) {
+			if( job == NULL ) {
 				break;
 			}
 
 			/* execute job */
-			mrmailbox_log_info(mailbox, 0, "Executing job #%i, action %i...", (int)job.m_job_id, (int)job.m_action);
-			job.m_start_again_at = 0;
-			switch( job.m_action ) {
-				case MRJ_CONNECT_TO_IMAP:      mrmailbox_connect_to_imap      (mailbox, &job); break;
-                case MRJ_SEND_MSG_TO_SMTP:     mrmailbox_send_msg_to_smtp     (mailbox, &job); break;
-                case MRJ_SEND_MSG_TO_IMAP:     mrmailbox_send_msg_to_imap     (mailbox, &job); break;
-                case MRJ_DELETE_MSG_ON_IMAP:   mrmailbox_delete_msg_on_imap   (mailbox, &job); break;
-                case MRJ_MARKSEEN_MSG_ON_IMAP: mrmailbox_markseen_msg_on_imap (mailbox, &job); break;
-                case MRJ_MARKSEEN_MDN_ON_IMAP: mrmailbox_markseen_mdn_on_imap (mailbox, &job); break;
-                case MRJ_SEND_MDN:             mrmailbox_send_mdn             (mailbox, &job); break;
+			cnt = carray_count(jobs);
+			for( i = 0; i < cnt; i++ ) {
+				((mrjob_t*)carray_get(jobs, i))->m_start_again_at = 0;
 			}
-
-			/* delete job or execute job later again */
-			if( job.m_start_again_at ) {
-				mrsqlite3_lock(mailbox->m_sql);
-					stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_jobs_SET_dp_WHERE_id,
-						"UPDATE jobs SET desired_timestamp=?, param=? WHERE id=?;");
-					sqlite3_bind_int64(stmt, 1, job.m_start_again_at);
-					sqlite3_bind_text (stmt, 2, job.m_param->m_packed, -1, SQLITE_STATIC);
-					sqlite3_bind_int  (stmt, 3, job.m_job_id);
-					sqlite3_step(stmt);
-				mrsqlite3_unlock(mailbox->m_sql);
-				mrmailbox_log_info(mailbox, 0, "Job #%i delayed for %i seconds", (int)job.m_job_id, (int)(job.m_start_again_at-time(NULL)));
+			if( cnt > 1 ) {
+				mrmailbox_log_info(mailbox, 0, "Executing jobs #%i..#%i, action %i...", (int)job->m_job_id, (int)((mrjob_t*)carray_get(jobs, cnt-1))->m_job_id, (int)job->m_action);
 			}
 			else {
-				mrsqlite3_lock(mailbox->m_sql);
-					stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_jobs_WHERE_id,
-						"DELETE FROM jobs WHERE id=?;");
-					sqlite3_bind_int(stmt, 1, job.m_job_id);
-					sqlite3_step(stmt);
-				mrsqlite3_unlock(mailbox->m_sql);
-				mrmailbox_log_info(mailbox, 0, "Job #%i done and deleted from database", (int)job.m_job_id);
+				mrmailbox_log_info(mailbox, 0, "Executing job #%i, action %i...", (int)job->m_job_id, (int)job->m_action);
+			}
+			switch( job->m_action ) {
+				case MRJ_CONNECT_TO_IMAP:      mrmailbox_connect_to_imap       (mailbox, job);  break;
+				case MRJ_SEND_MSG_TO_SMTP:     mrmailbox_send_msgs_to_smtp     (mailbox, jobs); break;
+				case MRJ_SEND_MSG_TO_IMAP:     mrmailbox_send_msg_to_imap      (mailbox, job);  break;
+				case MRJ_DELETE_MSG_ON_IMAP:   mrmailbox_delete_msgs_on_imap   (mailbox, jobs); break;
+				case MRJ_MARKSEEN_MSG_ON_IMAP: mrmailbox_markseen_msgs_on_imap (mailbox, jobs); break;
+				case MRJ_MARKSEEN_MDN_ON_IMAP: mrmailbox_markseen_mdns_on_imap (mailbox, jobs); break;
+				case MRJ_SEND_MDN:             mrmailbox_send_mdn              (mailbox, job);  break;
+			}
+
+			/* delete jobs or execute jobs later again; the database is updated in batches, see save_executed_jobs() */
+			for( i = 0; i < cnt; i++ ) {
+				job = carray_get(jobs, i);
+				carray_add(executed, job_new(job->m_job_id, job->m_action, job->m_foreign_id, mrparam_get_packed(job->m_param), job->m_start_again_at), NULL);
+			}
+
+			if( MR_JOB_SAVE_AT_ONCE(job->m_action) ) {
+				save_executed_jobs(mailbox, executed); /* eg. a message must not be sent twice if we crash before the next batch is written */
+			}
+
+			pthread_mutex_lock(&mailbox->m_job_condmutex);
+				killed = mailbox->m_job_running_killed; /* set if the action was killed while executing, see mrjob_kill_action__() */
+				mailbox->m_job_running = NULL;
+				for( i = 0; i < cnt; i++ ) {
+					job = carray_get(jobs, i);
+					if( job->m_start_again_at && !killed ) {
+						heap_push(mailbox->m_job_delayed, job, cmp_delayed);
+						mrmailbox_log_info(mailbox, 0, "Job #%i delayed for %i seconds", (int)job->m_job_id, (int)(job->m_start_again_at-time(NULL)));
+						carray_set(jobs, i, NULL);
+					}
+				}
+			pthread_mutex_unlock(&mailbox->m_job_condmutex);
+
+			for( i = 0; i < cnt; i++ ) {
+				if( (job=carray_get(jobs, i)) != NULL ) {
+					mrmailbox_log_info(mailbox, 0, "Job #%i done and deleted", (int)job->m_job_id);
+					job_unref(job);
+				}
+			}
+
+			if( carray_count(executed) >= MR_JOB_SAVE_EVERY ) {
+				save_executed_jobs(mailbox, executed);
 			}
 		}
 
+		save_executed_jobs(mailbox, executed);
 	}
 
 	/* exit thread */
 exit_:
-	mrparam_unref(job.m_param);
+	save_executed_jobs(mailbox, executed);
+	carray_free(executed);
+	carray_free(jobs);
 	mrmailbox_log_info(mailbox, 0, "Exit job thread.");
 	mrosnative_unsetup_thread(mailbox); /* must be very last */
 	return NULL;
@@ -187,6 +411,9 @@ exit_:
 
 void mrjob_init_thread(mrmailbox_t* mailbox)
 {
+	mailbox->m_job_due     = carray_new(16);
+	mailbox->m_job_delayed = carray_new(16);
+	mailbox->m_job_added   = carray_new(16);
 	pthread_mutex_init(&mailbox->m_job_condmutex, NULL);
     pthread_cond_init(&mailbox->m_job_cond, NULL);
     pthread_create(&mailbox->m_job_thread, NULL, job_thread_entry_point, mailbox);
@@ -204,6 +431,55 @@ void mrjob_exit_thread(mrmailbox_t* mailbox)
 	pthread_join(mailbox->m_job_thread, NULL);
 	pthread_cond_destroy(&mailbox->m_job_cond);
 	pthread_mutex_destroy(&mailbox->m_job_condmutex);
+
+	empty_queue__(mailbox);
+	carray_free(mailbox->m_job_due);
+	carray_free(mailbox->m_job_delayed);
+	mailbox->m_job_due     = NULL;
+	mailbox->m_job_delayed = NULL;
+
+	mrjob_transaction_end__(mailbox, 0);
+	carray_free(mailbox->m_job_added);
+	mailbox->m_job_added   = NULL;
+}
+
+
+static void signal_job_thread(mrmailbox_t* mailbox) /* the caller must lock m_job_condmutex */
+{
+	if( !mailbox->m_job_do_exit ) {
+		mrmailbox_log_info(mailbox, 0, "Signal job thread to wake up...");
+		mailbox->m_job_condflag = 1;
+		pthread_cond_signal(&mailbox->m_job_cond);
+	}
+}
+
+
+void mrjob_load__(mrmailbox_t* mailbox)
+{
+	sqlite3_stmt* stmt;
+
+	if( mailbox == NULL || mailbox->m_job_due == NULL /*job thread already exited*/ ) {
+		return;
+	}
+
+	mrjob_transaction_end__(mailbox, 0); /* the jobs added are loaded from the database below, if they were committed */
+
+	pthread_mutex_lock(&mailbox->m_job_condmutex);
+
+		empty_queue__(mailbox);
+
+		if( mrsqlite3_is_open(mailbox->m_sql) ) {
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_iafpd_FROM_jobs,
+				"SELECT id, action, foreign_id, param, desired_timestamp FROM jobs;");
+			while( sqlite3_step(stmt) == SQLITE_ROW ) {
+				queue_job__(mailbox, job_new(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 2),
+					(const char*)sqlite3_column_text(stmt, 3), (time_t)sqlite3_column_int64(stmt, 4)));
+			}
+		}
+
+		signal_job_thread(mailbox);
+
+	pthread_mutex_unlock(&mailbox->m_job_condmutex);
 }
 
 
@@ -225,18 +501,61 @@ uint32_t mrjob_add__(mrmailbox_t* mailbox, int action, int foreign_id, const cha
 
 	job_id = sqlite3_last_insert_rowid(mailbox->m_sql->m_cobj);
 
-	pthread_mutex_lock(&mailbox->m_job_condmutex);
-		if( !mailbox->m_job_do_exit ) {
-			mrmailbox_log_info(mailbox, 0, "Signal job thread to wake up...");
-			mailbox->m_job_condflag = 1;
-			pthread_cond_signal(&mailbox->m_job_cond);
-		}
-	pthread_mutex_unlock(&mailbox->m_job_condmutex);
+	/* inside a transaction, the job is queued on commit - otherwise, the job thread may execute a job that is rolled back */
+	carray_add(mailbox->m_job_added, job_new(job_id, action, foreign_id, param, 0), NULL);
+	if( mailbox->m_sql->m_transactionCount == 0 ) {
+		mrjob_transaction_end__(mailbox, 1);
+	}
 
 	return job_id;
 }
 
 
+void mrjob_transaction_end__(mrmailbox_t* mailbox, int committed)
+{
+	/* called when the outermost transaction ends and on rollbacks of nested transactions (savepoints);
+	in the latter case, only the jobs rolled back are removed from m_job_added */
+	sqlite3_stmt* stmt;
+	unsigned int  i, cnt, kept = 0;
+	mrjob_t*      job;
+
+	if( mailbox == NULL || mailbox->m_job_added == NULL || (cnt=carray_count(mailbox->m_job_added)) == 0 ) {
+		return;
+	}
+
+	if( committed )
+	{
+		if( mailbox->m_sql->m_transactionCount > 0 ) {
+			return; /* a nested transaction, the outer one may still be rolled back */
+		}
+
+		pthread_mutex_lock(&mailbox->m_job_condmutex);
+			for( i = 0; i < cnt; i++ ) {
+				queue_job__(mailbox, (mrjob_t*)carray_get(mailbox->m_job_added, i));
+			}
+			signal_job_thread(mailbox);
+		pthread_mutex_unlock(&mailbox->m_job_condmutex);
+	}
+	else
+	{
+		for( i = 0; i < cnt; i++ ) {
+			job = (mrjob_t*)carray_get(mailbox->m_job_added, i);
+			if( mailbox->m_sql->m_transactionCount > 0 && mrsqlite3_is_open(mailbox->m_sql) ) {
+				stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_id_FROM_jobs_WHERE_id, "SELECT id FROM jobs WHERE id=?;");
+				sqlite3_bind_int(stmt, 1, job->m_job_id);
+				if( sqlite3_step(stmt) == SQLITE_ROW ) {
+					carray_set(mailbox->m_job_added, kept++, job);
+					continue;
+				}
+			}
+			job_unref(job);
+		}
+	}
+
+	carray_set_size(mailbox->m_job_added, kept);
+}
+
+
 void mrjob_try_again_later(mrjob_t* ths, int initial_delay_seconds)
 {
 	if( ths == NULL ) { /* may be NULL if called eg. from mrmailbox_connect_to_imap() */
@@ -283,5 +602,27 @@ void mrjob_kill_action__(mrmailbox_t* mailbox, int action)
 		"DELETE FROM jobs WHERE action=?;");
 	sqlite3_bind_int(stmt, 1, action);
 	sqlite3_step(stmt);
+
+	if( mailbox->m_job_added ) {
+		unsigned int i, cnt = carray_count(mailbox->m_job_added), kept = 0;
+		for( i = 0; i < cnt; i++ ) {
+			mrjob_t* job = carray_get(mailbox->m_job_added, i);
+			if( job->m_action == action ) {
+				job_unref(job);
+			}
+			else {
+				carray_set(mailbox->m_job_added, kept++, job);
+			}
+		}
+		carray_set_size(mailbox->m_job_added, kept);
+	}
+
+	pthread_mutex_lock(&mailbox->m_job_condmutex);
+		remove_action_from_heap__(mailbox->m_job_due, action, cmp_due);
+		remove_action_from_heap__(mailbox->m_job_delayed, action, cmp_delayed);
+		if( mailbox->m_job_running && mailbox->m_job_running->m_action == action ) {
+			mailbox->m_job_running_killed = 1; /* do not execute the running job again, the database record is already deleted */
+		}
+	pthread_mutex_unlock(&mailbox->m_job_condmutex);
 }
 
@@ -54,6 +54,8 @@ void     mrjob_init_thread     (mrmailbox_t*);
 void     mrjob_exit_thread     (mrmailbox_t*);
 uint32_t mrjob_add__           (mrmailbox_t*, int action, int foreign_id, const char* param); /* returns the job_id or 0 on errors. the job may or may not be done if the function returns. */
 void     mrjob_kill_action__   (mrmailbox_t*, int action); /* delete all pending jobs with the given action */
+void     mrjob_load__          (mrmailbox_t*); /* (re-)load the pending jobs from the database, must be called after the database is opened, closed or the jobs table is modified directly */
+void     mrjob_transaction_end__(mrmailbox_t*, int committed); /* called by mrsqlite3_commit__() and mrsqlite3_rollback__(), queues the jobs added in the transaction */
 
 #define  MR_AT_ONCE            0
 #define  MR_INCREATION_POLL    2 /* this value does not increase the number of tries */
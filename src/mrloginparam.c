@@ -150,6 +150,8 @@ static char* get_readable_flags(int flags)
 
 			CAT_FLAG(MR_NO_EXTRA_IMAP_UPLOAD, "NO_EXTRA_IMAP_UPLOAD ");
 			CAT_FLAG(MR_NO_MOVE_TO_CHATS,     "NO_MOVE_TO_CHATS ");
+			CAT_FLAG(MR_NO_IMAP_COMPRESS,     "NO_IMAP_COMPRESS ");
+			CAT_FLAG(MR_NO_IMAP_JOBS_CONNECTION, "NO_IMAP_JOBS_CONNECTION ");
 
 			if( !flag_added ) {
 				char* temp = mr_mprintf("0x%x ", 1<<bit); mrstrbuilder_cat(&strbuilder, temp); free(temp);
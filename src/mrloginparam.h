@@ -66,6 +66,8 @@ typedef struct mrloginparam_t
 
 	#define       MR_NO_EXTRA_IMAP_UPLOAD   0x2000000
 	#define       MR_NO_MOVE_TO_CHATS       0x4000000
+	#define       MR_NO_IMAP_COMPRESS       0x8000000 /* do not use COMPRESS=DEFLATE even if the server supports it */
+	#define       MR_NO_IMAP_JOBS_CONNECTION 0x10000000 /* do not open a second IMAP connection for jobs, jobs interrupt IDLE then */
 
 	int           m_server_flags;
 } mrloginparam_t;
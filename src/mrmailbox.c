@@ -27,7 +27,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h> /* for getpid() */
 #include <unistd.h>    /* for getpid() */
 #include <sqlite3.h>
@@ -42,6 +44,7 @@
 #include "mrloginparam.h"
 #include "mrkey.h"
 #include "mrpgp.h"
+#include "mrosnative.h"
 
 
 /*******************************************************************************
@@ -291,10 +294,144 @@ cleanup:
  ******************************************************************************/
 
 
+static int is_known_imf__(mrmailbox_t* ths, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                          const char* server_folder, uint32_t server_uid, int readonly)
+{
+	/* parse the header block only and check if the Message-ID is already in the database - as messages are moved
+	between folders or re-fetched from time to time, this is quite usual and we do not want to parse (and maybe decrypt)
+	the whole message again.  If the message was moved around on the server, the server_uid is updated unless readonly is set. */
+	int                    is_known = 0;
+	size_t                 index = 0;
+	struct mailimf_fields* fields = NULL;
+	struct mailimf_field*  field;
+	char*                  old_server_folder = NULL;
+	uint32_t               old_server_uid = 0;
+
+	if( mailimf_envelope_and_optional_fields_parse(imf_raw_not_terminated, imf_raw_bytes, &index, &fields)!=MAILIMF_NO_ERROR
+	 || fields == NULL ) {
+		goto cleanup;
+	}
+
+	if( (field=mr_find_mailimf_field(fields, MAILIMF_FIELD_MESSAGE_ID))==NULL
+	 || field->fld_data.fld_message_id==NULL || field->fld_data.fld_message_id->mid_value==NULL ) {
+		goto cleanup; /* messages without Message-ID get an ID created from other fields, see receive_imf() */
+	}
+
+	if( mrmailbox_rfc724_mid_exists__(ths, field->fld_data.fld_message_id->mid_value, &old_server_folder, &old_server_uid) ) {
+		if( !readonly && (strcmp(old_server_folder, server_folder)!=0 || old_server_uid!=server_uid) ) {
+			mrmailbox_update_server_uid__(ths, field->fld_data.fld_message_id->mid_value, server_folder, server_uid);
+		}
+		is_known = 1;
+	}
+
+cleanup:
+	if( fields ) {
+		mailimf_fields_free(fields);
+	}
+	free(old_server_folder);
+	return is_known;
+}
+
+
+/*******************************************************************************
+ * Receive several messages in one transaction
+ ******************************************************************************/
+
+
+#define MR_BULK_RECEIVE_MSGS 100 /* commit the bulk transaction after this number of messages ... */
+#define MR_BULK_RECEIVE_MS   250 /* ... or after this number of milliseconds, whatever comes first; others wait for the lock meanwhile */
+
+
+static uint64_t bulk_now_ms()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec*1000 + tv.tv_usec/1000;
+}
+
+
+static void bulk_receive_commit(mrmailbox_t* ths)
+{
+	/* commit the transaction held over several messages and send the collected events;
+	MR_EVENT_MSGS_CHANGED and MR_EVENT_INCOMING_MSG are coalesced to one event per chat: MR_EVENT_INCOMING_MSG with the last incoming message
+	if there is any, else MR_EVENT_MSGS_CHANGED with the last changed message */
+	carray* chats = NULL; /* 3 entries per chat: chat_id, last changed msg_id, last incoming msg_id or 0 */
+	size_t  i, j, icnt, jcnt;
+
+	if( ths->m_bulk_locked ) {
+		mrsqlite3_commit__(ths->m_sql);
+		mrsqlite3_unlock(ths->m_sql);
+		ths->m_bulk_locked = 0;
+	}
+	ths->m_bulk_msgs = 0;
+
+	if( (icnt=carray_count(ths->m_bulk_events)) == 0 ) {
+		return;
+	}
+
+	chats = carray_new(16);
+	for( i = 0; i < icnt; i += 3 )
+	{
+		uintptr_t event = (uintptr_t)carray_get(ths->m_bulk_events, i);
+		if( event == MR_EVENT_MSGS_CHANGED || event == MR_EVENT_INCOMING_MSG )
+		{
+			jcnt = carray_count(chats);
+			for( j = 0; j < jcnt; j += 3 ) {
+				if( carray_get(chats, j) == carray_get(ths->m_bulk_events, i+1) ) {
+					break;
+				}
+			}
+
+			if( j == jcnt ) {
+				carray_add(chats, carray_get(ths->m_bulk_events, i+1), NULL);
+				carray_add(chats, NULL, NULL);
+				carray_add(chats, NULL, NULL);
+			}
+
+			carray_set(chats, event == MR_EVENT_INCOMING_MSG? j+2 : j+1, carray_get(ths->m_bulk_events, i+2));
+		}
+	}
+
+	jcnt = carray_count(chats);
+	for( j = 0; j < jcnt; j += 3 ) {
+		if( carray_get(chats, j+2) ) {
+			ths->m_cb(ths, MR_EVENT_INCOMING_MSG, (uintptr_t)carray_get(chats, j), (uintptr_t)carray_get(chats, j+2));
+		}
+		else {
+			ths->m_cb(ths, MR_EVENT_MSGS_CHANGED, (uintptr_t)carray_get(chats, j), (uintptr_t)carray_get(chats, j+1));
+		}
+	}
+
+	for( i = 0; i < icnt; i += 3 ) {
+		uintptr_t event = (uintptr_t)carray_get(ths->m_bulk_events, i);
+		if( event != MR_EVENT_MSGS_CHANGED && event != MR_EVENT_INCOMING_MSG ) {
+			ths->m_cb(ths, (int)event, (uintptr_t)carray_get(ths->m_bulk_events, i+1), (uintptr_t)carray_get(ths->m_bulk_events, i+2));
+		}
+	}
+
+	carray_free(chats);
+	carray_set_size(ths->m_bulk_events, 0);
+}
+
+
+static void send_receive_event(mrmailbox_t* ths, int bulk, int event, uintptr_t data1, uintptr_t data2)
+{
+	if( bulk ) {
+		/* the UI would not see the message before the transaction is committed, see bulk_receive_commit() */
+		carray_add(ths->m_bulk_events, (void*)(uintptr_t)event, NULL);
+		carray_add(ths->m_bulk_events, (void*)data1, NULL);
+		carray_add(ths->m_bulk_events, (void*)data2, NULL);
+	}
+	else {
+		ths->m_cb(ths, event, data1, data2);
+	}
+}
+
+
 static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
-                          const char* server_folder, uint32_t server_uid, uint32_t flags)
+                          const char* server_folder, uint32_t server_uid, uint32_t flags, mrmimeparser_t* parsed)
 {
-	/* the function returns the number of created messages in the database */
+	/* if given, parsed is the result of mrmimeparser_parse() for imf_raw_not_terminated, it is freed by this function */
 	int              incoming = 0;
 	int              incoming_from_known_sender = 0;
 	#define          outgoing (!incoming)
@@ -312,7 +449,7 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 	uint32_t         first_dblocal_id = 0;
 	char*            rfc724_mid = NULL; /* Message-ID from the header */
 	time_t           message_timestamp = MR_INVALID_TIMESTAMP;
-	mrmimeparser_t*  mime_parser = mrmimeparser_new(ths->m_blobdir, ths);
+	mrmimeparser_t*  mime_parser = parsed? parsed : mrmimeparser_new(ths->m_blobdir, ths);
 	int              db_locked = 0;
 	int              transaction_pending = 0;
 	clistiter*       cur1;
@@ -325,6 +462,8 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 
 	int              has_return_path = 0;
 	char*            txt_raw = NULL;
+	int              is_known = 0;
+	int              bulk = (ths->m_bulk_receive && pthread_equal(ths->m_bulk_thread, pthread_self()));
 
 	mrmailbox_log_info(ths, 0, "Receive message #%lu from %s.", server_uid, server_folder? server_folder:"?");
 
@@ -346,18 +485,54 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 	normally, this is done by mailimf_message_parse(), however, as we also need the MIME data,
 	we use mailmime_parse() through MrMimeParser (both call mailimf_struct_multiple_parse() somewhen, I did not found out anything
 	that speaks against this approach yet) */
-	mrmimeparser_parse(mime_parser, imf_raw_not_terminated, imf_raw_bytes);
+	mrsqlite3_lock(ths->m_sql);
+		is_known = is_known_imf__(ths, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, 0);
+	mrsqlite3_unlock(ths->m_sql);
+	if( is_known ) {
+		mrmailbox_log_info(ths, 0, "Message already in DB.");
+		if( parsed ) {
+			/* parsed by a worker before an earlier message with the same Message-ID was written; the files of the parts are not referenced */
+			for( i = 0; i < carray_count(mime_parser->m_parts); i++ ) {
+				mrmimepart_t* part = (mrmimepart_t*)carray_get(mime_parser->m_parts, i);
+				char* pathNfilename = mrparam_get(part->m_param, MRP_FILE, NULL);
+				if( pathNfilename ) {
+					mr_delete_file(pathNfilename, ths);
+					free(pathNfilename);
+				}
+			}
+		}
+		goto cleanup;
+	}
+
+	if( parsed == NULL ) {
+		if( bulk ) {
+			bulk_receive_commit(ths); /* the decryption reads from a read-only connection, this must not be done with the database locked */
+		}
+		mrmimeparser_parse(mime_parser, imf_raw_not_terminated, imf_raw_bytes);
+	}
 	if( mime_parser->m_header == NULL ) {
 		mrmailbox_log_info(ths, 0, "No header.");
 		goto cleanup; /* Error - even adding an empty record won't help as we do not know the message ID */
 	}
 
+	/* in bulk mode, the database is locked and a transaction is opened over several messages; the mutex is recursive, so all
+	locks below are nested.  The transaction below is a savepoint then, so a failed message is rolled back on its own */
+	if( bulk && !ths->m_bulk_locked ) {
+		mrsqlite3_lock(ths->m_sql);
+		mrsqlite3_begin_transaction__(ths->m_sql);
+		ths->m_bulk_locked = 1;
+		ths->m_bulk_started_ms = bulk_now_ms();
+	}
+
 	mrsqlite3_lock(ths->m_sql);
 	db_locked = 1;
 
 	mrsqlite3_begin_transaction__(ths->m_sql);
 	transaction_pending = 1;
 
+		/* apply the Autocrypt header, the decryption itself has not modified the peerstate */
+		mrmailbox_e2ee_apply_autocrypt__(ths, mime_parser->m_mimeroot);
+
 
 		/* Check, if the mail comes from extern, resp. is not send by us.  This is a _really_ important step
 		as messages send by us are used to validate other mail senders and receivers.
@@ -625,6 +800,8 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 					txt_raw = mr_mprintf("%s\n\n%s", mime_parser->m_subject? mime_parser->m_subject : "", part->m_msg_raw);
 				}
 
+				mrmailbox_ref_msg_file__(ths, part->m_param, part->m_file_hash);
+
 				stmt = mrsqlite3_predefine__(ths->m_sql, INSERT_INTO_msgs_msscftttsmttpb,
 					"INSERT INTO msgs (rfc724_mid,server_folder,server_uid,chat_id,from_id, to_id,timestamp,type, state,msgrmsg,txt,txt_raw,param,bytes)"
 					" VALUES (?,?,?,?,?, ?,?,?, ?,?,?,?,?,?);");
@@ -640,7 +817,7 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 				sqlite3_bind_int  (stmt, 10, msgrmsg);
 				sqlite3_bind_text (stmt, 11, part->m_msg? part->m_msg : "", -1, SQLITE_STATIC);
 				sqlite3_bind_text (stmt, 12, txt_raw? txt_raw : "", -1, SQLITE_STATIC);
-				sqlite3_bind_text (stmt, 13, part->m_param->m_packed, -1, SQLITE_STATIC);
+				sqlite3_bind_text (stmt, 13, mrparam_get_packed(part->m_param), -1, SQLITE_STATIC);
 				sqlite3_bind_int  (stmt, 14, part->m_bytes);
 				if( sqlite3_step(stmt) != SQLITE_DONE ) {
 					mrmailbox_log_info(ths, 0, "Cannot write DB.");
@@ -757,7 +934,7 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 					Unconsumed MDNs from normal MUAs are _not_ moved.
 					NB: we do not delete the MDN as it may be used by other clients
 
-					CAVE: we rely on mrimap_markseen_msg() not to move messages that are aready in the correct folder.
+					CAVE: we rely on mrimap_markseen_msgs() not to move messages that are aready in the correct folder.
 					otherwiese, the moved message get a new server_uid and is "fresh" again and we will be here again to move it away -
 					a classical deadlock, see also (***) */
 					if( mime_parser->m_is_send_by_messenger || mdn_consumed ) {
@@ -812,7 +989,7 @@ cleanup:
 		if( create_event_to_send ) {
 			size_t i, icnt = carray_count(created_db_entries);
 			for( i = 0; i < icnt; i += 2 ) {
-				ths->m_cb(ths, create_event_to_send, (uintptr_t)carray_get(created_db_entries, i), (uintptr_t)carray_get(created_db_entries, i+1));
+				send_receive_event(ths, bulk, create_event_to_send, (uintptr_t)carray_get(created_db_entries, i), (uintptr_t)carray_get(created_db_entries, i+1));
 			}
 		}
 		carray_free(created_db_entries);
@@ -821,12 +998,213 @@ cleanup:
 	if( rr_event_to_send ) {
 		size_t i, icnt = carray_count(rr_event_to_send);
 		for( i = 0; i < icnt; i += 2 ) {
-			ths->m_cb(ths, MR_EVENT_MSG_READ, (uintptr_t)carray_get(rr_event_to_send, i), (uintptr_t)carray_get(rr_event_to_send, i+1));
+			send_receive_event(ths, bulk, MR_EVENT_MSG_READ, (uintptr_t)carray_get(rr_event_to_send, i), (uintptr_t)carray_get(rr_event_to_send, i+1));
 		}
 		carray_free(rr_event_to_send);
 	}
 
 	free(txt_raw);
+
+	if( bulk ) {
+		ths->m_bulk_msgs++;
+		if( ths->m_bulk_msgs >= MR_BULK_RECEIVE_MSGS || bulk_now_ms()-ths->m_bulk_started_ms >= MR_BULK_RECEIVE_MS ) {
+			bulk_receive_commit(ths);
+		}
+	}
+}
+
+
+/*******************************************************************************
+ * Parse messages received in bulk mode by worker threads
+ ******************************************************************************/
+
+
+#define MR_RECV_MAX_BYTES (8*1024*1024) /* max. raw bytes buffered in m_recv_queue; if exceeded, the IMAP thread waits for the workers */
+
+#define MR_RECV_QUEUED  0
+#define MR_RECV_PARSING 1
+#define MR_RECV_PARSED  2
+
+typedef struct mrrecvmsg_t
+{
+	char*           m_raw;          /* a copy of the message as the IMAP buffer is freed as soon as the message is queued */
+	size_t          m_raw_bytes;
+	char*           m_server_folder;
+	uint32_t        m_server_uid;
+	uint32_t        m_flags;
+	mrmimeparser_t* m_mime_parser;  /* set by the worker, NULL if the message is already in the database */
+	int             m_state;        /* MR_RECV_* */
+} mrrecvmsg_t;
+
+
+static void* recv_thread_entry_point(void* entry_arg)
+{
+	mrmailbox_t* ths = (mrmailbox_t*)entry_arg;
+	mrosnative_setup_thread(ths); /* must be very first */
+
+	mrrecvmsg_t* msg;
+	int          i, icnt, is_known;
+
+	pthread_mutex_lock(&ths->m_recv_mutex);
+	while( !ths->m_recv_do_exit )
+	{
+		msg = NULL;
+		icnt = carray_count(ths->m_recv_queue);
+		for( i = 0; i < icnt; i++ ) {
+			if( ((mrrecvmsg_t*)carray_get(ths->m_recv_queue, i))->m_state == MR_RECV_QUEUED ) {
+				msg = (mrrecvmsg_t*)carray_get(ths->m_recv_queue, i);
+				break;
+			}
+		}
+
+		if( msg == NULL ) {
+			pthread_cond_wait(&ths->m_recv_cond, &ths->m_recv_mutex);
+			continue;
+		}
+
+		msg->m_state = MR_RECV_PARSING;
+		pthread_mutex_unlock(&ths->m_recv_mutex);
+
+			/* the check is repeated by receive_imf(), here, we use a read-only connection to avoid waiting for the writing IMAP thread */
+			mrsqlite3_lock_read(ths->m_sql);
+				is_known = is_known_imf__(ths, msg->m_raw, msg->m_raw_bytes, msg->m_server_folder, msg->m_server_uid, 1);
+			mrsqlite3_unlock_read(ths->m_sql);
+
+			if( !is_known ) {
+				msg->m_mime_parser = mrmimeparser_new(ths->m_blobdir, ths);
+				mrmimeparser_parse(msg->m_mime_parser, msg->m_raw, msg->m_raw_bytes);
+			}
+
+		pthread_mutex_lock(&ths->m_recv_mutex);
+		msg->m_state = MR_RECV_PARSED;
+		pthread_cond_broadcast(&ths->m_recv_cond);
+	}
+	pthread_mutex_unlock(&ths->m_recv_mutex);
+
+	mrosnative_unsetup_thread(ths); /* must be very last */
+	return NULL;
+}
+
+
+static void write_received(mrmailbox_t* ths, size_t max_queued_bytes)
+{
+	/* write the parsed messages from the head of the queue to the database in the order they were received.
+	The workers only read from read-only connections, so they are not blocked by the bulk transaction; the peerstates are updated
+	by receive_imf() in the order the messages were received.  If more than max_queued_bytes are queued, we wait for the workers;
+	as mrsqlite3_lock_read() falls back to the writing connection if there are no read-only connections, the bulk transaction is committed before. */
+	mrrecvmsg_t* msg;
+
+	pthread_mutex_lock(&ths->m_recv_mutex);
+	while( carray_count(ths->m_recv_queue) > 0 )
+	{
+		msg = (mrrecvmsg_t*)carray_get(ths->m_recv_queue, 0);
+		if( msg->m_state != MR_RECV_PARSED )
+		{
+			if( ths->m_recv_queued_bytes <= max_queued_bytes ) {
+				if( ths->m_bulk_locked && bulk_now_ms()-ths->m_bulk_started_ms >= MR_BULK_RECEIVE_MS ) {
+					pthread_mutex_unlock(&ths->m_recv_mutex);
+						bulk_receive_commit(ths); /* do not hold the lock while nothing is written */
+					pthread_mutex_lock(&ths->m_recv_mutex);
+				}
+				break;
+			}
+
+			pthread_mutex_unlock(&ths->m_recv_mutex);
+				bulk_receive_commit(ths);
+			pthread_mutex_lock(&ths->m_recv_mutex);
+
+			while( msg->m_state != MR_RECV_PARSED ) {
+				pthread_cond_wait(&ths->m_recv_cond, &ths->m_recv_mutex);
+			}
+		}
+
+		carray_delete_slow(ths->m_recv_queue, 0);
+		ths->m_recv_queued_bytes -= msg->m_raw_bytes;
+		pthread_mutex_unlock(&ths->m_recv_mutex);
+
+			receive_imf(ths, msg->m_raw, msg->m_raw_bytes, msg->m_server_folder, msg->m_server_uid, msg->m_flags, msg->m_mime_parser);
+			free(msg->m_raw);
+			free(msg->m_server_folder);
+			free(msg);
+
+		pthread_mutex_lock(&ths->m_recv_mutex);
+	}
+	pthread_mutex_unlock(&ths->m_recv_mutex);
+}
+
+
+static void queue_received(mrmailbox_t* ths, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                           const char* server_folder, uint32_t server_uid, uint32_t flags)
+{
+	mrrecvmsg_t* msg = calloc(1, sizeof(mrrecvmsg_t));
+	if( msg == NULL || (msg->m_raw=malloc(imf_raw_bytes))==NULL ) {
+		exit(55); /* cannot allocate little memory, unrecoverable error */
+	}
+	memcpy(msg->m_raw, imf_raw_not_terminated, imf_raw_bytes);
+	msg->m_raw_bytes     = imf_raw_bytes;
+	msg->m_server_folder = safe_strdup(server_folder);
+	msg->m_server_uid    = server_uid;
+	msg->m_flags         = flags;
+
+	/* backpressure: make room for the new message */
+	write_received(ths, imf_raw_bytes < MR_RECV_MAX_BYTES? MR_RECV_MAX_BYTES-imf_raw_bytes : 0);
+
+	pthread_mutex_lock(&ths->m_recv_mutex);
+		carray_add(ths->m_recv_queue, msg, NULL);
+		ths->m_recv_queued_bytes += imf_raw_bytes;
+		pthread_cond_broadcast(&ths->m_recv_cond);
+	pthread_mutex_unlock(&ths->m_recv_mutex);
+
+	/* write messages parsed meanwhile, do not wait */
+	write_received(ths, (size_t)-1);
+}
+
+
+static void init_recv_workers(mrmailbox_t* ths)
+{
+	/* the threads are started by start_recv_workers() when messages are received in bulk mode for the first time */
+	pthread_mutex_init(&ths->m_recv_mutex, NULL);
+	pthread_cond_init(&ths->m_recv_cond, NULL);
+	ths->m_recv_queue = carray_new(16);
+}
+
+
+static void start_recv_workers(mrmailbox_t* ths)
+{
+	/* only called from the thread receiving in bulk mode, so m_recv_workers_cnt needs no lock */
+	long cores;
+	int  i;
+
+	if( ths->m_recv_workers_cnt > 0 ) {
+		return;
+	}
+
+	/* one core is left for the IMAP thread writing to the database */
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	ths->m_recv_workers_cnt = MR_MIN(MR_MAX((int)cores-1, 1), MR_RECV_MAX_WORKERS);
+	for( i = 0; i < ths->m_recv_workers_cnt; i++ ) {
+		pthread_create(&ths->m_recv_workers[i], NULL, recv_thread_entry_point, ths);
+	}
+}
+
+
+static void exit_recv_workers(mrmailbox_t* ths)
+{
+	int i;
+
+	pthread_mutex_lock(&ths->m_recv_mutex);
+		ths->m_recv_do_exit = 1;
+		pthread_cond_broadcast(&ths->m_recv_cond);
+	pthread_mutex_unlock(&ths->m_recv_mutex);
+
+	for( i = 0; i < ths->m_recv_workers_cnt; i++ ) {
+		pthread_join(ths->m_recv_workers[i], NULL);
+	}
+	ths->m_recv_workers_cnt = 0;
+
+	carray_free(ths->m_recv_queue); /* the queue is empty as bulk mode is ended by cb_bulk_receive() before mrimap_t returns */
+	pthread_cond_destroy(&ths->m_recv_cond);
+	pthread_mutex_destroy(&ths->m_recv_mutex);
 }
 
 
@@ -854,10 +1232,63 @@ static void cb_set_config_int(mrimap_t* imap, const char* key, int32_t def)
 		mrsqlite3_set_config_int__(mailbox->m_sql, key, def);
 	mrsqlite3_unlock(mailbox->m_sql);
 }
+static char* cb_get_config(mrimap_t* imap, const char* key, const char* def)
+{
+	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
+	mrsqlite3_lock(mailbox->m_sql);
+		char* ret = mrsqlite3_get_config__(mailbox->m_sql, key, def);
+	mrsqlite3_unlock(mailbox->m_sql);
+	return ret;
+}
+static void cb_set_config(mrimap_t* imap, const char* key, const char* value)
+{
+	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
+	mrsqlite3_lock(mailbox->m_sql);
+		mrsqlite3_set_config__(mailbox->m_sql, key, value);
+	mrsqlite3_unlock(mailbox->m_sql);
+}
 static void cb_receive_imf(mrimap_t* imap, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags)
 {
 	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
-	receive_imf(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags);
+	if( mailbox->m_bulk_receive && pthread_equal(mailbox->m_bulk_thread, pthread_self()) && mailbox->m_recv_workers_cnt > 0 ) {
+		queue_received(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags); /* parse in parallel, write in order */
+	}
+	else {
+		receive_imf(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags, NULL);
+	}
+}
+static void cb_bulk_receive(mrimap_t* imap, int start)
+{
+	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
+	if( start ) {
+		start_recv_workers(mailbox);
+		mailbox->m_bulk_thread  = pthread_self();
+		mailbox->m_bulk_receive = 1;
+	}
+	else {
+		write_received(mailbox, 0);
+		bulk_receive_commit(mailbox);
+		mailbox->m_bulk_receive = 0;
+	}
+}
+static void cb_remote_flags(mrimap_t* imap, const char* server_folder, uint32_t server_uid_first, uint32_t server_uid_last, uint32_t flags)
+{
+	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
+	int          bulk = (mailbox->m_bulk_receive && pthread_equal(mailbox->m_bulk_thread, pthread_self()));
+	if( bulk && !mailbox->m_bulk_locked ) {
+		mrsqlite3_lock(mailbox->m_sql);
+		mrsqlite3_begin_transaction__(mailbox->m_sql);
+		mailbox->m_bulk_locked = 1;
+		mailbox->m_bulk_started_ms = bulk_now_ms();
+	}
+
+	mrsqlite3_lock(mailbox->m_sql);
+		int changes = mrmailbox_apply_remote_flags__(mailbox, server_folder, server_uid_first, server_uid_last, flags);
+	mrsqlite3_unlock(mailbox->m_sql);
+
+	if( changes ) {
+		send_receive_event(mailbox, bulk, MR_EVENT_MSGS_CHANGED, 0, 0);
+	}
 }
 
 
@@ -875,16 +1306,21 @@ mrmailbox_t* mrmailbox_new(mrmailboxcb_t cb, void* userData)
 
 	pthread_mutex_init(&ths->m_wake_lock_critical, NULL);
 
+	pthread_mutex_init(&ths->m_e2ee_keyring_mutex, NULL);
+
 	ths->m_sql      = mrsqlite3_new(ths);
 	ths->m_cb       = cb? cb : cb_dummy;
 	ths->m_userData = userData;
-	ths->m_imap     = mrimap_new(cb_get_config_int, cb_set_config_int, cb_receive_imf, (void*)ths, ths);
+	ths->m_imap     = mrimap_new(cb_get_config_int, cb_set_config_int, cb_get_config, cb_set_config, cb_receive_imf, cb_bulk_receive, cb_remote_flags, (void*)ths, ths);
+	ths->m_bulk_events = carray_new(48);
 	ths->m_smtp     = mrsmtp_new(ths);
 
 	mrjob_init_thread(ths);
 
 	mrpgp_init(ths);
 
+	init_recv_workers(ths);
+
 	/* Random-seed.  An additional seed with more random data is done just before key generation
 	(the timespan between this call and the key generation time is typically random.
 	Moreover, later, we add a hash of the first message data to the random-seed
@@ -913,6 +1349,8 @@ void mrmailbox_unref(mrmailbox_t* ths)
 		return;
 	}
 
+	exit_recv_workers(ths);
+
 	mrpgp_exit(ths);
 
 	mrjob_exit_thread(ths);
@@ -924,8 +1362,12 @@ void mrmailbox_unref(mrmailbox_t* ths)
 	mrimap_unref(ths->m_imap);
 	mrsmtp_unref(ths->m_smtp);
 	mrsqlite3_unref(ths->m_sql);
+	carray_free(ths->m_bulk_events);
 	pthread_mutex_destroy(&ths->m_wake_lock_critical);
 
+	mrmailbox_e2ee_forget_keys__(ths);
+	pthread_mutex_destroy(&ths->m_e2ee_keyring_mutex);
+
 	pthread_mutex_destroy(&ths->m_log_ringbuf_critical);
 	for( int i = 0; i < MR_LOG_RINGBUF_SIZE; i++ ) {
 		free(ths->m_log_ringbuf[i]);
@@ -939,6 +1381,72 @@ void mrmailbox_unref(mrmailbox_t* ths)
 }
 
 
+static void delete_stale_rendered_files__(mrmailbox_t* ths)
+{
+	/* messages rendered for SMTP are written to the blob-directory before the job uploading them to IMAP is committed;
+	if the app is killed in between, the file is referenced by no job and would never be deleted.
+	If a file is deleted here while a job is about to reference it, mrmailbox_send_msg_to_imap() renders the message again. */
+	carray*        referenced = carray_new(16);
+	mrparam_t*     param = mrparam_new();
+	sqlite3_stmt*  stmt = NULL;
+	DIR*           dir_handle = NULL;
+	struct dirent* dir_entry;
+	char*          curr_pathNfilename = NULL;
+	int            i, cnt, is_referenced;
+
+	if( (stmt=mrsqlite3_prepare_v2_(ths->m_sql, "SELECT param FROM jobs WHERE action=?;"))==NULL ) {
+		goto cleanup;
+	}
+	sqlite3_bind_int(stmt, 1, MRJ_SEND_MSG_TO_IMAP);
+	while( sqlite3_step(stmt)==SQLITE_ROW ) {
+		mrparam_set_packed(param, (const char*)sqlite3_column_text(stmt, 0));
+		char* file = mrparam_get(param, MRP_FILE, NULL);
+		if( file ) {
+			carray_add(referenced, file, NULL);
+		}
+	}
+
+	if( (dir_handle=opendir(ths->m_blobdir))==NULL ) {
+		goto cleanup;
+	}
+
+	while( (dir_entry=readdir(dir_handle))!=NULL )
+	{
+		if( strncmp(dir_entry->d_name, MR_RENDERED_PREFIX, strlen(MR_RENDERED_PREFIX))!=0 ) {
+			continue;
+		}
+
+		free(curr_pathNfilename);
+		curr_pathNfilename = mr_mprintf("%s/%s", ths->m_blobdir, dir_entry->d_name);
+
+		is_referenced = 0;
+		cnt = carray_count(referenced);
+		for( i = 0; i < cnt; i++ ) {
+			if( strcmp((char*)carray_get(referenced, i), curr_pathNfilename)==0 ) {
+				is_referenced = 1;
+				break;
+			}
+		}
+
+		if( !is_referenced ) {
+			mrmailbox_log_info(ths, 0, "Deleting stale rendered message \"%s\".", curr_pathNfilename);
+			mr_delete_file(curr_pathNfilename, ths);
+		}
+	}
+
+cleanup:
+	if( dir_handle ) { closedir(dir_handle); }
+	if( stmt ) { sqlite3_finalize(stmt); }
+	cnt = carray_count(referenced);
+	for( i = 0; i < cnt; i++ ) {
+		free(carray_get(referenced, i));
+	}
+	carray_free(referenced);
+	mrparam_unref(param);
+	free(curr_pathNfilename);
+}
+
+
 int mrmailbox_open(mrmailbox_t* ths, const char* dbfile, const char* blobdir)
 {
 	int success = 0;
@@ -958,6 +1466,7 @@ int mrmailbox_open(mrmailbox_t* ths, const char* dbfile, const char* blobdir)
 	if( !mrsqlite3_open__(ths->m_sql, dbfile) ) {
 		goto cleanup;
 	}
+	mrjob_load__(ths);
 	mrjob_kill_action__(ths, MRJ_CONNECT_TO_IMAP);
 
 	/* backup dbfile name */
@@ -973,6 +1482,8 @@ int mrmailbox_open(mrmailbox_t* ths, const char* dbfile, const char* blobdir)
 		mr_create_folder(ths->m_blobdir, ths);
 	}
 
+	delete_stale_rendered_files__(ths);
+
 	/* success */
 	success = 1;
 
@@ -1006,6 +1517,8 @@ void mrmailbox_close(mrmailbox_t* ths)
 		if( mrsqlite3_is_open(ths->m_sql) ) {
 			mrsqlite3_close__(ths->m_sql);
 		}
+		mrjob_load__(ths); /* empties the job queue */
+		mrmailbox_e2ee_forget_keys__(ths);
 
 		free(ths->m_dbfile);
 		ths->m_dbfile = NULL;
@@ -1042,7 +1555,7 @@ int mrmailbox_poke_eml_file(mrmailbox_t* ths, const char* filename)
 		goto cleanup;
 	}
 
-	receive_imf(ths, data, data_bytes, "import", 0, 0); /* this static function is the reason why this function is not moved to mrmailbox_imex.c */
+	receive_imf(ths, data, data_bytes, "import", 0, 0, NULL); /* this static function is the reason why this function is not moved to mrmailbox_imex.c */
 	success = 1;
 
 cleanup:
@@ -1127,6 +1640,7 @@ char* mrmailbox_get_info(mrmailbox_t* ths)
 	char *displayname = NULL, *temp = NULL, *l_readable_str = NULL, *l2_readable_str = NULL, *fingerprint_str = NULL;
 	mrloginparam_t *l = NULL, *l2 = NULL;
 	int contacts, chats, real_msgs, deaddrop_msgs, is_configured, dbversion, mdns_enabled, e2ee_enabled, prv_key_count, pub_key_count;
+	unsigned long config_cache_hits, config_cache_misses, contact_cache_hits, contact_cache_misses;
 	mrkey_t* self_public = mrkey_new();
 
 	mrstrbuilder_t  ret;
@@ -1177,6 +1691,14 @@ char* mrmailbox_get_info(mrmailbox_t* ths)
 			fingerprint_str = safe_strdup("<Not yet calculated>");
 		}
 
+		pthread_mutex_lock(&ths->m_sql->m_config_cache_mutex);
+			config_cache_hits   = ths->m_sql->m_config_cache_hits;
+			config_cache_misses = ths->m_sql->m_config_cache_misses;
+		pthread_mutex_unlock(&ths->m_sql->m_config_cache_mutex);
+
+		contact_cache_hits   = ths->m_sql->m_contact_cache_hits;
+		contact_cache_misses = ths->m_sql->m_contact_cache_misses;
+
 	mrsqlite3_unlock(ths->m_sql);
 
 	l_readable_str = mrloginparam_get_readable(l);
@@ -1193,6 +1715,9 @@ char* mrmailbox_get_info(mrmailbox_t* ths)
 		"Messages in mailbox: %i\n"
 		"Contacts: %i\n"
 		"Database=%s, dbversion=%i, Blobdir=%s\n"
+		"Config cache hits=%lu, misses=%lu\n"
+		"Contact cache hits=%lu, misses=%lu\n"
+		"IMAP bytes received=%llu (%llu uncompressed), sent=%llu (%llu uncompressed), compression=%i\n"
 		"\n"
 		"displayname=%s\n"
 		"configured=%i\n"
@@ -1209,6 +1734,11 @@ char* mrmailbox_get_info(mrmailbox_t* ths)
 
 		, chats, real_msgs, deaddrop_msgs, contacts
 		, ths->m_dbfile? ths->m_dbfile : unset,   dbversion,   ths->m_blobdir? ths->m_blobdir : unset
+		, config_cache_hits, config_cache_misses
+		, contact_cache_hits, contact_cache_misses
+		, (unsigned long long)ths->m_imap->m_bytes_read,    (unsigned long long)(ths->m_imap->m_compressed? ths->m_imap->m_bytes_read_uncompressed : ths->m_imap->m_bytes_read)
+		, (unsigned long long)ths->m_imap->m_bytes_written, (unsigned long long)(ths->m_imap->m_compressed? ths->m_imap->m_bytes_written_uncompressed : ths->m_imap->m_bytes_written)
+		, ths->m_imap->m_compressed
 
         , displayname? displayname : unset
 		, is_configured
@@ -1269,6 +1799,7 @@ int mrmailbox_reset_tables(mrmailbox_t* ths, int bits)
 
 		if( bits & 1 ) {
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM jobs;");
+			mrjob_load__(ths);
 			mrmailbox_log_info(ths, 0, "Job resetted.");
 		}
 
@@ -1279,15 +1810,19 @@ int mrmailbox_reset_tables(mrmailbox_t* ths, int bits)
 
 		if( bits & 4 ) {
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM keypairs;");
+			mrmailbox_e2ee_forget_keys__(ths);
 			mrmailbox_log_info(ths, 0, "Private keypairs resetted.");
 		}
 
 		if( bits & 8 ) {
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM contacts WHERE id>" MR_STRINGIFY(MR_CONTACT_ID_LAST_SPECIAL) ";"); /* the other IDs are reserved - leave these rows to make sure, the IDs are not used by normal contacts*/
+			mrcontact_cache_empty__(ths->m_sql);
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM chats WHERE id>" MR_STRINGIFY(MR_CHAT_ID_LAST_SPECIAL) ";");
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM chats_contacts;");
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM msgs WHERE id>" MR_STRINGIFY(MR_MSG_ID_LAST_SPECIAL) ";");
+			mrsqlite3_execute__(ths->m_sql, "DELETE FROM blobs;");
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM config WHERE keyname LIKE 'imap.%' OR keyname LIKE 'configured%';");
+			mrsqlite3_load_config_cache__(ths->m_sql);
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM leftgrps;");
 			mrmailbox_log_info(ths, 0, "Rest but server config resetted.");
 		}
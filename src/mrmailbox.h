@@ -119,6 +119,31 @@ typedef struct mrmailbox_t
 	pthread_mutex_t  m_job_condmutex;
 	int              m_job_condflag;
 	int              m_job_do_exit;
+	carray*          m_job_due;      /* pending jobs to execute now, a heap ordered by priority, see mrjob.c; protected by m_job_condmutex as the following */
+	carray*          m_job_delayed;  /* pending jobs to execute later, a heap ordered by mrjob_t::m_start_again_at */
+	mrjob_t*         m_job_running;
+	int              m_job_running_killed;
+	carray*          m_job_added;    /* jobs added in the current transaction, queued on commit; protected by m_sql, see mrjob_transaction_end__() */
+
+	int              m_bulk_receive;        /* set while m_bulk_thread receives several messages in a row, see cb_bulk_receive() */
+	pthread_t        m_bulk_thread;
+	int              m_bulk_locked;         /* set if the database is locked and a transaction is opened over several messages */
+	int              m_bulk_msgs;
+	uint64_t         m_bulk_started_ms;
+	carray*          m_bulk_events;         /* events to send after the transaction is committed; 3 entries per event: event, data1, data2 */
+
+	#define          MR_RECV_MAX_WORKERS 4
+	pthread_t        m_recv_workers[MR_RECV_MAX_WORKERS]; /* threads parsing and decrypting messages received in bulk mode, see write_received() */
+	int              m_recv_workers_cnt;    /* 0 until the workers are started on the first bulk receive */
+	pthread_mutex_t  m_recv_mutex;
+	pthread_cond_t   m_recv_cond;           /* signalled if a message is added to m_recv_queue or parsed */
+	carray*          m_recv_queue;          /* received messages in the order they were received, protected by m_recv_mutex as the following */
+	size_t           m_recv_queued_bytes;
+	int              m_recv_do_exit;
+
+	struct mrkeyring_t* m_e2ee_private_keyring;      /* self private keys for decrypting, loaded on demand and protected by m_e2ee_keyring_mutex, see mrmailbox_e2ee_decrypt() */
+	char*            m_e2ee_private_keyring_addr;
+	pthread_mutex_t  m_e2ee_keyring_mutex;
 
 	mrmailboxcb_t    m_cb;
 	void*            m_userData;
@@ -225,6 +250,16 @@ Optionally, some special markers added to the ID-array may help to implement vir
 carray* mrmailbox_get_chat_msgs (mrmailbox_t*, uint32_t chat_id, uint32_t flags, uint32_t marker1before);
 
 
+/* mrmailbox_get_chat_msgs_page() returns a window of at most page_size messages of a chat, oldest first, with the same markers as mrmailbox_get_chat_msgs().
+The window starts just before (MR_PAGE_OLDER) or just after (MR_PAGE_NEWER) the anchor message given by its timestamp and ID;
+for the next page, pass the timestamp and ID of the first (MR_PAGE_OLDER) or last (MR_PAGE_NEWER) message of the previous page.
+Without an anchor (anchor_id=0), MR_PAGE_OLDER returns the newest messages and MR_PAGE_NEWER the oldest ones.
+Day markers are the same as in the full list, however, they are calculated for the window only. */
+#define MR_PAGE_OLDER -1
+#define MR_PAGE_NEWER  1
+carray* mrmailbox_get_chat_msgs_page (mrmailbox_t*, uint32_t chat_id, uint32_t flags, uint32_t marker1before, time_t anchor_timestamp, uint32_t anchor_id, int direction, int page_size);
+
+
 /* Search messages containing the given query string.
 Searching can be done globally (chat_id=0) or in a specified chat only (chat_id set).
 - The function returns an array of messages IDs which must be carray_free()'d by the caller.
@@ -316,9 +351,11 @@ typedef struct mrmailbox_e2ee_helper_t {
 } mrmailbox_e2ee_helper_t;
 
 void mrmailbox_e2ee_encrypt             (mrmailbox_t*, const clist* recipients_addr, int e2ee_guaranteed, int encrypt_to_self, struct mailmime* in_out_message, mrmailbox_e2ee_helper_t*);
-int  mrmailbox_e2ee_decrypt             (mrmailbox_t*, struct mailmime* in_out_message, int* ret_validation_errors); /* returns 1 if sth. was decrypted, 0 in other cases */
+int  mrmailbox_e2ee_decrypt             (mrmailbox_t*, struct mailmime* in_out_message, int* ret_validation_errors); /* returns 1 if sth. was decrypted, 0 in other cases; must not be called with m_sql locked */
+void mrmailbox_e2ee_apply_autocrypt__   (mrmailbox_t*, struct mailmime* message); /* updates the peerstate of the sender, called for the decrypted messages in the order they are received */
 void mrmailbox_e2ee_thanks              (mrmailbox_e2ee_helper_t*); /* frees data referenced by "mailmime" but not freed by mailmime_free(). After calling mre2ee_unhelp(), in_out_message cannot be used any longer! */
 int  mrmailbox_ensure_secret_key_exists (mrmailbox_t*); /* makes sure, the private key exists, needed only for exporting keys and the case no message was sent before */
+void mrmailbox_e2ee_forget_keys__      (mrmailbox_t*); /* must be called if the keypairs table is modified */
 
 
 /* logging */
@@ -223,6 +223,7 @@ static int load_or_generate_self_public_key__(mrmailbox_t* mailbox, mrkey_t* pub
 				mrmailbox_log_warning(mailbox, 0, "Cannot save keypair.");
 				goto cleanup;
 			}
+			mrmailbox_e2ee_forget_keys__(mailbox);
 
 			mrmailbox_log_info(mailbox, 0, "Keypair generated.");
 
@@ -632,10 +633,48 @@ static int contains_report(struct mailmime* mime)
 }
 
 
+static mraheader_t* get_autocrypt_info(mrmailbox_t* mailbox, struct mailimf_fields* imffields, char** ret_from, time_t* ret_message_time)
+{
+	/* get message_time and from (both may be unset) and the Autocrypt header, if any */
+	mraheader_t* autocryptheader = NULL;
+
+	*ret_from = NULL;
+	*ret_message_time = 0;
+
+	struct mailimf_field* field = mr_find_mailimf_field(imffields, MAILIMF_FIELD_FROM);
+	if( field && field->fld_data.fld_from ) {
+		*ret_from = mr_find_first_addr(field->fld_data.fld_from->frm_mb_list);
+	}
+
+	field = mr_find_mailimf_field(imffields, MAILIMF_FIELD_ORIG_DATE);
+	if( field && field->fld_data.fld_orig_date ) {
+		struct mailimf_orig_date* orig_date = field->fld_data.fld_orig_date;
+		if( orig_date ) {
+			*ret_message_time = mr_timestamp_from_date(orig_date->dt_date_time); /* is not yet checked against bad times! */
+			if( *ret_message_time != MR_INVALID_TIMESTAMP && *ret_message_time > time(NULL) ) {
+				*ret_message_time = time(NULL);
+			}
+		}
+	}
+
+	autocryptheader = mraheader_new_from_imffields(*ret_from, imffields);
+	if( autocryptheader ) {
+		if( !mrpgp_is_valid_key(mailbox, autocryptheader->m_public_key) ) {
+			mraheader_unref(autocryptheader);
+			autocryptheader = NULL;
+		}
+	}
+
+	return autocryptheader;
+}
+
+
 int mrmailbox_e2ee_decrypt(mrmailbox_t* mailbox, struct mailmime* in_out_message, int* ret_validation_errors)
 {
 	/* return values: 0=nothing to decrypt/cannot decrypt, 1=sth. decrypted
-	(to detect parts that could not be decrypted, simply look for left "multipart/encrypted" MIME types */
+	(to detect parts that could not be decrypted, simply look for left "multipart/encrypted" MIME types.
+	Nothing is written to the database and the keys are read using a read-only connection, so several messages can be decrypted
+	in parallel while another thread writes; the Autocrypt header is applied by mrmailbox_e2ee_apply_autocrypt__() */
 	struct mailimf_fields* imffields = mr_find_mailimf_fields(in_out_message); /*just a pointer into mailmime structure, must not be freed*/
 	mraheader_t*           autocryptheader = NULL;
 	time_t                 message_time = 0;
@@ -650,79 +689,62 @@ int mrmailbox_e2ee_decrypt(mrmailbox_t* mailbox, struct mailmime* in_out_message
 		goto cleanup;
 	}
 
-	/* Autocrypt preparations:
-	- Set message_time and from (both may be unset)
-	- Get the autocrypt header, if any.
-	- Do not abort on errors - we should try at last the decyption below */
-	if( imffields )
-	{
-		struct mailimf_field* field = mr_find_mailimf_field(imffields, MAILIMF_FIELD_FROM);
-		if( field && field->fld_data.fld_from ) {
-			from = mr_find_first_addr(field->fld_data.fld_from->frm_mb_list);
+	autocryptheader = get_autocrypt_info(mailbox, imffields, &from, &message_time);
+
+	mrsqlite3_lock_read(mailbox->m_sql);
+	locked = 1;
+
+		/* load private key for decryption */
+		if( (self_addr=mrsqlite3_get_config__(mailbox->m_sql, "configured_addr", NULL))==NULL ) {
+			goto cleanup;
 		}
 
-		field = mr_find_mailimf_field(imffields, MAILIMF_FIELD_ORIG_DATE);
-		if( field && field->fld_data.fld_orig_date ) {
-			struct mailimf_orig_date* orig_date = field->fld_data.fld_orig_date;
-			if( orig_date ) {
-				message_time = mr_timestamp_from_date(orig_date->dt_date_time); /* is not yet checked against bad times! */
-				if( message_time != MR_INVALID_TIMESTAMP && message_time > time(NULL) ) {
-					message_time = time(NULL);
+		pthread_mutex_lock(&mailbox->m_e2ee_keyring_mutex);
+
+			if( mailbox->m_e2ee_private_keyring==NULL
+			 || mailbox->m_e2ee_private_keyring_addr==NULL || strcmp(mailbox->m_e2ee_private_keyring_addr, self_addr)!=0 )
+			{
+				/* the keys are loaded once and not for every message; the parsed keys are cached in mrpgp.c */
+				mrkeyring_unref(mailbox->m_e2ee_private_keyring);
+				free(mailbox->m_e2ee_private_keyring_addr);
+				mailbox->m_e2ee_private_keyring_addr = NULL;
+				mailbox->m_e2ee_private_keyring = mrkeyring_new();
+				if( mrkeyring_load_self_private_for_decrypting__(mailbox->m_e2ee_private_keyring, self_addr, mailbox->m_sql) ) {
+					mailbox->m_e2ee_private_keyring_addr = safe_strdup(self_addr);
 				}
 			}
-		}
-	}
 
-	autocryptheader = mraheader_new_from_imffields(from, imffields);
-	if( autocryptheader ) {
-		if( !mrpgp_is_valid_key(mailbox, autocryptheader->m_public_key) ) {
-			mraheader_unref(autocryptheader);
-			autocryptheader = NULL;
-		}
-	}
+			if( mailbox->m_e2ee_private_keyring_addr )
+			{
+				/* copy the keys as the reference counters of mrkey_t are not thread-safe and the keyring is used outside the lock */
+				int i;
+				for( i = 0; i < mailbox->m_e2ee_private_keyring->m_count; i++ ) {
+					mrkey_t* key = mrkey_new();
+						mrkey_set_from_key(key, mailbox->m_e2ee_private_keyring->m_keys[i]);
+						mrkeyring_add(private_keyring, key);
+					mrkey_unref(key);
+				}
+			}
 
-	/* modify the peerstate (eg. if there is a peer but not autocrypt header, stop encryption) */
-	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
+		pthread_mutex_unlock(&mailbox->m_e2ee_keyring_mutex);
 
-		/* apply Autocrypt:-header */
-		if( message_time > 0
-		 && from )
-		{
+		if( private_keyring->m_count <= 0 ) {
+			goto cleanup;
+		}
+
+		/* load peer with public key for verification; the Autocrypt header of this message is applied in memory only */
+		if( from ) {
 			if( mrapeerstate_load_from_db__(peerstate, mailbox->m_sql, from) ) {
-				if( autocryptheader ) {
+				if( autocryptheader && message_time > 0 ) {
 					mrapeerstate_apply_header(peerstate, autocryptheader, message_time);
-					mrapeerstate_save_to_db__(peerstate, mailbox->m_sql, 0/*no not create*/);
-				}
-				else {
-					if( message_time > peerstate->m_last_seen_autocrypt
-					 && !contains_report(in_out_message) /*reports are ususally not encrpyted; do not degrade decryption then*/ ){
-						mrapeerstate_degrade_encryption(peerstate, message_time);
-						mrapeerstate_save_to_db__(peerstate, mailbox->m_sql, 0/*no not create*/);
-					}
 				}
 			}
-			else if( autocryptheader ) {
+			else if( autocryptheader && message_time > 0 ) {
 				mrapeerstate_init_from_header(peerstate, autocryptheader, message_time);
-				mrapeerstate_save_to_db__(peerstate, mailbox->m_sql, 1/*create*/);
 			}
 		}
 
-		/* load private key for decryption */
-		if( (self_addr=mrsqlite3_get_config__(mailbox->m_sql, "configured_addr", NULL))==NULL ) {
-			goto cleanup;
-		}
-
-		if( !mrkeyring_load_self_private_for_decrypting__(private_keyring, self_addr, mailbox->m_sql) ) {
-			goto cleanup;
-		}
-
-		/* if not yet done, load peer with public key for verification (should be last as the peer may be modified above) */
-		if( peerstate->m_public_key->m_bytes <= 0 ) {
-			mrapeerstate_load_from_db__(peerstate, mailbox->m_sql, from);
-		}
-
-	mrsqlite3_unlock(mailbox->m_sql);
+	mrsqlite3_unlock_read(mailbox->m_sql);
 	locked = 0;
 
 	/* finally, decrypt.  If sth. was decrypted, decrypt_recursive() returns "true" and we start over to decrypt maybe just added parts. */
@@ -739,7 +761,7 @@ int mrmailbox_e2ee_decrypt(mrmailbox_t* mailbox, struct mailmime* in_out_message
 	//mr_print_mime(in_out_message);
 
 cleanup:
-	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
+	if( locked ) { mrsqlite3_unlock_read(mailbox->m_sql); }
 	mraheader_unref(autocryptheader);
 	mrapeerstate_unref(peerstate);
 	mrkeyring_unref(private_keyring);
@@ -748,3 +770,62 @@ cleanup:
 	return sth_decrypted;
 }
 
+
+void mrmailbox_e2ee_apply_autocrypt__(mrmailbox_t* mailbox, struct mailmime* message)
+{
+	/* modify the peerstate (eg. if there is a peer but not autocrypt header, stop encryption).  This is done by the thread
+	writing the received message to the database, so the headers are applied in the order the messages are received */
+	struct mailimf_fields* imffields = mr_find_mailimf_fields(message); /*just a pointer into mailmime structure, must not be freed*/
+	mraheader_t*           autocryptheader = NULL;
+	time_t                 message_time = 0;
+	mrapeerstate_t*        peerstate = mrapeerstate_new();
+	char*                  from = NULL;
+
+	if( mailbox==NULL || message==NULL || imffields==NULL || peerstate==NULL ) {
+		goto cleanup;
+	}
+
+	autocryptheader = get_autocrypt_info(mailbox, imffields, &from, &message_time);
+
+	if( message_time > 0
+	 && from )
+	{
+		if( mrapeerstate_load_from_db__(peerstate, mailbox->m_sql, from) ) {
+			if( autocryptheader ) {
+				mrapeerstate_apply_header(peerstate, autocryptheader, message_time);
+				mrapeerstate_save_to_db__(peerstate, mailbox->m_sql, 0/*no not create*/);
+			}
+			else {
+				if( message_time > peerstate->m_last_seen_autocrypt
+				 && !contains_report(message) /*reports are ususally not encrpyted; do not degrade decryption then*/ ){
+					mrapeerstate_degrade_encryption(peerstate, message_time);
+					mrapeerstate_save_to_db__(peerstate, mailbox->m_sql, 0/*no not create*/);
+				}
+			}
+		}
+		else if( autocryptheader ) {
+			mrapeerstate_init_from_header(peerstate, autocryptheader, message_time);
+			mrapeerstate_save_to_db__(peerstate, mailbox->m_sql, 1/*create*/);
+		}
+	}
+
+cleanup:
+	mraheader_unref(autocryptheader);
+	mrapeerstate_unref(peerstate);
+	free(from);
+}
+
+
+void mrmailbox_e2ee_forget_keys__(mrmailbox_t* mailbox)
+{
+	if( mailbox == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&mailbox->m_e2ee_keyring_mutex);
+		mrkeyring_unref(mailbox->m_e2ee_private_keyring);
+		mailbox->m_e2ee_private_keyring = NULL;
+		free(mailbox->m_e2ee_private_keyring_addr);
+		mailbox->m_e2ee_private_keyring_addr = NULL;
+	pthread_mutex_unlock(&mailbox->m_e2ee_keyring_mutex);
+}
@@ -271,6 +271,7 @@ static int import_self_keys(mrmailbox_t* mailbox, const char* dir_name)
 				mrmailbox_log_error(mailbox, 0, "Cannot save keypair.");
 				goto cleanup;
 			}
+			mrmailbox_e2ee_forget_keys__(mailbox);
 
 			imported_count++;
 
@@ -699,22 +700,59 @@ cleanup:
  ******************************************************************************/
 
 
+/* the database is copied using the SQLite online backup API in steps of MR_BAK_PAGES_PER_STEP pages; the mailbox is locked
+only during a single step, so that messages can be received and read while the backup is in progress.
+as the source connection is used for the backup, changes made in between are also written to the backup by SQLite */
+#define MR_BAK_PAGES_PER_STEP  128
+#define MR_BAK_BLOB_CHUNK_BYTES 65536 /* files are copied in chunks of this size using sqlite3_blob_write(), they are never read completely into memory */
+
+
+static int is_file_to_backup(const char* name /*name without path; may also be `.` or `..`*/)
+{
+	int name_len = strlen(name);
+	int prefix_len = strlen(MR_BAK_PREFIX);
+	int suffix_len = strlen(MR_BAK_SUFFIX);
+	if( (name_len==1 && name[0]=='.')
+	 || (name_len==2 && name[0]=='.' && name[1]=='.')
+	 || (strncmp(name, MR_RENDERED_PREFIX, strlen(MR_RENDERED_PREFIX))==0)
+	 || (name_len > prefix_len && strncmp(name, MR_BAK_PREFIX, prefix_len)==0 && name_len > suffix_len && strncmp(&name[name_len-suffix_len-1], "." MR_BAK_SUFFIX, suffix_len)==0) ) {
+		return 0;
+	}
+	return 1;
+}
+
+
+static void backup_progress(mrmailbox_t* mailbox, uint64_t done_bytes, uint64_t total_bytes, int* last_percent)
+{
+	int percent = total_bytes>0? (int)((done_bytes*100)/total_bytes) : 100;
+	if( percent < 1 ) { percent = 1; }
+	if( percent > 100 ) { percent = 100; }
+	if( percent != *last_percent ) {
+		*last_percent = percent;
+		mailbox->m_cb(mailbox, MR_EVENT_IMEX_PROGRESS, percent, 0);
+	}
+}
+
+
 static int export_backup(mrmailbox_t* mailbox, const char* dir, const char* setup_code)
 {
-	int            success = 0, locked = 0, closed = 0;
-	char*          dest_pathNfilename = NULL;
-	mrsqlite3_t*   dest_sql = NULL;
-	time_t         now = time(NULL);
-	DIR*           dir_handle = NULL;
-	struct dirent* dir_entry;
-	int            prefix_len = strlen(MR_BAK_PREFIX);
-	int            suffix_len = strlen(MR_BAK_SUFFIX);
-	char*          curr_pathNfilename = NULL;
-	void*          buf = NULL;
-	size_t         buf_bytes = 0;
-	sqlite3_stmt*  stmt = NULL;
-	int            total_files_count = 0, processed_files_count = 0;
-	int            delete_dest_file = 0;
+	int             success = 0, locked = 0, transaction_pending = 0;
+	char*           dest_pathNfilename = NULL;
+	sqlite3*        dest_db = NULL;
+	sqlite3_backup* backup = NULL;
+	mrsqlite3_t*    dest_sql = NULL;
+	time_t          now = time(NULL);
+	DIR*            dir_handle = NULL;
+	struct dirent*  dir_entry;
+	char*           curr_pathNfilename = NULL;
+	FILE*           curr_file = NULL;
+	sqlite3_blob*   blob = NULL;
+	void*           buf = NULL;
+	sqlite3_stmt*   stmt = NULL;
+	sqlite3_stmt*   delete_stmt = NULL;
+	uint64_t        db_bytes = 0, total_bytes = 0, done_bytes = 0;
+	int             last_percent = 0, rc;
+	int             delete_dest_file = 0;
 
 	/* get a fine backup file name (the name includes the date so that multiple backup instances are possible) */
 	{
@@ -728,24 +766,79 @@ static int export_backup(mrmailbox_t* mailbox, const char* dir, const char* setu
 		}
 	}
 
-	/* temporary lock and close the source (we just make a copy of the whole file, this is the fastest and easiest approach) */
-	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
-	mrsqlite3_close__(mailbox->m_sql);
-	closed = 1;
+	/* scan the blob directory to get the number of bytes to copy, the progress is based on this */
+	if( (dir_handle=opendir(mailbox->m_blobdir))==NULL ) {
+		mrmailbox_log_error(mailbox, 0, "Backup: Cannot get info for blob-directory \"%s\".", mailbox->m_blobdir);
+		goto cleanup;
+	}
+
+	while( (dir_entry=readdir(dir_handle))!=NULL ) {
+		if( is_file_to_backup(dir_entry->d_name) ) {
+			free(curr_pathNfilename);
+			curr_pathNfilename = mr_mprintf("%s/%s", mailbox->m_blobdir, dir_entry->d_name);
+			total_bytes += mr_get_filebytes(curr_pathNfilename);
+		}
+	}
 
-	/* copy file to backup directory */
+	closedir(dir_handle);
+	dir_handle = NULL;
+
+	db_bytes = mr_get_filebytes(mailbox->m_dbfile); /* only an estimation as changes may still be in the WAL file */
+	total_bytes += db_bytes;
+
+	/* copy the database to the backup file while the mailbox stays open */
 	mrmailbox_log_info(mailbox, 0, "Backup \"%s\" to \"%s\".", mailbox->m_dbfile, dest_pathNfilename);
-	if( !mr_copy_file(mailbox->m_dbfile, dest_pathNfilename, mailbox) ) {
-		goto cleanup; /* error already logged */
+	delete_dest_file = 1; /* set to 0 on success */
+
+	if( sqlite3_open(dest_pathNfilename, &dest_db) != SQLITE_OK ) {
+		mrmailbox_log_error(mailbox, 0, "Backup: Cannot open \"%s\".", dest_pathNfilename);
+		goto cleanup;
 	}
 
-	/* unlock and re-open the source and make it availabe again for the normal use */
-	mrsqlite3_open__(mailbox->m_sql, mailbox->m_dbfile);
-	closed = 0;
+	mrsqlite3_lock(mailbox->m_sql);
+	locked = 1;
+		backup = sqlite3_backup_init(dest_db, "main", mailbox->m_sql->m_cobj, "main");
 	mrsqlite3_unlock(mailbox->m_sql);
 	locked = 0;
 
+	if( backup == NULL ) {
+		mrmailbox_log_error(mailbox, 0, "Backup: Cannot initialize: %s", sqlite3_errmsg(dest_db));
+		goto cleanup;
+	}
+
+	do
+	{
+		if( s_imex_do_exit ) {
+			goto cleanup;
+		}
+
+		mrsqlite3_lock(mailbox->m_sql);
+		locked = 1;
+			rc = sqlite3_backup_step(backup, MR_BAK_PAGES_PER_STEP);
+		mrsqlite3_unlock(mailbox->m_sql);
+		locked = 0;
+
+		if( rc == SQLITE_BUSY || rc == SQLITE_LOCKED ) {
+			sqlite3_sleep(100);
+		}
+		else if( rc != SQLITE_OK && rc != SQLITE_DONE ) {
+			mrmailbox_log_error(mailbox, 0, "Disk full? Cannot copy database to backup (error %i).", rc);
+			goto cleanup;
+		}
+
+		if( sqlite3_backup_pagecount(backup) > 0 ) {
+			int pages = sqlite3_backup_pagecount(backup);
+			backup_progress(mailbox, (db_bytes*(pages-sqlite3_backup_remaining(backup)))/pages, total_bytes, &last_percent);
+		}
+	}
+	while( rc != SQLITE_DONE );
+
+	sqlite3_backup_finish(backup);
+	backup = NULL;
+	sqlite3_close(dest_db);
+	dest_db = NULL;
+	done_bytes = db_bytes;
+
 	/* add all files as blobs to the database copy (this does not require the source to be locked, neigher the destination as it is used only here) */
 	if( (dest_sql=mrsqlite3_new(mailbox/*for logging only*/))==NULL
 	 || !mrsqlite3_open__(dest_sql, dest_pathNfilename) ) {
@@ -758,87 +851,117 @@ static int export_backup(mrmailbox_t* mailbox, const char* dir, const char* setu
 		}
 	}
 
-	/* scan directory, pass 1: collect file info */
-	total_files_count = 0;
 	if( (dir_handle=opendir(mailbox->m_blobdir))==NULL ) {
-		mrmailbox_log_error(mailbox, 0, "Backup: Cannot get info for blob-directory \"%s\".", mailbox->m_blobdir);
+		mrmailbox_log_error(mailbox, 0, "Backup: Cannot copy from blob-directory \"%s\".", mailbox->m_blobdir);
 		goto cleanup;
 	}
 
-	while( (dir_entry=readdir(dir_handle))!=NULL ) {
-		total_files_count++;
+	if( (buf=malloc(MR_BAK_BLOB_CHUNK_BYTES))==NULL ) {
+		exit(68); /* cannot allocate little memory, unrecoverable error */
 	}
 
-	closedir(dir_handle);
-	dir_handle = NULL;
+	/* all files are added in a single transaction, this avoids syncing the disk for every file */
+	mrsqlite3_begin_transaction__(dest_sql);
+	transaction_pending = 1;
 
-	if( total_files_count>0 )
+	stmt = mrsqlite3_prepare_v2_(dest_sql, "INSERT INTO backup_blobs (file_name, file_content) VALUES (?, ?);");
+	while( (dir_entry=readdir(dir_handle))!=NULL )
 	{
-		/* scan directory, pass 2: copy files */
-		if( (dir_handle=opendir(mailbox->m_blobdir))==NULL ) {
-			mrmailbox_log_error(mailbox, 0, "Backup: Cannot copy from blob-directory \"%s\".", mailbox->m_blobdir);
+		char*  name = dir_entry->d_name;
+		size_t file_bytes, pos, chunk_bytes;
+		int    file_changed = 0;
+		sqlite3_int64 rowid = 0;
+
+		if( s_imex_do_exit ) {
 			goto cleanup;
 		}
 
-		stmt = mrsqlite3_prepare_v2_(dest_sql, "INSERT INTO backup_blobs (file_name, file_content) VALUES (?, ?);");
-		while( (dir_entry=readdir(dir_handle))!=NULL )
+		if( !is_file_to_backup(name) ) {
+			continue;
+		}
+
+		free(curr_pathNfilename);
+		curr_pathNfilename = mr_mprintf("%s/%s", mailbox->m_blobdir, name);
+		if( (file_bytes=mr_get_filebytes(curr_pathNfilename))<=0
+		 || (curr_file=fopen(curr_pathNfilename, "rb"))==NULL ) {
+			continue;
+		}
+
+		/* reserve the space for the file, the content is streamed into the zeroblob below */
+		sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+		sqlite3_bind_zeroblob(stmt, 2, file_bytes);
+		if( sqlite3_step(stmt)!=SQLITE_DONE
+		 || sqlite3_blob_open(dest_sql->m_cobj, "main", "backup_blobs", "file_content", (rowid=sqlite3_last_insert_rowid(dest_sql->m_cobj)), 1, &blob)!=SQLITE_OK ) {
+			mrmailbox_log_error(mailbox, 0, "Disk full? Cannot add file \"%s\" to backup.", curr_pathNfilename);
+			goto cleanup; /* this is not recoverable! writing to the sqlite database should work! */
+		}
+		sqlite3_reset(stmt);
+
+		for( pos = 0; pos < file_bytes; pos += chunk_bytes )
 		{
-			if( s_imex_do_exit ) {
-				delete_dest_file = 1;
+			chunk_bytes = file_bytes-pos < MR_BAK_BLOB_CHUNK_BYTES? file_bytes-pos : MR_BAK_BLOB_CHUNK_BYTES;
+			if( fread(buf, 1, chunk_bytes, curr_file)!=chunk_bytes ) {
+				file_changed = 1; /* the file was truncated or replaced since its size was read */
+				break;
+			}
+
+			if( sqlite3_blob_write(blob, buf, chunk_bytes, pos)!=SQLITE_OK ) {
+				mrmailbox_log_error(mailbox, 0, "Disk full? Cannot add file \"%s\" to backup.", curr_pathNfilename);
 				goto cleanup;
 			}
 
-			processed_files_count++;
+			done_bytes += chunk_bytes;
+			backup_progress(mailbox, done_bytes, total_bytes, &last_percent);
+		}
 
-			int percent = (processed_files_count*100)/total_files_count;
-			if( percent < 1 ) { percent = 1; }
-			if( percent > 100 ) { percent = 100; }
-			mailbox->m_cb(mailbox, MR_EVENT_IMEX_PROGRESS, percent, 0);
+		if( !file_changed && fgetc(curr_file)!=EOF ) {
+			file_changed = 1; /* the file has grown since its size was read */
+		}
 
-			char* name = dir_entry->d_name; /* name without path; may also be `.` or `..` */
-			int name_len = strlen(name);
-			if( (name_len==1 && name[0]=='.')
-			 || (name_len==2 && name[0]=='.' && name[1]=='.')
-			 || (name_len > prefix_len && strncmp(name, MR_BAK_PREFIX, prefix_len)==0 && name_len > suffix_len && strncmp(&name[name_len-suffix_len-1], "." MR_BAK_SUFFIX, suffix_len)==0) ) {
-				//mrmailbox_log_info(mailbox, 0, "Backup: Skipping \"%s\".", name);
-				continue;
-			}
+		sqlite3_blob_close(blob);
+		blob = NULL;
+		fclose(curr_file);
+		curr_file = NULL;
 
-			//mrmailbox_log_info(mailbox, 0, "Backup \"%s\".", name);
-			free(curr_pathNfilename);
-			curr_pathNfilename = mr_mprintf("%s/%s", mailbox->m_blobdir, name);
-			free(buf);
-			if( !mr_read_file(curr_pathNfilename, &buf, &buf_bytes, mailbox) || buf==NULL || buf_bytes<=0 ) {
-				continue;
+		/* a file that changes during the backup is skipped, the row must not keep a partial or zero-filled blob */
+		if( file_changed ) {
+			mrmailbox_log_warning(mailbox, 0, "Backup: File \"%s\" changed while reading, skipped.", curr_pathNfilename);
+			if( (delete_stmt=mrsqlite3_prepare_v2_(dest_sql, "DELETE FROM backup_blobs WHERE id=?;"))==NULL ) {
+				goto cleanup; /* error already logged */
 			}
-
-			sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
-			sqlite3_bind_blob(stmt, 2, buf, buf_bytes, SQLITE_STATIC);
-			if( sqlite3_step(stmt)!=SQLITE_DONE ) {
-				mrmailbox_log_error(mailbox, 0, "Disk full? Cannot add file \"%s\" to backup.", curr_pathNfilename);
-				goto cleanup; /* this is not recoverable! writing to the sqlite database should work! */
+			sqlite3_bind_int64(delete_stmt, 1, rowid);
+			if( sqlite3_step(delete_stmt)!=SQLITE_DONE ) {
+				mrmailbox_log_error(mailbox, 0, "Disk full? Cannot remove file \"%s\" from backup.", curr_pathNfilename);
+				goto cleanup;
 			}
-			sqlite3_reset(stmt);
+			sqlite3_finalize(delete_stmt);
+			delete_stmt = NULL;
 		}
 	}
-	else
-	{
-		mrmailbox_log_info(mailbox, 0, "Backup: No files to copy.", mailbox->m_blobdir);
-	}
 
 	/* done - set some special config values (do this last to avoid importing crashed backups) */
 	mrsqlite3_set_config_int__(dest_sql, "backup_time", now);
 	mrsqlite3_set_config__    (dest_sql, "backup_for", mailbox->m_blobdir);
 
+	mrsqlite3_commit__(dest_sql);
+	transaction_pending = 0;
+
 	mailbox->m_cb(mailbox, MR_EVENT_IMEX_FILE_WRITTEN, (uintptr_t)dest_pathNfilename, (uintptr_t)"application/octet-stream");
+	delete_dest_file = 0;
 	success = 1;
 
 cleanup:
 	if( dir_handle ) { closedir(dir_handle); }
-	if( closed ) { mrsqlite3_open__(mailbox->m_sql, mailbox->m_dbfile); }
 	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
 
+	if( backup ) { sqlite3_backup_finish(backup); }
+	if( dest_db ) { sqlite3_close(dest_db); }
+
+	if( curr_file ) { fclose(curr_file); }
+	if( blob ) { sqlite3_blob_close(blob); }
 	if( stmt ) { sqlite3_finalize(stmt); }
+	if( delete_stmt ) { sqlite3_finalize(delete_stmt); }
+	if( transaction_pending ) { mrsqlite3_rollback__(dest_sql); }
 	mrsqlite3_close__(dest_sql);
 	mrsqlite3_unref(dest_sql);
 	if( delete_dest_file ) { mr_delete_file(dest_pathNfilename, mailbox); }
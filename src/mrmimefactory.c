@@ -341,7 +341,7 @@ static struct mailmime* build_body_file(const mrmsg_t* msg, const char* base_nam
 			filename_to_send = mr_mprintf("%s - %s.%s",  author, title, suffix); /* the separator ` - ` is used on the receiver's side to construct the information; we avoid using ID3-scanners for security purposes */
 		}
 		else {
-			filename_to_send = mr_get_filename(pathNfilename);
+			filename_to_send = mrmsg_get_filename_by_param(msg->m_param);
 		}
 		free(author);
 		free(title);
@@ -356,7 +356,7 @@ static struct mailmime* build_body_file(const mrmsg_t* msg, const char* base_nam
 		filename_to_send = mr_mprintf("video.%s", suffix? suffix : "dat");
 	}
 	else {
-		filename_to_send = mr_get_filename(pathNfilename);
+		filename_to_send = mrmsg_get_filename_by_param(msg->m_param);
 	}
 
 	/* check mimetype */
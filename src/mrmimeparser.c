@@ -27,6 +27,8 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <pthread.h>
 #include "mrmailbox.h"
 #include "mrmimeparser.h"
 #include "mrmimefactory.h"
@@ -557,6 +559,7 @@ static void mrmimepart_unref(mrmimepart_t* ths)
 		ths->m_msg_raw = NULL;
 	}
 
+	free(ths->m_file_hash);
 	mrparam_unref(ths->m_param);
 	free(ths);
 }
@@ -788,10 +791,25 @@ static char* get_file_disposition_suffix_(struct mailmime_disposition* file_disp
 #endif
 
 
+static int mr_get_mime_transfer_encoding(struct mailmime* mime)
+{
+	if( mime->mm_mime_fields != NULL ) {
+		clistiter* cur;
+		for( cur = clist_begin(mime->mm_mime_fields->fld_list); cur != NULL; cur = clist_next(cur) ) {
+			struct mailmime_field* field = (struct mailmime_field*)clist_content(cur);
+			if( field && field->fld_type == MAILMIME_FIELD_TRANSFER_ENCODING && field->fld_data.fld_encoding ) {
+				return field->fld_data.fld_encoding->enc_type;
+			}
+		}
+	}
+	return MAILMIME_MECHANISM_BINARY;
+}
+
+
 int mr_mime_transfer_decode(struct mailmime* mime, const char** ret_decoded_data, size_t* ret_decoded_data_bytes, char** ret_to_mmap_string_unref)
 {
-	int                   mime_transfer_encoding = MAILMIME_MECHANISM_BINARY;
-	struct mailmime_data* mime_data = mime->mm_data.mm_single;
+	int                   mime_transfer_encoding;
+	struct mailmime_data* mime_data;
 	const char*           decoded_data = NULL; /* must not be free()'d */
 	size_t                decoded_data_bytes = 0;
 	char*                 transfer_decoding_buffer = NULL; /* mmap_string_unref()'d if set */
@@ -801,16 +819,8 @@ int mr_mime_transfer_decode(struct mailmime* mime, const char** ret_decoded_data
 		return 0;
 	}
 
-	if( mime->mm_mime_fields != NULL ) {
-		clistiter* cur;
-		for( cur = clist_begin(mime->mm_mime_fields->fld_list); cur != NULL; cur = clist_next(cur) ) {
-			struct mailmime_field* field = (struct mailmime_field*)clist_content(cur);
-			if( field && field->fld_type == MAILMIME_FIELD_TRANSFER_ENCODING && field->fld_data.fld_encoding ) {
-				mime_transfer_encoding = field->fld_data.fld_encoding->enc_type;
-				break;
-			}
-		}
-	}
+	mime_transfer_encoding = mr_get_mime_transfer_encoding(mime);
+	mime_data = mime->mm_data.mm_single;
 
 	/* regard `Content-Transfer-Encoding:` */
 	if( mime_transfer_encoding == MAILMIME_MECHANISM_7BIT
@@ -843,6 +853,107 @@ int mr_mime_transfer_decode(struct mailmime* mime, const char** ret_decoded_data
 }
 
 
+#define MR_DECODE_CHUNK_BYTES 65536
+
+
+/* Decode a single part to the given writer in chunks of MR_DECODE_CHUNK_BYTES; in contrast to mr_mime_transfer_decode(), the decoded
+data are never held completely in memory, which is important for large attachments.  Unencoded data are written directly from the
+raw message.  Returns 0 if the transfer encoding is not supported this way, mr_mime_transfer_decode() should be used then. */
+static int mr_mime_transfer_decode_to_file(struct mailmime* mime, mrfilewriter_t* writer)
+{
+	int         mime_transfer_encoding = mr_get_mime_transfer_encoding(mime);
+	const char* in       = mime->mm_data.mm_single->dt_data.dt_text.dt_data;
+	size_t      in_bytes = mime->mm_data.mm_single->dt_data.dt_text.dt_length, i;
+	char*       out = NULL;
+	size_t      out_bytes = 0;
+
+	if( mime_transfer_encoding == MAILMIME_MECHANISM_7BIT
+	 || mime_transfer_encoding == MAILMIME_MECHANISM_8BIT
+	 || mime_transfer_encoding == MAILMIME_MECHANISM_BINARY )
+	{
+		for( i = 0; i < in_bytes; i += MR_DECODE_CHUNK_BYTES ) {
+			mrfilewriter_write(writer, &in[i], MR_MIN(in_bytes-i, MR_DECODE_CHUNK_BYTES));
+		}
+		return 1;
+	}
+
+	if( mime_transfer_encoding != MAILMIME_MECHANISM_BASE64
+	 && mime_transfer_encoding != MAILMIME_MECHANISM_QUOTED_PRINTABLE ) {
+		return 0;
+	}
+
+	if( (out=malloc(MR_DECODE_CHUNK_BYTES))==NULL ) {
+		exit(65); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	if( mime_transfer_encoding == MAILMIME_MECHANISM_BASE64 )
+	{
+		uint32_t bits = 0;
+		int      bit_cnt = 0, c, v;
+		for( i = 0; i < in_bytes; i++ ) {
+			c = (unsigned char)in[i];
+			if( c>='A' && c<='Z' )      { v = c-'A'; }
+			else if( c>='a' && c<='z' ) { v = c-'a'+26; }
+			else if( c>='0' && c<='9' ) { v = c-'0'+52; }
+			else if( c=='+' )           { v = 62; }
+			else if( c=='/' )           { v = 63; }
+			else if( c=='=' )           { bits = 0; bit_cnt = 0; continue; } /* padding, the remaining bits are not used */
+			else                        { continue; } /* line ends and other characters are ignored */
+
+			bits = ((bits<<6) | v) & 0xFFFF;
+			bit_cnt += 6;
+			if( bit_cnt >= 8 ) {
+				bit_cnt -= 8;
+				out[out_bytes++] = (char)(bits>>bit_cnt);
+				if( out_bytes == MR_DECODE_CHUNK_BYTES ) {
+					mrfilewriter_write(writer, out, out_bytes);
+					out_bytes = 0;
+				}
+			}
+		}
+	}
+	else
+	{
+		#define HEXVAL(c) ((c)<='9'? (c)-'0' : ((c)|0x20)-'a'+10)
+		for( i = 0; i < in_bytes; i++ ) {
+			if( in[i]=='=' ) {
+				if( i+1 < in_bytes && in[i+1]=='\n' ) {
+					i += 1; /* soft line break */
+					continue;
+				}
+				else if( i+2 < in_bytes && in[i+1]=='\r' && in[i+2]=='\n' ) {
+					i += 2; /* soft line break */
+					continue;
+				}
+				else if( i+2 < in_bytes && isxdigit((unsigned char)in[i+1]) && isxdigit((unsigned char)in[i+2]) ) {
+					out[out_bytes++] = (char)((HEXVAL(in[i+1])<<4) | HEXVAL(in[i+2]));
+					i += 2;
+				}
+				else {
+					out[out_bytes++] = '='; /* invalid, keep as is */
+				}
+			}
+			else {
+				out[out_bytes++] = in[i];
+			}
+
+			if( out_bytes == MR_DECODE_CHUNK_BYTES ) {
+				mrfilewriter_write(writer, out, out_bytes);
+				out_bytes = 0;
+			}
+		}
+		#undef HEXVAL
+	}
+
+	mrfilewriter_write(writer, out, out_bytes);
+	free(out);
+	return 1;
+}
+
+
+static pthread_mutex_t s_blobdir_critical = PTHREAD_MUTEX_INITIALIZER; /* see mrmimeparser_add_single_part_if_known() */
+
+
 static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mailmime* mime)
 {
 	mrmimepart_t*                part = mrmimepart_new();
@@ -858,6 +969,7 @@ static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mai
 	char*                        charset_buffer = NULL; /* charconv_buffer_free()'d if set (just calls mmap_string_unref()) */
 	const char*                  decoded_data = NULL; /* must not be free()'d */
 	size_t                       decoded_data_bytes = 0;
+	mrfilewriter_t*              writer = NULL;
 	mrsimplify_t*                simplifier = NULL;
 
 	if( mime == NULL || mime->mm_data.mm_single == NULL || part == NULL ) {
@@ -875,17 +987,16 @@ static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mai
 		goto cleanup;
 	}
 
-
-	/* regard `Content-Transfer-Encoding:` */
-	if( !mr_mime_transfer_decode(mime, &decoded_data, &decoded_data_bytes, &transfer_decoding_buffer) ) {
-		goto cleanup; /* no always error - but no data */
-	}
-
 	switch( mime_type )
 	{
 		case MR_MIMETYPE_TEXT_PLAIN:
 		case MR_MIMETYPE_TEXT_HTML:
 			{
+				/* regard `Content-Transfer-Encoding:` */
+				if( !mr_mime_transfer_decode(mime, &decoded_data, &decoded_data_bytes, &transfer_decoding_buffer) ) {
+					goto cleanup; /* no always error - but no data */
+				}
+
 				if( simplifier==NULL ) {
 					simplifier = mrsimplify_new();
 					if( simplifier==NULL ) {
@@ -967,18 +1078,30 @@ static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mai
 					}
 				}
 
-				/* create a free file name to use */
-				if( (pathNfilename=mr_get_fine_pathNfilename(ths->m_blobdir, desired_filename)) == NULL ) {
-					goto cleanup;
+				/* create a free file name to use; messages may be parsed by several threads, so we have to make sure,
+				a free name is not used by another thread in the meantime.  Creating the file reserves the name, so the data can be written outside the lock. */
+				pthread_mutex_lock(&s_blobdir_critical);
+					if( (pathNfilename=mr_get_fine_pathNfilename(ths->m_blobdir, desired_filename)) == NULL
+					 || (writer=mrfilewriter_new(pathNfilename, mime_type==MR_MIMETYPE_IMAGE, ths->m_mailbox)) == NULL ) {
+						pthread_mutex_unlock(&s_blobdir_critical);
+						goto cleanup;
+					}
+				pthread_mutex_unlock(&s_blobdir_critical);
+
+				/* decode the data to the file in chunks; only for unusual transfer encodings, the data are decoded in memory first */
+				if( !mr_mime_transfer_decode_to_file(mime, writer) ) {
+					if( mr_mime_transfer_decode(mime, &decoded_data, &decoded_data_bytes, &transfer_decoding_buffer) ) {
+						mrfilewriter_write(writer, decoded_data, decoded_data_bytes);
+					}
 				}
 
-				/* copy data to file */
-                if( mr_write_file(pathNfilename, decoded_data, decoded_data_bytes, ths->m_mailbox)==0 ) {
-					goto cleanup;
-                }
+				if( !mrfilewriter_close(writer, &part->m_file_hash) || writer->m_bytes <= 0 ) {
+					mr_delete_file(pathNfilename, ths->m_mailbox);
+					goto cleanup; /* no always error - but no data */
+				}
 
 				part->m_type  = msg_type;
-				part->m_bytes = decoded_data_bytes;
+				part->m_bytes = writer->m_bytes;
 				mrparam_set(part->m_param, MRP_FILE, pathNfilename);
 				if( MR_MSG_MAKE_FILENAME_SEARCHABLE(msg_type) ) {
 					part->m_msg = mr_get_filename(pathNfilename);
@@ -989,7 +1112,7 @@ static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mai
 
 				if( mime_type == MR_MIMETYPE_IMAGE ) {
 					uint32_t w = 0, h = 0;
-					if( mr_get_filemeta(decoded_data, decoded_data_bytes, &w, &h) ) {
+					if( mr_get_filemeta(writer->m_head, writer->m_head_bytes, &w, &h) ) {
 						mrparam_set_int(part->m_param, MRP_WIDTH, w);
 						mrparam_set_int(part->m_param, MRP_HEIGHT, h);
 					}
@@ -1027,6 +1150,7 @@ cleanup:
 		mmap_string_unref(transfer_decoding_buffer);
 	}
 
+	mrfilewriter_unref(writer);
 	free(pathNfilename);
 	free(file_suffix);
 	free(desired_filename);
@@ -49,6 +49,7 @@ typedef struct mrmimepart_t
 	char*               m_msg_raw;
 	int                 m_bytes;
 	mrparam_t*          m_param;
+	char*               m_file_hash; /* hash of the file referenced by MRP_FILE, if any, used to detect duplicate files, see mrmailbox_ref_msg_file__() */
 } mrmimepart_t;
 
 
@@ -201,6 +201,44 @@ void mrmailbox_update_server_uid__(mrmailbox_t* mailbox, const char* rfc724_mid,
 }
 
 
+int mrmailbox_apply_remote_flags__(mrmailbox_t* mailbox, const char* server_folder, uint32_t server_uid_first, uint32_t server_uid_last, uint32_t flags)
+{
+	/* apply flags changed by other clients to the messages in the given UID range, returns the number of changed messages.
+	Messages gone on the server are marked as seen and lose their server location, so that no job tries to access them;
+	we do not delete them locally. */
+	sqlite3_stmt* stmt;
+	int           changes = 0;
+
+	if( server_folder == NULL || server_uid_first == 0 || server_uid_last < server_uid_first ) {
+		return 0;
+	}
+
+	if( flags & (MR_IMAP_SEEN|MR_IMAP_GONE) ) {
+		stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_msgs_SET_seen_WHERE_server_folder_AND_uids,
+			"UPDATE msgs SET state=" MR_STRINGIFY(MR_IN_SEEN) " WHERE server_folder=? AND server_uid BETWEEN ? AND ? AND (state=" MR_STRINGIFY(MR_IN_FRESH) " OR state=" MR_STRINGIFY(MR_IN_NOTICED) ");");
+		sqlite3_bind_text (stmt, 1, server_folder, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 2, server_uid_first);
+		sqlite3_bind_int64(stmt, 3, server_uid_last);
+		if( sqlite3_step(stmt) == SQLITE_DONE ) {
+			changes += sqlite3_changes(mailbox->m_sql->m_cobj);
+		}
+	}
+
+	if( flags & MR_IMAP_GONE ) {
+		stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_msgs_SET_ss_WHERE_server_folder_AND_uids,
+			"UPDATE msgs SET server_folder='', server_uid=0 WHERE server_folder=? AND server_uid BETWEEN ? AND ?;");
+		sqlite3_bind_text (stmt, 1, server_folder, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 2, server_uid_first);
+		sqlite3_bind_int64(stmt, 3, server_uid_last);
+		if( sqlite3_step(stmt) == SQLITE_DONE ) {
+			changes += sqlite3_changes(mailbox->m_sql->m_cobj);
+		}
+	}
+
+	return changes;
+}
+
+
 void mr_guess_msgtype_from_suffix(const char* pathNfilename, int* ret_msgtype, char** ret_mime)
 {
 	if( pathNfilename == NULL || ret_msgtype == NULL || ret_mime == NULL) {
@@ -385,6 +423,13 @@ char* mrmailbox_get_msg_info(mrmailbox_t* mailbox, uint32_t msg_id)
 	mrstrbuilder_cat(&ret, p); free(p);
 	mrstrbuilder_cat(&ret, "\n");
 
+	/* add recipients rejected by the SMTP server */
+	if( (p=mrparam_get(msg->m_param, MRP_REJECTED_RCPTS, NULL))!=NULL ) {
+		mrstrbuilder_cat(&ret, "Rejected: ");
+		mrstrbuilder_cat(&ret, p); free(p);
+		mrstrbuilder_cat(&ret, "\n");
+	}
+
 	/* add "suspicious" status */
 	if( msg->m_state==MR_IN_FRESH ) {
 		mrstrbuilder_cat(&ret, "Status: Fresh\n");
@@ -500,7 +545,9 @@ char* mrmsg_get_summarytext_by_raw(int type, const char* text, mrparam_t* param,
 
 		case MR_MSG_AUDIO:
 			if( (value=mrparam_get(param, MRP_TRACKNAME, NULL))==NULL ) { /* although we send files with "author - title" in the filename, existing files may follow other conventions, so this lookup is neccessary */
-				pathNfilename = mrparam_get(param, MRP_FILE, "ErrFilename");
+				if( (pathNfilename=mrmsg_get_filename_by_param(param))==NULL ) {
+					pathNfilename = safe_strdup("ErrFilename");
+				}
 				mr_get_authorNtitle_from_filename(pathNfilename, NULL, &value);
 			}
 			label = mrstock_str(MR_STR_AUDIO);
@@ -508,8 +555,9 @@ char* mrmsg_get_summarytext_by_raw(int type, const char* text, mrparam_t* param,
 			break;
 
 		case MR_MSG_FILE:
-			pathNfilename = mrparam_get(param, MRP_FILE, "ErrFilename");
-			value = mr_get_filename(pathNfilename);
+			if( (value=mrmsg_get_filename_by_param(param))==NULL ) {
+				value = safe_strdup("ErrFilename");
+			}
 			label = mrstock_str(MR_STR_FILE);
 			ret = mr_mprintf("%s: %s", label, value);
 			break;
@@ -533,23 +581,37 @@ char* mrmsg_get_summarytext_by_raw(int type, const char* text, mrparam_t* param,
 }
 
 
-char* mrmsg_get_filename(mrmsg_t* msg)
+char* mrmsg_get_filename_by_param(mrparam_t* param)
 {
+	/* if the file is shared with an identical file of another message, MRP_FILE refers to the name of the other message */
 	char* ret = NULL, *pathNfilename = NULL;
 
-	if( msg == NULL ) {
-		goto cleanup;
+	if( (ret=mrparam_get(param, MRP_FILENAME, NULL))!=NULL && ret[0] ) {
+		return ret;
+	}
+	free(ret);
+	ret = NULL;
+
+	if( (pathNfilename=mrparam_get(param, MRP_FILE, NULL))!=NULL ) {
+		ret = mr_get_filename(pathNfilename);
+		free(pathNfilename);
 	}
 
-	pathNfilename = mrparam_get(msg->m_param, MRP_FILE, NULL);
-	if( pathNfilename == NULL ) {
+	return ret;
+}
+
+
+char* mrmsg_get_filename(mrmsg_t* msg)
+{
+	char* ret = NULL;
+
+	if( msg == NULL ) {
 		goto cleanup;
 	}
 
-	ret = mr_get_filename(pathNfilename);
+	ret = mrmsg_get_filename_by_param(msg->m_param);
 
 cleanup:
-	free(pathNfilename);
 	return ret? ret : safe_strdup(NULL);
 }
 
@@ -590,7 +652,7 @@ mrpoortext_t* mrmsg_get_mediainfo(mrmsg_t* msg)
 		free(ret->m_text1); ret->m_text1 = NULL;
 		free(ret->m_text2); ret->m_text2 = NULL;
 
-		pathNfilename = mrparam_get(msg->m_param, MRP_FILE, NULL);
+		pathNfilename = mrmsg_get_filename_by_param(msg->m_param);
 		if( pathNfilename == NULL ) {
 			goto cleanup;
 		}
@@ -647,7 +709,7 @@ void mrmsg_save_param_to_disk__(mrmsg_t* msg)
 
 	sqlite3_stmt* stmt = mrsqlite3_predefine__(msg->m_mailbox->m_sql, UPDATE_msgs_SET_param_WHERE_id,
 		"UPDATE msgs SET param=? WHERE id=?;");
-	sqlite3_bind_text(stmt, 1, msg->m_param->m_packed, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 1, mrparam_get_packed(msg->m_param), -1, SQLITE_STATIC);
 	sqlite3_bind_int (stmt, 2, msg->m_id);
 	sqlite3_step(stmt);
 }
@@ -666,104 +728,395 @@ void mrmsg_save_param_to_disk(mrmsg_t* msg)
 
 
 /*******************************************************************************
- * Delete messages
+ * Coalesce IMAP jobs
  ******************************************************************************/
 
 
-void mrmailbox_delete_msg_on_imap(mrmailbox_t* mailbox, mrjob_t* job)
+typedef struct mrimapjob_t
 {
-	int      locked = 0, delete_from_server = 1;
-	mrmsg_t* msg = mrmsg_new();
+	mrjob_t*  m_job;
+	mrmsg_t*  m_msg;           /* the message the job belongs to; NULL for MDNs, they're not in the database */
+	char*     m_server_folder; /* may point to m_msg->m_server_folder */
+	uint32_t  m_server_uid;
+	int       m_ms_flags;      /* flags for mrimap_markseen_msgs() */
+	int       m_pending;       /* set if the message should be handled on the server */
+	int       m_try_again;     /* set if the job is tried again later */
+} mrimapjob_t;
 
-	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
 
-		if( !mrmsg_load_from_db__(msg, mailbox, job->m_foreign_id) ) {
-			goto cleanup;
-		}
+static mrimapjob_t* imapjobs_new(carray* jobs)
+{
+	int          i, cnt = carray_count(jobs);
+	mrimapjob_t* ij = calloc(cnt, sizeof(mrimapjob_t));
+	if( ij == NULL ) {
+		exit(51); /* cannot allocate little memory, unrecoverable error */
+	}
+	for( i = 0; i < cnt; i++ ) {
+		ij[i].m_job = (mrjob_t*)carray_get(jobs, i);
+	}
+	return ij;
+}
 
-		if( mrmailbox_rfc724_mid_cnt__(mailbox, msg->m_rfc724_mid) != 1 ) {
-			mrmailbox_log_info(mailbox, 0, "The message is deleted from the server when all message are deleted.");
-			delete_from_server = 0;
+
+static void imapjobs_unref(mrimapjob_t* ij, int cnt, int free_folders)
+{
+	int i;
+	for( i = 0; i < cnt; i++ ) {
+		if( free_folders ) {
+			free(ij[i].m_server_folder);
 		}
+		mrmsg_unref(ij[i].m_msg);
+	}
+	free(ij);
+}
 
-	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
 
-	/* if this is the last existing part of the message, we delete the message from the server */
-	if( delete_from_server )
-	{
+static int imapjobs_connect(mrmailbox_t* mailbox, mrimapjob_t* ij, int cnt)
+{
+	/* connect to IMAP if needed; if this is not possible, all pending jobs are tried again later */
+	int i;
+
+	if( !mrimap_is_connected(mailbox->m_imap) ) {
+		mrmailbox_connect_to_imap(mailbox, NULL);
 		if( !mrimap_is_connected(mailbox->m_imap) ) {
-			mrmailbox_connect_to_imap(mailbox, NULL);
-			if( !mrimap_is_connected(mailbox->m_imap) ) {
-				mrjob_try_again_later(job, MR_STANDARD_DELAY);
-				goto cleanup;
+			for( i = 0; i < cnt; i++ ) {
+				if( ij[i].m_pending ) {
+					mrjob_try_again_later(ij[i].m_job, MR_STANDARD_DELAY);
+					ij[i].m_pending = 0;
+					ij[i].m_try_again = 1;
+				}
 			}
+			return 0;
 		}
+	}
+	return 1;
+}
 
-		if( !mrimap_delete_msg(mailbox->m_imap, msg->m_rfc724_mid, msg->m_server_folder, msg->m_server_uid) )
-		{
-			mrjob_try_again_later(job, MR_STANDARD_DELAY);
-			goto cleanup;
+
+static int imapjobs_collect_folder(mrimapjob_t* ij, int cnt, int* ret_idx, uint32_t* ret_uids, int* ret_ms_flags)
+{
+	/* collect all pending jobs in the folder of the first pending job and mark them as no longer pending;
+	returns the number of collected jobs, 0 if nothing is pending */
+	int i, first = -1, ret_cnt = 0;
+	for( i = 0; i < cnt; i++ ) {
+		if( ij[i].m_pending && (first==-1 || strcmp(ij[i].m_server_folder, ij[first].m_server_folder)==0) ) {
+			if( first == -1 ) {
+				first = i;
+			}
+			ij[i].m_pending = 0;
+			ret_idx[ret_cnt] = i;
+			ret_uids[ret_cnt] = ij[i].m_server_uid;
+			ret_ms_flags[ret_cnt] = ij[i].m_ms_flags;
+			ret_cnt++;
 		}
 	}
+	return ret_cnt;
+}
 
-	/* we delete the database entry ...
-	- if the message is successfully removed from the server
-	- or if there are other parts of the messages in the database (in this case we have not deleted if from the server)
-	(As long as the message is not removed from the IMAP-server, we need at least one database entry to avoid a re-download) */
-	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
 
-		sqlite3_stmt* stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_msgs_WHERE_id, "DELETE FROM msgs WHERE id=?;");
-		sqlite3_bind_int(stmt, 1, msg->m_id);
-		sqlite3_step(stmt);
+static void imapjobs_markseen(mrmailbox_t* mailbox, mrimapjob_t* ij, int cnt)
+{
+	/* mark all pending messages as seen, one command per folder instead of one command per message */
+	int       k, grp_cnt;
+	int*      idx       = calloc(cnt, sizeof(int));
+	int*      ms_flags  = calloc(cnt, sizeof(int));
+	int*      out_flags = calloc(cnt, sizeof(int));
+	uint32_t* uids      = calloc(cnt, sizeof(uint32_t));
+	uint32_t* new_uids  = calloc(cnt, sizeof(uint32_t));
+	char*     new_server_folder = NULL;
 
-		char* pathNfilename = mrparam_get(msg->m_param, MRP_FILE, NULL);
-		if( pathNfilename ) {
-			if( strncmp(mailbox->m_blobdir, pathNfilename, strlen(mailbox->m_blobdir))==0 )
-			{
-				char* strLikeFilename = mr_mprintf("%%f=%s%%", pathNfilename);
-				sqlite3_stmt* stmt2 = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT id FROM msgs WHERE type!=? AND param LIKE ?;"); /* if this gets too slow, an index over "type" should help. */
-				sqlite3_bind_int (stmt2, 1, MR_MSG_TEXT);
-				sqlite3_bind_text(stmt2, 2, strLikeFilename, -1, SQLITE_STATIC);
-				int file_used_by_other_msgs = (sqlite3_step(stmt2)==SQLITE_ROW)? 1 : 0;
-				free(strLikeFilename);
-				sqlite3_finalize(stmt2);
-
-				if( !file_used_by_other_msgs )
+	if( idx==NULL || ms_flags==NULL || out_flags==NULL || uids==NULL || new_uids==NULL ) {
+		exit(52); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	if( !imapjobs_connect(mailbox, ij, cnt) ) {
+		goto cleanup;
+	}
+
+	while( (grp_cnt=imapjobs_collect_folder(ij, cnt, idx, uids, ms_flags)) > 0 )
+	{
+		if( mrimap_markseen_msgs(mailbox->m_imap, ij[idx[0]].m_server_folder, grp_cnt, uids,
+		       ms_flags, &new_server_folder, new_uids, out_flags) == 0 )
+		{
+			for( k = 0; k < grp_cnt; k++ ) {
+				mrjob_try_again_later(ij[idx[k]].m_job, MR_STANDARD_DELAY);
+				ij[idx[k]].m_try_again = 1;
+			}
+		}
+		else
+		{
+			mrsqlite3_lock(mailbox->m_sql);
+			mrsqlite3_begin_transaction__(mailbox->m_sql);
+
+				for( k = 0; k < grp_cnt; k++ )
 				{
-					mr_delete_file(pathNfilename, mailbox);
+					mrmsg_t* msg = ij[idx[k]].m_msg;
+					if( msg == NULL ) {
+						continue;
+					}
 
-					char* increation_file = mr_mprintf("%s.increation", pathNfilename);
-					mr_delete_file(increation_file, mailbox);
-					free(increation_file);
+					if( new_server_folder && new_uids[k] ) {
+						mrmailbox_update_server_uid__(mailbox, msg->m_rfc724_mid, new_server_folder, new_uids[k]);
+					}
+					else if( out_flags[k]&MR_MS_MOVED ) {
+						/* moved without COPYUID: the old location is no longer valid and must not be cleared by VANISHED for the old folder;
+						the new location is set when the message is fetched from the destination folder */
+						mrmailbox_update_server_uid__(mailbox, msg->m_rfc724_mid, "", 0);
+					}
 
-					char* filenameOnly = mr_get_filename(pathNfilename);
-					if( msg->m_type==MR_MSG_VOICE ) {
-						char* waveform_file = mr_mprintf("%s/%s.waveform", mailbox->m_blobdir, filenameOnly);
-						mr_delete_file(waveform_file, mailbox);
-						free(waveform_file);
+					if( out_flags[k]&MR_MS_MDNSent_JUST_SET ) {
+						mrjob_add__(mailbox, MRJ_SEND_MDN, msg->m_id, NULL); /* results in a call to mrmailbox_send_mdn() */
 					}
-					else if( msg->m_type==MR_MSG_VIDEO ) {
-						char* preview_file = mr_mprintf("%s/%s-preview.jpg", mailbox->m_blobdir, filenameOnly);
-						mr_delete_file(preview_file, mailbox);
-						free(preview_file);
+				}
+
+			mrsqlite3_commit__(mailbox->m_sql);
+			mrsqlite3_unlock(mailbox->m_sql);
+		}
+
+		free(new_server_folder);
+		new_server_folder = NULL;
+	}
+
+cleanup:
+	free(idx);
+	free(ms_flags);
+	free(out_flags);
+	free(uids);
+	free(new_uids);
+}
+
+
+/*******************************************************************************
+ * Delete messages
+ ******************************************************************************/
+
+
+void mrmailbox_ref_msg_file__(mrmailbox_t* mailbox, mrparam_t* param, const char* hash)
+{
+	/* Count the reference of a message to its file.  If the same file is already in the blob-directory, the new file is deleted and
+	MRP_FILE is changed to the existing file; the original name is kept in MRP_FILENAME.  Must be called before the message is inserted
+	to the database. */
+	char*         pathNfilename = NULL;
+	size_t        bytes = 0;
+	sqlite3_stmt* stmt;
+
+	if( mailbox==NULL || param==NULL || (pathNfilename=mrparam_get(param, MRP_FILE, NULL))==NULL ) {
+		goto cleanup;
+	}
+
+	bytes = mr_get_filebytes(pathNfilename);
+
+	if( hash && hash[0] && mailbox->m_blobdir && strncmp(mailbox->m_blobdir, pathNfilename, strlen(mailbox->m_blobdir))==0 )
+	{
+		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_path_FROM_blobs_WHERE_hbp,
+			"SELECT path FROM blobs WHERE hash=? AND bytes=? AND path!=? AND refcnt>0;");
+		sqlite3_bind_text (stmt, 1, hash, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 2, bytes);
+		sqlite3_bind_text (stmt, 3, pathNfilename, -1, SQLITE_STATIC);
+		if( sqlite3_step(stmt) == SQLITE_ROW ) {
+			char* existing = safe_strdup((const char*)sqlite3_column_text(stmt, 0));
+			if( mr_file_exist(existing) ) {
+				if( !mrparam_exists(param, MRP_FILENAME) ) {
+					char* filename = mr_get_filename(pathNfilename);
+					mrparam_set(param, MRP_FILENAME, filename);
+					free(filename);
+				}
+				mr_delete_file(pathNfilename, mailbox); /* not yet referenced by any row */
+				mrparam_set(param, MRP_FILE, existing);
+				free(pathNfilename);
+				pathNfilename = existing;
+			}
+			else {
+				free(existing);
+			}
+		}
+	}
+
+	stmt = mrsqlite3_predefine__(mailbox->m_sql, INSERT_INTO_blobs_pbh,
+		"INSERT OR IGNORE INTO blobs (path, bytes, hash) VALUES (?, ?, ?);");
+	sqlite3_bind_text (stmt, 1, pathNfilename, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, bytes);
+	sqlite3_bind_text (stmt, 3, hash? hash : "", -1, SQLITE_STATIC);
+	sqlite3_step(stmt);
+
+	stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_blobs_SET_refcnt_inc_WHERE_p,
+		"UPDATE blobs SET refcnt=refcnt+1 WHERE path=?;");
+	sqlite3_bind_text (stmt, 1, pathNfilename, -1, SQLITE_STATIC);
+	sqlite3_step(stmt);
+
+cleanup:
+	free(pathNfilename);
+}
+
+
+void mrmailbox_unref_msg_file__(mrmailbox_t* mailbox, int msg_type, mrparam_t* param)
+{
+	/* Remove the reference of a message to its file; if the file is no longer used by any message, it is deleted
+	when the transaction is committed, see mrsqlite3_delete_file_on_commit__(). */
+	char*         pathNfilename = NULL;
+	int           file_used_by_other_msgs = 1;
+	sqlite3_stmt* stmt;
+
+	if( mailbox==NULL || param==NULL || (pathNfilename=mrparam_get(param, MRP_FILE, NULL))==NULL ) {
+		goto cleanup;
+	}
+
+	stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_blobs_WHERE_p_AND_unused,
+		"DELETE FROM blobs WHERE path=? AND refcnt<=1;");
+	sqlite3_bind_text(stmt, 1, pathNfilename, -1, SQLITE_STATIC);
+	sqlite3_step(stmt);
+	if( sqlite3_changes(mailbox->m_sql->m_cobj) > 0 ) {
+		file_used_by_other_msgs = 0;
+	}
+	else {
+		stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_blobs_SET_refcnt_dec_WHERE_p,
+			"UPDATE blobs SET refcnt=refcnt-1 WHERE path=?;");
+		sqlite3_bind_text(stmt, 1, pathNfilename, -1, SQLITE_STATIC);
+		sqlite3_step(stmt);
+		if( sqlite3_changes(mailbox->m_sql->m_cobj) == 0 ) {
+			file_used_by_other_msgs = 0; /* the file is not counted at all */
+		}
+	}
+
+	if( !file_used_by_other_msgs
+	 && strncmp(mailbox->m_blobdir, pathNfilename, strlen(mailbox->m_blobdir))==0 )
+	{
+		mrsqlite3_delete_file_on_commit__(mailbox->m_sql, pathNfilename);
+
+		char* increation_file = mr_mprintf("%s.increation", pathNfilename);
+		mrsqlite3_delete_file_on_commit__(mailbox->m_sql, increation_file);
+		free(increation_file);
+
+		char* filenameOnly = mr_get_filename(pathNfilename);
+		if( msg_type==MR_MSG_VOICE ) {
+			char* waveform_file = mr_mprintf("%s/%s.waveform", mailbox->m_blobdir, filenameOnly);
+			mrsqlite3_delete_file_on_commit__(mailbox->m_sql, waveform_file);
+			free(waveform_file);
+		}
+		else if( msg_type==MR_MSG_VIDEO ) {
+			char* preview_file = mr_mprintf("%s/%s-preview.jpg", mailbox->m_blobdir, filenameOnly);
+			mrsqlite3_delete_file_on_commit__(mailbox->m_sql, preview_file);
+			free(preview_file);
+		}
+		free(filenameOnly);
+	}
+
+cleanup:
+	free(pathNfilename);
+}
+
+
+static void delete_msg_from_db__(mrmailbox_t* mailbox, mrmsg_t* msg)
+{
+	sqlite3_stmt* stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_msgs_WHERE_id, "DELETE FROM msgs WHERE id=?;");
+	sqlite3_bind_int(stmt, 1, msg->m_id);
+	sqlite3_step(stmt);
+
+	mrmailbox_unref_msg_file__(mailbox, msg->m_type, msg->m_param);
+}
+
+
+void mrmailbox_delete_msgs_on_imap(mrmailbox_t* mailbox, carray* jobs)
+{
+	int          i, k, grp_cnt, cnt = carray_count(jobs), connect = 0;
+	mrimapjob_t* ij = imapjobs_new(jobs);
+	int*         idx = calloc(cnt, sizeof(int));
+	int*         ms_flags = calloc(cnt, sizeof(int));
+	uint32_t*    uids = calloc(cnt, sizeof(uint32_t));
+
+	if( idx==NULL || ms_flags==NULL || uids==NULL ) {
+		exit(53); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	mrsqlite3_lock(mailbox->m_sql);
+
+		for( i = 0; i < cnt; i++ )
+		{
+			/* a message deleted several times is handled once, the other jobs are done;
+			otherwise, the reference to its file would be removed several times */
+			for( k = 0; k < i; k++ ) {
+				if( ij[k].m_job->m_foreign_id == ij[i].m_job->m_foreign_id ) {
+					break;
+				}
+			}
+			if( k < i ) {
+				continue;
+			}
+
+			ij[i].m_msg = mrmsg_new();
+			if( !mrmsg_load_from_db__(ij[i].m_msg, mailbox, ij[i].m_job->m_foreign_id) ) {
+				mrmsg_unref(ij[i].m_msg);
+				ij[i].m_msg = NULL;
+			}
+		}
+
+		for( i = 0; i < cnt; i++ )
+		{
+			int same_mid_in_batch = 1, later_in_batch = 0;
+			if( ij[i].m_msg == NULL ) {
+				continue;
+			}
+
+			/* if this is the last existing part of the message, we delete the message from the server.
+			other parts of the same message may be deleted in this batch, too; they are deleted from the database below,
+			so the last of them in the batch is handled as the last existing part */
+			for( k = 0; k < cnt; k++ ) {
+				if( k != i && ij[k].m_msg && ij[k].m_msg->m_id != ij[i].m_msg->m_id
+				 && ij[k].m_msg->m_rfc724_mid && ij[i].m_msg->m_rfc724_mid && strcmp(ij[k].m_msg->m_rfc724_mid, ij[i].m_msg->m_rfc724_mid)==0 ) {
+					same_mid_in_batch++;
+					if( k > i ) {
+						later_in_batch = 1;
 					}
-					free(filenameOnly);
 				}
 			}
-			free(pathNfilename);
+
+			if( later_in_batch || mrmailbox_rfc724_mid_cnt__(mailbox, ij[i].m_msg->m_rfc724_mid) != same_mid_in_batch ) {
+				mrmailbox_log_info(mailbox, 0, "The message is deleted from the server when all message are deleted.");
+				continue;
+			}
+
+			ij[i].m_server_folder = ij[i].m_msg->m_server_folder;
+			ij[i].m_server_uid    = ij[i].m_msg->m_server_uid;
+			ij[i].m_pending       = (ij[i].m_server_folder && ij[i].m_server_folder[0] && ij[i].m_server_uid)? 1 : 0;
+			connect |= ij[i].m_pending;
 		}
 
 	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
 
-cleanup:
-	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
+	/* delete the messages from the server, one command per folder */
+	if( connect && imapjobs_connect(mailbox, ij, cnt) )
+	{
+		while( (grp_cnt=imapjobs_collect_folder(ij, cnt, idx, uids, ms_flags)) > 0 )
+		{
+			if( !mrimap_delete_msgs(mailbox->m_imap, ij[idx[0]].m_server_folder, grp_cnt, uids) ) {
+				for( k = 0; k < grp_cnt; k++ ) {
+					mrjob_try_again_later(ij[idx[k]].m_job, MR_STANDARD_DELAY);
+					ij[idx[k]].m_try_again = 1;
+				}
+			}
+		}
 	}
-	mrmsg_unref(msg);
+
+	/* we delete the database entry ...
+	- if the message is successfully removed from the server
+	- or if there are other parts of the messages in the database (in this case we have not deleted if from the server)
+	(As long as the message is not removed from the IMAP-server, we need at least one database entry to avoid a re-download) */
+	mrsqlite3_lock(mailbox->m_sql);
+	mrsqlite3_begin_transaction__(mailbox->m_sql);
+
+		for( i = 0; i < cnt; i++ ) {
+			if( ij[i].m_msg && !ij[i].m_try_again ) {
+				delete_msg_from_db__(mailbox, ij[i].m_msg);
+			}
+		}
+
+	mrsqlite3_commit__(mailbox->m_sql);
+	mrsqlite3_unlock(mailbox->m_sql);
+
+	imapjobs_unref(ij, cnt, 0);
+	free(idx);
+	free(ms_flags);
+	free(uids);
 }
 
 
@@ -866,101 +1219,60 @@ cleanup:
  ******************************************************************************/
 
 
-void mrmailbox_markseen_msg_on_imap(mrmailbox_t* mailbox, mrjob_t* job)
+void mrmailbox_markseen_msgs_on_imap(mrmailbox_t* mailbox, carray* jobs)
 {
-	int      locked = 0;
-	mrmsg_t* msg = mrmsg_new();
-	char*    new_server_folder = NULL;
-	uint32_t new_server_uid = 0;
-	int      in_ms_flags = 0, out_ms_flags = 0;
-
-	if( !mrimap_is_connected(mailbox->m_imap) ) {
-		mrmailbox_connect_to_imap(mailbox, NULL);
-		if( !mrimap_is_connected(mailbox->m_imap) ) {
-			mrjob_try_again_later(job, MR_STANDARD_DELAY);
-			goto cleanup;
-		}
-	}
+	int          i, cnt = carray_count(jobs), mdns_enabled;
+	mrimapjob_t* ij = imapjobs_new(jobs);
 
 	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
-
-		if( !mrmsg_load_from_db__(msg, mailbox, job->m_foreign_id) ) {
-			goto cleanup;
-		}
 
-		/* add an additional job for sending the MDN (here in a thread for fast ui resonses) (an extra job as the MDN has a lower priority) */
-		if( mrparam_get_int(msg->m_param, MRP_WANTS_MDN, 0) /* MRP_WANTS_MDN is set only for one part of a multipart-message */
-		 && mrsqlite3_get_config_int__(mailbox->m_sql, "mdns_enabled", MR_MDNS_DEFAULT_ENABLED) ) {
-			in_ms_flags |= MR_MS_SET_MDNSent_FLAG;
-		}
-
-	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
+		mdns_enabled = mrsqlite3_get_config_int__(mailbox->m_sql, "mdns_enabled", MR_MDNS_DEFAULT_ENABLED);
 
-	if( msg->m_is_msgrmsg ) {
-		in_ms_flags |= MR_MS_ALSO_MOVE;
-	}
-
-	if( mrimap_markseen_msg(mailbox->m_imap, msg->m_server_folder, msg->m_server_uid,
-		   in_ms_flags, &new_server_folder, &new_server_uid, &out_ms_flags) != 0 )
-	{
-		if( (new_server_folder && new_server_uid) || out_ms_flags&MR_MS_MDNSent_JUST_SET )
+		for( i = 0; i < cnt; i++ )
 		{
-			mrsqlite3_lock(mailbox->m_sql);
-			locked = 1;
+			ij[i].m_msg = mrmsg_new();
+			if( !mrmsg_load_from_db__(ij[i].m_msg, mailbox, ij[i].m_job->m_foreign_id) ) {
+				continue;
+			}
 
-				if( new_server_folder && new_server_uid )
-				{
-					mrmailbox_update_server_uid__(mailbox, msg->m_rfc724_mid, new_server_folder, new_server_uid);
-				}
+			/* add an additional job for sending the MDN (here in a thread for fast ui resonses) (an extra job as the MDN has a lower priority) */
+			if( mrparam_get_int(ij[i].m_msg->m_param, MRP_WANTS_MDN, 0) /* MRP_WANTS_MDN is set only for one part of a multipart-message */
+			 && mdns_enabled ) {
+				ij[i].m_ms_flags |= MR_MS_SET_MDNSent_FLAG;
+			}
 
-				if( out_ms_flags&MR_MS_MDNSent_JUST_SET )
-				{
-					mrjob_add__(mailbox, MRJ_SEND_MDN, msg->m_id, NULL); /* results in a call to mrmailbox_send_mdn() */
-				}
+			if( ij[i].m_msg->m_is_msgrmsg ) {
+				ij[i].m_ms_flags |= MR_MS_ALSO_MOVE;
+			}
 
-			mrsqlite3_unlock(mailbox->m_sql);
-			locked = 0;
+			ij[i].m_server_folder = ij[i].m_msg->m_server_folder;
+			ij[i].m_server_uid    = ij[i].m_msg->m_server_uid;
+			ij[i].m_pending       = (ij[i].m_server_folder && ij[i].m_server_uid)? 1 : 0;
 		}
-	}
-	else
-	{
-		mrjob_try_again_later(job, MR_STANDARD_DELAY);
-	}
 
-cleanup:
-	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
-	}
-	mrmsg_unref(msg);
-	free(new_server_folder);
+	mrsqlite3_unlock(mailbox->m_sql);
+
+	imapjobs_markseen(mailbox, ij, cnt);
+
+	imapjobs_unref(ij, cnt, 0);
 }
 
 
-void mrmailbox_markseen_mdn_on_imap(mrmailbox_t* mailbox, mrjob_t* job)
+void mrmailbox_markseen_mdns_on_imap(mrmailbox_t* mailbox, carray* jobs)
 {
-	char*    server_folder = mrparam_get    (job->m_param, MRP_SERVER_FOLDER, NULL);
-	uint32_t server_uid    = mrparam_get_int(job->m_param, MRP_SERVER_UID, 0);
-	char*    new_server_folder = NULL;
-	uint32_t new_server_uid    = 0;
-	int      out_ms_flags = 0;
+	int          i, cnt = carray_count(jobs);
+	mrimapjob_t* ij = imapjobs_new(jobs);
 
-	if( !mrimap_is_connected(mailbox->m_imap) ) {
-		mrmailbox_connect_to_imap(mailbox, NULL);
-		if( !mrimap_is_connected(mailbox->m_imap) ) {
-			mrjob_try_again_later(job, MR_STANDARD_DELAY);
-			goto cleanup;
-		}
+	for( i = 0; i < cnt; i++ ) {
+		ij[i].m_server_folder = mrparam_get    (ij[i].m_job->m_param, MRP_SERVER_FOLDER, NULL);
+		ij[i].m_server_uid    = mrparam_get_int(ij[i].m_job->m_param, MRP_SERVER_UID, 0);
+		ij[i].m_ms_flags      = MR_MS_ALSO_MOVE;
+		ij[i].m_pending       = (ij[i].m_server_folder && ij[i].m_server_uid)? 1 : 0;
 	}
 
-	if( mrimap_markseen_msg(mailbox->m_imap, server_folder, server_uid, MR_MS_ALSO_MOVE, &new_server_folder, &new_server_uid, &out_ms_flags) == 0 ) {
-		mrjob_try_again_later(job, MR_STANDARD_DELAY);
-	}
+	imapjobs_markseen(mailbox, ij, cnt);
 
-cleanup:
-	free(server_folder);
-	free(new_server_folder);
+	imapjobs_unref(ij, cnt, 1);
 }
 
 
@@ -1095,7 +1407,7 @@ void mrmailbox_send_mdn(mrmailbox_t* mailbox, mrjob_t* job)
 	}
 
 	/* connect to SMTP server, if not yet done */
-	if( !mrsmtp_is_connected(mailbox->m_smtp) ) {
+	if( !mrsmtp_check_connection(mailbox->m_smtp) ) {
 		mrloginparam_t* loginparam = mrloginparam_new();
 			mrsqlite3_lock(mailbox->m_sql);
 				mrloginparam_read__(loginparam, mailbox->m_sql, "configured_");
@@ -1115,8 +1427,11 @@ void mrmailbox_send_mdn(mrmailbox_t* mailbox, mrjob_t* job)
 
 	//char* t1=mr_null_terminate(mimefactory.m_out->str,mimefactory.m_out->len);printf("~~~~~MDN~~~~~\n%s\n~~~~~/MDN~~~~~",t1);free(t1); // DEBUG OUTPUT
 
-	if( !mrsmtp_send_msg(mailbox->m_smtp, mimefactory.m_recipients_addr, mimefactory.m_out->str, mimefactory.m_out->len) ) {
-		mrsmtp_disconnect(mailbox->m_smtp);
+	int sent = mrsmtp_send_msg(mailbox->m_smtp, mimefactory.m_recipients_addr, mimefactory.m_out->str, mimefactory.m_out->len, NULL);
+	if( sent != MR_SMTP_SENT ) {
+		if( sent == MR_SMTP_CONNECTION_ERROR ) {
+			mrsmtp_disconnect(mailbox->m_smtp);
+		}
 		mrjob_try_again_later(job, MR_AT_ONCE); /* MR_AT_ONCE is only the _initial_ delay, if the second try failes, the delay gets larger */
 		goto cleanup;
 	}
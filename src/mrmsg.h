@@ -115,14 +115,18 @@ size_t       mrmailbox_get_deaddrop_msg_cnt__ (mrmailbox_t*);
 int          mrmailbox_rfc724_mid_cnt__       (mrmailbox_t*, const char* rfc724_mid);
 int          mrmailbox_rfc724_mid_exists__    (mrmailbox_t*, const char* rfc724_mid, char** ret_server_folder, uint32_t* ret_server_uid);
 void         mrmailbox_update_server_uid__    (mrmailbox_t*, const char* rfc724_mid, const char* server_folder, uint32_t server_uid);
+int          mrmailbox_apply_remote_flags__   (mrmailbox_t*, const char* server_folder, uint32_t server_uid_first, uint32_t server_uid_last, uint32_t flags);
 void         mrmailbox_update_msg_chat_id__   (mrmailbox_t*, uint32_t msg_id, uint32_t chat_id);
 void         mrmailbox_update_msg_state__     (mrmailbox_t*, uint32_t msg_id, int state);
-void         mrmailbox_delete_msg_on_imap     (mrmailbox_t* mailbox, mrjob_t* job);
+void         mrmailbox_delete_msgs_on_imap    (mrmailbox_t*, carray* jobs); /* jobs of the action MRJ_DELETE_MSG_ON_IMAP */
+void         mrmailbox_ref_msg_file__         (mrmailbox_t*, mrparam_t*, const char* hash); /* call before inserting a message with MRP_FILE; MRP_FILE may be changed to an identical file */
+void         mrmailbox_unref_msg_file__       (mrmailbox_t*, int msg_type, mrparam_t*); /* call after deleting a message; the file is deleted if not used by other messages */
 int          mrmailbox_mdn_from_ext__         (mrmailbox_t*, uint32_t from_id, const char* rfc724_mid, uint32_t* ret_chat_id, uint32_t* ret_msg_id); /* returns 1 if an event should be send */
 void         mrmailbox_send_mdn               (mrmailbox_t*, mrjob_t* job);
-void         mrmailbox_markseen_msg_on_imap   (mrmailbox_t* mailbox, mrjob_t* job);
-void         mrmailbox_markseen_mdn_on_imap   (mrmailbox_t* mailbox, mrjob_t* job);
+void         mrmailbox_markseen_msgs_on_imap  (mrmailbox_t*, carray* jobs); /* jobs of the action MRJ_MARKSEEN_MSG_ON_IMAP */
+void         mrmailbox_markseen_mdns_on_imap  (mrmailbox_t*, carray* jobs); /* jobs of the action MRJ_MARKSEEN_MDN_ON_IMAP */
 char*        mrmsg_get_summarytext_by_raw     (int type, const char* text, mrparam_t*, int approx_bytes); /* the returned value must be free()'d */
+char*        mrmsg_get_filename_by_param      (mrparam_t*); /* MRP_FILENAME or the base name of MRP_FILE, NULL if there is no file; the returned value must be free()'d */
 int          mrmsg_is_increation__            (const mrmsg_t*);
 void         mrmsg_save_param_to_disk__       (mrmsg_t*);
 void         mr_get_authorNtitle_from_filename(const char* pathNfilename, char** ret_author, char** ret_title);
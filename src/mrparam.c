@@ -27,6 +27,7 @@
 
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include "mrmailbox.h"
 #include "mrtools.h"
@@ -38,35 +39,82 @@
  ******************************************************************************/
 
 
-static char* find_param(char* ths, int key, char** ret_p2)
+#define MR_PARAM_COMPACT_BYTES 4096 /* the arena is compacted if more than half of it is unused, but not below this size */
+
+
+static int add_to_arena(mrparam_t* ths, const char* value, size_t value_bytes)
 {
-	char *p1, *p2;
+	/* copies the value to the arena and returns its offset */
+	int offset;
 
-	/* let p1 point to the start of the */
-	p1 = ths;
-	while( 1 ) {
-		if( p1 == NULL || *p1 == 0 ) {
-			return NULL;
+	if( ths->_m_arena_used + value_bytes + 1 > ths->_m_arena_size ) {
+		ths->_m_arena_size = (ths->_m_arena_used + value_bytes + 1) * 2;
+		if( (ths->_m_arena=realloc(ths->_m_arena, ths->_m_arena_size))==NULL ) {
+			exit(58); /* cannot allocate little memory, unrecoverable error */
 		}
-		else if( *p1 == key && p1[1] == '=' ) {
-			break;
+	}
+
+	offset = ths->_m_arena_used;
+	memcpy(&ths->_m_arena[offset], value, value_bytes);
+	ths->_m_arena[offset+value_bytes] = 0;
+	ths->_m_arena_used += value_bytes + 1;
+
+	mr_rtrim(&ths->_m_arena[offset]); /* to be safe with '\r' characters ... */
+	return offset;
+}
+
+
+static void compact_arena(mrparam_t* ths)
+{
+	/* values replaced by mrparam_set() are not reused; if this happens often, copy the used values to a new arena */
+	char*  old_arena = ths->_m_arena;
+	int    i, key;
+
+	ths->_m_arena        = NULL;
+	ths->_m_arena_used   = 0;
+	ths->_m_arena_size   = 0;
+	ths->_m_arena_unused = 0;
+	for( i = 0; i < ths->_m_order_cnt; i++ ) {
+		key = (unsigned char)ths->_m_order[i];
+		const char* value = &old_arena[ths->_m_index[key]-1];
+		ths->_m_index[key] = add_to_arena(ths, value, strlen(value)) + 1;
+	}
+
+	free(old_arena);
+}
+
+
+static void parse_packed(mrparam_t* ths)
+{
+	/* build the index from m_packed; if a key is given several times, the first one is used */
+	const char *p1 = ths->m_packed, *p2;
+	int         key;
+
+	while( p1 && *p1 ) {
+		/* let p2 point to the character _after_ the line - eiter `\n` or `\0` */
+		p2 = strchr(p1, '\n'); /* if `\r\n` is used, this `\r` is trimmed from the value or skipped as an invalid line */
+		if( p2 == NULL ) {
+			p2 = &p1[strlen(p1)];
 		}
-		else {
-			p1 = strchr(p1, '\n'); /* if `\r\n` is used, this `\r` is also skipped by this*/
-			if( p1 ) {
-				p1++;
-			}
+
+		key = (unsigned char)p1[0];
+		if( p1[1] == '=' && ths->_m_index[key] == 0 ) {
+			ths->_m_index[key] = add_to_arena(ths, &p1[2], p2-&p1[2]) + 1;
+			ths->_m_order[ths->_m_order_cnt++] = (char)key;
 		}
-	}
 
-	/* let p2 point to the character _after_ the value - eiter `\n` or `\0` */
-	p2 = strchr(p1, '\n');
-	if( p2 == NULL ) {
-		p2 = &p1[strlen(p1)];
+		p1 = *p2? p2+1 : NULL;
 	}
+}
 
-	*ret_p2 = p2;
-	return p1;
+
+static const char* get_value(mrparam_t* ths, int key)
+{
+	/* returns a pointer to the value in the arena or NULL, the pointer is valid until the parameters are modified */
+	if( ths == NULL || key <= 0 || key > 255 || ths->_m_index[key] == 0 ) {
+		return NULL;
+	}
+	return &ths->_m_arena[ths->_m_index[key]-1];
 }
 
 
@@ -97,17 +145,28 @@ void mrparam_unref(mrparam_t* ths)
 
 	mrparam_empty(ths);
 	free(ths->m_packed);
+	free(ths->_m_arena);
 	free(ths);
 }
 
 
 void mrparam_empty(mrparam_t* ths)
 {
+	int i;
+
 	if( ths == NULL ) {
 		return;
 	}
 
+	for( i = 0; i < ths->_m_order_cnt; i++ ) {
+		ths->_m_index[(unsigned char)ths->_m_order[i]] = 0;
+	}
+	ths->_m_order_cnt    = 0;
+	ths->_m_arena_used   = 0;
+	ths->_m_arena_unused = 0;
+
 	ths->m_packed[0] = 0;
+	ths->_m_packed_dirty = 0;
 }
 
 
@@ -122,123 +181,134 @@ void mrparam_set_packed(mrparam_t* ths, const char* packed)
 	if( packed ) {
 		free(ths->m_packed);
 		ths->m_packed = safe_strdup(packed);
+		parse_packed(ths);
 	}
 }
 
 
-int mrparam_exists(mrparam_t* ths, int key)
+const char* mrparam_get_packed(mrparam_t* ths)
 {
-	char *p2;
+	int    i;
+	size_t bytes = 0;
+	char*  p;
 
-	if( ths == NULL || key == 0 ) {
-		return 0;
+	if( ths == NULL ) {
+		return "";
+	}
+
+	if( ths->_m_packed_dirty )
+	{
+		for( i = 0; i < ths->_m_order_cnt; i++ ) {
+			bytes += 3/*key, `=` and `\n`*/ + strlen(get_value(ths, (unsigned char)ths->_m_order[i]));
+		}
+
+		free(ths->m_packed);
+		if( (ths->m_packed=malloc(bytes+1))==NULL ) {
+			exit(59); /* cannot allocate little memory, unrecoverable error */
+		}
+
+		p = ths->m_packed;
+		for( i = 0; i < ths->_m_order_cnt; i++ ) {
+			const char* value = get_value(ths, (unsigned char)ths->_m_order[i]);
+			size_t      value_bytes = strlen(value);
+			if( i > 0 ) {
+				*p++ = '\n';
+			}
+			*p++ = ths->_m_order[i];
+			*p++ = '=';
+			memcpy(p, value, value_bytes);
+			p += value_bytes;
+		}
+		*p = 0;
+
+		ths->_m_packed_dirty = 0;
 	}
 
-	return find_param(ths->m_packed, key, &p2)? 1 : 0;
+	return ths->m_packed;
 }
 
-char* mrparam_get(mrparam_t* ths, int key, const char* def)
+
+int mrparam_exists(mrparam_t* ths, int key)
 {
-	char *p1, *p2, bak, *ret;
+	return get_value(ths, key)? 1 : 0;
+}
 
-	if( ths == NULL || key == 0 ) {
-		return def? safe_strdup(def) : NULL;
-	}
 
-	p1 = find_param(ths->m_packed, key, &p2);
-	if( p1 == NULL ) {
+char* mrparam_get(mrparam_t* ths, int key, const char* def)
+{
+	const char* value = get_value(ths, key);
+
+	if( value == NULL ) {
 		return def? safe_strdup(def) : NULL;
 	}
 
-	p1 += 2; /* skip key and "=" (safe as find_param checks for its existance) */
-
-	bak = *p2;
-	*p2 = 0;
-	ret = safe_strdup(p1);
-	mr_rtrim(ret); /* to be safe with '\r' characters ... */
-	*p2 = bak;
-	return ret;
+	return safe_strdup(value);
 }
 
 
 int32_t mrparam_get_int(mrparam_t* ths, int key, int32_t def)
 {
-	if( ths == NULL || key == 0 ) {
+	const char* value = get_value(ths, key); /* no need to copy the value */
+
+	if( value == NULL ) {
 		return def;
 	}
 
-    char* str = mrparam_get(ths, key, NULL);
-    if( str == NULL ) {
-		return def;
-    }
-    int32_t ret = atol(str);
-    free(str);
-    return ret;
+	return atol(value);
 }
 
 
 void mrparam_set(mrparam_t* ths, int key, const char* value)
 {
-	char *old1, *old2, *new1 = NULL;
+	int i;
 
-	if( ths == NULL || key == 0 ) {
+	if( ths == NULL || key <= 0 || key > 255 ) {
 		return;
 	}
 
-	old1 = ths->m_packed;
-	old2 = NULL;
+	if( ths->_m_index[key] ) {
+		ths->_m_arena_unused += strlen(get_value(ths, key)) + 1;
+	}
 
-	/* remove existing parameter from packed string, if any */
-	if( old1 ) {
-		char *p1, *p2;
-		p1 = find_param(old1, key, &p2);
-		if( p1 != NULL ) {
-			*p1 = 0;
-			old2 = p2;
-		}
-		else if( value==NULL ) {
+	if( value == NULL )
+	{
+		if( ths->_m_index[key] == 0 ) {
 			return; /* parameter does not exist and should be cleared -> done. */
 		}
-	}
-
-	mr_rtrim(old1); /* trim functions are null-pointer-safe */
-	mr_ltrim(old2);
-
-	if( old1 && old1[0]==0 ) { old1 = NULL; }
-	if( old2 && old2[0]==0 ) { old2 = NULL; }
 
-	/* create new string */
-	if( value ) {
-		new1 = mr_mprintf("%s%s%c=%s%s%s",
-			old1?  old1 : "",
-			old1?  "\n" : "",
-			key,
-			value,
-			old2?  "\n" : "",
-			old2?  old2 : "");
+		ths->_m_index[key] = 0;
+		for( i = 0; i < ths->_m_order_cnt; i++ ) {
+			if( (unsigned char)ths->_m_order[i] == key ) {
+				memmove(&ths->_m_order[i], &ths->_m_order[i+1], ths->_m_order_cnt-i-1);
+				ths->_m_order_cnt--;
+				break;
+			}
+		}
 	}
-	else {
-		new1 = mr_mprintf("%s%s%s",
-			old1?         old1 : "",
-			(old1&&old2)? "\n" : "",
-			old2?         old2 : "");
+	else
+	{
+		if( ths->_m_index[key] == 0 ) {
+			ths->_m_order[ths->_m_order_cnt++] = (char)key; /* new parameters are added to the end, existing ones keep their position */
+		}
+		ths->_m_index[key] = add_to_arena(ths, value, strlen(value)) + 1; /* the old value is not reused */
 	}
 
-	free(ths->m_packed);
-	ths->m_packed = new1;
+	if( ths->_m_arena_used > MR_PARAM_COMPACT_BYTES && ths->_m_arena_unused > ths->_m_arena_used/2 ) {
+		compact_arena(ths);
+	}
+
+	ths->_m_packed_dirty = 1;
 }
 
 
 void mrparam_set_int(mrparam_t* ths, int key, int32_t value)
 {
+	char value_str[16];
+
 	if( ths == NULL || key == 0 ) {
 		return;
 	}
 
-    char* value_str = mr_mprintf("%i", (int)value);
-    if( value_str == NULL ) {
-		return;
-    }
-    mrparam_set(ths, key, value_str);
-    free(value_str);
+	snprintf(value_str, sizeof(value_str), "%i", (int)value);
+	mrparam_set(ths, key, value_str);
 }
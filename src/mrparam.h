@@ -37,7 +37,8 @@ extern "C" {
 #endif
 
 
-#define MRP_FILE              'f'  /* for msgs */
+#define MRP_FILE              'f'  /* for msgs; for jobs: the rendered message to upload */
+#define MRP_FILENAME          'F'  /* for msgs: the original file name if MRP_FILE refers to an identical file of another message, see mrmailbox_ref_msg_file__() */
 #define MRP_WIDTH             'w'  /* for msgs */
 #define MRP_HEIGHT            'h'  /* for msgs */
 #define MRP_DURATION          'd'  /* for msgs */
@@ -50,6 +51,7 @@ extern "C" {
 #define MRP_FORWARDED         'a'  /* for msgs */
 #define MRP_SYSTEM_CMD        'S'  /* for msgs */
 #define MRP_SYSTEM_CMD_PARAM  'E'  /* for msgs */
+#define MRP_REJECTED_RCPTS    'x'  /* for msgs: comma-separated list of recipients rejected by the SMTP server */
 
 #define MRP_SERVER_FOLDER     'Z'  /* for jobs */
 #define MRP_SERVER_UID        'z'  /* for jobs */
@@ -64,7 +66,18 @@ extern "C" {
 
 typedef struct mrparam_t
 {
-	char*    m_packed;    /* != NULL */
+	char*    m_packed;         /* != NULL; after mrparam_set() and Co., this is up to date only after calling mrparam_get_packed() */
+
+	/* the following members should be treated as library private; the parameters are parsed once by mrparam_set_packed(),
+	the packed string is created again only if needed by mrparam_get_packed() */
+	int      _m_packed_dirty;
+	char*    _m_arena;         /* the values, each terminated by a null-character */
+	size_t   _m_arena_used;
+	size_t   _m_arena_size;
+	size_t   _m_arena_unused;  /* bytes of values replaced or removed by mrparam_set() */
+	int      _m_index[256];    /* for each key the offset of the value in _m_arena plus one, 0 if the key is unset */
+	char     _m_order[256];    /* the keys in the order they appear in the packed string */
+	int      _m_order_cnt;
 } mrparam_t;
 
 
@@ -73,6 +86,7 @@ void          mrparam_unref        (mrparam_t*);
 
 void          mrparam_empty        (mrparam_t*);
 void          mrparam_set_packed   (mrparam_t*, const char*); /* overwrites all existing parameters */
+const char*   mrparam_get_packed   (mrparam_t*); /* the result must not be free()'d and is valid until the parameters are modified */
 
 int           mrparam_exists       (mrparam_t*, int key);
 char*         mrparam_get          (mrparam_t*, int key, const char* def); /* the value may be an empty string, "def" is returned only if the value unset.  The result must be free()'d in any case. */
@@ -56,6 +56,280 @@
 static pgp_io_t s_io;
 
 
+/*******************************************************************************
+ * Parsed-key cache
+ ******************************************************************************/
+
+
+/* Parsing keys with pgp_filter_keys_from_mem() is expensive compared to using
+them and the same few keys are used again and again, so we keep the parsed
+keyrings in a process-wide LRU cache keyed by the raw key data.  Users get a
+referenced entry and must not modify the keyrings; keys used by a thread stay
+valid even if they are evicted meanwhile.  The keys are shallow-copied into the
+keyrings passed to netpgp; as netpgp and OpenSSL are not known to only read them,
+an entry is used by one thread at a time, see cached_keys_use(). */
+#define MR_PGP_KEY_CACHE_MAX 32
+
+
+typedef struct mrpgp_cached_key_t
+{
+	struct mrpgp_cached_key_t* m_prev; /* more recently used */
+	struct mrpgp_cached_key_t* m_next; /* less recently used */
+	uint32_t       m_hash;
+	unsigned char* m_binary;
+	int            m_bytes;
+	pgp_keyring_t  m_public_keys;
+	pgp_keyring_t  m_private_keys;
+	int            m_refcnt; /* one for being in the cache plus one for each user */
+	pthread_mutex_t m_use_mutex; /* held while netpgp uses the keyrings */
+} mrpgp_cached_key_t;
+
+
+static pthread_mutex_t     s_key_cache_critical = PTHREAD_MUTEX_INITIALIZER;
+static mrpgp_cached_key_t* s_key_cache_first = NULL;
+static mrpgp_cached_key_t* s_key_cache_last = NULL;
+static int                 s_key_cache_cnt = 0;
+
+
+static uint32_t hash_key_data(const unsigned char* buf, int bytes)
+{
+	uint32_t hash = 2166136261U; /* FNV-1a */
+	int      i;
+	for( i = 0; i < bytes; i++ ) {
+		hash = (hash ^ buf[i]) * 16777619U;
+	}
+	return hash;
+}
+
+
+static void wipe_seckey(pgp_seckey_t* seckey)
+{
+	/* pgp_seckey_free() uses BN_free() which does not clear the memory */
+	switch( seckey->pubkey.alg ) {
+		case PGP_PKA_RSA:
+		case PGP_PKA_RSA_ENCRYPT_ONLY:
+		case PGP_PKA_RSA_SIGN_ONLY:
+			if( seckey->key.rsa.d ) { BN_clear(seckey->key.rsa.d); }
+			if( seckey->key.rsa.p ) { BN_clear(seckey->key.rsa.p); }
+			if( seckey->key.rsa.q ) { BN_clear(seckey->key.rsa.q); }
+			if( seckey->key.rsa.u ) { BN_clear(seckey->key.rsa.u); }
+			break;
+
+		case PGP_PKA_DSA:
+			if( seckey->key.dsa.x ) { BN_clear(seckey->key.dsa.x); }
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+static void cached_key_free(mrpgp_cached_key_t* entry)
+{
+	unsigned i, j;
+
+	for( i = 0; i < entry->m_private_keys.keyc; i++ ) {
+		pgp_key_t* key = &entry->m_private_keys.keys[i];
+		wipe_seckey(&key->key.seckey);
+		for( j = 0; j < key->subkeyc; j++ ) {
+			wipe_seckey(&key->subkeys[j].key.seckey);
+		}
+	}
+
+	pgp_keyring_purge(&entry->m_public_keys);
+	pgp_keyring_purge(&entry->m_private_keys);
+	mr_wipe_secret_mem(entry->m_binary, entry->m_bytes);
+	free(entry->m_binary);
+	pthread_mutex_destroy(&entry->m_use_mutex);
+	free(entry);
+}
+
+
+static void cached_key_unlink__(mrpgp_cached_key_t* entry)
+{
+	if( entry->m_prev ) { entry->m_prev->m_next = entry->m_next; } else { s_key_cache_first = entry->m_next; }
+	if( entry->m_next ) { entry->m_next->m_prev = entry->m_prev; } else { s_key_cache_last = entry->m_prev; }
+	entry->m_prev = NULL;
+	entry->m_next = NULL;
+	s_key_cache_cnt--;
+}
+
+
+static void cached_key_link_first__(mrpgp_cached_key_t* entry)
+{
+	entry->m_prev = NULL;
+	entry->m_next = s_key_cache_first;
+	if( s_key_cache_first ) { s_key_cache_first->m_prev = entry; } else { s_key_cache_last = entry; }
+	s_key_cache_first = entry;
+	s_key_cache_cnt++;
+}
+
+
+static mrpgp_cached_key_t* cached_key_find__(uint32_t hash, const mrkey_t* raw_key)
+{
+	mrpgp_cached_key_t* entry;
+	for( entry = s_key_cache_first; entry; entry = entry->m_next ) {
+		if( entry->m_hash == hash && entry->m_bytes == raw_key->m_bytes
+		 && memcmp(entry->m_binary, raw_key->m_binary, raw_key->m_bytes)==0 ) {
+			cached_key_unlink__(entry);
+			cached_key_link_first__(entry);
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+
+static mrpgp_cached_key_t* cached_key_get(const mrkey_t* raw_key)
+{
+	/* returns the parsed key with an additional reference, the caller must call cached_key_release() */
+	mrpgp_cached_key_t *entry = NULL, *parsed = NULL, *evicted = NULL, *unused = NULL;
+	pgp_memory_t*       keysmem = NULL;
+	uint32_t            hash;
+
+	if( raw_key==NULL || raw_key->m_binary==NULL || raw_key->m_bytes <= 0 ) {
+		return NULL;
+	}
+
+	hash = hash_key_data(raw_key->m_binary, raw_key->m_bytes);
+
+	pthread_mutex_lock(&s_key_cache_critical);
+		if( (entry=cached_key_find__(hash, raw_key))!=NULL ) {
+			entry->m_refcnt++;
+		}
+	pthread_mutex_unlock(&s_key_cache_critical);
+
+	if( entry ) {
+		return entry;
+	}
+
+	/* parse outside of the lock - other threads may need other keys meanwhile */
+	if( (parsed=calloc(1, sizeof(mrpgp_cached_key_t)))==NULL
+	 || (parsed->m_binary=malloc(raw_key->m_bytes))==NULL
+	 || (keysmem=pgp_memory_new())==NULL ) {
+		exit(56); /* cannot allocate little memory, unrecoverable error */
+	}
+	parsed->m_hash   = hash;
+	parsed->m_bytes  = raw_key->m_bytes;
+	parsed->m_refcnt = 2;
+	pthread_mutex_init(&parsed->m_use_mutex, NULL);
+	memcpy(parsed->m_binary, raw_key->m_binary, raw_key->m_bytes);
+
+	pgp_memory_add(keysmem, raw_key->m_binary, raw_key->m_bytes);
+	pgp_filter_keys_from_mem(&s_io, &parsed->m_public_keys, &parsed->m_private_keys, NULL, 0, keysmem); /* function returns 0 on any error in any packet - this does not mean, we cannot use the key. The callers check the details therefore. */
+	pgp_memory_free(keysmem);
+
+	pthread_mutex_lock(&s_key_cache_critical);
+		if( (entry=cached_key_find__(hash, raw_key))!=NULL ) {
+			entry->m_refcnt++; /* another thread was faster */
+			unused = parsed;
+		}
+		else {
+			entry = parsed;
+			cached_key_link_first__(entry);
+			if( s_key_cache_cnt > MR_PGP_KEY_CACHE_MAX ) {
+				evicted = s_key_cache_last;
+				cached_key_unlink__(evicted);
+				if( --evicted->m_refcnt > 0 ) {
+					evicted = NULL; /* still in use, freed by the last cached_key_release() */
+				}
+			}
+		}
+	pthread_mutex_unlock(&s_key_cache_critical);
+
+	if( unused )  { cached_key_free(unused); }
+	if( evicted ) { cached_key_free(evicted); }
+	return entry;
+}
+
+
+static void cached_key_release(mrpgp_cached_key_t* entry)
+{
+	int refcnt;
+
+	if( entry == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&s_key_cache_critical);
+		refcnt = --entry->m_refcnt;
+	pthread_mutex_unlock(&s_key_cache_critical);
+
+	if( refcnt <= 0 ) {
+		cached_key_free(entry);
+	}
+}
+
+
+static void cached_key_clear(void)
+{
+	mrpgp_cached_key_t *entry, *to_free = NULL;
+
+	pthread_mutex_lock(&s_key_cache_critical);
+		while( (entry=s_key_cache_first)!=NULL ) {
+			cached_key_unlink__(entry);
+			if( --entry->m_refcnt <= 0 ) {
+				entry->m_next = to_free;
+				to_free = entry;
+			}
+		}
+	pthread_mutex_unlock(&s_key_cache_critical);
+
+	while( (entry=to_free)!=NULL ) {
+		to_free = entry->m_next;
+		cached_key_free(entry);
+	}
+}
+
+
+static void cached_keys_use(mrpgp_cached_key_t** entries, int cnt, mrpgp_cached_key_t* extra, int lock)
+{
+	/* lock or unlock the given entries and `extra`, NULL entries are ignored.  The entries are locked ordered by their address,
+	so threads using several keys cannot deadlock; an entry given several times is locked once */
+	uintptr_t prev = 0, next, curr;
+	int       i;
+
+	while( 1 )
+	{
+		next = 0;
+		for( i = 0; i <= cnt; i++ ) {
+			curr = (uintptr_t)(i < cnt? entries[i] : extra);
+			if( curr > prev && (next == 0 || curr < next) ) {
+				next = curr;
+			}
+		}
+
+		if( next == 0 ) {
+			break;
+		}
+
+		if( lock ) {
+			pthread_mutex_lock(&((mrpgp_cached_key_t*)next)->m_use_mutex);
+		}
+		else {
+			pthread_mutex_unlock(&((mrpgp_cached_key_t*)next)->m_use_mutex);
+		}
+		prev = next;
+	}
+}
+
+
+static void add_keys_from_cache(pgp_keyring_t* dst, const pgp_keyring_t* src)
+{
+	/* the keys are only referenced, free `dst` using pgp_keyring_free(), _not_ pgp_keyring_purge() */
+	unsigned i;
+	for( i = 0; i < src->keyc; i++ ) {
+		pgp_keyring_add(dst, &src->keys[i]);
+	}
+}
+
+
+/*******************************************************************************
+ * Main interface
+ ******************************************************************************/
+
+
 void mrpgp_init(mrmailbox_t* mailbox)
 {
 	SSL_library_init(); /* older, but more compatible function, simply defined as OPENSSL_init_ssl().
@@ -73,6 +347,7 @@ void mrpgp_init(mrmailbox_t* mailbox)
 
 void mrpgp_exit(mrmailbox_t* mailbox)
 {
+	cached_key_clear();
 }
 
 
@@ -304,73 +579,60 @@ cleanup:
 
 int mrpgp_is_valid_key(mrmailbox_t* mailbox, const mrkey_t* raw_key)
 {
-	int             key_is_valid = 0;
-	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_memory_t*   keysmem = pgp_memory_new();
+	int                 key_is_valid = 0;
+	mrpgp_cached_key_t* parsed = NULL;
 
 	if( mailbox==NULL || raw_key==NULL
-	 || raw_key->m_binary == NULL || raw_key->m_bytes <= 0
-	 || public_keys==NULL || private_keys==NULL || keysmem==NULL ) {
+	 || (parsed=cached_key_get(raw_key))==NULL ) {
 		goto cleanup;
 	}
 
-	pgp_memory_add(keysmem, raw_key->m_binary, raw_key->m_bytes);
-
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys, NULL, 0, keysmem); /* function returns 0 on any error in any packet - this does not mean, we cannot use the key. We check the details below therefore. */
-
-	if( raw_key->m_type == MR_PUBLIC && public_keys->keyc >= 1 ) {
+	if( raw_key->m_type == MR_PUBLIC && parsed->m_public_keys.keyc >= 1 ) {
 		key_is_valid = 1;
 	}
-	else if( raw_key->m_type == MR_PRIVATE && private_keys->keyc >= 1 ) {
+	else if( raw_key->m_type == MR_PRIVATE && parsed->m_private_keys.keyc >= 1 ) {
 		key_is_valid = 1;
 	}
 
 cleanup:
-	if( keysmem )      { pgp_memory_free(keysmem); }
-	if( public_keys )  { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
-	if( private_keys ) { pgp_keyring_purge(private_keys); free(private_keys); }
+	cached_key_release(parsed);
 	return key_is_valid;
 }
 
 
 int mrpgp_calc_fingerprint(mrmailbox_t* mailbox, const mrkey_t* raw_key, uint8_t** ret_fingerprint, size_t* ret_fingerprint_bytes)
 {
-	int             success = 0;
-	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_memory_t*   keysmem = pgp_memory_new();
+	int                 success = 0;
+	mrpgp_cached_key_t* parsed = NULL;
+	pgp_fingerprint_t   fingerprint;
+	int                 fingerprint_ok;
 
 	if( mailbox==NULL || raw_key==NULL || ret_fingerprint==NULL || *ret_fingerprint!=NULL || ret_fingerprint_bytes==NULL || *ret_fingerprint_bytes!=0
-	 || raw_key->m_binary == NULL || raw_key->m_bytes <= 0
-	 || public_keys==NULL || private_keys==NULL || keysmem==NULL ) {
+	 || (parsed=cached_key_get(raw_key))==NULL ) {
 		goto cleanup;
 	}
 
-	pgp_memory_add(keysmem, raw_key->m_binary, raw_key->m_bytes);
-
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys, NULL, 0, keysmem);
-
-	if( raw_key->m_type != MR_PUBLIC || public_keys->keyc <= 0 ) {
+	if( raw_key->m_type != MR_PUBLIC || parsed->m_public_keys.keyc <= 0 ) {
 		goto cleanup;
 	}
 
-	pgp_key_t* key0 = &public_keys->keys[0];
-	pgp_pubkey_t* pubkey0 = &key0->key.pubkey;
-	if( !pgp_fingerprint(&key0->pubkeyfpr, pubkey0, 0) ) {
+	/* calculate into a local structure, the cached key may be used by other threads at the same time */
+	memset(&fingerprint, 0, sizeof(pgp_fingerprint_t));
+	cached_keys_use(&parsed, 1, NULL, 1);
+		fingerprint_ok = pgp_fingerprint(&fingerprint, &parsed->m_public_keys.keys[0].key.pubkey, 0);
+	cached_keys_use(&parsed, 1, NULL, 0);
+	if( !fingerprint_ok ) {
 		goto cleanup;
 	}
 
-	*ret_fingerprint_bytes = key0->pubkeyfpr.length;
+	*ret_fingerprint_bytes = fingerprint.length;
     *ret_fingerprint = malloc(*ret_fingerprint_bytes);
-	memcpy(*ret_fingerprint, key0->pubkeyfpr.fingerprint, *ret_fingerprint_bytes);
+	memcpy(*ret_fingerprint, fingerprint.fingerprint, *ret_fingerprint_bytes);
 
 	success = 1;
 
 cleanup:
-	if( keysmem )      { pgp_memory_free(keysmem); }
-	if( public_keys )  { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
-	if( private_keys ) { pgp_keyring_purge(private_keys); free(private_keys); }
+	cached_key_release(parsed);
 	return success;
 }
 
@@ -436,16 +698,16 @@ int mrpgp_pk_encrypt(  mrmailbox_t*       mailbox,
                        void**             ret_ctext,
                        size_t*            ret_ctext_bytes)
 {
-	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  dummy_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_memory_t*   keysmem = pgp_memory_new();
-	pgp_memory_t*   signedmem = NULL;
-	int             i, success = 0;
+	pgp_keyring_t*       public_keys = calloc(1, sizeof(pgp_keyring_t)); /* references keys from the cache, do not purge */
+	mrpgp_cached_key_t** parsed_public = NULL;
+	mrpgp_cached_key_t*  parsed_private = NULL;
+	pgp_memory_t*        signedmem = NULL;
+	int                  i, private_keyc = 0, keys_locked = 0, success = 0;
 
 	if( mailbox==NULL || plain_text==NULL || plain_bytes==0 || ret_ctext==NULL || ret_ctext_bytes==NULL
 	 || raw_public_keys_for_encryption==NULL || raw_public_keys_for_encryption->m_count<=0
-	 || keysmem==NULL || public_keys==NULL || private_keys==NULL || dummy_keys==NULL ) {
+	 || public_keys==NULL
+	 || (parsed_public=calloc(raw_public_keys_for_encryption->m_count, sizeof(mrpgp_cached_key_t*)))==NULL ) {
 		goto cleanup;
 	}
 
@@ -454,31 +716,36 @@ int mrpgp_pk_encrypt(  mrmailbox_t*       mailbox,
 
 	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
 	for( i = 0; i < raw_public_keys_for_encryption->m_count; i++ ) {
-		pgp_memory_add(keysmem, raw_public_keys_for_encryption->m_keys[i]->m_binary, raw_public_keys_for_encryption->m_keys[i]->m_bytes);
+		if( (parsed_public[i]=cached_key_get(raw_public_keys_for_encryption->m_keys[i]))!=NULL ) {
+			add_keys_from_cache(public_keys, &parsed_public[i]->m_public_keys);
+			private_keyc += parsed_public[i]->m_private_keys.keyc; /* should stay 0 */
+		}
 	}
 
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys/*should stay empty*/, NULL, 0, keysmem);
-	if( public_keys->keyc <=0 || private_keys->keyc!=0 ) {
-		mrmailbox_log_warning(mailbox, 0, "Encryption-keyring contains unexpected data (%i/%i)", public_keys->keyc, private_keys->keyc);
+	if( public_keys->keyc <=0 || private_keyc!=0 ) {
+		mrmailbox_log_warning(mailbox, 0, "Encryption-keyring contains unexpected data (%i/%i)", public_keys->keyc, private_keyc);
 		goto cleanup;
 	}
 
+	if( raw_private_key_for_signing ) {
+		if( (parsed_private=cached_key_get(raw_private_key_for_signing))==NULL
+		 || parsed_private->m_private_keys.keyc <= 0 ) {
+			mrmailbox_log_warning(mailbox, 0, "No key for signing found.");
+			goto cleanup;
+		}
+	}
+
+	cached_keys_use(parsed_public, raw_public_keys_for_encryption->m_count, parsed_private, 1);
+	keys_locked = 1;
+
 	/* encrypt */
 	{
 		const void* signed_text = NULL;
 		size_t      signed_bytes = 0;
 		int         encrypt_raw_packet = 0;
 
-		if( raw_private_key_for_signing ) {
-			pgp_memory_clear(keysmem);
-			pgp_memory_add(keysmem, raw_private_key_for_signing->m_binary, raw_private_key_for_signing->m_bytes);
-			pgp_filter_keys_from_mem(&s_io, dummy_keys, private_keys, NULL, 0, keysmem);
-			if( private_keys->keyc <= 0 ) {
-				mrmailbox_log_warning(mailbox, 0, "No key for signing found.");
-				goto cleanup;
-			}
-
-			pgp_key_t* sk0 = &private_keys->keys[0];
+		if( parsed_private ) {
+			pgp_key_t* sk0 = &parsed_private->m_private_keys.keys[0];
 			signedmem = pgp_sign_buf(&s_io, plain_text, plain_bytes, &sk0->key.seckey, time(NULL)/*birthtime*/, 0/*duration*/, "sha1", 0/*armored*/, 0/*cleartext*/);
 			if( signedmem == NULL ) {
 				mrmailbox_log_warning(mailbox, 0, "Signing failed.");
@@ -507,11 +774,16 @@ int mrpgp_pk_encrypt(  mrmailbox_t*       mailbox,
 	success = 1;
 
 cleanup:
-	if( keysmem )      { pgp_memory_free(keysmem); }
+	if( keys_locked )  { cached_keys_use(parsed_public, raw_public_keys_for_encryption->m_count, parsed_private, 0); }
 	if( signedmem )    { pgp_memory_free(signedmem); }
-	if( public_keys )  { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
-	if( private_keys ) { pgp_keyring_purge(private_keys); free(private_keys); }
-	if( dummy_keys )   { pgp_keyring_purge(dummy_keys); free(dummy_keys); }
+	if( public_keys )  { pgp_keyring_free(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
+	if( parsed_public ) {
+		for( i = 0; i < raw_public_keys_for_encryption->m_count; i++ ) {
+			cached_key_release(parsed_public[i]);
+		}
+		free(parsed_public);
+	}
+	cached_key_release(parsed_private);
 	return success;
 }
 
@@ -526,18 +798,19 @@ int mrpgp_pk_decrypt(  mrmailbox_t*       mailbox,
                        size_t*            ret_plain_bytes,
                        int*               ret_validation_errors)
 {
-	pgp_keyring_t*    public_keys = calloc(1, sizeof(pgp_keyring_t)); /*should be 0 after parsing*/
-	pgp_keyring_t*    private_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*    dummy_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_validation_t* vresult = calloc(1, sizeof(pgp_validation_t));
-	key_id_t*         recipients_key_ids = NULL;
-	unsigned          recipients_count = 0;
-	pgp_memory_t*     keysmem = pgp_memory_new();
-	int               i, success = 0;
+	pgp_keyring_t*       public_keys = calloc(1, sizeof(pgp_keyring_t)); /* references keys from the cache, do not purge */
+	pgp_keyring_t*       private_keys = calloc(1, sizeof(pgp_keyring_t)); /* - " - */
+	mrpgp_cached_key_t** parsed_private = NULL;
+	mrpgp_cached_key_t*  parsed_public = NULL;
+	pgp_validation_t*    vresult = calloc(1, sizeof(pgp_validation_t));
+	key_id_t*            recipients_key_ids = NULL;
+	unsigned             recipients_count = 0;
+	int                  i, keys_locked = 0, success = 0;
 
 	if( mailbox==NULL || ctext==NULL || ctext_bytes==0 || ret_plain==NULL || ret_plain_bytes==NULL || ret_validation_errors==NULL
 	 || raw_private_keys_for_decryption==NULL || raw_private_keys_for_decryption->m_count<=0
-	 || vresult==NULL || keysmem==NULL || public_keys==NULL || private_keys==NULL ) {
+	 || vresult==NULL || public_keys==NULL || private_keys==NULL
+	 || (parsed_private=calloc(raw_private_keys_for_decryption->m_count, sizeof(mrpgp_cached_key_t*)))==NULL ) {
 		goto cleanup;
 	}
 
@@ -546,21 +819,25 @@ int mrpgp_pk_decrypt(  mrmailbox_t*       mailbox,
 
 	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
 	for( i = 0; i < raw_private_keys_for_decryption->m_count; i++ ) {
-		pgp_memory_add(keysmem, raw_private_keys_for_decryption->m_keys[i]->m_binary, raw_private_keys_for_decryption->m_keys[i]->m_bytes);
+		if( (parsed_private[i]=cached_key_get(raw_private_keys_for_decryption->m_keys[i]))!=NULL ) {
+			add_keys_from_cache(private_keys, &parsed_private[i]->m_private_keys);
+		}
 	}
 
-	pgp_filter_keys_from_mem(&s_io, dummy_keys/*should stay empty*/, private_keys, NULL, 0, keysmem);
 	if( private_keys->keyc<=0 ) {
 		mrmailbox_log_warning(mailbox, 0, "Decryption-keyring contains unexpected data (%i/%i)", public_keys->keyc, private_keys->keyc);
 		goto cleanup;
 	}
 
 	if( raw_public_key_for_validation ) {
-		pgp_memory_clear(keysmem);
-		pgp_memory_add(keysmem, raw_public_key_for_validation->m_binary, raw_public_key_for_validation->m_bytes);
-		pgp_filter_keys_from_mem(&s_io, public_keys, dummy_keys/*should stay empty*/, NULL, 0, keysmem);
+		if( (parsed_public=cached_key_get(raw_public_key_for_validation))!=NULL ) {
+			add_keys_from_cache(public_keys, &parsed_public->m_public_keys);
+		}
 	}
 
+	cached_keys_use(parsed_private, raw_private_keys_for_decryption->m_count, parsed_public, 1);
+	keys_locked = 1;
+
 	/* decrypt */
 	{
 		pgp_memory_t* outmem = pgp_decrypt_and_validate_buf(&s_io, vresult, ctext, ctext_bytes, private_keys, public_keys,
@@ -600,10 +877,16 @@ int mrpgp_pk_decrypt(  mrmailbox_t*       mailbox,
 	success = 1;
 
 cleanup:
-	if( keysmem )            { pgp_memory_free(keysmem); }
-	if( public_keys )        { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
-	if( private_keys )       { pgp_keyring_purge(private_keys); free(private_keys); }
-	if( dummy_keys )         { pgp_keyring_purge(dummy_keys); free(dummy_keys); }
+	if( keys_locked )        { cached_keys_use(parsed_private, raw_private_keys_for_decryption->m_count, parsed_public, 0); }
+	if( public_keys )        { pgp_keyring_free(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
+	if( private_keys )       { pgp_keyring_free(private_keys); free(private_keys); }
+	if( parsed_private ) {
+		for( i = 0; i < raw_private_keys_for_decryption->m_count; i++ ) {
+			cached_key_release(parsed_private[i]);
+		}
+		free(parsed_private);
+	}
+	cached_key_release(parsed_public);
 	if( vresult )            { pgp_validate_result_free(vresult); }
 	if( recipients_key_ids ) { free(recipients_key_ids); }
 	return success;
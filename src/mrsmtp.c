@@ -40,6 +40,8 @@
 #define LOCK_SMTP   pthread_mutex_lock(&ths->m_mutex); smtp_locked = 1;
 #define UNLOCK_SMTP if( smtp_locked ) { pthread_mutex_unlock(&ths->m_mutex); smtp_locked = 0; }
 
+#define MR_SMTP_CHECK_AFTER_SECONDS 60 /* sessions unused for this time are checked using NOOP before they are reused, servers close idle sessions after some minutes */
+
 
 /*******************************************************************************
  * Main interface
@@ -84,6 +86,40 @@ int mrsmtp_is_connected(const mrsmtp_t* ths)
 }
 
 
+int mrsmtp_check_connection(mrsmtp_t* ths)
+{
+	/* returns 1 if the session can be reused for sending; if the server has closed the session in between, we disconnect and return 0,
+	so that the caller connects again at once instead of failing on the next MAIL FROM */
+	int smtp_locked = 0, connected = 0;
+
+	if( ths == NULL ) {
+		return 0;
+	}
+
+	LOCK_SMTP
+
+		if( ths->m_hEtpan == NULL ) {
+			goto cleanup;
+		}
+
+		if( time(NULL)-ths->m_last_use >= MR_SMTP_CHECK_AFTER_SECONDS ) {
+			if( mailsmtp_noop(ths->m_hEtpan) != MAILSMTP_NO_ERROR ) {
+				mrmailbox_log_info(ths->m_mailbox, 0, "SMTP-session lost, reconnecting.");
+				mailsmtp_free(ths->m_hEtpan);
+				ths->m_hEtpan = NULL;
+				goto cleanup;
+			}
+			ths->m_last_use = time(NULL);
+		}
+
+		connected = 1;
+
+cleanup:
+	UNLOCK_SMTP
+	return connected;
+}
+
+
 static void body_progress(size_t current, size_t maximum, void* user_data)
 {
 	#if DEBUG_SMTP
@@ -210,6 +246,7 @@ int mrsmtp_connect(mrsmtp_t* ths, const mrloginparam_t* lp)
 			mrmailbox_log_info(ths->m_mailbox, 0, "SMTP-Login ok.");
 		}
 
+		ths->m_last_use = time(NULL);
 		success = 1;
 
 cleanup:
@@ -251,17 +288,40 @@ void mrsmtp_disconnect(mrsmtp_t* ths)
  ******************************************************************************/
 
 
-int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not_terminated, size_t data_bytes)
+static int is_connection_error(int r)
 {
-	int           success = 0, r, smtp_locked = 0;
-	clistiter*    iter;
+	/* errors after which the session cannot be used further; on other errors, the server has just rejected the message */
+	return (r==MAILSMTP_ERROR_STREAM || r==MAILSMTP_ERROR_SERVICE_NOT_AVAILABLE || r==MAILSMTP_ERROR_UNEXPECTED_CODE || r==MAILSMTP_ERROR_MEMORY);
+}
+
+
+int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not_terminated, size_t data_bytes, char** ret_rejected)
+{
+	/* the message is sent if at least one recipient is accepted; recipients rejected by the server are reported one by one
+	and, if ret_rejected is given, returned as a comma-separated list */
+	int            ret = MR_SMTP_CONNECTION_ERROR, r = MAILSMTP_NO_ERROR, smtp_locked = 0, i, rcpt_cnt, rcpt_accepted = 0;
+	clistiter*     iter;
+	clist*         addresses = NULL;
+	int*           rcpt_errors = NULL;
+	mrstrbuilder_t rejected;
+
+	mrstrbuilder_init(&rejected);
+
+	if( ret_rejected ) {
+		*ret_rejected = NULL;
+	}
 
 	if( ths == NULL ) {
-		return 0;
+		return MR_SMTP_CONNECTION_ERROR;
 	}
 
 	if( recipients == NULL || clist_count(recipients)==0 || data_not_terminated == NULL || data_bytes == 0 ) {
-		return 1; /* "null message" send */
+		return MR_SMTP_SENT; /* "null message" send */
+	}
+
+	rcpt_cnt = clist_count(recipients);
+	if( (rcpt_errors=calloc(rcpt_cnt, sizeof(int)))==NULL ) {
+		exit(67); /* cannot allocate little memory, unrecoverable error */
 	}
 
 	LOCK_SMTP
@@ -270,34 +330,86 @@ int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not
 			goto cleanup;
 		}
 
-		/* set source */
-		if( (r=(ths->m_esmtp?
-				mailesmtp_mail(ths->m_hEtpan, ths->m_from, 1, "etPanSMTPTest") :
-				 mailsmtp_mail(ths->m_hEtpan, ths->m_from))) != MAILSMTP_NO_ERROR )
+		if( ths->m_esmtp && (ths->m_hEtpan->esmtp&MAILSMTP_ESMTP_PIPELINING) )
 		{
-			// this error is very usual - we've simply lost the server connection and reconnect as soon as possible.
-			// so, we do not log the first time this happens
-			mrmailbox_log_error_if(&ths->m_log_usual_error, ths->m_mailbox, 0, "mailsmtp_mail: %s, %s (%i)", ths->m_from, mailsmtp_strerror(r), (int)r);
-			ths->m_log_usual_error = 1;
-			goto cleanup;
+			/* send MAIL FROM, all RCPT TO and DATA with a single round trip, see RFC 2920 */
+			addresses = esmtp_address_list_new();
+			for( iter=clist_begin(recipients); iter!=NULL; iter=clist_next(iter)) {
+				esmtp_address_list_add(addresses, (char*)clist_content(iter), MAILSMTP_DSN_NOTIFY_FAILURE|MAILSMTP_DSN_NOTIFY_DELAY, NULL);
+			}
+
+			r = mailesmtp_mail_rcpt_data_pipelined(ths->m_hEtpan, ths->m_from, 1, "etPanSMTPTest", 0, addresses, rcpt_errors);
+
+			for( i = 0; i < rcpt_cnt; i++ ) {
+				if( rcpt_errors[i] == MAILSMTP_NO_ERROR ) {
+					rcpt_accepted++;
+				}
+			}
+
+			/* if no recipient is accepted, DATA is rejected with 503 or 554 and the recipients are reported below;
+			other errors are errors of MAIL FROM or of the connection */
+			if( r != MAILSMTP_NO_ERROR
+			 && (rcpt_accepted>0 || (r!=MAILSMTP_ERROR_BAD_SEQUENCE_OF_COMMAND && r!=MAILSMTP_ERROR_TRANSACTION_FAILED)) ) {
+				mrmailbox_log_error_if(&ths->m_log_usual_error, ths->m_mailbox, 0, "mailesmtp_mail_rcpt_data_pipelined: %s, %s (%i)", ths->m_from, mailsmtp_strerror(r), (int)r);
+				ths->m_log_usual_error = 1;
+				goto cleanup;
+			}
+
+			ths->m_log_usual_error = 0;
 		}
+		else
+		{
+			/* set source */
+			if( (r=(ths->m_esmtp?
+					mailesmtp_mail(ths->m_hEtpan, ths->m_from, 1, "etPanSMTPTest") :
+					 mailsmtp_mail(ths->m_hEtpan, ths->m_from))) != MAILSMTP_NO_ERROR )
+			{
+				// this error is very usual - we've simply lost the server connection and reconnect as soon as possible.
+				// so, we do not log the first time this happens
+				mrmailbox_log_error_if(&ths->m_log_usual_error, ths->m_mailbox, 0, "mailsmtp_mail: %s, %s (%i)", ths->m_from, mailsmtp_strerror(r), (int)r);
+				ths->m_log_usual_error = 1;
+				goto cleanup;
+			}
 
-		ths->m_log_usual_error = 0;
+			ths->m_log_usual_error = 0;
 
-		/* set recipients */
-		for( iter=clist_begin(recipients); iter!=NULL; iter=clist_next(iter)) {
-			const char* rcpt = clist_content(iter);
-			if( (r = (ths->m_esmtp?
+			/* set recipients */
+			for( iter=clist_begin(recipients), i=0; iter!=NULL; iter=clist_next(iter), i++) {
+				const char* rcpt = clist_content(iter);
+				rcpt_errors[i] = (ths->m_esmtp?
 					 mailesmtp_rcpt(ths->m_hEtpan, rcpt, MAILSMTP_DSN_NOTIFY_FAILURE|MAILSMTP_DSN_NOTIFY_DELAY, NULL) :
-					  mailsmtp_rcpt(ths->m_hEtpan, rcpt))) != MAILSMTP_NO_ERROR) {
-				mrmailbox_log_error_if(&ths->m_log_connect_errors, ths->m_mailbox, 0, "mailsmtp_rcpt: %s: %s", rcpt, mailsmtp_strerror(r));
-				goto cleanup;
+					  mailsmtp_rcpt(ths->m_hEtpan, rcpt));
+				if( is_connection_error(rcpt_errors[i]) ) {
+					r = rcpt_errors[i];
+					mrmailbox_log_error_if(&ths->m_log_connect_errors, ths->m_mailbox, 0, "mailsmtp_rcpt: %s: %s", rcpt, mailsmtp_strerror(r));
+					goto cleanup;
+				}
+				else if( rcpt_errors[i] == MAILSMTP_NO_ERROR ) {
+					rcpt_accepted++;
+				}
+			}
+
+			/* message */
+			if( rcpt_accepted > 0 ) {
+				if ((r = mailsmtp_data(ths->m_hEtpan)) != MAILSMTP_NO_ERROR) {
+					fprintf(stderr, "mailsmtp_data: %s\n", mailsmtp_strerror(r));
+					goto cleanup;
+				}
 			}
 		}
 
-		/* message */
-		if ((r = mailsmtp_data(ths->m_hEtpan)) != MAILSMTP_NO_ERROR) {
-			fprintf(stderr, "mailsmtp_data: %s\n", mailsmtp_strerror(r));
+		for( iter=clist_begin(recipients), i=0; iter!=NULL; iter=clist_next(iter), i++) {
+			if( rcpt_errors[i] != MAILSMTP_NO_ERROR ) {
+				mrmailbox_log_error(ths->m_mailbox, 0, "SMTP-server rejects recipient %s: %s", (const char*)clist_content(iter), mailsmtp_strerror(rcpt_errors[i]));
+				if( rejected.m_buf[0] ) {
+					mrstrbuilder_cat(&rejected, ",");
+				}
+				mrstrbuilder_cat(&rejected, (const char*)clist_content(iter));
+			}
+		}
+
+		if( rcpt_accepted == 0 ) {
+			r = MAILSMTP_ERROR_MAILBOX_UNAVAILABLE; /* not sent to anyone, the message is tried again later; the session is reset below */
 			goto cleanup;
 		}
 
@@ -306,12 +418,33 @@ int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not
 			goto cleanup;
 		}
 
-		success = 1;
+		ths->m_last_use = time(NULL);
+		ret = MR_SMTP_SENT;
 
 cleanup:
 
+	/* if the server has only rejected the message (eg. it is too large or no recipient is accepted), the session can be used for the next message;
+	the transaction is reset in case it was left open */
+	if( ret != MR_SMTP_SENT && ths->m_hEtpan && !is_connection_error(r) ) {
+		if( mailsmtp_reset(ths->m_hEtpan) == MAILSMTP_NO_ERROR ) {
+			ths->m_last_use = time(NULL);
+			ret = MR_SMTP_REJECTED;
+		}
+	}
+
 	UNLOCK_SMTP
 
-	return success;
-}
+	if( ret_rejected && rejected.m_buf[0] ) {
+		*ret_rejected = rejected.m_buf;
+	}
+	else {
+		free(rejected.m_buf);
+	}
+
+	if( addresses ) {
+		esmtp_address_list_free(addresses);
+	}
+	free(rcpt_errors);
 
+	return ret;
+}
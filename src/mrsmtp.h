@@ -48,15 +48,21 @@ typedef struct mrsmtp_t
 	int             m_log_connect_errors;
 	int             m_log_usual_error;
 
+	time_t          m_last_use;      /* the session is reused for several messages, see mrsmtp_check_connection() */
+
 	mrmailbox_t*    m_mailbox;
 } mrsmtp_t;
 
 mrsmtp_t*    mrsmtp_new          (mrmailbox_t*);
 void         mrsmtp_unref        (mrsmtp_t*);
 int          mrsmtp_is_connected (const mrsmtp_t*);
+int          mrsmtp_check_connection (mrsmtp_t*);
 int          mrsmtp_connect      (mrsmtp_t*, const mrloginparam_t*);
 void         mrsmtp_disconnect   (mrsmtp_t*);
-int          mrsmtp_send_msg     (mrsmtp_t*, const clist* recipients, const char* data, size_t data_bytes);
+#define      MR_SMTP_SENT              1
+#define      MR_SMTP_REJECTED          0  /* the server rejected the message, eg. it is too large or no recipient is accepted; the session can be used further */
+#define      MR_SMTP_CONNECTION_ERROR -1  /* the session should be disconnected */
+int          mrsmtp_send_msg     (mrsmtp_t*, const clist* recipients, const char* data, size_t data_bytes, char** ret_rejected); /* returns MR_SMTP_*; *ret_rejected must be free()'d */
 
 
 #ifdef __cplusplus
@@ -31,6 +31,11 @@
  *   (normally 2 MB cache, 1 KB page size on sqlite < 3.12.0, 4 KB for newer
  *   versions)
  *
+ * - We use `PRAGMA journal_mode=WAL`: the one writing connection and the
+ *   read-only connections in m_readers[] do not block each other, see
+ *   mrsqlite3_lock_read().  As the journal mode is persistent, all other
+ *   connections to the database file use WAL, too.
+ *
  * - We use `sqlite3_last_insert_rowid()` to find out created records - for this
  *   purpose, the primary ID has to be marked using `INTEGER PRIMARY KEY`, see
  *   https://www.sqlite.org/c3ref/last_insert_rowid.html
@@ -49,6 +54,7 @@
 #include "mrtools.h"
 #include "mrchat.h"
 #include "mrcontact.h"
+#include "mrjob.h"
 
 
 /*******************************************************************************
@@ -70,6 +76,17 @@ void mrsqlite3_log_error(mrsqlite3_t* ths, const char* msg_format, ...)
 }
 
 
+static mrsqlite3_t* get_conn(mrsqlite3_t* ths)
+{
+	/* returns the read-only connection bound to the calling thread by mrsqlite3_lock_read() or the writing connection */
+	mrsqlite3_t* reader;
+	if( ths->m_reader_key_created && (reader=(mrsqlite3_t*)pthread_getspecific(ths->m_reader_key))!=NULL ) {
+		return reader;
+	}
+	return ths;
+}
+
+
 sqlite3_stmt* mrsqlite3_prepare_v2_(mrsqlite3_t* ths, const char* querystr)
 {
 	sqlite3_stmt* retStmt = NULL;
@@ -78,6 +95,8 @@ sqlite3_stmt* mrsqlite3_prepare_v2_(mrsqlite3_t* ths, const char* querystr)
 		return NULL;
 	}
 
+	ths = get_conn(ths);
+
 	if( sqlite3_prepare_v2(ths->m_cobj,
 	         querystr, -1 /*read `sql` up to the first null-byte*/,
 	         &retStmt,
@@ -124,10 +143,19 @@ cleanup:
  ******************************************************************************/
 
 
+/* an entry of m_files_to_delete, see mrsqlite3_delete_file_on_commit__() */
+typedef struct mrsqlite3_file_t
+{
+	char* m_pathNfilename;
+	int   m_level; /* the value of m_transactionCount when the file was added */
+} mrsqlite3_file_t;
+
+
 mrsqlite3_t* mrsqlite3_new(mrmailbox_t* mailbox)
 {
-	mrsqlite3_t* ths = NULL;
-	int          i;
+	mrsqlite3_t*        ths = NULL;
+	int                 i;
+	pthread_mutexattr_t attr;
 
 	if( (ths=calloc(1, sizeof(mrsqlite3_t)))==NULL ) {
 		exit(24); /* cannot allocate little memory, unrecoverable error */
@@ -139,7 +167,23 @@ mrsqlite3_t* mrsqlite3_new(mrmailbox_t* mailbox)
 		ths->m_pd[i] = NULL;
 	}
 
-	pthread_mutex_init(&ths->m_critical_, NULL);
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE); /* the thread receiving messages in bulk mode holds the lock over several calls, see receive_imf() */
+	pthread_mutex_init(&ths->m_critical_, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_mutex_init(&ths->m_config_cache_mutex, NULL);
+
+	for( i = 0; i < MR_SQLITE_READERS; i++ ) {
+		if( (ths->m_readers[i]=calloc(1, sizeof(mrsqlite3_t)))==NULL ) {
+			exit(48); /* cannot allocate little memory, unrecoverable error */
+		}
+		ths->m_readers[i]->m_mailbox = mailbox;
+		pthread_mutex_init(&ths->m_readers[i]->m_critical_, NULL);
+	}
+
+	if( pthread_key_create(&ths->m_reader_key, NULL) == 0 ) {
+		ths->m_reader_key_created = 1;
+	}
 
 	return ths;
 }
@@ -147,6 +191,8 @@ mrsqlite3_t* mrsqlite3_new(mrmailbox_t* mailbox)
 
 void mrsqlite3_unref(mrsqlite3_t* ths)
 {
+	int i;
+
 	if( ths == NULL ) {
 		return;
 	}
@@ -157,11 +203,126 @@ void mrsqlite3_unref(mrsqlite3_t* ths)
 		pthread_mutex_unlock(&ths->m_critical_);
 	}
 
+	for( i = 0; i < MR_SQLITE_READERS; i++ ) {
+		if( ths->m_readers[i] ) {
+			pthread_mutex_destroy(&ths->m_readers[i]->m_critical_);
+			free(ths->m_readers[i]);
+		}
+	}
+
+	if( ths->m_reader_key_created ) {
+		pthread_key_delete(ths->m_reader_key);
+	}
+
+	if( ths->m_files_to_delete ) {
+		carray_free(ths->m_files_to_delete); /* emptied by mrsqlite3_close__() */
+	}
+
+	pthread_mutex_destroy(&ths->m_config_cache_mutex);
 	pthread_mutex_destroy(&ths->m_critical_);
 	free(ths);
 }
 
 
+static void close_reader(mrsqlite3_t* reader)
+{
+	int i;
+
+	pthread_mutex_lock(&reader->m_critical_); /* wait until the reader is no longer used */
+
+		for( i = 0; i < PREDEFINED_CNT; i++ ) {
+			if( reader->m_pd[i] ) {
+				sqlite3_finalize(reader->m_pd[i]);
+				reader->m_pd[i] = NULL;
+			}
+		}
+
+		if( reader->m_cobj ) {
+			sqlite3_close(reader->m_cobj);
+			reader->m_cobj = NULL;
+		}
+
+	pthread_mutex_unlock(&reader->m_critical_);
+}
+
+
+static void open_readers__(mrsqlite3_t* ths, const char* dbfile)
+{
+	/* open the read-only connections; this is done after the tables are created or updated.  On errors, the writing
+	connection is used for reading, see mrsqlite3_lock_read() */
+	int i;
+
+	for( i = 0; i < MR_SQLITE_READERS; i++ )
+	{
+		mrsqlite3_t* reader = ths->m_readers[i];
+
+		pthread_mutex_lock(&reader->m_critical_);
+
+			if( sqlite3_open_v2(dbfile, &reader->m_cobj, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK ) {
+				mrsqlite3_log_error(reader, "Cannot open database \"%s\" for reading.", dbfile);
+				sqlite3_close(reader->m_cobj); /* sqlite3_close() accepts NULL */
+				reader->m_cobj = NULL;
+			}
+			else {
+				sqlite3_busy_timeout(reader->m_cobj, 10*1000);
+			}
+
+		pthread_mutex_unlock(&reader->m_critical_);
+	}
+}
+
+
+static void setup_fts__(mrsqlite3_t* ths)
+{
+	/* full text index used by mrmailbox_search_msgs(); the triggers keep the index in sync with all inserts, updates and deletes on msgs.
+	This is checked on every open, as a database may be used by libraries compiled with and without FTS5: without FTS5, the triggers
+	would let every insert into msgs fail, so they are dropped and we search using LIKE; with FTS5, missing triggers are created and
+	the index is rebuilt, as messages may be added while there were no triggers. */
+	sqlite3_stmt* stmt;
+	int           triggers = 0;
+
+	ths->m_has_fts = 0;
+
+	if( sqlite3_compileoption_used("ENABLE_FTS5") )
+	{
+		if( (stmt=mrsqlite3_prepare_v2_(ths, "SELECT COUNT(*) FROM sqlite_master WHERE type='trigger' AND name IN ('msgs_fts_ai', 'msgs_fts_ad', 'msgs_fts_au');")) != NULL ) {
+			if( sqlite3_step(stmt) == SQLITE_ROW ) {
+				triggers = sqlite3_column_int(stmt, 0);
+			}
+			sqlite3_finalize(stmt);
+		}
+
+		if( triggers != 3 )
+		{
+			mrmailbox_log_info(ths->m_mailbox, 0, "Building full text index...");
+			mrsqlite3_begin_transaction__(ths);
+				mrsqlite3_execute__(ths, "CREATE VIRTUAL TABLE IF NOT EXISTS msgs_fts USING fts5(txt, content='msgs', content_rowid='id');");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER IF NOT EXISTS msgs_fts_ai AFTER INSERT ON msgs BEGIN"
+							" INSERT INTO msgs_fts (rowid, txt) VALUES (new.id, new.txt);"
+							" END;");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER IF NOT EXISTS msgs_fts_ad AFTER DELETE ON msgs BEGIN"
+							" INSERT INTO msgs_fts (msgs_fts, rowid, txt) VALUES ('delete', old.id, old.txt);"
+							" END;");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER IF NOT EXISTS msgs_fts_au AFTER UPDATE OF txt ON msgs BEGIN"
+							" INSERT INTO msgs_fts (msgs_fts, rowid, txt) VALUES ('delete', old.id, old.txt);"
+							" INSERT INTO msgs_fts (rowid, txt) VALUES (new.id, new.txt);"
+							" END;");
+				mrsqlite3_execute__(ths, "INSERT INTO msgs_fts (msgs_fts) VALUES ('rebuild');"); /* index existing messages */
+			mrsqlite3_commit__(ths);
+		}
+
+		ths->m_has_fts = mrsqlite3_table_exists__(ths, "msgs_fts");
+	}
+	else
+	{
+		/* the virtual table itself cannot be dropped without the module; it is not used and rebuilt as described above */
+		mrsqlite3_execute__(ths, "DROP TRIGGER IF EXISTS msgs_fts_ai;");
+		mrsqlite3_execute__(ths, "DROP TRIGGER IF EXISTS msgs_fts_ad;");
+		mrsqlite3_execute__(ths, "DROP TRIGGER IF EXISTS msgs_fts_au;");
+	}
+}
+
+
 int mrsqlite3_open__(mrsqlite3_t* ths, const char* dbfile)
 {
 	if( ths == NULL || dbfile == NULL ) {
@@ -178,6 +339,12 @@ int mrsqlite3_open__(mrsqlite3_t* ths, const char* dbfile)
 		goto cleanup;
 	}
 
+	/* WAL allows reading from the connections in m_readers[] while writing, see mrsqlite3_lock_read();
+	with WAL, synchronous=NORMAL is safe against corruption and avoids a sync on each commit */
+	mrsqlite3_execute__(ths, "PRAGMA journal_mode=WAL;");
+	mrsqlite3_execute__(ths, "PRAGMA synchronous=NORMAL;");
+	sqlite3_busy_timeout(ths->m_cobj, 10*1000);
+
 	/* Init tables to dbversion=0 */
 	if( !mrsqlite3_table_exists__(ths, "config") )
 	{
@@ -330,6 +497,148 @@ int mrsqlite3_open__(mrsqlite3_t* ths, const char* dbfile)
 	#define NEW_DB_VERSION 13 /* just leave this to make sure version 13 is not used again */
 	#undef NEW_DB_VERSION
 
+	#define NEW_DB_VERSION 14
+		if( dbversion < NEW_DB_VERSION )
+		{
+			/* the full text index is created by setup_fts__() on every open */
+			dbversion = NEW_DB_VERSION;
+			mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+		}
+	#undef NEW_DB_VERSION
+
+	#define NEW_DB_VERSION 15
+		if( dbversion < NEW_DB_VERSION )
+		{
+			/* the last message of each chat is stored in the chats table, so mrchatlist_load_from_db__() needs not to search msgs for each chat.
+			The triggers keep the columns up to date on inserting, deleting and moving messages. */
+			#define MR_CHATS_SET_LAST_MSG(chat_id) \
+				"UPDATE chats SET" \
+				" last_msg_id=IFNULL((SELECT id FROM msgs WHERE chat_id=chats.id ORDER BY timestamp DESC, id DESC LIMIT 1),0)," \
+				" last_timestamp=IFNULL((SELECT MAX(timestamp) FROM msgs WHERE chat_id=chats.id),0)" \
+				" WHERE " chat_id ";"
+			mrsqlite3_execute__(ths, "ALTER TABLE chats ADD COLUMN last_msg_id INTEGER DEFAULT 0;");
+			mrsqlite3_execute__(ths, "ALTER TABLE chats ADD COLUMN last_timestamp INTEGER DEFAULT 0;");
+			mrsqlite3_execute__(ths, "CREATE INDEX chats_index2 ON chats (last_timestamp);");
+			mrsqlite3_execute__(ths, "CREATE TRIGGER chats_last_msg_ai AFTER INSERT ON msgs BEGIN"
+						" UPDATE chats SET last_msg_id=new.id, last_timestamp=new.timestamp"
+						" WHERE id=new.chat_id AND (new.timestamp>last_timestamp OR (new.timestamp=last_timestamp AND new.id>last_msg_id));"
+						" END;");
+			mrsqlite3_execute__(ths, "CREATE TRIGGER chats_last_msg_ad AFTER DELETE ON msgs BEGIN "
+						MR_CHATS_SET_LAST_MSG("id=old.chat_id AND last_msg_id=old.id")
+						" END;");
+			mrsqlite3_execute__(ths, "CREATE TRIGGER chats_last_msg_au AFTER UPDATE OF chat_id, timestamp ON msgs"
+						" WHEN old.chat_id!=new.chat_id OR old.timestamp!=new.timestamp BEGIN "
+						MR_CHATS_SET_LAST_MSG("id IN (old.chat_id, new.chat_id)")
+						" END;");
+			mrsqlite3_execute__(ths, MR_CHATS_SET_LAST_MSG("1")); /* backfill existing chats */
+			#undef MR_CHATS_SET_LAST_MSG
+
+			dbversion = NEW_DB_VERSION;
+			mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+		}
+	#undef NEW_DB_VERSION
+
+	#define NEW_DB_VERSION 16
+		if( dbversion < NEW_DB_VERSION )
+		{
+			/* the blobs table counts the messages referencing a file, so deleting a message needs not to search all messages for the file;
+			the hash is used to store identical files only once, see mrmailbox_ref_msg_file__() */
+			mrsqlite3_execute__(ths, "CREATE TABLE blobs (id INTEGER PRIMARY KEY, path TEXT DEFAULT '', bytes INTEGER DEFAULT 0, hash TEXT DEFAULT '', refcnt INTEGER DEFAULT 0);");
+			mrsqlite3_execute__(ths, "CREATE UNIQUE INDEX blobs_index1 ON blobs (path);");
+			mrsqlite3_execute__(ths, "CREATE INDEX blobs_index2 ON blobs (hash);");
+
+			/* count the files of existing messages; the hash is left empty, existing files are not deduplicated */
+			{
+				sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(ths, "SELECT param FROM msgs WHERE type!=" MR_STRINGIFY(MR_MSG_TEXT) ";");
+				sqlite3_stmt* stmt_ins = mrsqlite3_prepare_v2_(ths, "INSERT OR IGNORE INTO blobs (path, bytes) VALUES (?, ?);");
+				sqlite3_stmt* stmt_upd = mrsqlite3_prepare_v2_(ths, "UPDATE blobs SET refcnt=refcnt+1 WHERE path=?;");
+				mrparam_t*    param = mrparam_new();
+				mrsqlite3_begin_transaction__(ths);
+				while( sqlite3_step(stmt) == SQLITE_ROW ) {
+					mrparam_set_packed(param, (const char*)sqlite3_column_text(stmt, 0));
+					char* pathNfilename = mrparam_get(param, MRP_FILE, NULL);
+					if( pathNfilename ) {
+						sqlite3_bind_text (stmt_ins, 1, pathNfilename, -1, SQLITE_STATIC);
+						sqlite3_bind_int64(stmt_ins, 2, mr_get_filebytes(pathNfilename));
+						sqlite3_step(stmt_ins);
+						sqlite3_reset(stmt_ins);
+
+						sqlite3_bind_text (stmt_upd, 1, pathNfilename, -1, SQLITE_STATIC);
+						sqlite3_step(stmt_upd);
+						sqlite3_reset(stmt_upd);
+						free(pathNfilename);
+					}
+				}
+				mrsqlite3_commit__(ths);
+				mrparam_unref(param);
+				sqlite3_finalize(stmt_upd);
+				sqlite3_finalize(stmt_ins);
+				sqlite3_finalize(stmt);
+			}
+
+			dbversion = NEW_DB_VERSION;
+			mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+		}
+	#undef NEW_DB_VERSION
+
+	#define NEW_DB_VERSION 17
+		if( dbversion < NEW_DB_VERSION )
+		{
+			/* for mrmailbox_get_chat_msgs_page(), the index allows seeking to the anchor and reading the page in order, without sorting the whole chat */
+			mrsqlite3_execute__(ths, "CREATE INDEX msgs_index5 ON msgs (chat_id, timestamp, id);");
+
+			dbversion = NEW_DB_VERSION;
+			mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+		}
+	#undef NEW_DB_VERSION
+
+	#define NEW_DB_VERSION 18
+		if( dbversion < NEW_DB_VERSION )
+		{
+			/* msgs_index2 (chat_id) is a prefix of msgs_index5 (chat_id, timestamp, id) and only costs time on inserting.
+			msgs_index4 (state) is replaced by partial indexes over the few fresh messages: msgs_index6 is for counting and noticing
+			the fresh messages of a chat, msgs_index7 returns all fresh messages already sorted.  The queries must use the same
+			literal condition `state=MR_IN_FRESH` as the indexes, otherwise SQLite does not use them. */
+			mrsqlite3_execute__(ths, "DROP INDEX IF EXISTS msgs_index2;");
+			mrsqlite3_execute__(ths, "DROP INDEX IF EXISTS msgs_index4;");
+			mrsqlite3_execute__(ths, "CREATE INDEX msgs_index6 ON msgs (chat_id) WHERE state=" MR_STRINGIFY(MR_IN_FRESH) ";");
+			mrsqlite3_execute__(ths, "CREATE INDEX msgs_index7 ON msgs (timestamp, id) WHERE state=" MR_STRINGIFY(MR_IN_FRESH) ";");
+
+			dbversion = NEW_DB_VERSION;
+			mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+		}
+	#undef NEW_DB_VERSION
+
+	#define NEW_DB_VERSION 19
+		if( dbversion < NEW_DB_VERSION )
+		{
+			/* flags synced from the server address ranges of UIDs in a folder, see mrmailbox_apply_remote_flags__() */
+			mrsqlite3_execute__(ths, "CREATE INDEX msgs_index8 ON msgs (server_folder, server_uid);");
+
+			dbversion = NEW_DB_VERSION;
+			mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+		}
+	#undef NEW_DB_VERSION
+
+	#define NEW_DB_VERSION 20
+		if( dbversion < NEW_DB_VERSION )
+		{
+			/* the chatlist is sorted by the newer of draft and last message, see mrchatlist_load_from_db__(); chats_index2 over
+			last_timestamp alone cannot serve this order.  The expression must be the same as in the ORDER BY clause. */
+			mrsqlite3_execute__(ths, "DROP INDEX IF EXISTS chats_index2;");
+			mrsqlite3_execute__(ths, "CREATE INDEX chats_index3 ON chats (MAX(draft_timestamp, last_timestamp), last_msg_id);");
+
+			dbversion = NEW_DB_VERSION;
+			mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+		}
+	#undef NEW_DB_VERSION
+
+	setup_fts__(ths);
+
+	mrsqlite3_load_config_cache__(ths);
+
+	open_readers__(ths, dbfile);
+
 	mrmailbox_log_info(ths->m_mailbox, 0, "Opened \"%s\" successfully.", dbfile);
 	return 1;
 
@@ -347,6 +656,12 @@ void mrsqlite3_close__(mrsqlite3_t* ths)
 		return;
 	}
 
+	for( i = 0; i < MR_SQLITE_READERS; i++ ) {
+		if( ths->m_readers[i] ) {
+			close_reader(ths->m_readers[i]);
+		}
+	}
+
 	if( ths->m_cobj )
 	{
 		for( i = 0; i < PREDEFINED_CNT; i++ ) {
@@ -360,6 +675,27 @@ void mrsqlite3_close__(mrsqlite3_t* ths)
 		ths->m_cobj = NULL;
 	}
 
+	ths->m_has_fts = 0;
+
+	pthread_mutex_lock(&ths->m_config_cache_mutex);
+		if( ths->m_config_cache ) {
+			chash_free(ths->m_config_cache);
+			ths->m_config_cache = NULL;
+		}
+	pthread_mutex_unlock(&ths->m_config_cache_mutex);
+
+	mrcontact_cache_empty__(ths);
+
+	if( ths->m_files_to_delete ) {
+		/* closing rolls back an open transaction, so the files are still referenced */
+		for( i = 0; i < (int)carray_count(ths->m_files_to_delete); i++ ) {
+			mrsqlite3_file_t* file = (mrsqlite3_file_t*)carray_get(ths->m_files_to_delete, i);
+			free(file->m_pathNfilename);
+			free(file);
+		}
+		carray_set_size(ths->m_files_to_delete, 0);
+	}
+
 	mrmailbox_log_info(ths->m_mailbox, 0, "Database closed."); /* We log the information even if not real closing took place; this is to detect logic errors. */
 }
 
@@ -383,6 +719,8 @@ sqlite3_stmt* mrsqlite3_predefine__(mrsqlite3_t* ths, size_t idx, const char* qu
 		return NULL;
 	}
 
+	ths = get_conn(ths);
+
 	if( ths->m_pd[idx] ) {
 		sqlite3_reset(ths->m_pd[idx]);
 		return ths->m_pd[idx]; /* fine, already prepared before */
@@ -502,6 +840,18 @@ int mrsqlite3_set_config__(mrsqlite3_t* ths, const char* key, const char* value)
 		return 0;
 	}
 
+	pthread_mutex_lock(&ths->m_config_cache_mutex);
+		if( ths->m_config_cache ) {
+			chashdatum k = { (void*)key, strlen(key) }, v = { (void*)value, value? strlen(value)+1 : 0 };
+			if( value ) {
+				chash_set(ths->m_config_cache, &k, &v, NULL);
+			}
+			else {
+				chash_delete(ths->m_config_cache, &k, NULL);
+			}
+		}
+	pthread_mutex_unlock(&ths->m_config_cache_mutex);
+
 	return 1;
 }
 
@@ -514,6 +864,18 @@ char* mrsqlite3_get_config__(mrsqlite3_t* ths, const char* key, const char* def)
 		return strdup_keep_null(def);
 	}
 
+	pthread_mutex_lock(&ths->m_config_cache_mutex);
+		if( ths->m_config_cache ) {
+			/* the cache contains the whole config table, so a key not found in the cache does not exist in the database */
+			chashdatum k = { (void*)key, strlen(key) }, v;
+			char* ret = (chash_get(ths->m_config_cache, &k, &v)==0)? safe_strdup((const char*)v.data) : strdup_keep_null(def);
+			ths->m_config_cache_hits++;
+			pthread_mutex_unlock(&ths->m_config_cache_mutex);
+			return ret;
+		}
+		ths->m_config_cache_misses++;
+	pthread_mutex_unlock(&ths->m_config_cache_mutex);
+
 	stmt = mrsqlite3_predefine__(ths, SELECT_v_FROM_config_k, SELECT_v_FROM_config_k_STATEMENT);
 	sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
 	if( sqlite3_step(stmt) == SQLITE_ROW )
@@ -543,6 +905,41 @@ int32_t mrsqlite3_get_config_int__(mrsqlite3_t* ths, const char* key, int32_t de
 }
 
 
+void mrsqlite3_load_config_cache__(mrsqlite3_t* ths)
+{
+	sqlite3_stmt* stmt;
+	chash*        cache;
+
+	if( !mrsqlite3_is_open(ths) ) {
+		return;
+	}
+
+	if( (cache=chash_new(CHASH_DEFAULTSIZE, CHASH_COPYALL))==NULL ) {
+		exit(54); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	/* if there are several rows with the same key, use the first one as mrsqlite3_get_config__() did without cache */
+	stmt = mrsqlite3_prepare_v2_(ths, "SELECT keyname, value FROM config ORDER BY id DESC;");
+	while( sqlite3_step(stmt) == SQLITE_ROW )
+	{
+		const char* key   = (const char*)sqlite3_column_text(stmt, 0);
+		const char* value = (const char*)sqlite3_column_text(stmt, 1);
+		if( key && value ) {
+			chashdatum k = { (void*)key, strlen(key) }, v = { (void*)value, strlen(value)+1 };
+			chash_set(cache, &k, &v, NULL);
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	pthread_mutex_lock(&ths->m_config_cache_mutex);
+		if( ths->m_config_cache ) {
+			chash_free(ths->m_config_cache);
+		}
+		ths->m_config_cache = cache;
+	pthread_mutex_unlock(&ths->m_config_cache_mutex);
+}
+
+
 int mrsqlite3_set_config_int__(mrsqlite3_t* ths, const char* key, int32_t value)
 {
     char* value_str = mr_mprintf("%i", (int)value);
@@ -576,11 +973,133 @@ void mrsqlite3_unlock(mrsqlite3_t* ths)
 }
 
 
+void mrsqlite3_lock_read(mrsqlite3_t* ths) /* wait and lock a read-only connection */
+{
+	mrsqlite3_t* reader = NULL;
+	int          i;
+
+	/* use the first unused reader, if all are busy, wait for the first one */
+	for( i = 0; i < MR_SQLITE_READERS; i++ ) {
+		if( pthread_mutex_trylock(&ths->m_readers[i]->m_critical_) == 0 ) {
+			reader = ths->m_readers[i];
+			break;
+		}
+	}
+
+	if( reader == NULL ) {
+		reader = ths->m_readers[0];
+		pthread_mutex_lock(&reader->m_critical_);
+	}
+
+	if( reader->m_cobj == NULL || !ths->m_reader_key_created ) {
+		/* database not opened or the reader could not be opened, read from the writing connection */
+		pthread_mutex_unlock(&reader->m_critical_);
+		mrsqlite3_lock(ths);
+		return;
+	}
+
+	pthread_setspecific(ths->m_reader_key, reader);
+
+	mrmailbox_wake_lock(ths->m_mailbox);
+}
+
+
+void mrsqlite3_unlock_read(mrsqlite3_t* ths)
+{
+	mrsqlite3_t*  reader;
+	sqlite3_stmt* stmt;
+
+	if( !ths->m_reader_key_created || (reader=(mrsqlite3_t*)pthread_getspecific(ths->m_reader_key))==NULL ) {
+		mrsqlite3_unlock(ths); /* mrsqlite3_lock_read() has fallen back to the writing connection */
+		return;
+	}
+
+	/* reset statements not stepped to the end - otherwise, their read transaction stays open
+	and the next user of the reader would not see changes made in the meantime */
+	for( stmt = sqlite3_next_stmt(reader->m_cobj, NULL); stmt != NULL; stmt = sqlite3_next_stmt(reader->m_cobj, stmt) ) {
+		if( sqlite3_stmt_busy(stmt) ) {
+			sqlite3_reset(stmt);
+		}
+	}
+
+	pthread_setspecific(ths->m_reader_key, NULL);
+
+	mrmailbox_wake_unlock(ths->m_mailbox);
+
+	pthread_mutex_unlock(&reader->m_critical_);
+}
+
+
 /*******************************************************************************
  * Transactions
  ******************************************************************************/
 
 
+void mrsqlite3_delete_file_on_commit__(mrsqlite3_t* ths, const char* pathNfilename)
+{
+	/* a file referenced by the database must not be deleted before the deletion of the reference is committed,
+	otherwise a rollback leaves rows pointing to a deleted file */
+	mrsqlite3_file_t* file;
+
+	if( ths == NULL || pathNfilename == NULL ) {
+		return;
+	}
+
+	if( ths->m_transactionCount == 0 ) {
+		mr_delete_file(pathNfilename, ths->m_mailbox);
+		return;
+	}
+
+	if( ths->m_files_to_delete == NULL && (ths->m_files_to_delete=carray_new(16))==NULL ) {
+		exit(70); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	if( (file=calloc(1, sizeof(mrsqlite3_file_t)))==NULL ) {
+		exit(71); /* cannot allocate little memory, unrecoverable error */
+	}
+	file->m_pathNfilename = safe_strdup(pathNfilename);
+	file->m_level         = ths->m_transactionCount;
+	carray_add(ths->m_files_to_delete, file, NULL);
+}
+
+
+static void files_to_delete_transaction_end__(mrsqlite3_t* ths, int committed)
+{
+	/* called after m_transactionCount is decremented: the files are deleted if the outermost transaction is committed;
+	on a rollback, the files added since the begin of the transaction or savepoint are kept */
+	unsigned int i, kept = 0;
+
+	if( ths->m_files_to_delete == NULL ) {
+		return;
+	}
+
+	for( i = 0; i < carray_count(ths->m_files_to_delete); i++ )
+	{
+		mrsqlite3_file_t* file = (mrsqlite3_file_t*)carray_get(ths->m_files_to_delete, i);
+		if( file->m_level > ths->m_transactionCount )
+		{
+			if( committed && ths->m_transactionCount == 0 ) {
+				mr_delete_file(file->m_pathNfilename, ths->m_mailbox);
+			}
+			else if( committed ) {
+				file->m_level = ths->m_transactionCount; /* a released savepoint belongs to the outer transaction */
+				carray_set(ths->m_files_to_delete, kept++, file);
+				continue;
+			}
+
+			free(file->m_pathNfilename);
+			free(file);
+		}
+		else
+		{
+			carray_set(ths->m_files_to_delete, kept++, file);
+		}
+	}
+
+	carray_set_size(ths->m_files_to_delete, kept);
+}
+
+
 void mrsqlite3_begin_transaction__(mrsqlite3_t* ths)
 {
 	sqlite3_stmt* stmt;
@@ -594,6 +1113,16 @@ void mrsqlite3_begin_transaction__(mrsqlite3_t* ths)
 			mrsqlite3_log_error(ths, "Cannot begin transaction.");
 		}
 	}
+	else
+	{
+		/* write the origin upgrades of the outer transaction, so that a rollback of the savepoint only discards its own ones */
+		mrcontact_cache_flush__(ths);
+
+		stmt = mrsqlite3_predefine__(ths, SAVEPOINT_transaction, "SAVEPOINT nested;");
+		if( sqlite3_step(stmt) != SQLITE_DONE ) {
+			mrsqlite3_log_error(ths, "Cannot begin nested transaction.");
+		}
+	}
 }
 
 
@@ -610,8 +1139,33 @@ void mrsqlite3_rollback__(mrsqlite3_t* ths)
 				mrsqlite3_log_error(ths, "Cannot rollback transaction.");
 			}
 		}
+		else
+		{
+			/* ROLLBACK TO keeps the savepoint on the stack, so it is released afterwards */
+			stmt = mrsqlite3_predefine__(ths, ROLLBACK_TO_transaction, "ROLLBACK TO nested;");
+			if( sqlite3_step(stmt) != SQLITE_DONE ) {
+				mrsqlite3_log_error(ths, "Cannot rollback nested transaction.");
+			}
+
+			stmt = mrsqlite3_predefine__(ths, RELEASE_transaction, "RELEASE nested;");
+			if( sqlite3_step(stmt) != SQLITE_DONE ) {
+				mrsqlite3_log_error(ths, "Cannot release nested transaction.");
+			}
+		}
+
+		if( ths->m_config_cache ) {
+			mrsqlite3_load_config_cache__(ths); /* the rollback may have reverted mrsqlite3_set_config__() calls */
+		}
+
+		mrcontact_cache_empty__(ths); /* the rollback may have reverted contacts added or modified by mrmailbox_add_or_lookup_contact__() */
 
 		ths->m_transactionCount--;
+
+		files_to_delete_transaction_end__(ths, 0);
+
+		if( ths->m_mailbox && ths->m_mailbox->m_sql == ths ) {
+			mrjob_transaction_end__(ths->m_mailbox, 0); /* forget the jobs rolled back */
+		}
 	}
 }
 
@@ -624,12 +1178,27 @@ void mrsqlite3_commit__(mrsqlite3_t* ths)
 	{
 		if( ths->m_transactionCount == 1 )
 		{
+			mrcontact_cache_flush__(ths); /* write the origin upgrades collected during the transaction */
+
 			stmt = mrsqlite3_predefine__(ths, COMMIT_transaction, "COMMIT;");
 			if( sqlite3_step(stmt) != SQLITE_DONE ) {
 				mrsqlite3_log_error(ths, "Cannot commit transaction.");
 			}
 		}
+		else
+		{
+			stmt = mrsqlite3_predefine__(ths, RELEASE_transaction, "RELEASE nested;");
+			if( sqlite3_step(stmt) != SQLITE_DONE ) {
+				mrsqlite3_log_error(ths, "Cannot commit nested transaction.");
+			}
+		}
 
 		ths->m_transactionCount--;
+
+		files_to_delete_transaction_end__(ths, 1);
+
+		if( ths->m_transactionCount == 0 && ths->m_mailbox && ths->m_mailbox->m_sql == ths ) {
+			mrjob_transaction_end__(ths->m_mailbox, 1); /* queue the jobs added in the transaction */
+		}
 	}
 }
@@ -53,6 +53,9 @@ enum
 	 BEGIN_transaction = 0 /* must be first */
 	,ROLLBACK_transaction
 	,COMMIT_transaction
+	,SAVEPOINT_transaction
+	,ROLLBACK_TO_transaction
+	,RELEASE_transaction
 
 	,SELECT_v_FROM_config_k
 	,INSERT_INTO_config_kv
@@ -61,7 +64,7 @@ enum
 
 	,SELECT_COUNT_FROM_contacts
 	,SELECT_naob_FROM_contacts_i
-	,SELECT_inao_FROM_contacts_a
+	,SELECT_inaob_FROM_contacts_a
 	,SELECT_id_FROM_contacts_WHERE_id
 	,SELECT_na_FROM_chats_contacs_JOIN_contacts_WHERE_cc
 	,SELECT_p_FROM_chats_contacs_JOIN_contacts_peerstates_WHERE_cc
@@ -113,9 +116,13 @@ enum
 	,SELECT_ircftttstpb_FROM_msg_WHERE_i
 	,SELECT_ss_FROM_msgs_WHERE_m
 	,SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c
+	,SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_AND_older
+	,SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_AND_newer
 	,SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_fresh
 	,SELECT_i_FROM_msgs_WHERE_query
 	,SELECT_i_FROM_msgs_WHERE_chat_id_AND_query
+	,SELECT_i_FROM_msgs_fts_WHERE_query
+	,SELECT_i_FROM_msgs_fts_WHERE_chat_id_AND_query
 	,INSERT_INTO_msgs_msscftttsmttpb
 	,INSERT_INTO_msgs_mcftttstpb
 	,UPDATE_msgs_SET_chat_id_WHERE_id
@@ -124,6 +131,8 @@ enum
 	,UPDATE_msgs_SET_noticed_WHERE_id_AND_fresh
 	,UPDATE_msgs_SET_state_WHERE_chat_id_AND_state
 	,UPDATE_msgs_SET_ss_WHERE_rfc724_mid
+	,UPDATE_msgs_SET_seen_WHERE_server_folder_AND_uids
+	,UPDATE_msgs_SET_ss_WHERE_server_folder_AND_uids
 	,UPDATE_msgs_SET_param_WHERE_id
 	,DELETE_FROM_msgs_WHERE_id
 	,DELETE_FROM_msgs_WHERE_rfc724_mid
@@ -134,9 +143,9 @@ enum
 	,DELETE_FROM_msgs_mdns_WHERE_m
 
 	,INSERT_INTO_jobs_aafp
-	,SELECT_MIN_d_FROM_jobs
-	,SELECT_iafp_FROM_jobs
+	,SELECT_iafpd_FROM_jobs
 	,DELETE_FROM_jobs_WHERE_id
+	,SELECT_id_FROM_jobs_WHERE_id
 	,DELETE_FROM_jobs_WHERE_action
 	,UPDATE_jobs_SET_dp_WHERE_id
 
@@ -152,10 +161,19 @@ enum
 	,SELECT_private_key_FROM_keypairs_ORDER_BY_default
 	,SELECT_public_key_FROM_keypairs_WHERE_default
 
+	,INSERT_INTO_blobs_pbh
+	,SELECT_path_FROM_blobs_WHERE_hbp
+	,UPDATE_blobs_SET_refcnt_inc_WHERE_p
+	,UPDATE_blobs_SET_refcnt_dec_WHERE_p
+	,DELETE_FROM_blobs_WHERE_p_AND_unused
+
 	,PREDEFINED_CNT /* must be last */
 };
 
 
+#define MR_SQLITE_READERS 2 /* number of read-only connections used by mrsqlite3_lock_read() */
+
+
 typedef struct mrsqlite3_t
 {
 	/* prepared statements - this is the favourite way for the caller to use SQLite */
@@ -167,12 +185,41 @@ typedef struct mrsqlite3_t
 	/* helper for MrSqlite3Transaction */
 	int           m_transactionCount;
 
+	/* set if the full text index msgs_fts is available, this requires a SQLite library compiled with FTS5 */
+	int           m_has_fts;
+
 	mrmailbox_t*  m_mailbox; /* used for logging and to acquire wakelocks, there may be N mrsqlite_t objects per mrmailbox! In practise, we use 2 on backup, 1 otherwise. */
 
 	/* the user must make sure, only one thread uses sqlite at the same time!
-	for this purpose, all calls must be enclosed by a locked m_critical; use mrsqlite3_lock() for this purpose */
+	for this purpose, all calls must be enclosed by a locked m_critical; use mrsqlite3_lock() for this purpose (the lock is recursive) */
 	pthread_mutex_t m_critical_;
 
+	/* read-only connections to the same database, each with its own m_pd[] and m_critical_.  As the database is in WAL mode,
+	reading from these connections does not wait for the writer (eg. while a message is received) and vice versa. */
+	struct mrsqlite3_t* m_readers[MR_SQLITE_READERS];
+
+	/* the connection bound to the calling thread by mrsqlite3_lock_read(); mrsqlite3_predefine__() and Co. use this connection instead of m_cobj */
+	pthread_key_t   m_reader_key;
+	int             m_reader_key_created;
+
+	/* write-through copy of the config table, loaded by mrsqlite3_open__() and updated by mrsqlite3_set_config__();
+	NULL while the database is closed or migrated.  Protected by m_config_cache_mutex as mrsqlite3_get_config__() may also be called using mrsqlite3_lock_read() */
+	chash*          m_config_cache;
+	pthread_mutex_t m_config_cache_mutex;
+	unsigned long   m_config_cache_hits;
+	unsigned long   m_config_cache_misses;
+
+	/* cache for mrmailbox_add_or_lookup_contact__() and Co., see mrcontact.c; the entries are indexed by the lower-case address and by the
+	contact ID.  Only used by the writer holding mrsqlite3_lock(); emptied by mrsqlite3_close__() and by rollbacks */
+	chash*          m_contact_cache_addr;
+	chash*          m_contact_cache_id;
+	int             m_contact_cache_pending; /* number of entries with an origin upgrade not yet written, flushed by mrsqlite3_commit__() */
+	unsigned long   m_contact_cache_hits;
+	unsigned long   m_contact_cache_misses;
+
+	/* files to delete when the transaction deleting their references is committed, see mrsqlite3_delete_file_on_commit__() */
+	carray*         m_files_to_delete;
+
 } mrsqlite3_t;
 
 
@@ -187,6 +234,7 @@ int           mrsqlite3_set_config__     (mrsqlite3_t*, const char* key, const c
 int           mrsqlite3_set_config_int__ (mrsqlite3_t*, const char* key, int32_t value);
 char*         mrsqlite3_get_config__     (mrsqlite3_t*, const char* key, const char* def); /* the returned string must be free()'d, returns NULL on errors */
 int32_t       mrsqlite3_get_config_int__ (mrsqlite3_t*, const char* key, int32_t def);
+void          mrsqlite3_load_config_cache__(mrsqlite3_t*); /* must be called if the config table is modified without mrsqlite3_set_config__() */
 
 /* tools, these functions are compatible to the corresponding sqlite3_* functions */
 sqlite3_stmt* mrsqlite3_predefine__      (mrsqlite3_t*, size_t idx, const char* sql); /*the result is resetted as needed and must not be freed. CAVE: you must not call this function with different strings for the same index!*/
@@ -199,13 +247,21 @@ void          mrsqlite3_log_error        (mrsqlite3_t*, const char* msg, ...);
 the user of MrSqlite3 must make sure that the MrSqlite3-object is only used by one thread at the same time.
 In general, we will lock the hightest level as possible - this avoids deadlocks and massive on/off lockings.
 Low-level-functions, eg. the MrSqlite3-methods, do not lock. */
-void          mrsqlite3_lock             (mrsqlite3_t*); /* lock or wait; these calls must not be nested in a single thread */
+void          mrsqlite3_lock             (mrsqlite3_t*); /* lock or wait; the lock is recursive, so a thread holding it may call this again, each call needs its mrsqlite3_unlock() */
 void          mrsqlite3_unlock           (mrsqlite3_t*);
 
-/* nestable transactions, only the outest is really used */
+/* locking for read-only access: between these calls, the `__` functions use one of the read-only connections and may run
+concurrently with a writer holding mrsqlite3_lock().  Only use this for functions that do not write anything, including
+transactions; the calls must not be nested with mrsqlite3_lock() in a single thread. */
+void          mrsqlite3_lock_read        (mrsqlite3_t*);
+void          mrsqlite3_unlock_read      (mrsqlite3_t*);
+
+/* nestable transactions; nested transactions are savepoints, so rolling back a nested transaction only reverts the changes made
+since its begin and the outer transaction can still be committed */
 void          mrsqlite3_begin_transaction__(mrsqlite3_t*);
 void          mrsqlite3_commit__           (mrsqlite3_t*);
 void          mrsqlite3_rollback__         (mrsqlite3_t*);
+void          mrsqlite3_delete_file_on_commit__(mrsqlite3_t*, const char* pathNfilename); /* outside of a transaction, the file is deleted at once */
 
 #ifdef __cplusplus
 } /* /extern "C" */
@@ -35,6 +35,8 @@
 #include <sys/stat.h>
 #include <sys/types.h> /* for getpid() */
 #include <unistd.h>    /* for getpid() */
+#include <openssl/sha.h>
+#include <openssl/evp.h>
 #include <libetpan/libetpan.h>
 #include <libetpan/mailimap_types.h>
 #include "mrmailbox.h"
@@ -1689,6 +1691,131 @@ cleanup:
 }
 
 
+static char* render_hash(const unsigned char* hash)
+{
+	char* ret;
+	int   i;
+
+	if( (ret=malloc(SHA256_DIGEST_LENGTH*2+1))==NULL ) {
+		exit(57); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	for( i = 0; i < SHA256_DIGEST_LENGTH; i++ ) {
+		sprintf(&ret[i*2], "%02x", (int)hash[i]);
+	}
+
+	return ret;
+}
+
+
+char* mr_get_data_hash(const void* buf, size_t buf_bytes)
+{
+	unsigned char hash[SHA256_DIGEST_LENGTH];
+
+	SHA256((const unsigned char*)buf, buf_bytes, hash);
+	return render_hash(hash);
+}
+
+
+mrfilewriter_t* mrfilewriter_new(const char* pathNfilename, int keep_head, mrmailbox_t* log)
+{
+	mrfilewriter_t* ths = NULL;
+	FILE*           f;
+
+	if( pathNfilename == NULL ) {
+		return NULL;
+	}
+
+	if( (f=fopen(pathNfilename, "wb"))==NULL ) {
+		mrmailbox_log_warning(log, 0, "Cannot open \"%s\" for writing.", pathNfilename);
+		return NULL;
+	}
+
+	if( (ths=calloc(1, sizeof(mrfilewriter_t)))==NULL
+	 || (ths->_m_sha256=EVP_MD_CTX_create())==NULL
+	 || (keep_head && (ths->m_head=malloc(MR_FILEWRITER_HEAD_BYTES))==NULL) ) {
+		exit(64); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	ths->m_file           = f;
+	ths->_m_pathNfilename = safe_strdup(pathNfilename);
+	ths->_m_log           = log;
+	EVP_DigestInit_ex((EVP_MD_CTX*)ths->_m_sha256, EVP_sha256(), NULL);
+
+	return ths;
+}
+
+
+void mrfilewriter_write(mrfilewriter_t* ths, const void* buf, size_t buf_bytes)
+{
+	if( ths == NULL || ths->m_file == NULL || ths->m_error || buf == NULL || buf_bytes <= 0 ) {
+		return;
+	}
+
+	if( fwrite(buf, 1, buf_bytes, ths->m_file) != buf_bytes ) {
+		mrmailbox_log_warning(ths->_m_log, 0, "Cannot write %lu bytes to \"%s\".", (unsigned long)buf_bytes, ths->_m_pathNfilename);
+		ths->m_error = 1;
+		return;
+	}
+
+	EVP_DigestUpdate((EVP_MD_CTX*)ths->_m_sha256, buf, buf_bytes);
+
+	if( ths->m_head && ths->m_head_bytes < MR_FILEWRITER_HEAD_BYTES ) {
+		size_t head_add = MR_MIN(buf_bytes, MR_FILEWRITER_HEAD_BYTES-ths->m_head_bytes);
+		memcpy(ths->m_head+ths->m_head_bytes, buf, head_add);
+		ths->m_head_bytes += head_add;
+	}
+
+	ths->m_bytes += buf_bytes;
+}
+
+
+int mrfilewriter_close(mrfilewriter_t* ths, char** ret_hash)
+{
+	unsigned char hash[SHA256_DIGEST_LENGTH];
+
+	if( ths == NULL || ths->m_file == NULL ) {
+		return 0;
+	}
+
+	if( fclose(ths->m_file) != 0 && !ths->m_error ) {
+		mrmailbox_log_warning(ths->_m_log, 0, "Cannot write \"%s\".", ths->_m_pathNfilename);
+		ths->m_error = 1;
+	}
+	ths->m_file = NULL;
+
+	if( ths->m_error ) {
+		return 0;
+	}
+
+	if( ret_hash ) {
+		EVP_DigestFinal_ex((EVP_MD_CTX*)ths->_m_sha256, hash, NULL);
+		*ret_hash = render_hash(hash);
+	}
+
+	return 1;
+}
+
+
+void mrfilewriter_unref(mrfilewriter_t* ths)
+{
+	if( ths == NULL ) {
+		return;
+	}
+
+	if( ths->m_file ) {
+		fclose(ths->m_file);
+	}
+
+	free(ths->m_head);
+	if( ths->_m_sha256 ) {
+		EVP_MD_CTX_destroy((EVP_MD_CTX*)ths->_m_sha256);
+	}
+	free(ths->_m_pathNfilename);
+	free(ths);
+}
+
+
 int mr_write_file(const char* pathNfilename, const void* buf, size_t buf_bytes, mrmailbox_t* log)
 {
 	int success = 0;
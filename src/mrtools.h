@@ -116,6 +116,26 @@ char*   mr_get_filesuffix_lc       (const char* pathNfilename); /* the returned
 void    mr_split_filename          (const char* pathNfilename, char** ret_basename, char** ret_all_suffixes_incl_dot); /* the case of the suffix is preserved! */
 int     mr_get_filemeta            (const void* buf, size_t buf_bytes, uint32_t* ret_width, uint32_t *ret_height);
 char*   mr_get_fine_pathNfilename  (const char* folder, const char* desired_name);
+char*   mr_get_data_hash           (const void* buf, size_t buf_bytes); /* hex-encoded SHA-256 of the data, the return value must be free()'d */
+
+/* writing files in chunks; the SHA-256 of the data and, if requested, the first bytes needed by mr_get_filemeta() are collected on the fly,
+so the data written need not to be held in memory at once */
+#define MR_FILEWRITER_HEAD_BYTES 131072
+typedef struct mrfilewriter_t
+{
+	FILE*          m_file;
+	size_t         m_bytes;      /* bytes written so far */
+	unsigned char* m_head;       /* the first bytes written, NULL if not requested by mrfilewriter_new() */
+	size_t         m_head_bytes;
+	int            m_error;
+	void*          _m_sha256;
+	char*          _m_pathNfilename;
+	mrmailbox_t*   _m_log;
+} mrfilewriter_t;
+mrfilewriter_t* mrfilewriter_new   (const char* pathNfilename, int keep_head, mrmailbox_t* log); /* creates the file; returns NULL if this is not possible */
+void            mrfilewriter_write (mrfilewriter_t*, const void* buf, size_t buf_bytes);
+int             mrfilewriter_close (mrfilewriter_t*, char** ret_hash); /* returns 0 on write errors; the hash is as from mr_get_data_hash() and must be free()'d */
+void            mrfilewriter_unref (mrfilewriter_t*); /* also closes the file, if not yet done */
 
 /* macros */
 #define MR_QUOTEHELPER(name) #name
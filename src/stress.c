@@ -32,10 +32,16 @@
 
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/time.h>
 #include <assert.h>
 #include "mrmailbox.h"
+#include "mrimap.h"
 #include "mrsimplify.h"
 #include "mrmimeparser.h"
 #include "mrmimefactory.h"
@@ -43,7 +49,145 @@
 #include "mrapeerstate.h"
 #include "mraheader.h"
 #include "mrkeyring.h"
+#include "mrkey.h"
 #include "mrtools.h"
+#include "mrjob.h"
+
+
+static mrmailbox_t* stress_open_synthetic_mailbox(int msg_cnt)
+{
+	/* creates a temporary mailbox with 1000 contacts, 200 chats and the given number of messages spread over the chats;
+	every 50th message is fresh, the message with the UID x in INBOX has the Message-ID x@stress.example.org */
+	const char*  tmpdir = getenv("TMPDIR");
+	char*        dbfile = mr_mprintf("%s/stress-synthetic-%i.db", (tmpdir&&tmpdir[0])? tmpdir : "/tmp", (int)getpid());
+	char*        q3 = NULL;
+	mrmailbox_t* mb = mrmailbox_new(NULL, NULL);
+	int          ok;
+
+	mr_delete_file(dbfile, NULL);
+	ok = mrmailbox_open(mb, dbfile, NULL);
+	assert( ok );
+
+	mrsqlite3_lock(mb->m_sql);
+	mrsqlite3_begin_transaction__(mb->m_sql);
+		#define STRESS_SEQ "WITH RECURSIVE seq(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM seq WHERE x<%i) "
+		q3 = mr_mprintf(STRESS_SEQ
+			"INSERT INTO contacts (id, name, addr, origin) SELECT 1000+x, 'Contact '||x, 'contact'||x||'@example.org', " MR_STRINGIFY(MR_ORIGIN_OUTGOING_TO) " FROM seq;", 1000);
+		ok = mrsqlite3_execute__(mb->m_sql, q3);
+		assert( ok );
+		free(q3);
+		q3 = mr_mprintf(STRESS_SEQ
+			"INSERT INTO chats (id, type, name) SELECT 1000+x, CASE WHEN x%%4 THEN " MR_STRINGIFY(MR_CHAT_NORMAL) " ELSE " MR_STRINGIFY(MR_CHAT_GROUP) " END, 'Chat '||x FROM seq;", 200);
+		ok = mrsqlite3_execute__(mb->m_sql, q3);
+		assert( ok );
+		free(q3);
+		q3 = mr_mprintf(STRESS_SEQ
+			"INSERT INTO chats_contacts (chat_id, contact_id) SELECT 1000+x, 1000+x FROM seq;", 200);
+		ok = mrsqlite3_execute__(mb->m_sql, q3);
+		assert( ok );
+		free(q3);
+		q3 = mr_mprintf(STRESS_SEQ
+			"INSERT INTO msgs (rfc724_mid, server_folder, server_uid, chat_id, from_id, to_id, timestamp, type, state, txt)"
+			" SELECT x||'@stress.example.org', 'INBOX', x, 1001+x%%200, CASE WHEN x%%5 THEN 1001+x%%1000 ELSE " MR_STRINGIFY(MR_CONTACT_ID_SELF) " END, 0, 1500000000+x*60,"
+			" " MR_STRINGIFY(MR_MSG_TEXT) ", CASE WHEN x%%50 THEN " MR_STRINGIFY(MR_IN_SEEN) " ELSE " MR_STRINGIFY(MR_IN_FRESH) " END, 'message '||x FROM seq;", msg_cnt);
+		ok = mrsqlite3_execute__(mb->m_sql, q3);
+		assert( ok );
+		free(q3);
+		#undef STRESS_SEQ
+	mrsqlite3_commit__(mb->m_sql);
+	mrsqlite3_unlock(mb->m_sql);
+
+	free(dbfile);
+	return mb;
+}
+
+
+static void stress_close_synthetic_mailbox(mrmailbox_t* mb)
+{
+	char* dbfile = safe_strdup(mb->m_dbfile);
+	char* blobdir = mr_mprintf("%s-blobs", dbfile);
+
+	mrmailbox_close(mb);
+	mrmailbox_unref(mb);
+
+	mr_delete_file(dbfile, NULL);
+	rmdir(blobdir);
+	free(blobdir);
+	free(dbfile);
+}
+
+
+static void stress_check_query_plan(mrsqlite3_t* sql, size_t idx, const char* scan_ok)
+{
+	/* asserts that the statement was prepared on any connection and neither scans a whole table or index nor sorts using a
+	temporary b-tree.  A SCAN or TEMP B-TREE line is accepted only if it contains `scan_ok`; lookups in a full text index are
+	shown as "SCAN ... VIRTUAL TABLE INDEX" and are always accepted. */
+	mrsqlite3_t*  conn = sql->m_pd[idx]? sql : NULL;
+	sqlite3_stmt* stmt = NULL;
+	char*         q3;
+	int           i, ok, bad;
+
+	for( i = 0; i < MR_SQLITE_READERS && conn == NULL; i++ ) {
+		if( sql->m_readers[i] && sql->m_readers[i]->m_pd[idx] ) {
+			conn = sql->m_readers[i];
+		}
+	}
+	if( conn == NULL ) {
+		mrmailbox_log_error(sql->m_mailbox, 0, "Statement #%i to check is not used by the typical queries.", (int)idx);
+	}
+	assert( conn != NULL );
+
+	q3 = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", sqlite3_sql(conn->m_pd[idx]));
+	ok = sqlite3_prepare_v2(conn->m_cobj, q3, -1, &stmt, NULL);
+	assert( ok == SQLITE_OK );
+	while( sqlite3_step(stmt) == SQLITE_ROW )
+	{
+		const char* detail = (const char*)sqlite3_column_text(stmt, 3); /* eg. "SEARCH TABLE msgs AS m USING INDEX msgs_index5 (chat_id=?)" */
+		bad = detail
+		   && ( (strncmp(detail, "SCAN", 4)==0 && strstr(detail, "VIRTUAL TABLE")==NULL && strstr(detail, "CONSTANT ROW")==NULL)
+		     || strstr(detail, "TEMP B-TREE")!=NULL )
+		   && (scan_ok==NULL || strstr(detail, scan_ok)==NULL);
+		if( bad ) {
+			mrmailbox_log_error(sql->m_mailbox, 0, "Statement #%i uses \"%s\": %s", (int)idx, detail, sqlite3_sql(conn->m_pd[idx]));
+		}
+		assert( !bad );
+	}
+	sqlite3_finalize(stmt);
+	sqlite3_free(q3);
+}
+
+
+typedef struct stress_decrypt_param_t
+{
+	mrmailbox_t*   m_mailbox;
+	const void*    m_ctext;
+	size_t         m_ctext_bytes;
+	mrkeyring_t*   m_keyring;
+	const mrkey_t* m_public_key;
+	const char*    m_original_text;
+	int            m_failed;
+} stress_decrypt_param_t;
+
+
+static void* stress_decrypt_thread(void* entry_arg)
+{
+	/* decrypt the same message several times; the threads use the same cached keys, see mrpgp.c */
+	stress_decrypt_param_t* param = (stress_decrypt_param_t*)entry_arg;
+	int                     i, ok, validation_errors;
+	void*                   plain;
+	size_t                  plain_bytes;
+
+	for( i = 0; i < 20; i++ ) {
+		plain = NULL;
+		ok = mrpgp_pk_decrypt(param->m_mailbox, param->m_ctext, param->m_ctext_bytes, param->m_keyring, param->m_public_key, 1, &plain, &plain_bytes, &validation_errors);
+		if( !ok || plain == NULL || plain_bytes != strlen(param->m_original_text)
+		 || strncmp((char*)plain, param->m_original_text, plain_bytes)!=0 || validation_errors != 0 ) {
+			param->m_failed = 1;
+		}
+		free(plain);
+	}
+	return NULL;
+}
 
 
 void stress_functions(mrmailbox_t* mailbox)
@@ -200,14 +344,50 @@ void stress_functions(mrmailbox_t* mailbox)
 		mrparam_set_int(p1, 'b', 2);
 		mrparam_set    (p1, 'c', NULL);
 		mrparam_set_int(p1, 'd', 4);
-		assert( strcmp(p1->m_packed, "a=foo\nb=2\nd=4")==0 );
+		assert( strcmp(mrparam_get_packed(p1), "a=foo\nb=2\nd=4")==0 );
 
 		mrparam_set    (p1, 'b', NULL);
-		assert( strcmp(p1->m_packed, "a=foo\nd=4")==0 );
+		assert( strcmp(mrparam_get_packed(p1), "a=foo\nd=4")==0 );
 
 		mrparam_set    (p1, 'a', NULL);
 		mrparam_set    (p1, 'd', NULL);
-		assert( strcmp(p1->m_packed, "")==0 );
+		assert( strcmp(mrparam_get_packed(p1), "")==0 );
+
+		/* duplicate keys: the first value is used; the packed string is not rebuilt before a parameter is modified */
+		mrparam_set_packed(p1, "a=1\nb=2\na=3");
+		assert( mrparam_get_int(p1, 'a', 0)==1 );
+		assert( strcmp(mrparam_get_packed(p1), "a=1\nb=2\na=3")==0 );
+		mrparam_set_int(p1, 'b', 5);
+		assert( strcmp(mrparam_get_packed(p1), "a=1\nb=5")==0 );
+		assert( strcmp(p1->m_packed, "a=1\nb=5")==0 );
+
+		/* empty values are set */
+		mrparam_set_packed(p1, "a=\nb=2");
+		assert( mrparam_exists(p1, 'a')==1 );
+		char* str = mrparam_get(p1, 'a', "def");
+		assert( str && str[0]==0 );
+		free(str);
+		mrparam_set(p1, 'c', "");
+		assert( strcmp(mrparam_get_packed(p1), "a=\nb=2\nc=")==0 );
+
+		/* round trip: the packed string gives the same parameters; replacing values often compacts the arena without changing them */
+		{
+			mrparam_t* p2 = mrparam_new();
+			char       value[64];
+			int        i;
+			for( i = 0; i < 1000; i++ ) {
+				snprintf(value, sizeof(value), "value-%i-with-some-more-bytes", i);
+				mrparam_set(p1, 'a'+(i%3), value);
+			}
+			mrparam_set_packed(p2, mrparam_get_packed(p1));
+			assert( strcmp(mrparam_get_packed(p2), mrparam_get_packed(p1))==0 );
+			assert( p1->_m_arena_used < 16*1024 ); /* without compaction, about 30000 bytes */
+			str = mrparam_get(p2, 'b', NULL);
+			assert( str && strcmp(str, "value-997-with-some-more-bytes")==0 );
+			free(str);
+			assert( strcmp(mrparam_get_packed(p2), "a=value-999-with-some-more-bytes\nb=value-997-with-some-more-bytes\nc=value-998-with-some-more-bytes")==0 );
+			mrparam_unref(p2);
+		}
 
 		mrparam_unref(p1);
 	}
@@ -342,6 +522,34 @@ void stress_functions(mrmailbox_t* mailbox)
 			mrkeyring_unref(keyring);
 		}
 
+		/* several threads decrypting with the same private key at the same time, as the receive workers do */
+		{
+			#define STRESS_DECRYPT_THREADS 4
+			pthread_t              threads[STRESS_DECRYPT_THREADS];
+			stress_decrypt_param_t param[STRESS_DECRYPT_THREADS]; /* one per thread, so m_failed needs no lock */
+			mrkeyring_t*           keyring = mrkeyring_new();
+			int                    i;
+
+			mrkeyring_add(keyring, private_key);
+			for( i = 0; i < STRESS_DECRYPT_THREADS; i++ ) {
+				memset(&param[i], 0, sizeof(stress_decrypt_param_t));
+				param[i].m_mailbox       = mailbox;
+				param[i].m_ctext         = ctext_signed;
+				param[i].m_ctext_bytes   = ctext_signed_bytes;
+				param[i].m_keyring       = keyring;
+				param[i].m_public_key    = public_key;
+				param[i].m_original_text = original_text;
+				pthread_create(&threads[i], NULL, stress_decrypt_thread, &param[i]);
+			}
+			for( i = 0; i < STRESS_DECRYPT_THREADS; i++ ) {
+				pthread_join(threads[i], NULL);
+				assert( !param[i].m_failed );
+			}
+
+			mrkeyring_unref(keyring);
+			#undef STRESS_DECRYPT_THREADS
+		}
+
 		{
 			mrkeyring_t* keyring = mrkeyring_new();
 			mrkeyring_add(keyring, private_key2);
@@ -361,4 +569,667 @@ void stress_functions(mrmailbox_t* mailbox)
 		mrkey_unref(public_key);
 		mrkey_unref(private_key);
 	}
+
+
+	/* test decoding attachments to blob files: base64 and quoted-printable are decoded in chunks, the hash and the image dimensions
+	are computed on the fly
+	 **************************************************************************/
+
+	{
+		const char*     tmpdir = getenv("TMPDIR");
+		char*           blobdir = mr_mprintf("%s/stress-blobs-%i", (tmpdir&&tmpdir[0])? tmpdir : "/tmp", (int)getpid());
+		unsigned char   gif[64];
+		char*           gif_base64, *imf, *file, *hash;
+		void*           buf = NULL;
+		size_t          buf_bytes = 0;
+		int             i, ok, images = 0, files = 0;
+		mrmimeparser_t* mime_parser;
+
+		memset(gif, 0x55, sizeof(gif));
+		memcpy(gif, "GIF89a\x02\x01\x03\x00", 10); /* 258 x 3 pixels */
+		file = encode_base64((const char*)gif, sizeof(gif));
+		gif_base64 = mr_insert_breaks(file, 16, "\r\n"); /* short lines to test the line ends */
+		free(file);
+
+		imf = mr_mprintf(
+			"From: alice@example.org\r\n"
+			"To: bob@example.org\r\n"
+			"Subject: attachments\r\n"
+			"MIME-Version: 1.0\r\n"
+			"Content-Type: multipart/mixed; boundary=\"==b==\"\r\n"
+			"\r\n"
+			"--==b==\r\n"
+			"Content-Type: image/gif\r\n"
+			"Content-Transfer-Encoding: base64\r\n"
+			"Content-Disposition: attachment; filename=\"image.gif\"\r\n"
+			"\r\n"
+			"%s\r\n"
+			"--==b==\r\n"
+			"Content-Type: application/octet-stream\r\n"
+			"Content-Transfer-Encoding: quoted-printable\r\n"
+			"Content-Disposition: attachment; filename=\"data.bin\"\r\n"
+			"\r\n"
+			"a=3Db=\r\nc=00d\r\n"
+			"--==b==--\r\n", gif_base64);
+
+		ok = mr_create_folder(blobdir, NULL);
+		assert( ok );
+		mime_parser = mrmimeparser_new(blobdir, mailbox);
+		mrmimeparser_parse(mime_parser, imf, strlen(imf));
+		for( i = 0; i < (int)carray_count(mime_parser->m_parts); i++ ) {
+			mrmimepart_t* part = (mrmimepart_t*)carray_get(mime_parser->m_parts, i);
+			file = mrparam_get(part->m_param, MRP_FILE, NULL);
+			assert( file );
+			ok = mr_read_file(file, &buf, &buf_bytes, NULL);
+			assert( ok && buf_bytes == part->m_bytes );
+			hash = mr_get_data_hash(buf, buf_bytes);
+			assert( part->m_file_hash && strcmp(hash, part->m_file_hash)==0 );
+			if( part->m_type == MR_MSG_IMAGE || part->m_type == MR_MSG_GIF ) {
+				assert( buf_bytes == sizeof(gif) && memcmp(buf, gif, sizeof(gif))==0 );
+				assert( mrparam_get_int(part->m_param, MRP_WIDTH, 0) == 258 && mrparam_get_int(part->m_param, MRP_HEIGHT, 0) == 3 );
+				images++;
+			}
+			else {
+				assert( buf_bytes == 6 && memcmp(buf, "a=bc\0d", 6)==0 );
+				files++;
+			}
+			free(hash);
+			free(buf);
+			mr_delete_file(file, NULL);
+			free(file);
+		}
+		assert( images == 1 && files == 1 );
+		mrmimeparser_unref(mime_parser);
+
+		rmdir(blobdir);
+		free(imf);
+		free(gif_base64);
+		free(blobdir);
+	}
+
+
+	/* test the contact cache, nested transactions and flags synced from the server on a small synthetic mailbox
+	 **************************************************************************/
+
+	{
+		mrmailbox_t* mb = stress_open_synthetic_mailbox(1000);
+		int          ok;
+
+		/* the contact cache must return the same results as the database; origin upgrades are written on commit */
+		{
+			int          sth_modified = 0, is_blocked = 0;
+			uint32_t     id1, id2, id3;
+			unsigned long hits;
+			mrcontact_t* contact = mrcontact_new();
+
+			mrsqlite3_lock(mb->m_sql);
+				id1  = mrmailbox_add_or_lookup_contact__(mb, NULL, "contact1@example.org", MR_ORIGIN_INCOMING_UNKNOWN_FROM, &sth_modified);
+				hits = mb->m_sql->m_contact_cache_hits;
+				id2  = mrmailbox_add_or_lookup_contact__(mb, NULL, "CONTACT1@example.org", MR_ORIGIN_INCOMING_UNKNOWN_FROM, NULL);
+				assert( id1 == 1001 && id2 == 1001 && sth_modified && mb->m_sql->m_contact_cache_hits == hits+1 );
+
+				mrsqlite3_begin_transaction__(mb->m_sql);
+					id1 = mrmailbox_add_or_lookup_contact__(mb, NULL, "contact1@example.org", MR_ORIGIN_ADRESS_BOOK, NULL);
+					id2 = mrmailbox_add_or_lookup_contact__(mb, NULL, "contact2@example.org", MR_ORIGIN_ADRESS_BOOK, NULL);
+					assert( id1 == 1001 && id2 == 1002 && mb->m_sql->m_contact_cache_pending == 2 );
+					ok = mrcontact_load_from_db__(contact, mb->m_sql, 1002);
+					assert( ok && contact->m_origin == MR_ORIGIN_OUTGOING_TO );
+					ok = mrmailbox_is_known_contact__(mb, 1002, &is_blocked);
+					assert( ok && !is_blocked );
+				mrsqlite3_commit__(mb->m_sql);
+				assert( mb->m_sql->m_contact_cache_pending == 0 );
+				ok = mrcontact_load_from_db__(contact, mb->m_sql, 1002);
+				assert( ok && contact->m_origin == MR_ORIGIN_ADRESS_BOOK );
+
+				mrsqlite3_begin_transaction__(mb->m_sql);
+					id3 = mrmailbox_add_or_lookup_contact__(mb, "New One", "new.one@example.org", MR_ORIGIN_INCOMING_UNKNOWN_FROM, NULL);
+					assert( id3 > 1002 );
+				mrsqlite3_rollback__(mb->m_sql);
+				id3 = mrmailbox_add_or_lookup_contact__(mb, "New One", "new.one@example.org", MR_ORIGIN_INCOMING_UNKNOWN_FROM, NULL);
+				ok = mrcontact_load_from_db__(contact, mb->m_sql, id3);
+				assert( ok && strcmp(contact->m_name, "New One")==0 );
+			mrsqlite3_unlock(mb->m_sql);
+
+			ok = mrmailbox_block_contact(mb, 1002, 1);
+			assert( ok );
+			mrsqlite3_lock(mb->m_sql);
+				ok = mrmailbox_is_contact_blocked__(mb, 1002);
+				assert( ok );
+			mrsqlite3_unlock(mb->m_sql);
+			mrmailbox_block_contact(mb, 1002, 0);
+
+			ok = mrmailbox_delete_contact(mb, id3);
+			assert( ok );
+			mrsqlite3_lock(mb->m_sql);
+				id1 = mrmailbox_add_or_lookup_contact__(mb, NULL, "new.one@example.org", MR_ORIGIN_INCOMING_UNKNOWN_FROM, NULL);
+				ok = mrcontact_load_from_db__(contact, mb->m_sql, id1);
+				assert( ok ); /* the deleted contact must not be returned from the cache */
+			mrsqlite3_unlock(mb->m_sql);
+
+			mrcontact_unref(contact);
+		}
+
+		/* nested transactions are savepoints, rolling back a nested transaction keeps the changes of the outer one */
+		{
+			char* outer, *inner;
+
+			mrsqlite3_lock(mb->m_sql);
+				mrsqlite3_begin_transaction__(mb->m_sql);
+					mrsqlite3_set_config__(mb->m_sql, "stress_outer", "1");
+					mrsqlite3_begin_transaction__(mb->m_sql);
+						mrsqlite3_set_config__(mb->m_sql, "stress_inner", "1");
+					mrsqlite3_rollback__(mb->m_sql);
+				mrsqlite3_commit__(mb->m_sql);
+				outer = mrsqlite3_get_config__(mb->m_sql, "stress_outer", NULL);
+				inner = mrsqlite3_get_config__(mb->m_sql, "stress_inner", NULL);
+				assert( outer && strcmp(outer, "1")==0 && inner == NULL );
+				free(outer);
+				free(inner);
+			mrsqlite3_unlock(mb->m_sql);
+		}
+
+		/* files are deleted only when the deletion of their references is committed */
+		{
+			char* file = mr_mprintf("%s-stress-file.txt", mb->m_dbfile);
+
+			ok = mr_write_file(file, "content", 7, mb);
+			assert( ok );
+			mrsqlite3_lock(mb->m_sql);
+				mrsqlite3_begin_transaction__(mb->m_sql);
+					mrsqlite3_begin_transaction__(mb->m_sql);
+						mrsqlite3_delete_file_on_commit__(mb->m_sql, file);
+					mrsqlite3_rollback__(mb->m_sql);
+				mrsqlite3_commit__(mb->m_sql);
+				assert( mr_file_exist(file) );
+
+				mrsqlite3_begin_transaction__(mb->m_sql);
+					mrsqlite3_begin_transaction__(mb->m_sql);
+						mrsqlite3_delete_file_on_commit__(mb->m_sql, file);
+					mrsqlite3_commit__(mb->m_sql);
+					assert( mr_file_exist(file) );
+				mrsqlite3_commit__(mb->m_sql);
+				assert( !mr_file_exist(file) );
+			mrsqlite3_unlock(mb->m_sql);
+			free(file);
+		}
+
+		/* a message deleted twice must remove the reference to its file only once, the file is still used by another message */
+		{
+			char*         file = mr_mprintf("%s/stress-shared.jpg", mb->m_blobdir);
+			char*         q3 = NULL;
+			uint32_t      msg_id1, msg_id2;
+			sqlite3_stmt* stmt;
+			mrjob_t       job1, job2;
+			carray*       jobs = carray_new(2);
+
+			ok = mr_write_file(file, "content", 7, mb);
+			assert( ok );
+			mrsqlite3_lock(mb->m_sql);
+				q3 = sqlite3_mprintf("INSERT INTO blobs (path, bytes, refcnt) VALUES (%Q, 7, 2);", file);
+				ok = mrsqlite3_execute__(mb->m_sql, q3);
+				assert( ok );
+				sqlite3_free(q3);
+				q3 = sqlite3_mprintf("UPDATE msgs SET type=%i, param='f=%q', server_folder='', server_uid=0 WHERE rfc724_mid IN ('201@stress.example.org', '202@stress.example.org');", MR_MSG_IMAGE, file);
+				ok = mrsqlite3_execute__(mb->m_sql, q3);
+				assert( ok );
+				sqlite3_free(q3);
+				stmt = mrsqlite3_prepare_v2_(mb->m_sql, "SELECT id FROM msgs WHERE rfc724_mid=?;");
+				sqlite3_bind_text(stmt, 1, "201@stress.example.org", -1, SQLITE_STATIC);
+				ok = sqlite3_step(stmt)==SQLITE_ROW;
+				msg_id1 = sqlite3_column_int(stmt, 0);
+				sqlite3_reset(stmt);
+				sqlite3_bind_text(stmt, 1, "202@stress.example.org", -1, SQLITE_STATIC);
+				ok = ok && sqlite3_step(stmt)==SQLITE_ROW;
+				msg_id2 = sqlite3_column_int(stmt, 0);
+				sqlite3_finalize(stmt);
+				assert( ok && msg_id1 != msg_id2 );
+			mrsqlite3_unlock(mb->m_sql);
+
+			memset(&job1, 0, sizeof(mrjob_t));
+			job1.m_action     = MRJ_DELETE_MSG_ON_IMAP;
+			job1.m_foreign_id = msg_id1;
+			job1.m_param      = mrparam_new();
+			job2 = job1;
+			job2.m_param      = mrparam_new();
+			carray_add(jobs, &job1, NULL);
+			carray_add(jobs, &job2, NULL);
+			mrmailbox_delete_msgs_on_imap(mb, jobs);
+			assert( job1.m_start_again_at == 0 && job2.m_start_again_at == 0 );
+			assert( mr_file_exist(file) );
+
+			carray_delete(jobs, 1);
+			job1.m_foreign_id = msg_id2;
+			mrmailbox_delete_msgs_on_imap(mb, jobs);
+			assert( !mr_file_exist(file) );
+
+			mrparam_unref(job1.m_param);
+			mrparam_unref(job2.m_param);
+			carray_free(jobs);
+			free(file);
+		}
+
+		/* flags synced from the server address UID ranges; only fresh messages are marked as seen */
+		{
+			char*    server_folder = NULL;
+			uint32_t server_uid = 0;
+			int      changes;
+
+			mrsqlite3_lock(mb->m_sql);
+				changes = mrmailbox_apply_remote_flags__(mb, "INBOX", 1, 60, MR_IMAP_SEEN);
+				assert( changes == 1 ); /* #50 */
+				changes = mrmailbox_apply_remote_flags__(mb, "INBOX", 1, 60, MR_IMAP_SEEN);
+				assert( changes == 0 );
+				changes = mrmailbox_apply_remote_flags__(mb, "INBOX", 100, 100, MR_IMAP_GONE);
+				assert( changes == 2 );
+				ok = mrmailbox_rfc724_mid_exists__(mb, "100@stress.example.org", &server_folder, &server_uid);
+				assert( ok && server_folder && server_folder[0]==0 && server_uid == 0 );
+				free(server_folder);
+			mrsqlite3_unlock(mb->m_sql);
+		}
+
+		stress_close_synthetic_mailbox(mb);
+	}
+}
+
+
+void stress_query_plans(void)
+{
+	/* run the typical queries on a synthetic mailbox large enough for SQLite to prefer indexes and check the plans of the statements
+	listed below; the other statements work on small tables or, as the search for the sender's name in all messages, cannot use an
+	index by design.  Building the mailbox takes some seconds, so this is not part of stress_functions(). */
+	mrmailbox_t* mb = stress_open_synthetic_mailbox(20000);
+	char*        server_folder = NULL;
+	uint32_t     server_uid = 0;
+
+	{
+		mrchatlist_t* chatlist = mrmailbox_get_chatlist(mb, NULL);
+		assert( mrchatlist_get_cnt(chatlist) == 200 );
+		mrchatsummaries_t* summaries = mrchatlist_get_summaries(chatlist, 0, 50);
+		assert( summaries->m_cnt == 50 && summaries->m_items[0].m_text2 );
+		mrchatsummaries_unref(summaries);
+		mrchat_t* chat = mrchatlist_get_chat_by_index(chatlist, 0);
+		mrpoortext_unref(mrchatlist_get_summary_by_index(chatlist, 0, chat));
+		mrchat_get_fresh_msg_count(chat);
+		mrchat_unref(chat);
+		mrchatlist_unref(chatlist);
+		mrchatlist_unref(mrmailbox_get_chatlist(mb, "Chat 1"));
+
+		carray* msgs = mrmailbox_get_chat_msgs(mb, 1001, MR_GCM_ADDDAYMARKER, 0);
+		assert( msgs && carray_count(msgs) >= 100 );
+		carray_free(msgs);
+		msgs = mrmailbox_get_chat_msgs_page(mb, 1001, MR_GCM_ADDDAYMARKER, 0, 0, 0, MR_PAGE_OLDER, 20);
+		assert( msgs && carray_count(msgs) >= 20 );
+		carray_free(msgs);
+		msgs = mrmailbox_get_chat_msgs_page(mb, 1001, 0, 0, 0, 0, MR_PAGE_NEWER, 20);
+		assert( msgs && carray_count(msgs) == 20 );
+		carray_free(msgs);
+		carray_free(mrmailbox_get_fresh_msgs(mb));
+		carray_free(mrmailbox_get_chat_media(mb, 1001, MR_MSG_IMAGE, MR_MSG_VIDEO));
+		carray_free(mrmailbox_search_msgs(mb, 0, "message 1"));
+		carray_free(mrmailbox_search_msgs(mb, 1001, "message 1"));
+		carray_free(mrmailbox_get_known_contacts(mb, NULL));
+		carray_free(mrmailbox_get_known_contacts(mb, "contact1"));
+		carray_free(mrmailbox_get_blocked_contacts(mb));
+		mrmailbox_get_blocked_count(mb);
+		carray_free(mrmailbox_get_chat_contacts(mb, 1001));
+		mrcontact_unref(mrmailbox_get_contact(mb, 1001));
+		mrmsg_unref(mrmailbox_get_msg(mb, 1));
+		free(mrmailbox_get_msg_info(mb, 1));
+		mrmailbox_marknoticed_chat(mb, 1001);
+
+		mrsqlite3_lock(mb->m_sql);
+			mrmailbox_add_or_lookup_contact__(mb, NULL, "contact5@example.org", MR_ORIGIN_INCOMING_UNKNOWN_FROM, NULL);
+			mrmailbox_rfc724_mid_exists__(mb, "100@stress.example.org", &server_folder, &server_uid);
+			mrmailbox_rfc724_mid_cnt__(mb, "100@stress.example.org");
+			mrmailbox_apply_remote_flags__(mb, "INBOX", 1, 60, MR_IMAP_SEEN|MR_IMAP_GONE);
+		mrsqlite3_unlock(mb->m_sql);
+		free(server_folder);
+	}
+
+	{
+		const struct { size_t m_idx; const char* m_scan_ok; } checks[] = {
+			 { SELECT_ii_FROM_chats_LEFT_JOIN_msgs,                    "chats_index3" } /* all chats are listed, already sorted by the index */
+			,{ SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c,          NULL }
+			,{ SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_AND_older, NULL }
+			,{ SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_AND_newer, NULL }
+			,{ SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_fresh,      "msgs_index7" } /* the partial index contains only the fresh messages */
+			,{ mb->m_sql->m_has_fts? SELECT_i_FROM_msgs_fts_WHERE_chat_id_AND_query : SELECT_i_FROM_msgs_WHERE_chat_id_AND_query, NULL }
+			,{ SELECT_i_FROM_msgs_WHERE_ctt,                           NULL }
+			,{ SELECT_ircftttstpb_FROM_msg_WHERE_i,                    NULL }
+			,{ SELECT_itndd_FROM_chats_WHERE_i,                        NULL }
+			,{ SELECT_naob_FROM_contacts_i,                            NULL }
+			,{ SELECT_inaob_FROM_contacts_a,                           NULL }
+			,{ SELECT_COUNT_FROM_msgs_WHERE_state_AND_chat_id,         NULL }
+			,{ UPDATE_msgs_SET_state_WHERE_chat_id_AND_state,          NULL }
+			,{ SELECT_ss_FROM_msgs_WHERE_m,                            NULL }
+			,{ SELECT_COUNT_FROM_msgs_WHERE_rfc724_mid,                NULL }
+			,{ UPDATE_msgs_SET_seen_WHERE_server_folder_AND_uids,      NULL }
+			,{ UPDATE_msgs_SET_ss_WHERE_server_folder_AND_uids,        NULL }
+		};
+		size_t i;
+
+		for( i = 0; i < sizeof(checks)/sizeof(checks[0]); i++ ) {
+			stress_check_query_plan(mb->m_sql, checks[i].m_idx, checks[i].m_scan_ok);
+		}
+		mrmailbox_log_info(mb, 0, "%i query plans checked.", (int)i);
+	}
+
+	stress_close_synthetic_mailbox(mb);
+}
+
+
+
+/*******************************************************************************
+ * Benchmark
+ ******************************************************************************/
+
+
+#define BENCH_SELF_ADDR  "self@example.org"
+#define BENCH_SENDERS    50
+#define BENCH_ROUNDS     10
+#define BENCH_MS(start, end) (((end).tv_sec-(start).tv_sec)*1000.0 + ((end).tv_usec-(start).tv_usec)/1000.0)
+
+
+static char* bench_render_msg(int i, const char* pgp_ctext)
+{
+	/* returns the i-th synthetic message; the kinds rotate between plain, multipart, encrypted, group, outgoing and MDN */
+	char   date[64];
+	time_t timestamp = 1483228800 + i*60; /* 2017-01-01 */
+	int    sender = i%BENCH_SENDERS;
+	struct tm tm;
+
+	gmtime_r(&timestamp, &tm);
+	strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S +0000", &tm);
+
+	#define BENCH_HEAD(from, to) \
+		"From: " from "\r\n" \
+		"To: " to "\r\n" \
+		"Date: %s\r\n" \
+		"Message-ID: <%i@bench.example.org>\r\n" \
+		"Chat-Version: 1.0\r\n" \
+		"Subject: Chat: lorem ipsum %i\r\n"
+
+	switch( i%6 )
+	{
+		case 0:
+			return mr_mprintf(BENCH_HEAD("Sender %i <sender%i@example.org>", BENCH_SELF_ADDR)
+				"Content-Type: text/plain; charset=utf-8\r\n"
+				"\r\n"
+				"lorem ipsum dolor sit amet, message %i\r\n",
+				sender, sender, date, i, i, i);
+
+		case 1:
+			return mr_mprintf(BENCH_HEAD("Sender %i <sender%i@example.org>", BENCH_SELF_ADDR)
+				"Content-Type: multipart/mixed; boundary=\"==bench==\"\r\n"
+				"\r\n"
+				"--==bench==\r\n"
+				"Content-Type: text/plain; charset=utf-8\r\n"
+				"\r\n"
+				"lorem ipsum with attachment, message %i\r\n"
+				"--==bench==\r\n"
+				"Content-Type: text/plain\r\n"
+				"Content-Disposition: attachment; filename=\"file%i.txt\"\r\n"
+				"\r\n"
+				"attachment of message %i\r\n"
+				"--==bench==--\r\n",
+				sender, sender, date, i, i, i, i, i);
+
+		case 2:
+			return mr_mprintf(BENCH_HEAD("Sender %i <sender%i@example.org>", BENCH_SELF_ADDR)
+				"Content-Type: multipart/encrypted; protocol=\"application/pgp-encrypted\"; boundary=\"==bench==\"\r\n"
+				"\r\n"
+				"--==bench==\r\n"
+				"Content-Type: application/pgp-encrypted\r\n"
+				"\r\n"
+				"Version: 1\r\n"
+				"\r\n"
+				"--==bench==\r\n"
+				"Content-Type: application/octet-stream; name=\"encrypted.asc\"\r\n"
+				"\r\n"
+				"%s\r\n"
+				"--==bench==--\r\n",
+				sender, sender, date, i, i, pgp_ctext);
+
+		case 3:
+			return mr_mprintf(BENCH_HEAD("Sender %i <sender%i@example.org>", BENCH_SELF_ADDR ", sender%i@example.org")
+				"Chat-Group-ID: benchgrp%i\r\n"
+				"Chat-Group-Name: Group %i\r\n"
+				"Content-Type: text/plain; charset=utf-8\r\n"
+				"\r\n"
+				"lorem ipsum to the group, message %i\r\n",
+				sender, sender, (sender+1)%BENCH_SENDERS, date, i, i, sender%10, sender%10, i);
+
+		case 4:
+			return mr_mprintf(BENCH_HEAD(BENCH_SELF_ADDR, "Sender %i <sender%i@example.org>")
+				"Content-Type: text/plain; charset=utf-8\r\n"
+				"\r\n"
+				"lorem ipsum from self, message %i\r\n",
+				sender, sender, date, i, i, i);
+
+		default: /* MDN for the outgoing message before */
+			return mr_mprintf(BENCH_HEAD("Sender %i <sender%i@example.org>", BENCH_SELF_ADDR)
+				"Content-Type: multipart/report; report-type=disposition-notification; boundary=\"==bench==\"\r\n"
+				"\r\n"
+				"--==bench==\r\n"
+				"Content-Type: text/plain; charset=utf-8\r\n"
+				"\r\n"
+				"The message was displayed.\r\n"
+				"--==bench==\r\n"
+				"Content-Type: message/disposition-notification\r\n"
+				"\r\n"
+				"Original-Message-ID: <%i@bench.example.org>\r\n"
+				"Disposition: manual-action/MDN-sent-automatically; displayed\r\n"
+				"--==bench==--\r\n",
+				(sender+BENCH_SENDERS-1)%BENCH_SENDERS, (sender+BENCH_SENDERS-1)%BENCH_SENDERS, date, i, i, i-1);
+	}
+
+	#undef BENCH_HEAD
+}
+
+
+static void bench_delete_dir(const char* dir)
+{
+	/* the blob directory contains only files */
+	DIR*           dh;
+	struct dirent* entry;
+
+	if( (dh=opendir(dir))!=NULL ) {
+		while( (entry=readdir(dh))!=NULL ) {
+			if( strcmp(entry->d_name, ".")!=0 && strcmp(entry->d_name, "..")!=0 ) {
+				char* path = mr_mprintf("%s/%s", dir, entry->d_name);
+				mr_delete_file(path, NULL);
+				free(path);
+			}
+		}
+		closedir(dh);
+	}
+	rmdir(dir);
+}
+
+
+static char* bench_run(const char* tmpdir, int msg_cnt)
+{
+	/* returns a JSON object with the timings in milliseconds */
+	char*          ret = NULL;
+	char*          dbfile = mr_mprintf("%s/stress-bench-%i-%i.db", tmpdir, (int)getpid(), msg_cnt);
+	char*          blobdir = mr_mprintf("%s-blobs", dbfile);
+	char*          emlfile = mr_mprintf("%s/stress-bench-%i.eml", tmpdir, (int)getpid());
+	char*          version = mrmailbox_get_version_str();
+	mrmailbox_t*   mb = mrmailbox_new(NULL, NULL);
+	mrkey_t*       public_key = mrkey_new();
+	mrkeyring_t*   public_keyring = mrkeyring_new();
+	mrkeyring_t*   private_keyring = mrkeyring_new();
+	void*          pgp_ctext = NULL;
+	char*          pgp_ctext_str = NULL;
+	size_t         pgp_ctext_bytes = 0;
+	uint32_t       chat_id = 0, msg_id = 0;
+	int            i, round;
+	struct timeval start, end;
+	double         keygen_ms, receive_ms, encrypt_ms = 0, decrypt_ms = 0, chatlist_ms = 0, chat_msgs_ms = 0, chat_msgs_page_ms = 0, search_ms = 0, render_ms = 0;
+	const char*    plain = "Content-Type: text/plain; charset=utf-8\r\n\r\nlorem ipsum dolor sit amet, this is an encrypted message\r\n";
+
+	mr_delete_file(dbfile, NULL);
+	if( !mrmailbox_open(mb, dbfile, NULL) ) {
+		goto cleanup;
+	}
+	mrmailbox_set_config(mb, "configured_addr", BENCH_SELF_ADDR);
+
+	/* key operations: generate the own key and encrypt the text used for the encrypted messages to it */
+	gettimeofday(&start, NULL);
+		mrmailbox_ensure_secret_key_exists(mb);
+	gettimeofday(&end, NULL);
+	keygen_ms = BENCH_MS(start, end);
+
+	mrsqlite3_lock(mb->m_sql);
+		mrkey_load_self_public__(public_key, BENCH_SELF_ADDR, mb->m_sql);
+		mrkeyring_load_self_private_for_decrypting__(private_keyring, BENCH_SELF_ADDR, mb->m_sql);
+	mrsqlite3_unlock(mb->m_sql);
+	mrkeyring_add(public_keyring, public_key);
+
+	for( round = 0; round < BENCH_ROUNDS; round++ ) {
+		void*  temp = NULL;
+		size_t temp_bytes = 0;
+		int    validation_errors = 0;
+
+		free(pgp_ctext);
+		pgp_ctext = NULL;
+		gettimeofday(&start, NULL);
+			mrpgp_pk_encrypt(mb, plain, strlen(plain), public_keyring, NULL, 1, &pgp_ctext, &pgp_ctext_bytes);
+		gettimeofday(&end, NULL);
+		encrypt_ms += BENCH_MS(start, end);
+
+		gettimeofday(&start, NULL);
+			mrpgp_pk_decrypt(mb, pgp_ctext, pgp_ctext_bytes, private_keyring, NULL, 1, &temp, &temp_bytes, &validation_errors);
+		gettimeofday(&end, NULL);
+		decrypt_ms += BENCH_MS(start, end);
+		free(temp);
+	}
+	pgp_ctext_str = mr_null_terminate((const char*)pgp_ctext, pgp_ctext_bytes);
+
+	/* receive: the senders are known, so their messages go to normal chats and groups instead of the deaddrop */
+	for( i = 0; i < BENCH_SENDERS; i++ ) {
+		char* name = mr_mprintf("Sender %i", i), *addr = mr_mprintf("sender%i@example.org", i);
+		mrmailbox_create_contact(mb, name, addr);
+		free(name);
+		free(addr);
+	}
+
+	receive_ms = 0;
+	for( i = 0; i < msg_cnt; i++ ) {
+		char* eml = bench_render_msg(i, pgp_ctext_str);
+		mr_write_file(emlfile, eml, strlen(eml), mb);
+		free(eml);
+
+		gettimeofday(&start, NULL);
+			mrmailbox_poke_eml_file(mb, emlfile);
+		gettimeofday(&end, NULL);
+		receive_ms += BENCH_MS(start, end);
+	}
+
+	/* chatlist and chat */
+	for( round = 0; round < BENCH_ROUNDS; round++ ) {
+		gettimeofday(&start, NULL);
+			mrchatlist_t* chatlist = mrmailbox_get_chatlist(mb, NULL);
+			mrchatsummaries_t* summaries = mrchatlist_get_summaries(chatlist, 0, mrchatlist_get_cnt(chatlist));
+			if( summaries->m_cnt > 0 ) {
+				chat_id = summaries->m_items[0].m_chat_id;
+			}
+			mrchatsummaries_unref(summaries);
+			mrchatlist_unref(chatlist);
+		gettimeofday(&end, NULL);
+		chatlist_ms += BENCH_MS(start, end);
+
+		gettimeofday(&start, NULL);
+			carray* msgs = mrmailbox_get_chat_msgs(mb, chat_id, MR_GCM_ADDDAYMARKER, 0);
+			if( msgs && carray_count(msgs) > 0 ) {
+				msg_id = (uint32_t)(uintptr_t)carray_get(msgs, carray_count(msgs)-1);
+			}
+			if( msgs ) { carray_free(msgs); }
+		gettimeofday(&end, NULL);
+		chat_msgs_ms += BENCH_MS(start, end);
+
+		gettimeofday(&start, NULL);
+			msgs = mrmailbox_get_chat_msgs_page(mb, chat_id, MR_GCM_ADDDAYMARKER, 0, 0, 0, MR_PAGE_OLDER, 50);
+			if( msgs ) { carray_free(msgs); }
+		gettimeofday(&end, NULL);
+		chat_msgs_page_ms += BENCH_MS(start, end);
+
+		gettimeofday(&start, NULL);
+			msgs = mrmailbox_search_msgs(mb, 0, "lorem");
+			if( msgs ) { carray_free(msgs); }
+		gettimeofday(&end, NULL);
+		search_ms += BENCH_MS(start, end);
+
+		gettimeofday(&start, NULL);
+		{
+			mrmimefactory_t factory;
+			mrmimefactory_init(&factory, mb);
+			if( mrmimefactory_load_msg(&factory, msg_id) ) {
+				mrmimefactory_render(&factory, 0);
+			}
+			mrmimefactory_empty(&factory);
+		}
+		gettimeofday(&end, NULL);
+		render_ms += BENCH_MS(start, end);
+	}
+
+	ret = mr_mprintf("{\"version\": \"%s\", \"msgs\": %i, \"receive_ms\": %.2f, \"receive_msgs_per_s\": %.1f, "
+		"\"chatlist_ms\": %.3f, \"chat_msgs_ms\": %.3f, \"chat_msgs_page_ms\": %.3f, \"search_ms\": %.3f, \"render_ms\": %.3f, "
+		"\"keygen_ms\": %.2f, \"encrypt_ms\": %.3f, \"decrypt_ms\": %.3f}",
+		version, msg_cnt, receive_ms, receive_ms>0? msg_cnt*1000.0/receive_ms : 0.0,
+		chatlist_ms/BENCH_ROUNDS, chat_msgs_ms/BENCH_ROUNDS, chat_msgs_page_ms/BENCH_ROUNDS, search_ms/BENCH_ROUNDS, render_ms/BENCH_ROUNDS,
+		keygen_ms, encrypt_ms/BENCH_ROUNDS, decrypt_ms/BENCH_ROUNDS);
+
+cleanup:
+	mrmailbox_close(mb);
+	mrmailbox_unref(mb);
+	mrkeyring_unref(public_keyring);
+	mrkeyring_unref(private_keyring);
+	mrkey_unref(public_key);
+	mr_delete_file(dbfile, NULL);
+	mr_delete_file(emlfile, NULL);
+	bench_delete_dir(blobdir);
+	free(pgp_ctext);
+	free(pgp_ctext_str);
+	free(version);
+	free(emlfile);
+	free(blobdir);
+	free(dbfile);
+	return ret;
+}
+
+
+char* stress_benchmark(int msg_cnt, const char* result_file)
+{
+	/* creates a synthetic mailbox for each scale and times the typical operations, see bench_run();
+	msg_cnt=0 runs all the scales.  Each line of the result is a JSON object; if result_file is given, the lines are appended to it. */
+	static const int default_scales[] = { 1000, 10000, 100000 };
+	const char*      tmpdir = getenv("TMPDIR");
+	mrstrbuilder_t   ret;
+	int              i;
+
+	mrstrbuilder_init(&ret);
+
+	if( tmpdir==NULL || tmpdir[0]==0 ) {
+		tmpdir = "/tmp";
+	}
+
+	for( i = 0; i < (msg_cnt>0? 1 : (int)(sizeof(default_scales)/sizeof(default_scales[0]))); i++ ) {
+		char* line = bench_run(tmpdir, msg_cnt>0? msg_cnt : default_scales[i]);
+		if( line ) {
+			mrstrbuilder_cat(&ret, line);
+			mrstrbuilder_cat(&ret, "\n");
+			if( result_file ) {
+				FILE* f = fopen(result_file, "a");
+				if( f ) {
+					fputs(line, f);
+					fputs("\n", f);
+					fclose(f);
+				}
+			}
+			free(line);
+		}
+	}
+
+	return ret.m_buf;
 }
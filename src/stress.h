@@ -33,7 +33,9 @@ extern "C" {
 #endif
 
 
-void stress_functions(mrmailbox_t*);
+void  stress_functions(mrmailbox_t*);
+void  stress_query_plans(void); /* builds a synthetic mailbox with 20000 messages and asserts that the typical queries use indexes */
+char* stress_benchmark(int msg_cnt, const char* result_file); /* msg_cnt=0 runs 1k, 10k and 100k messages; the result must be free()'d */
 
 
 #ifdef __cplusplus